@@ -842,6 +842,73 @@ void tlsf_destroy(tlsf_pool pool)
 {
 }
 
+/*
+** Overhead of a region added with tlsf_add_pool: the size field of the
+** free block plus the zero-size sentinel terminating the region.
+*/
+size_t tlsf_pool_overhead(void)
+{
+	return 2 * block_header_overhead;
+}
+
+/*
+** Add another memory region to an existing pool. The region becomes a
+** single free block followed by its own sentinel, so blocks never merge
+** across regions and the region can later be taken out again with
+** tlsf_remove_pool() once everything in it has been freed.
+*/
+int tlsf_add_pool(tlsf_pool tlsf, void* mem, size_t bytes)
+{
+	pool_t* pool = tlsf_cast(pool_t*, tlsf);
+	block_header_t* block;
+	block_header_t* next;
+
+	const size_t pool_bytes = align_down(bytes - tlsf_pool_overhead(),
+	                                     ALIGN_SIZE);
+
+	if ((tlsf_cast(tlsfptr_t, mem) % ALIGN_SIZE) != 0)
+		return -1;
+
+	if (pool_bytes < block_size_min || pool_bytes > block_size_max)
+		return -1;
+
+	/*
+	** Offset the start of the block so that the prev_phys_block field
+	** falls outside of the region. It will never be used since the
+	** block is marked as having a used predecessor.
+	*/
+	block = offset_to_block(mem, -(tlsfptr_t)block_header_overhead);
+	block_set_size(block, pool_bytes);
+	block_set_free(block);
+	block_set_prev_used(block);
+	block_insert(pool, block);
+
+	/* Split the block to create a zero-size sentinel block. */
+	next = block_link_next(block);
+	block_set_size(next, 0);
+	block_set_used(next);
+	block_set_prev_free(next);
+	return 0;
+}
+
+/*
+** Take a region added with tlsf_add_pool() out of the pool.
+** Returns nonzero (and leaves the pool untouched) if any part of the
+** region is still allocated.
+*/
+int tlsf_remove_pool(tlsf_pool tlsf, void* mem)
+{
+	pool_t* pool = tlsf_cast(pool_t*, tlsf);
+	block_header_t* block =
+		offset_to_block(mem, -(tlsfptr_t)block_header_overhead);
+
+	if (!block_is_free(block) || block_size(block_next(block)) != 0)
+		return -1;
+
+	block_remove(pool, block);
+	return 0;
+}
+
 void* tlsf_malloc(tlsf_pool tlsf, size_t size)
 {
 	pool_t* pool = tlsf_cast(pool_t*, tlsf);
@@ -27,6 +27,11 @@ typedef void* tlsf_pool;
 tlsf_pool tlsf_create(void* mem, size_t bytes);
 void tlsf_destroy(tlsf_pool pool);
 
+/* Add/remove additional memory regions to/from an existing pool. */
+int tlsf_add_pool(tlsf_pool pool, void* mem, size_t bytes);
+int tlsf_remove_pool(tlsf_pool pool, void* mem);
+size_t tlsf_pool_overhead(void);
+
 /* malloc/memalign/realloc/free replacements. */
 void* tlsf_malloc(tlsf_pool pool, size_t bytes);
 void* tlsf_memalign(tlsf_pool pool, size_t align, size_t bytes);
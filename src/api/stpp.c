@@ -27,6 +27,7 @@
 #include "misc/redblack.h"
 #include "misc/dbl.h"
 #include "misc/bytestream.h"
+#include "misc/minmax.h"
 #include "stpp.h"
 
 #include "backend/backend.h"
@@ -59,7 +60,22 @@ typedef struct stpp {
   struct stpp_prop_tree stpp_props;
   int stpp_prop_tally;
   int stpp_helloed_ok;
+  int stpp_flags;           // Negotiated STPP_HELLO_ flags
   struct stpp_imagereq_list stpp_imagereqs;
+
+  htsbuf_queue_t stpp_batch_bin;
+  htsbuf_queue_t stpp_batch_json;
+  int stpp_batch_bin_cnt;
+  int stpp_batch_bin_hdrlen; // Length of last header, used if cnt == 1
+  int stpp_batch_json_cnt;
+  asyncio_timer_t stpp_flush_timer;
+
+  // Statistics
+  int stpp_frames;
+  int stpp_records;
+  int stpp_coalesced;
+  int64_t stpp_bytes;
+  int64_t stpp_created;
 } stpp_t;
 
 
@@ -73,6 +89,12 @@ typedef struct stpp_subscription {
   stpp_t *ss_stpp;
   struct stpp_prop_list ss_dir_props;   // Exported props when in dir mode
   struct stpp_prop_list ss_value_props; // Exported props when in value mode
+
+  int64_t ss_interval;          // Min time between value updates
+  int64_t ss_last_send;
+  htsbuf_queue_t ss_pending;    // Value update held back by ss_interval
+  int ss_pending_opcode;
+  asyncio_timer_t ss_timer;
 } stpp_subscription_t;
 
 static int
@@ -106,6 +128,212 @@ sp_get(prop_t *p, stpp_subscription_t *ss)
 }
 
 
+/**
+ * Output
+ *
+ * Unless the client asked for batching (STPP_HELLO_BATCH) each
+ * notification goes out in a websocket frame of its own. Otherwise they
+ * are collected and sent as one frame once the current round of prop
+ * callbacks has been dispatched. The flush timer expires right away,
+ * so it fires on the next spin of the asyncio loop.
+ */
+
+#define STPP_BATCH_MAX (64 * 1024)
+
+static int
+stpp_put_varint(uint8_t *p, uint32_t v)
+{
+  int len = 0;
+  while(v >= 0x80) {
+    p[len++] = v | 0x80;
+    v >>= 7;
+  }
+  p[len++] = v;
+  return len;
+}
+
+
+/**
+ *
+ */
+static void
+stpp_output(stpp_t *stpp, int opcode, htsbuf_queue_t *hq)
+{
+  stpp->stpp_frames++;
+  stpp->stpp_bytes += hq->hq_size;
+  websocket_sendq(stpp->stpp_hc, opcode, hq);
+}
+
+
+/**
+ *
+ */
+static void
+stpp_flush(stpp_t *stpp)
+{
+  htsbuf_queue_t hq;
+
+  asyncio_timer_disarm(&stpp->stpp_flush_timer);
+
+  if(stpp->stpp_batch_bin_cnt == 1) {
+    // No need to wrap a single message
+    htsbuf_drop(&stpp->stpp_batch_bin, stpp->stpp_batch_bin_hdrlen);
+    stpp_output(stpp, 2, &stpp->stpp_batch_bin);
+  } else if(stpp->stpp_batch_bin_cnt > 1) {
+    htsbuf_queue_init(&hq, 0);
+    htsbuf_append_byte(&hq, STPP_CMD_BATCH);
+    htsbuf_appendq(&hq, &stpp->stpp_batch_bin);
+    stpp_output(stpp, 2, &hq);
+  }
+  stpp->stpp_batch_bin_cnt = 0;
+
+  if(stpp->stpp_batch_json_cnt == 1) {
+    stpp_output(stpp, 1, &stpp->stpp_batch_json);
+  } else if(stpp->stpp_batch_json_cnt > 1) {
+    htsbuf_queue_init(&hq, 0);
+    htsbuf_append(&hq, "[", 1);
+    htsbuf_appendq(&hq, &stpp->stpp_batch_json);
+    htsbuf_append(&hq, "]", 1);
+    stpp_output(stpp, 1, &hq);
+  }
+  stpp->stpp_batch_json_cnt = 0;
+}
+
+
+/**
+ *
+ */
+static void
+stpp_flush_timer_cb(void *aux)
+{
+  stpp_flush(aux);
+}
+
+
+/**
+ * Send (or batch) a message, 'hq' is consumed
+ */
+static void
+stpp_sendq(stpp_t *stpp, int opcode, htsbuf_queue_t *hq)
+{
+  stpp->stpp_records++;
+
+  if(!(stpp->stpp_flags & STPP_HELLO_BATCH)) {
+    stpp_output(stpp, opcode, hq);
+    return;
+  }
+
+  if(opcode == 2) {
+    uint8_t hdr[5];
+    stpp->stpp_batch_bin_hdrlen = stpp_put_varint(hdr, hq->hq_size);
+    htsbuf_append(&stpp->stpp_batch_bin, hdr, stpp->stpp_batch_bin_hdrlen);
+    htsbuf_appendq(&stpp->stpp_batch_bin, hq);
+    stpp->stpp_batch_bin_cnt++;
+  } else {
+    // JSON messages are batched as an array of messages
+    if(stpp->stpp_batch_json_cnt)
+      htsbuf_append(&stpp->stpp_batch_json, ",", 1);
+    htsbuf_appendq(&stpp->stpp_batch_json, hq);
+    stpp->stpp_batch_json_cnt++;
+  }
+
+  if(stpp->stpp_batch_bin.hq_size +
+     stpp->stpp_batch_json.hq_size >= STPP_BATCH_MAX)
+    stpp_flush(stpp);
+  else if(!asyncio_timer_is_armed(&stpp->stpp_flush_timer))
+    asyncio_timer_arm(&stpp->stpp_flush_timer, async_current_time());
+}
+
+
+/**
+ *
+ */
+static void
+ss_flush_pending(stpp_subscription_t *ss)
+{
+  asyncio_timer_disarm(&ss->ss_timer);
+  if(ss->ss_pending.hq_size == 0)
+    return;
+  ss->ss_last_send = async_current_time();
+  stpp_sendq(ss->ss_stpp, ss->ss_pending_opcode, &ss->ss_pending);
+}
+
+
+/**
+ *
+ */
+static void
+ss_timer_cb(void *aux)
+{
+  ss_flush_pending(aux);
+}
+
+
+static int
+ss_coalescable(const stpp_subscription_t *ss)
+{
+  return LIST_FIRST(&ss->ss_dir_props) == NULL;
+}
+
+
+/**
+ * Send notification for a subscription, 'hq' is consumed
+ *
+ * A value update replaces the previous value entirely, so if the
+ * client has set a rate limit for the subscription (STPP_CMD_SUB_RATE)
+ * updates arriving too fast are held back and only the latest one is
+ * sent. Anything else is sent right away, preceded by the held back
+ * value (if any) to keep ordering intact.
+ *
+ * If the subscription was a directory its children are unexported when
+ * the value is set, so the client must learn about that right away.
+ * Thus the callers only flag value updates with ss_coalescable().
+ */
+static void
+ss_notify(stpp_subscription_t *ss, int opcode, htsbuf_queue_t *hq, int value)
+{
+  const int64_t now = async_current_time();
+
+  if(!value || ss->ss_interval == 0) {
+    ss_flush_pending(ss);
+    ss->ss_last_send = now;
+    stpp_sendq(ss->ss_stpp, opcode, hq);
+    return;
+  }
+
+  if(ss->ss_pending.hq_size == 0 &&
+     now >= ss->ss_last_send + ss->ss_interval) {
+    ss->ss_last_send = now;
+    stpp_sendq(ss->ss_stpp, opcode, hq);
+    return;
+  }
+
+  if(ss->ss_pending.hq_size)
+    ss->ss_stpp->stpp_coalesced++;
+
+  htsbuf_queue_flush(&ss->ss_pending);
+  htsbuf_appendq(&ss->ss_pending, hq);
+  ss->ss_pending_opcode = opcode;
+
+  if(!asyncio_timer_is_armed(&ss->ss_timer))
+    asyncio_timer_arm(&ss->ss_timer, ss->ss_last_send + ss->ss_interval);
+}
+
+
+/**
+ *
+ */
+static void
+ss_notify_buf(stpp_subscription_t *ss, int opcode, const void *data,
+              size_t len, int value)
+{
+  htsbuf_queue_t hq;
+  htsbuf_queue_init(&hq, 0);
+  htsbuf_append(&hq, data, len);
+  ss_notify(ss, opcode, &hq, value);
+}
+
+
 
 /**
  *
@@ -164,14 +392,13 @@ resolve_propref(stpp_t *stpp, int propref)
  *
  */
 static void
-stpp_sub_json_add_child(stpp_subscription_t *ss, http_connection_t *hc,
-			prop_t *p, prop_t *before)
+stpp_sub_json_add_child(stpp_subscription_t *ss, prop_t *p, prop_t *before)
 { 
   char buf2[128];
   unsigned int b = before ? sp_get(before, ss)->sp_id : 0;
   stpp_prop_t *sp = stpp_property_export_from_sub(ss, p, &ss->ss_dir_props);
   snprintf(buf2, sizeof(buf2), "[5,%u,%u,[%u]]", ss->ss_id, b, sp->sp_id);
-  websocket_send(hc, 1, buf2, strlen(buf2));
+  ss_notify_buf(ss, 1, buf2, strlen(buf2), 0);
 }
 
 
@@ -179,8 +406,8 @@ stpp_sub_json_add_child(stpp_subscription_t *ss, http_connection_t *hc,
  *
  */
 static void
-stpp_sub_json_add_childs(stpp_subscription_t *ss, http_connection_t *hc,
-			 prop_vec_t *pv, prop_t *before)
+stpp_sub_json_add_childs(stpp_subscription_t *ss, prop_vec_t *pv,
+                         prop_t *before)
 { 
   unsigned int b = before ? sp_get(before, ss)->sp_id : 0;
   int i;
@@ -194,8 +421,8 @@ stpp_sub_json_add_childs(stpp_subscription_t *ss, http_connection_t *hc,
     stpp_prop_t *sp = stpp_property_export_from_sub(ss, p, &ss->ss_dir_props);
     htsbuf_qprintf(&hq, "%s%u", i ? "," : "", sp->sp_id);
   }
-  htsbuf_append(&hq, "]]", 1);
-  websocket_sendq(hc, 1, &hq);
+  htsbuf_append(&hq, "]]", 2);
+  ss_notify(ss, 1, &hq, 0);
 }
 
 
@@ -204,13 +431,12 @@ stpp_sub_json_add_childs(stpp_subscription_t *ss, http_connection_t *hc,
  *
  */
 static void
-stpp_sub_json_del_child(stpp_subscription_t *ss, http_connection_t *hc,
-			prop_t *p)
+stpp_sub_json_del_child(stpp_subscription_t *ss, prop_t *p)
 { 
   stpp_prop_t *sp = prop_tag_clear(p, ss);
   char buf2[128];
   snprintf(buf2, sizeof(buf2), "[6,%u,[%u]]", ss->ss_id, sp->sp_id);
-  websocket_send(hc, 1, buf2, strlen(buf2));
+  ss_notify_buf(ss, 1, buf2, strlen(buf2), 0);
   stpp_property_unexport_from_sub(ss, sp);
 }
 
@@ -220,15 +446,14 @@ stpp_sub_json_del_child(stpp_subscription_t *ss, http_connection_t *hc,
  *
  */
 static void
-stpp_sub_json_move_child(stpp_subscription_t *ss, http_connection_t *hc,
-			 prop_t *p, prop_t *before)
+stpp_sub_json_move_child(stpp_subscription_t *ss, prop_t *p, prop_t *before)
 { 
   stpp_prop_t *sp =          prop_tag_get(p, ss);
   stpp_prop_t *b =  before ? prop_tag_get(before, ss) : NULL;
   char buf2[128];
   snprintf(buf2, sizeof(buf2), "[7,%u,%u,%u]", ss->ss_id, sp->sp_id,
 	   b ? b->sp_id : 0);
-  websocket_send(hc, 1, buf2, strlen(buf2));
+  ss_notify_buf(ss, 1, buf2, strlen(buf2), 0);
 }
 
 
@@ -253,7 +478,6 @@ static void
 stpp_sub_json(void *opaque, prop_event_t event, ...)
 {
   stpp_subscription_t *ss = opaque;
-  http_connection_t *hc = ss->ss_stpp->stpp_hc;
   va_list ap;
   htsbuf_queue_t hq;
   char buf[64];
@@ -267,13 +491,13 @@ stpp_sub_json(void *opaque, prop_event_t event, ...)
   case PROP_SET_FLOAT:
     my_double2str(buf, sizeof(buf), va_arg(ap, double));
     snprintf(buf2, sizeof(buf2), "[4,%u,%s]", ss->ss_id, buf);
-    websocket_send(hc, 1, buf2, strlen(buf2));
+    ss_notify_buf(ss, 1, buf2, strlen(buf2), ss_coalescable(ss));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
   case PROP_SET_INT:
     snprintf(buf2, sizeof(buf2), "[4,%u,%d]", ss->ss_id, va_arg(ap, int));
-    websocket_send(hc, 1, buf2, strlen(buf2));
+    ss_notify_buf(ss, 1, buf2, strlen(buf2), ss_coalescable(ss));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
@@ -287,13 +511,13 @@ stpp_sub_json(void *opaque, prop_event_t event, ...)
     htsbuf_qprintf(&hq, "[4,%u,", ss->ss_id);
     htsbuf_append_and_escape_jsonstr(&hq, str);
     htsbuf_append(&hq, "]", 1);
-    websocket_sendq(hc, 1, &hq);
+    ss_notify(ss, 1, &hq, ss_coalescable(ss));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
   case PROP_SET_VOID:
     snprintf(buf2, sizeof(buf2), "[4,%u,null]", ss->ss_id);
-    websocket_send(hc, 1, buf2, strlen(buf2));
+    ss_notify_buf(ss, 1, buf2, strlen(buf2), ss_coalescable(ss));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
@@ -306,40 +530,40 @@ stpp_sub_json(void *opaque, prop_event_t event, ...)
     htsbuf_append(&hq, ",", 1);
     htsbuf_append_and_escape_jsonstr(&hq, str2);
     htsbuf_append(&hq, "]]", 2);
-    websocket_sendq(hc, 1, &hq);
+    ss_notify(ss, 1, &hq, ss_coalescable(ss));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
   case PROP_SET_DIR:
     snprintf(buf2, sizeof(buf2), "[4,%u,[\"dir\"]]", ss->ss_id);
-    websocket_send(hc, 1, buf2, strlen(buf2));
+    ss_notify_buf(ss, 1, buf2, strlen(buf2), 0);
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
   case PROP_ADD_CHILD:
-    stpp_sub_json_add_child(ss, hc, va_arg(ap, prop_t *), NULL);
+    stpp_sub_json_add_child(ss, va_arg(ap, prop_t *), NULL);
     break;
   case PROP_ADD_CHILD_BEFORE:
     p1 = va_arg(ap, prop_t *);
-    stpp_sub_json_add_child(ss, hc, p1, va_arg(ap, prop_t *));
+    stpp_sub_json_add_child(ss, p1, va_arg(ap, prop_t *));
     break;
 
   case PROP_ADD_CHILD_VECTOR:
-    stpp_sub_json_add_childs(ss, hc, va_arg(ap, prop_vec_t *), NULL);
+    stpp_sub_json_add_childs(ss, va_arg(ap, prop_vec_t *), NULL);
     break;
 
   case PROP_ADD_CHILD_VECTOR_BEFORE:
     pv = va_arg(ap, prop_vec_t *);
-    stpp_sub_json_add_childs(ss, hc, pv, va_arg(ap, prop_t *));
+    stpp_sub_json_add_childs(ss, pv, va_arg(ap, prop_t *));
     break;
 
   case PROP_DEL_CHILD:
-    stpp_sub_json_del_child(ss, hc, va_arg(ap, prop_t *));
+    stpp_sub_json_del_child(ss, va_arg(ap, prop_t *));
     break;
 
   case PROP_MOVE_CHILD:
     p1 = va_arg(ap, prop_t *);
-    stpp_sub_json_move_child(ss, hc, p1, va_arg(ap, prop_t *));
+    stpp_sub_json_move_child(ss, p1, va_arg(ap, prop_t *));
     break;
 
   default:
@@ -350,6 +574,37 @@ stpp_sub_json(void *opaque, prop_event_t event, ...)
   va_end(ap);
 }
 
+/**
+ * Export all props in vector and write their ids to 'buf'
+ *
+ * Ids are handed out sequentially so when delta coding is enabled each
+ * id after the first one is just a single byte on the wire. 'buf' must
+ * have room for five bytes per prop.
+ *
+ * Returns number of bytes written
+ */
+static int
+stpp_export_vector(stpp_subscription_t *ss, const prop_vec_t *pv,
+                   uint8_t *buf, int delta)
+{
+  uint8_t *p = buf;
+  uint32_t prev = 0;
+
+  for(int i = 0; i < prop_vec_len(pv); i++) {
+    uint32_t id = stpp_property_export_from_sub(ss, prop_vec_get(pv, i),
+                                                &ss->ss_dir_props)->sp_id;
+    if(delta && i > 0) {
+      p += stpp_put_varint(p, id - prev);
+    } else {
+      wr32_le(p, id);
+      p += 4;
+    }
+    prev = id;
+  }
+  return p - buf;
+}
+
+
 /**
  * Binary output
  */
@@ -357,13 +612,14 @@ static void
 stpp_sub_binary(void *opaque, prop_event_t event, ...)
 {
   stpp_subscription_t *ss = opaque;
-  http_connection_t *hc = ss->ss_stpp->stpp_hc;
+  const int delta = ss->ss_stpp->stpp_flags & STPP_HELLO_DELTA;
   va_list ap;
   const char *str;
   uint8_t *buf;
   int buflen = 1 + 1 + 4;
   int len;
   int flags;
+  int value = 0;
   prop_t *p, *before;
   const prop_vec_t *pv;
   stpp_prop_t *sp;
@@ -378,6 +634,7 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
     buflen += 4;
     buf = alloca(buflen);
     buf[1] = STPP_SET_INT;
+    value = ss_coalescable(ss);
     wr32_le(buf + 6, va_arg(ap, int));
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
@@ -386,6 +643,7 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
     buflen += 4;
     buf = alloca(buflen);
     buf[1] = STPP_SET_FLOAT;
+    value = ss_coalescable(ss);
     u.f = va_arg(ap, double);
     wr32_le(buf + 6, u.i);
     ss_clear_props(ss, &ss->ss_dir_props);
@@ -394,6 +652,7 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
   case PROP_SET_VOID:
     buf = alloca(buflen);
     buf[1] = STPP_SET_VOID;
+    value = ss_coalescable(ss);
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
@@ -414,6 +673,7 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
     buf[1] = STPP_SET_STRING;
     buf[6] = event == PROP_SET_RSTRING ? va_arg(ap, int) : 0;
     memcpy(buf + 7, str, len);
+    value = ss_coalescable(ss);
     ss_clear_props(ss, &ss->ss_dir_props);
     break;
 
@@ -445,29 +705,19 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
 
   case PROP_ADD_CHILD_VECTOR:
     pv = va_arg(ap, const prop_vec_t *);
-    buflen += prop_vec_len(pv) * 4;
-    buf = alloca(buflen);
-    for(int i = 0; i < prop_vec_len(pv); i++) {
-      wr32_le(buf + 6 + i * 4,
-              stpp_property_export_from_sub(ss, prop_vec_get(pv, i),
-                                            &ss->ss_dir_props)->sp_id);
-    }
-    buf[1] = STPP_ADD_CHILDS;
+    buf = alloca(buflen + prop_vec_len(pv) * 5);
+    buflen += stpp_export_vector(ss, pv, buf + 6, delta);
+    buf[1] = delta ? STPP_ADD_CHILDS_DELTA : STPP_ADD_CHILDS;
     break;
 
   case PROP_ADD_CHILD_VECTOR_BEFORE:
     pv = va_arg(ap, const prop_vec_t *);
     before = va_arg(ap, prop_t *);
 
-    buflen += prop_vec_len(pv) * 4 + 4;
-    buf = alloca(buflen);
+    buf = alloca(buflen + 4 + prop_vec_len(pv) * 5);
     wr32_le(buf + 6,  sp_get(before, ss)->sp_id);
-    for(int i = 0; i < prop_vec_len(pv); i++) {
-      wr32_le(buf + 10 + i * 4,
-              stpp_property_export_from_sub(ss, prop_vec_get(pv, i),
-                                            &ss->ss_dir_props)->sp_id);
-    }
-    buf[1] = STPP_ADD_CHILDS_BEFORE;
+    buflen += 4 + stpp_export_vector(ss, pv, buf + 10, delta);
+    buf[1] = delta ? STPP_ADD_CHILDS_BEFORE_DELTA : STPP_ADD_CHILDS_BEFORE;
     break;
 
   case PROP_DEL_CHILD:
@@ -537,7 +787,7 @@ stpp_sub_binary(void *opaque, prop_event_t event, ...)
   }
   buf[0] = STPP_CMD_NOTIFY;
   wr32_le(buf + 2, ss->ss_id);
-  websocket_send(hc, 2, buf, buflen);
+  ss_notify_buf(ss, 2, buf, buflen, value);
 }
 
 /**
@@ -561,6 +811,8 @@ stpp_cmd_sub(stpp_t *stpp, unsigned int id, int propref, const char *path,
   }
 
   ss->ss_stpp = stpp;
+  htsbuf_queue_init(&ss->ss_pending, 0);
+  asyncio_timer_init(&ss->ss_timer, ss_timer_cb, ss);
   ss->ss_sub = prop_subscribe(PROP_SUB_ALT_PATH | flags,
 			      PROP_TAG_COURIER, asyncio_courier,
 			      PROP_TAG_NAMESTR, path,
@@ -580,6 +832,8 @@ ss_destroy(stpp_t *stpp, stpp_subscription_t *ss)
   ss_clear_props(ss, &ss->ss_dir_props);
   ss_clear_props(ss, &ss->ss_value_props);
   prop_unsubscribe(ss->ss_sub);
+  asyncio_timer_disarm(&ss->ss_timer);
+  htsbuf_queue_flush(&ss->ss_pending);
   RB_REMOVE(&stpp->stpp_subscriptions, ss, ss_link);
   free(ss);
 }
@@ -600,6 +854,24 @@ stpp_cmd_unsub(stpp_t *stpp, unsigned int id)
 }
 
 
+/**
+ * Limit value updates of a subscription to one per 'interval' ms
+ */
+static void
+stpp_cmd_sub_rate(stpp_t *stpp, unsigned int id, unsigned int interval)
+{
+  stpp_subscription_t s, *ss;
+  s.ss_id = id;
+
+  if((ss = RB_FIND(&stpp->stpp_subscriptions, &s, ss_link, ss_cmp)) == NULL)
+    return;
+
+  ss->ss_interval = MIN(interval, 60000) * 1000LL;
+  if(ss->ss_interval == 0)
+    ss_flush_pending(ss);
+}
+
+
 /**
  *
  */
@@ -646,8 +918,18 @@ static void
 stpp_json(stpp_t *stpp, htsmsg_t *m)
 {
   int cmd = htsmsg_get_u32_or_default(m, HTSMSG_INDEX(0), 0);
+  char buf[64];
   
   switch(cmd) {
+  case STPP_CMD_HELLO:
+    // Optional for JSON clients, only needed to enable batching
+    stpp->stpp_flags = htsmsg_get_u32_or_default(m, HTSMSG_INDEX(2), 0) &
+      STPP_HELLO_BATCH;
+    snprintf(buf, sizeof(buf), "[%d,%d,%d]",
+             STPP_CMD_HELLO, STPP_VERSION, stpp->stpp_flags);
+    websocket_send(stpp->stpp_hc, 1, buf, strlen(buf));
+    break;
+
   case STPP_CMD_SUBSCRIBE:
     stpp_cmd_sub(stpp,
 		 htsmsg_get_u32_or_default(m, HTSMSG_INDEX(1), 0),
@@ -667,6 +949,12 @@ stpp_json(stpp_t *stpp, htsmsg_t *m)
 		 htsmsg_get_str(m, HTSMSG_INDEX(2)),
 		 htsmsg_field_find(m, HTSMSG_INDEX(3)));
     break;
+
+  case STPP_CMD_SUB_RATE:
+    stpp_cmd_sub_rate(stpp,
+                      htsmsg_get_u32_or_default(m, HTSMSG_INDEX(1), 0),
+                      htsmsg_get_u32_or_default(m, HTSMSG_INDEX(2), 0));
+    break;
   }
 }
 
@@ -893,7 +1181,7 @@ stpp_send_hello(stpp_t *stpp)
   buf[0] = STPP_CMD_HELLO;
   buf[1] = STPP_VERSION;
   memcpy(buf + 2, gconf.running_instance, 16);
-  buf[18] = 0x0; // Flags
+  buf[18] = stpp->stpp_flags;
   websocket_send(stpp->stpp_hc, 2, buf, buflen);
 }
 
@@ -1019,10 +1307,10 @@ stpp_binary(stpp_t *stpp, const uint8_t *data, int len)
       return -1;
 #if 0
     uint8_t version = data[0];
-    uint8_t flags = data[1];
     char *id = NULL;
     char *version = NULL;
 #endif
+    stpp->stpp_flags = data[1] & (STPP_HELLO_BATCH | STPP_HELLO_DELTA);
     stpp_send_hello(stpp);
     stpp->stpp_helloed_ok = 1;
     return 0;
@@ -1123,6 +1411,12 @@ stpp_binary(stpp_t *stpp, const uint8_t *data, int len)
     stpp_cmd_want_more_childs(stpp, rd32_le(data));
     break;
 
+  case STPP_CMD_SUB_RATE:
+    if(len != 8)
+      return -1;
+    stpp_cmd_sub_rate(stpp, rd32_le(data), rd32_le(data + 4));
+    break;
+
   case STPP_CMD_SELECT:
     {
       prop_t *p = decode_propref(stpp, &data, &len);
@@ -1217,6 +1511,10 @@ stpp_init(http_connection_t *hc, void *opaque)
 
   stpp_t *stpp = calloc(1, sizeof(stpp_t));
   stpp->stpp_hc = hc;
+  stpp->stpp_created = async_current_time();
+  htsbuf_queue_init(&stpp->stpp_batch_bin, 0);
+  htsbuf_queue_init(&stpp->stpp_batch_json, 0);
+  asyncio_timer_init(&stpp->stpp_flush_timer, stpp_flush_timer_cb, stpp);
   http_set_opaque(hc, stpp);
 
   prop_t *p = prop_create_multi(prop_get_global(),
@@ -1241,6 +1539,17 @@ stpp_fini(http_connection_t *hc, void *opaque)
 
   assert(stpp->stpp_props.root == NULL);
 
+  asyncio_timer_disarm(&stpp->stpp_flush_timer);
+  htsbuf_queue_flush(&stpp->stpp_batch_bin);
+  htsbuf_queue_flush(&stpp->stpp_batch_json);
+
+  const int64_t duration = async_current_time() - stpp->stpp_created;
+  TRACE(TRACE_DEBUG, "STPP",
+        "Session closed after %"PRId64"s: %d notifications in %d frames "
+        "(%"PRId64" bytes), %d value updates coalesced",
+        duration / 1000000, stpp->stpp_records, stpp->stpp_frames,
+        stpp->stpp_bytes, stpp->stpp_coalesced);
+
   stpp_imagereq_t *sir;
   while((sir = LIST_FIRST(&stpp->stpp_imagereqs)) != NULL) {
     LIST_REMOVE(sir, sir_link);
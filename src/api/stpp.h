@@ -22,6 +22,8 @@
 
 #define STPP_VERSION 3
 
+// Varints are little endian base 128, bit 7 set on all but the last byte
+
 // These things are sent over the wire so no changes here please
 
 #define STPP_CMD_HELLO       0
@@ -37,6 +39,14 @@
 #define STPP_CMD_IMAGE_REPLY 10
 #define STPP_CMD_IMAGE_FAIL  11
 #define STPP_CMD_IMAGE_CANCEL 12
+#define STPP_CMD_SUB_RATE    13 // Limit rate of value updates for subscription
+#define STPP_CMD_BATCH       14 // Sequence of [varint length][message]
+
+
+// Flags exchanged in STPP_CMD_HELLO, a feature is used if both sides set it
+
+#define STPP_HELLO_BATCH     0x1 // Notifications may be sent in STPP_CMD_BATCH
+#define STPP_HELLO_DELTA     0x2 // Child vectors may be sent delta coded
 
 
 // Notify types (First byte in STPP_CMD_NOTIFY message)
@@ -58,3 +68,5 @@
 #define STPP_TOGGLE_INT         13
 #define STPP_HAVE_MORE_CHILDS_YES 14
 #define STPP_HAVE_MORE_CHILDS_NO  15
+#define STPP_ADD_CHILDS_DELTA   16 // First id as u32, then varint deltas
+#define STPP_ADD_CHILDS_BEFORE_DELTA 17 // u32 before, then as above
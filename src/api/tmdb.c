@@ -45,6 +45,7 @@
 
 
 static hts_mutex_t tmdb_mutex;
+static hts_cond_t tmdb_cond;
 static metadata_source_t *tmdb;
 static char *tmdb_image_base_url;
 static int tmdb_configured;
@@ -64,6 +65,34 @@ static tmdb_image_size_t *poster_sizes, *backdrop_sizes, *profile_sizes;
 
 static int64_t tmdb_no_request_before;
 
+/**
+ * TMDB rate limits per client so there is no point in letting all
+ * metadata threads block on it. Keep a few requests in flight and let
+ * the other threads do local work meanwhile
+ */
+#define TMDB_MAX_REQUESTS 2
+
+static int tmdb_requests_inflight;
+
+/**
+ * Searches in flight. Items with the same title and year (multiple
+ * parts, the same file in different folders, etc) share the result
+ * instead of asking again
+ */
+LIST_HEAD(tmdb_search_list, tmdb_search);
+
+typedef struct tmdb_search {
+  LIST_ENTRY(tmdb_search) ts_link;
+  char *ts_title;
+  int ts_year;
+  int ts_refcount;
+  int ts_done;
+  buf_t *ts_result;
+  int ts_cache_info;
+} tmdb_search_t;
+
+static struct tmdb_search_list tmdb_searches;
+
 /**
  *
  */
@@ -83,17 +112,40 @@ tmdb_handle_rate_limit(struct http_header_list *response_headers)
   hts_mutex_unlock(&tmdb_mutex);
 }
 
+/**
+ * Wait until we're allowed to send a request. Must be paired with
+ * tmdb_request_done()
+ */
 static void
 tmdb_check_rate_limit(void)
 {
+  hts_mutex_lock(&tmdb_mutex);
   while(1) {
-    hts_mutex_lock(&tmdb_mutex);
     int64_t sleeptime = tmdb_no_request_before - arch_get_ts();
-    hts_mutex_unlock(&tmdb_mutex);
-    if(sleeptime < 0)
-      return;
-    usleep(MIN(sleeptime, 10000000));
+    if(sleeptime > 0) {
+      hts_cond_wait_timeout(&tmdb_cond, &tmdb_mutex,
+                            MIN(sleeptime / 1000 + 1, 10000));
+      continue;
+    }
+    if(tmdb_requests_inflight < TMDB_MAX_REQUESTS)
+      break;
+    hts_cond_wait(&tmdb_cond, &tmdb_mutex);
   }
+  tmdb_requests_inflight++;
+  hts_mutex_unlock(&tmdb_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+tmdb_request_done(void)
+{
+  hts_mutex_lock(&tmdb_mutex);
+  tmdb_requests_inflight--;
+  hts_cond_broadcast(&tmdb_cond);
+  hts_mutex_unlock(&tmdb_mutex);
 }
 
 /**
@@ -301,6 +353,7 @@ tmdb_load_movie_cast(const char *lookup_id)
                    FA_LOAD_PROTOCOL_CODE(&http_response_code),
                    FA_LOAD_FLAGS(FA_COMPRESSION),
                    NULL);
+  tmdb_request_done();
   if(result == NULL) {
     if(http_response_code == 429) {
       tmdb_handle_rate_limit(&response_headers);
@@ -416,6 +469,7 @@ tmdb_load_movie_info(void *db, const char *item_url, const char *lookup_id,
                    FA_LOAD_PROTOCOL_CODE(&http_response_code),
                    FA_LOAD_FLAGS(FA_COMPRESSION),
                    NULL);
+  tmdb_request_done();
   if(result == NULL) {
     if(http_response_code == 429) {
       tmdb_handle_rate_limit(&response_headers);
@@ -528,10 +582,9 @@ tmdb_load_movie_info(void *db, const char *item_url, const char *lookup_id,
 /**
  *
  */
-static int64_t
-tmdb_query_by_title_and_year0(void *db, const char *item_url,
-                              const char *title, int year, int duration,
-                              int qtype, int *cache_info)
+static buf_t *
+tmdb_search_movie(const char *url, const char *title, int year,
+                  int *cache_info)
 {
   char errbuf[256];
   buf_t *result;
@@ -542,8 +595,6 @@ tmdb_query_by_title_and_year0(void *db, const char *item_url,
   else
     yeartxt[0] = 0;
 
-  const char *url = "http://api.themoviedb.org/3/search/movie";
-
  retry:
   tmdb_check_rate_limit();
   int http_response_code = 0;
@@ -561,16 +612,97 @@ tmdb_query_by_title_and_year0(void *db, const char *item_url,
                    FA_LOAD_FLAGS(FA_COMPRESSION),
                    FA_LOAD_CACHE_INFO(cache_info),
                    NULL);
+  tmdb_request_done();
 
-  if(result == NULL) {
-    if(http_response_code == 429) {
-      tmdb_handle_rate_limit(&response_headers);
-      goto retry;
-    }
-    http_headers_free(&response_headers);
-    return METADATA_TEMPORARY_ERROR;
+  if(result == NULL && http_response_code == 429) {
+    tmdb_handle_rate_limit(&response_headers);
+    goto retry;
   }
   http_headers_free(&response_headers);
+  return result;
+}
+
+
+/**
+ *
+ */
+static void
+tmdb_search_release(tmdb_search_t *ts)
+{
+  ts->ts_refcount--;
+  if(ts->ts_refcount > 0)
+    return;
+  buf_release(ts->ts_result);
+  free(ts->ts_title);
+  free(ts);
+}
+
+
+/**
+ * Search for a movie, or wait for an identical search already in
+ * flight and use its result
+ */
+static buf_t *
+tmdb_search_movie_coalesced(const char *url, const char *title, int year,
+                            int *cache_info)
+{
+  tmdb_search_t *ts;
+  buf_t *result;
+
+  hts_mutex_lock(&tmdb_mutex);
+
+  LIST_FOREACH(ts, &tmdb_searches, ts_link)
+    if(ts->ts_year == year && !strcmp(ts->ts_title, title))
+      break;
+
+  if(ts != NULL) {
+    TMDB_TRACE("Query '%s' year:%d already in progress, waiting",
+               title, year);
+    ts->ts_refcount++;
+    while(!ts->ts_done)
+      hts_cond_wait(&tmdb_cond, &tmdb_mutex);
+    result = ts->ts_result ? buf_retain(ts->ts_result) : NULL;
+    *cache_info = ts->ts_cache_info;
+    tmdb_search_release(ts);
+    hts_mutex_unlock(&tmdb_mutex);
+    return result;
+  }
+
+  ts = calloc(1, sizeof(tmdb_search_t));
+  ts->ts_title = strdup(title);
+  ts->ts_year = year;
+  ts->ts_refcount = 1;
+  LIST_INSERT_HEAD(&tmdb_searches, ts, ts_link);
+  hts_mutex_unlock(&tmdb_mutex);
+
+  result = tmdb_search_movie(url, title, year, cache_info);
+
+  hts_mutex_lock(&tmdb_mutex);
+  LIST_REMOVE(ts, ts_link);
+  ts->ts_result = result ? buf_retain(result) : NULL;
+  ts->ts_cache_info = *cache_info;
+  ts->ts_done = 1;
+  hts_cond_broadcast(&tmdb_cond);
+  tmdb_search_release(ts);
+  hts_mutex_unlock(&tmdb_mutex);
+  return result;
+}
+
+
+/**
+ *
+ */
+static int64_t
+tmdb_query_by_title_and_year0(void *db, const char *item_url,
+                              const char *title, int year, int duration,
+                              int qtype, int *cache_info)
+{
+  char errbuf[256];
+  const char *url = "http://api.themoviedb.org/3/search/movie";
+
+  buf_t *result = tmdb_search_movie_coalesced(url, title, year, cache_info);
+  if(result == NULL)
+    return METADATA_TEMPORARY_ERROR;
 
   htsmsg_t *doc = htsmsg_json_deserialize2(buf_cstr(result),
                                            errbuf, sizeof(errbuf));
@@ -768,6 +900,7 @@ static void
 tmdb_init(void)
 {
   hts_mutex_init(&tmdb_mutex);
+  hts_cond_init(&tmdb_cond, &tmdb_mutex);
 
   tmdb = metadata_add_source("tmdb", "themoviedb.org", 100001,
 			     METADATA_TYPE_VIDEO, &search_fns,
@@ -116,8 +116,14 @@ audio_init(void)
                      _p("Setup audio output"),
                      "settings:audio");
 
+  audio_convert_init();
   audio_mastervol_init();
-  audio_class = audio_driver_init(asettings);
+#if CONFIG_AUDIOTEST
+  if(gconf.gapless_test_urls[0] != NULL)
+    audio_class = audio_dummy_init(asettings);
+  else
+#endif
+    audio_class = audio_driver_init(asettings);
 
   settings_create_separator(asettings,
 			    _p("Video playback"));
@@ -146,6 +152,9 @@ audio_init(void)
 
 #if CONFIG_AUDIOTEST
   audio_test_init(asettings);
+
+  if(gconf.gapless_test_urls[0] != NULL)
+    audio_gapless_test_start(gconf.gapless_test_urls);
 #endif
 }
 
@@ -219,11 +228,36 @@ audio_decoder_destroy(struct audio_decoder *ad)
     avresample_free(&ad->ad_avr);
   }
 
+  audio_direct_cleanup(&ad->ad_direct);
   audio_cleanup_spdif_muxer(ad);
   free(ad);
 }
 
 
+/**
+ * Number of converted samples ready to be read by the driver
+ */
+int
+audio_available(audio_decoder_t *ad)
+{
+  if(ad->ad_use_direct)
+    return audio_direct_available(&ad->ad_direct);
+  return ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
+}
+
+
+/**
+ * Read converted samples, same semantics as avresample_read()
+ */
+int
+audio_read(audio_decoder_t *ad, uint8_t **planes, int samples)
+{
+  if(ad->ad_use_direct)
+    return audio_direct_read(&ad->ad_direct, planes, samples);
+  return avresample_read(ad->ad_avr, planes, samples);
+}
+
+
 /**
  *
  */
@@ -512,7 +546,10 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
 
     int od = 0, id = 0;
 
-    if(ad->ad_avr != NULL) {
+    if(ad->ad_use_direct) {
+      od = audio_direct_available(&ad->ad_direct) *
+        1000000LL / ad->ad_out_sample_rate;
+    } else if(ad->ad_avr != NULL) {
       od = avresample_available(ad->ad_avr) *
         1000000LL / ad->ad_out_sample_rate;
       id = avresample_get_delay(ad->ad_avr) *
@@ -550,24 +587,44 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
 
     ac->ac_reconfig(ad);
 
-    if(ad->ad_avr == NULL)
-      ad->ad_avr = avresample_alloc_context();
-    else
-      avresample_close(ad->ad_avr);
-
-    av_opt_set_int(ad->ad_avr, "in_sample_fmt",
-                   ad->ad_in_sample_format, 0);
-    av_opt_set_int(ad->ad_avr, "in_sample_rate",
-                   ad->ad_in_sample_rate, 0);
-    av_opt_set_int(ad->ad_avr, "in_channel_layout",
-                   ad->ad_in_channel_layout, 0);
-
-    av_opt_set_int(ad->ad_avr, "out_sample_fmt",
-                   ad->ad_out_sample_format, 0);
-    av_opt_set_int(ad->ad_avr, "out_sample_rate",
-                   ad->ad_out_sample_rate, 0);
-    av_opt_set_int(ad->ad_avr, "out_channel_layout",
-                   ad->ad_out_channel_layout, 0);
+    // Drop whatever is left from the previous format
+    audio_direct_read(&ad->ad_direct, NULL,
+                      audio_direct_available(&ad->ad_direct));
+
+    ad->ad_use_direct =
+      !audio_direct_setup(&ad->ad_direct,
+                          ad->ad_in_sample_format,
+                          ad->ad_in_channel_layout,
+                          ad->ad_in_sample_rate,
+                          ad->ad_out_sample_format,
+                          ad->ad_out_channel_layout,
+                          ad->ad_out_sample_rate);
+
+    if(ad->ad_use_direct) {
+      if(ad->ad_avr != NULL) {
+        avresample_close(ad->ad_avr);
+        avresample_free(&ad->ad_avr);
+      }
+    } else {
+      if(ad->ad_avr == NULL)
+        ad->ad_avr = avresample_alloc_context();
+      else
+        avresample_close(ad->ad_avr);
+
+      av_opt_set_int(ad->ad_avr, "in_sample_fmt",
+                     ad->ad_in_sample_format, 0);
+      av_opt_set_int(ad->ad_avr, "in_sample_rate",
+                     ad->ad_in_sample_rate, 0);
+      av_opt_set_int(ad->ad_avr, "in_channel_layout",
+                     ad->ad_in_channel_layout, 0);
+
+      av_opt_set_int(ad->ad_avr, "out_sample_fmt",
+                     ad->ad_out_sample_format, 0);
+      av_opt_set_int(ad->ad_avr, "out_sample_rate",
+                     ad->ad_out_sample_rate, 0);
+      av_opt_set_int(ad->ad_avr, "out_channel_layout",
+                     ad->ad_out_channel_layout, 0);
+    }
 
     char buf1[128];
     char buf2[128];
@@ -578,13 +635,14 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
                                  -1, ad->ad_out_channel_layout);
 
     TRACE(TRACE_DEBUG, "Audio",
-          "Converting from [%s %dHz %s] to [%s %dHz %s]",
+          "Converting from [%s %dHz %s] to [%s %dHz %s] using %s",
           buf1, ad->ad_in_sample_rate,
           av_get_sample_fmt_name(ad->ad_in_sample_format),
           buf2, ad->ad_out_sample_rate,
-          av_get_sample_fmt_name(ad->ad_out_sample_format));
+          av_get_sample_fmt_name(ad->ad_out_sample_format),
+          ad->ad_use_direct ? audio_kernels.ak_name : "libavresample");
 
-    if(avresample_open(ad->ad_avr)) {
+    if(!ad->ad_use_direct && avresample_open(ad->ad_avr)) {
       TRACE(TRACE_ERROR, "Audio", "Unable to open resampler");
       avresample_free(&ad->ad_avr);
     }
@@ -598,7 +656,9 @@ audio_process_audio(audio_decoder_t *ad, media_buf_t *mb)
   ad->ad_estimated_duration =
     1000000LL * frame->nb_samples / frame->sample_rate;
 
-  if(ad->ad_avr != NULL) {
+  if(ad->ad_use_direct) {
+    audio_direct_convert(&ad->ad_direct, frame->data, frame->nb_samples);
+  } else if(ad->ad_avr != NULL) {
     avresample_convert(ad->ad_avr, NULL, 0, 0,
                        frame->data, frame->linesize[0],
                        frame->nb_samples);
@@ -641,7 +701,7 @@ audio_decode_thread(void *aux)
     if(ad->ad_spdif_muxer != NULL) {
       avail = ad->ad_spdif_frame_size;
     } else {
-      avail = ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
+      avail = audio_available(ad);
     }
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
@@ -765,9 +825,9 @@ audio_decode_thread(void *aux)
 	  mp->mp_seek_audio_done(mp);
 	ad->ad_discontinuity = 1;
 
-	if(ad->ad_avr != NULL) {
-	  avresample_read(ad->ad_avr, NULL, avresample_available(ad->ad_avr));
-	  assert(avresample_available(ad->ad_avr) == 0);
+	if(ad->ad_use_direct || ad->ad_avr != NULL) {
+	  audio_read(ad, NULL, audio_available(ad));
+	  assert(audio_available(ad) == 0);
 	}
 	break;
 
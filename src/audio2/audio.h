@@ -23,6 +23,7 @@
 
 #include "arch/threads.h"
 #include "media/media.h"
+#include "audio_convert.h"
 
 extern float audio_master_volume;
 extern int   audio_master_mute;
@@ -97,6 +98,9 @@ typedef struct audio_decoder {
 
   AVAudioResampleContext *ad_avr;
 
+  audio_direct_t ad_direct;
+  int ad_use_direct;  // ad_direct is used instead of ad_avr
+
   void *ad_mux_buffer;
   
   struct AVFormatContext *ad_spdif_muxer;
@@ -129,3 +133,11 @@ audio_class_t *audio_driver_init(struct prop *asettings);
 
 void audio_test_init(struct prop *asettings);
 
+audio_class_t *audio_dummy_init(struct prop *asettings);
+
+void audio_gapless_test_start(const char **urls);
+
+int audio_available(audio_decoder_t *ad);
+
+int audio_read(audio_decoder_t *ad, uint8_t **planes, int samples);
+
@@ -0,0 +1,838 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <libavutil/channel_layout.h>
+
+#include "main.h"
+#include "audio_convert.h"
+#include "misc/minmax.h"
+
+/**
+ * Direct sample conversion
+ *
+ * Most content is decoded to planar float at the same rate as the
+ * output runs at, so all that's needed is to interleave (or downmix)
+ * and convert to the output sample format. libavresample does that
+ * through a generic multi stage pipeline with an internal FIFO. Here
+ * it's done in two passes using the kernels below, straight into our
+ * own FIFO.
+ *
+ * The downmix matrix is built the same way libavresample builds its
+ * default one (center and surrounds at -3dB, LFE dropped, normalized
+ * to avoid clipping).
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+  defined(__GNUC__)
+#define AUDIO_SIMD_X86
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && \
+  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define AUDIO_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+/**
+ *
+ */
+static void
+interleave_flt_c(float *dst, const float *l, const float *r, int num)
+{
+  for(int i = 0; i < num; i++) {
+    dst[i * 2 + 0] = l[i];
+    dst[i * 2 + 1] = r[i];
+  }
+}
+
+
+/**
+ *
+ */
+static void
+downmix_flt_c(float *dst, const float **src, int channels,
+              const float *ml, const float *mr, int num)
+{
+  for(int i = 0; i < num; i++) {
+    float l = 0, r = 0;
+    for(int c = 0; c < channels; c++) {
+      l += src[c][i] * ml[c];
+      r += src[c][i] * mr[c];
+    }
+    dst[i * 2 + 0] = l;
+    dst[i * 2 + 1] = r;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+flt_to_s16_c(int16_t *dst, const float *src, int num)
+{
+  for(int i = 0; i < num; i++) {
+    const float f = src[i] * 32768.0f;
+    if(f >= 32767.0f)
+      dst[i] = INT16_MAX;
+    else if(f <= -32768.0f)
+      dst[i] = INT16_MIN;
+    else
+      dst[i] = lrintf(f);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+flt_to_s32_c(int32_t *dst, const float *src, int num)
+{
+  for(int i = 0; i < num; i++) {
+    const float f = src[i] * 2147483648.0f;
+    if(f >= 2147483648.0f)
+      dst[i] = INT32_MAX;
+    else if(f <= -2147483648.0f)
+      dst[i] = INT32_MIN;
+    else
+      dst[i] = lrintf(f);
+  }
+}
+
+
+const audio_kernels_t audio_kernels_c = {
+  .ak_name           = "C",
+  .ak_interleave_flt = interleave_flt_c,
+  .ak_downmix_flt    = downmix_flt_c,
+  .ak_flt_to_s16     = flt_to_s16_c,
+  .ak_flt_to_s32     = flt_to_s32_c,
+};
+
+audio_kernels_t audio_kernels;
+
+
+#ifdef AUDIO_SIMD_X86
+
+/**
+ *
+ */
+static void
+interleave_flt_sse2(float *dst, const float *l, const float *r, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    const __m128 a = _mm_loadu_ps(l + i);
+    const __m128 b = _mm_loadu_ps(r + i);
+    _mm_storeu_ps(dst + i * 2 + 0, _mm_unpacklo_ps(a, b));
+    _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(a, b));
+  }
+  interleave_flt_c(dst + i * 2, l + i, r + i, num - i);
+}
+
+
+/**
+ *
+ */
+static void
+downmix_flt_sse2(float *dst, const float **src, int channels,
+                 const float *ml, const float *mr, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    __m128 l = _mm_setzero_ps();
+    __m128 r = _mm_setzero_ps();
+    for(int c = 0; c < channels; c++) {
+      const __m128 v = _mm_loadu_ps(src[c] + i);
+      l = _mm_add_ps(l, _mm_mul_ps(v, _mm_set1_ps(ml[c])));
+      r = _mm_add_ps(r, _mm_mul_ps(v, _mm_set1_ps(mr[c])));
+    }
+    _mm_storeu_ps(dst + i * 2 + 0, _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+  }
+
+  if(i < num) {
+    const float *tail[8];
+    for(int c = 0; c < channels; c++)
+      tail[c] = src[c] + i;
+    downmix_flt_c(dst + i * 2, tail, channels, ml, mr, num - i);
+  }
+}
+
+
+/**
+ * cvtps2dq rounds to nearest even (as lrintf() does) and packssdw
+ * saturates, so we only need to keep the floats within int32 range
+ */
+static void
+flt_to_s16_sse2(int16_t *dst, const float *src, int num)
+{
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 hi = _mm_set1_ps(32767.0f);
+  const __m128 lo = _mm_set1_ps(-32768.0f);
+  int i = 0;
+  for(; i + 8 <= num; i += 8) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i + 0), scale);
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+    a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+    b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+  }
+  flt_to_s16_c(dst + i, src + i, num - i);
+}
+
+
+/**
+ * cvtps2dq returns 0x80000000 for anything out of range which is right
+ * for negative overflow, positive overflow is patched up
+ */
+static void
+flt_to_s32_sse2(int32_t *dst, const float *src, int num)
+{
+  const __m128 scale = _mm_set1_ps(2147483648.0f);
+  const __m128i max = _mm_set1_epi32(INT32_MAX);
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    const __m128 f = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+    const __m128i over = _mm_castps_si128(_mm_cmpge_ps(f, scale));
+    const __m128i v = _mm_cvtps_epi32(f);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_or_si128(_mm_andnot_si128(over, v),
+                                  _mm_and_si128(over, max)));
+  }
+  flt_to_s32_c(dst + i, src + i, num - i);
+}
+
+#endif // AUDIO_SIMD_X86
+
+
+#ifdef AUDIO_SIMD_NEON
+
+/**
+ *
+ */
+static void
+interleave_flt_neon(float *dst, const float *l, const float *r, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    float32x4x2_t v;
+    v.val[0] = vld1q_f32(l + i);
+    v.val[1] = vld1q_f32(r + i);
+    vst2q_f32(dst + i * 2, v);
+  }
+  interleave_flt_c(dst + i * 2, l + i, r + i, num - i);
+}
+
+
+/**
+ *
+ */
+static void
+downmix_flt_neon(float *dst, const float **src, int channels,
+                 const float *ml, const float *mr, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    float32x4x2_t o;
+    o.val[0] = vdupq_n_f32(0);
+    o.val[1] = vdupq_n_f32(0);
+    for(int c = 0; c < channels; c++) {
+      const float32x4_t v = vld1q_f32(src[c] + i);
+      o.val[0] = vaddq_f32(o.val[0], vmulq_n_f32(v, ml[c]));
+      o.val[1] = vaddq_f32(o.val[1], vmulq_n_f32(v, mr[c]));
+    }
+    vst2q_f32(dst + i * 2, o);
+  }
+
+  if(i < num) {
+    const float *tail[8];
+    for(int c = 0; c < channels; c++)
+      tail[c] = src[c] + i;
+    downmix_flt_c(dst + i * 2, tail, channels, ml, mr, num - i);
+  }
+}
+
+
+#if defined(__aarch64__)
+
+/**
+ * ARMv8 has a round-to-nearest-even conversion that saturates, ARMv7
+ * only truncates so we use the C versions there
+ */
+static void
+flt_to_s16_neon(int16_t *dst, const float *src, int num)
+{
+  int i = 0;
+  for(; i + 8 <= num; i += 8) {
+    const int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i),
+                                                   32768.0f));
+    const int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4),
+                                                   32768.0f));
+    vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+  }
+  flt_to_s16_c(dst + i, src + i, num - i);
+}
+
+
+/**
+ *
+ */
+static void
+flt_to_s32_neon(int32_t *dst, const float *src, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4)
+    vst1q_s32(dst + i, vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i),
+                                                  2147483648.0f)));
+  flt_to_s32_c(dst + i, src + i, num - i);
+}
+
+#endif // __aarch64__
+
+#endif // AUDIO_SIMD_NEON
+
+
+/**
+ * Select the best kernels for the CPU we're running on
+ */
+void
+audio_convert_init(void)
+{
+  audio_kernels = audio_kernels_c;
+
+#ifdef AUDIO_SIMD_X86
+  audio_kernels.ak_name           = "SSE2";
+  audio_kernels.ak_interleave_flt = interleave_flt_sse2;
+  audio_kernels.ak_downmix_flt    = downmix_flt_sse2;
+  audio_kernels.ak_flt_to_s16     = flt_to_s16_sse2;
+  audio_kernels.ak_flt_to_s32     = flt_to_s32_sse2;
+#endif
+
+#ifdef AUDIO_SIMD_NEON
+  audio_kernels.ak_name           = "NEON";
+  audio_kernels.ak_interleave_flt = interleave_flt_neon;
+  audio_kernels.ak_downmix_flt    = downmix_flt_neon;
+#if defined(__aarch64__)
+  audio_kernels.ak_flt_to_s16     = flt_to_s16_neon;
+  audio_kernels.ak_flt_to_s32     = flt_to_s32_neon;
+#endif
+#endif
+}
+
+
+/**
+ * Build stereo downmix matrix, returns number of input channels
+ */
+static int
+audio_direct_build_matrix(audio_direct_t *adc, int64_t layout)
+{
+  int c = 0;
+  float sl = 0, sr = 0;
+
+  for(int bit = 0; bit < 64; bit++) {
+    const int64_t ch = 1ULL << bit;
+    float l = 0, r = 0;
+
+    if(!(layout & ch))
+      continue;
+
+    if(c == 8)
+      return -1;
+
+    switch(ch) {
+    case AV_CH_FRONT_LEFT:
+      l = 1;
+      break;
+    case AV_CH_FRONT_RIGHT:
+      r = 1;
+      break;
+    case AV_CH_FRONT_CENTER:
+      l = r = M_SQRT1_2;
+      break;
+    case AV_CH_LOW_FREQUENCY:
+      break;
+    case AV_CH_BACK_LEFT:
+    case AV_CH_SIDE_LEFT:
+      l = M_SQRT1_2;
+      break;
+    case AV_CH_BACK_RIGHT:
+    case AV_CH_SIDE_RIGHT:
+      r = M_SQRT1_2;
+      break;
+    default:
+      return -1;
+    }
+    adc->adc_ml[c] = l;
+    adc->adc_mr[c] = r;
+    sl += l;
+    sr += r;
+    c++;
+  }
+
+  const float max = MAX(sl, sr);
+  if(max > 1.0f) {
+    for(int i = 0; i < c; i++) {
+      adc->adc_ml[i] /= max;
+      adc->adc_mr[i] /= max;
+    }
+  }
+  return c;
+}
+
+
+/**
+ * Returns 0 if the direct path can do this conversion
+ */
+int
+audio_direct_setup(audio_direct_t *adc,
+                   enum AVSampleFormat in_format, int64_t in_layout,
+                   int in_rate,
+                   enum AVSampleFormat out_format, int64_t out_layout,
+                   int out_rate)
+{
+  if(in_rate != out_rate || out_layout != AV_CH_LAYOUT_STEREO)
+    return -1;
+
+  switch(out_format) {
+  case AV_SAMPLE_FMT_S16:
+  case AV_SAMPLE_FMT_S32:
+  case AV_SAMPLE_FMT_FLT:
+    break;
+  default:
+    return -1;
+  }
+
+  const int channels = audio_direct_build_matrix(adc, in_layout);
+
+  switch(in_format) {
+  case AV_SAMPLE_FMT_FLTP:
+    // Plain stereo is interleaved, the rest goes through the matrix
+    if(in_layout != AV_CH_LAYOUT_STEREO &&
+       in_layout != AV_CH_LAYOUT_5POINT1 &&
+       in_layout != AV_CH_LAYOUT_5POINT1_BACK &&
+       in_layout != AV_CH_LAYOUT_7POINT1)
+      return -1;
+    break;
+
+  case AV_SAMPLE_FMT_FLT:
+  case AV_SAMPLE_FMT_S16:
+  case AV_SAMPLE_FMT_S16P:
+    if(in_layout != AV_CH_LAYOUT_STEREO)
+      return -1;
+    break;
+
+  default:
+    return -1;
+  }
+
+  adc->adc_channels = channels;
+  adc->adc_in_format = in_format;
+  adc->adc_out_format = out_format;
+  const int sample_size = av_get_bytes_per_sample(out_format) * 2;
+  if(sample_size != adc->adc_sample_size) {
+    // FIFO size is in samples, so it's no longer valid
+    free(adc->adc_fifo);
+    adc->adc_fifo = NULL;
+    adc->adc_fifo_size = 0;
+    adc->adc_sample_size = sample_size;
+  }
+  adc->adc_fifo_rd = 0;
+  adc->adc_fifo_wr = 0;
+  return 0;
+}
+
+
+/**
+ * Get scratch buffer for 'num' interleaved stereo float samples
+ */
+static float *
+audio_direct_mixbuf(audio_direct_t *adc, int num)
+{
+  if(num > adc->adc_mix_size) {
+    adc->adc_mix_size = num;
+    free(adc->adc_mix);
+    adc->adc_mix = malloc(num * 2 * sizeof(float));
+  }
+  return adc->adc_mix;
+}
+
+
+/**
+ * Make room for 'num' more samples in FIFO
+ */
+static void
+audio_direct_fifo_reserve(audio_direct_t *adc, int num)
+{
+  const int avail = audio_direct_available(adc);
+
+  if(adc->adc_fifo_rd > 0) {
+    memmove(adc->adc_fifo,
+            adc->adc_fifo + adc->adc_fifo_rd * adc->adc_sample_size,
+            avail * adc->adc_sample_size);
+    adc->adc_fifo_rd = 0;
+    adc->adc_fifo_wr = avail;
+  }
+
+  if(avail + num > adc->adc_fifo_size) {
+    adc->adc_fifo_size = MAX(avail + num, adc->adc_fifo_size * 2);
+    adc->adc_fifo = realloc(adc->adc_fifo,
+                            adc->adc_fifo_size * adc->adc_sample_size);
+  }
+}
+
+
+/**
+ * Convert 'num' samples (ie. AVFrame->data) and append them to FIFO
+ */
+void
+audio_direct_convert(audio_direct_t *adc, uint8_t * const *data, int num)
+{
+  const audio_kernels_t *ak = &audio_kernels;
+
+  audio_direct_fifo_reserve(adc, num);
+
+  uint8_t *dst = adc->adc_fifo + adc->adc_fifo_wr * adc->adc_sample_size;
+  adc->adc_fifo_wr += num;
+
+  if(adc->adc_in_format == adc->adc_out_format) {
+    // Interleaved stereo in the format we want
+    memcpy(dst, data[0], num * adc->adc_sample_size);
+    return;
+  }
+
+  float *mix = adc->adc_out_format == AV_SAMPLE_FMT_FLT ?
+    (float *)dst : audio_direct_mixbuf(adc, num);
+
+  switch(adc->adc_in_format) {
+  case AV_SAMPLE_FMT_FLTP:
+    if(adc->adc_channels == 2)
+      ak->ak_interleave_flt(mix, (const float *)data[0],
+                            (const float *)data[1], num);
+    else
+      ak->ak_downmix_flt(mix, (const float **)data, adc->adc_channels,
+                         adc->adc_ml, adc->adc_mr, num);
+    break;
+
+  case AV_SAMPLE_FMT_FLT:
+    memcpy(mix, data[0], num * 2 * sizeof(float));
+    break;
+
+  case AV_SAMPLE_FMT_S16: {
+    const int16_t *s = (const int16_t *)data[0];
+    for(int i = 0; i < num * 2; i++)
+      mix[i] = s[i] * (1.0f / (1 << 15));
+    break;
+  }
+
+  case AV_SAMPLE_FMT_S16P: {
+    const int16_t *l = (const int16_t *)data[0];
+    const int16_t *r = (const int16_t *)data[1];
+    for(int i = 0; i < num; i++) {
+      mix[i * 2 + 0] = l[i] * (1.0f / (1 << 15));
+      mix[i * 2 + 1] = r[i] * (1.0f / (1 << 15));
+    }
+    break;
+  }
+
+  default:
+    abort();
+  }
+
+  switch(adc->adc_out_format) {
+  case AV_SAMPLE_FMT_S16:
+    ak->ak_flt_to_s16((int16_t *)dst, mix, num * 2);
+    break;
+  case AV_SAMPLE_FMT_S32:
+    ak->ak_flt_to_s32((int32_t *)dst, mix, num * 2);
+    break;
+  default:
+    break;
+  }
+}
+
+
+/**
+ * Same semantics as avresample_read(), 'planes' may be NULL to discard
+ */
+int
+audio_direct_read(audio_direct_t *adc, uint8_t **planes, int num)
+{
+  num = MIN(num, audio_direct_available(adc));
+
+  if(planes != NULL && planes[0] != NULL)
+    memcpy(planes[0],
+           adc->adc_fifo + adc->adc_fifo_rd * adc->adc_sample_size,
+           num * adc->adc_sample_size);
+
+  adc->adc_fifo_rd += num;
+  if(adc->adc_fifo_rd == adc->adc_fifo_wr)
+    adc->adc_fifo_rd = adc->adc_fifo_wr = 0;
+  return num;
+}
+
+
+/**
+ *
+ */
+void
+audio_direct_cleanup(audio_direct_t *adc)
+{
+  free(adc->adc_mix);
+  free(adc->adc_fifo);
+  memset(adc, 0, sizeof(audio_direct_t));
+}
+
+
+/**
+ * Checks the kernels against each other and against the conversions
+ * libavresample does, plus the downmix matrices. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Ibuild.linux -Ibuild.linux/inst/include \
+ *   src/audio2/audio_convert.c -o /tmp/audioconv \
+ *   -Lbuild.linux/inst/lib -lavutil -lm
+ */
+#ifdef LOCAL_MAIN
+#include <stdio.h>
+#include <libavutil/common.h>
+
+#define LM_LEN 1027  // Odd, so the tails of all kernels are used
+
+static int lm_errors;
+
+static void
+lm_fill(float *f, int num, int seed)
+{
+  srand(seed);
+  for(int i = 0; i < num; i++) {
+    switch(i % 16) {
+    case 0:  f[i] = 1.0f;       break;
+    case 1:  f[i] = -1.0f;      break;
+    case 2:  f[i] = 1.5f;       break;
+    case 3:  f[i] = -3.0f;      break;
+    case 4:  f[i] = 1000.0f;    break;
+    case 5:  f[i] = -1000.0f;   break;
+    case 6:  f[i] = 0.5f / 32768.0f;  break;  // Ties, round to even
+    case 7:  f[i] = -1.5f / 32768.0f; break;
+    case 8:  f[i] = 32767.5f / 32768.0f; break;
+    default:
+      f[i] = (rand() / (float)RAND_MAX) * 2.2f - 1.1f;
+      break;
+    }
+  }
+}
+
+
+static void
+lm_check_s16(const char *name, const int16_t *got, const float *src, int num)
+{
+  for(int i = 0; i < num; i++) {
+    const int16_t ref = av_clip_int16(lrintf(src[i] * (1 << 15)));
+    if(got[i] != ref) {
+      printf("%s: s16 mismatch at %d: %f -> %d, expected %d\n",
+             name, i, src[i], got[i], ref);
+      lm_errors++;
+      return;
+    }
+  }
+}
+
+
+static void
+lm_check_s32(const char *name, const int32_t *got, const float *src, int num)
+{
+  for(int i = 0; i < num; i++) {
+    const int32_t ref = av_clipl_int32(llrintf(src[i] * (1U << 31)));
+    if(got[i] != ref) {
+      printf("%s: s32 mismatch at %d: %f -> %d, expected %d\n",
+             name, i, src[i], got[i], ref);
+      lm_errors++;
+      return;
+    }
+  }
+}
+
+
+static void
+lm_check_flt(const char *what, const float *a, const float *b, int num,
+             float tolerance)
+{
+  for(int i = 0; i < num; i++) {
+    if(fabsf(a[i] - b[i]) > tolerance * MAX(1.0f, fabsf(b[i]))) {
+      printf("%s: mismatch at %d: %f != %f\n", what, i, a[i], b[i]);
+      lm_errors++;
+      return;
+    }
+  }
+}
+
+
+static void
+lm_test_kernels(const audio_kernels_t *ak)
+{
+  static float src[8][LM_LEN];
+  static float out[LM_LEN * 2], ref[LM_LEN * 2];
+  static int16_t s16[LM_LEN];
+  static int32_t s32[LM_LEN];
+  const float *planes[8];
+  const float ml[8] = {0.4f, 0, 0.3f, 0, 0.3f, 0, 0.2f, 0.1f};
+  const float mr[8] = {0, 0.4f, 0.3f, 0, 0, 0.3f, 0.1f, 0.2f};
+
+  for(int c = 0; c < 8; c++) {
+    lm_fill(src[c], LM_LEN, c);
+    planes[c] = src[c];
+  }
+
+  // Odd lengths and unaligned start, for all tail sizes
+  for(int len = LM_LEN - 8; len <= LM_LEN - 1; len++) {
+    const float *l = src[0] + 1, *r = src[1] + 1;
+
+    ak->ak_interleave_flt(out, l, r, len);
+    audio_kernels_c.ak_interleave_flt(ref, l, r, len);
+    lm_check_flt("interleave", out, ref, len * 2, 0);
+
+    for(int ch = 1; ch <= 8; ch++) {
+      ak->ak_downmix_flt(out, planes, ch, ml, mr, len);
+      audio_kernels_c.ak_downmix_flt(ref, planes, ch, ml, mr, len);
+      // Allow for fused multiply-add in the C version
+      lm_check_flt("downmix", out, ref, len * 2, 1e-6f);
+    }
+
+    ak->ak_flt_to_s16(s16, src[0] + 1, len);
+    lm_check_s16(ak->ak_name, s16, src[0] + 1, len);
+
+    ak->ak_flt_to_s32(s32, src[0] + 1, len);
+    lm_check_s32(ak->ak_name, s32, src[0] + 1, len);
+  }
+}
+
+
+static void
+lm_test_matrix(const char *name, int64_t layout, int channels,
+               const float *ml, const float *mr)
+{
+  audio_direct_t adc = {0};
+
+  if(audio_direct_setup(&adc, AV_SAMPLE_FMT_FLTP, layout, 48000,
+                        AV_SAMPLE_FMT_FLT, AV_CH_LAYOUT_STEREO, 48000)) {
+    printf("%s: not accepted\n", name);
+    lm_errors++;
+    return;
+  }
+  if(adc.adc_channels != channels) {
+    printf("%s: %d channels, expected %d\n", name, adc.adc_channels,
+           channels);
+    lm_errors++;
+  }
+  lm_check_flt(name, adc.adc_ml, ml, channels, 1e-6f);
+  lm_check_flt(name, adc.adc_mr, mr, channels, 1e-6f);
+  audio_direct_cleanup(&adc);
+}
+
+
+/**
+ * Output format changes on the same decoder (as mac_audio.c does
+ * between tracks) must not reuse a FIFO sized for smaller samples
+ */
+static void
+lm_test_format_switch(void)
+{
+  static int16_t s16[4096 * 2];
+  static float l[4096], r[4096], out[4096 * 2];
+  audio_direct_t adc = {0};
+  uint8_t *data[2];
+  uint8_t *planes[1];
+
+  lm_fill(l, 4096, 10);
+  lm_fill(r, 4096, 11);
+
+  for(int round = 0; round < 2; round++) {
+    audio_direct_setup(&adc, AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 48000,
+                       AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 48000);
+    data[0] = (uint8_t *)s16;
+    audio_direct_convert(&adc, data, 4096);
+
+    audio_direct_setup(&adc, AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 48000,
+                       AV_SAMPLE_FMT_FLT, AV_CH_LAYOUT_STEREO, 48000);
+    data[0] = (uint8_t *)l;
+    data[1] = (uint8_t *)r;
+    audio_direct_convert(&adc, data, 4096);
+
+    planes[0] = (uint8_t *)out;
+    if(audio_direct_read(&adc, planes, 4096) != 4096) {
+      printf("format switch: short read\n");
+      lm_errors++;
+    }
+    for(int i = 0; i < 4096; i++) {
+      if(out[i * 2] != l[i] || out[i * 2 + 1] != r[i]) {
+        printf("format switch: mismatch at %d\n", i);
+        lm_errors++;
+        break;
+      }
+    }
+  }
+  audio_direct_cleanup(&adc);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  audio_direct_t adc = {0};
+
+  audio_convert_init();
+
+  lm_test_kernels(&audio_kernels_c);
+  if(audio_kernels.ak_flt_to_s16 != audio_kernels_c.ak_flt_to_s16 ||
+     audio_kernels.ak_downmix_flt != audio_kernels_c.ak_downmix_flt)
+    lm_test_kernels(&audio_kernels);
+
+  // FL FR FC LFE SL SR, normalized by 1 + 2 * sqrt(0.5)
+  const float ml51[6] = {0.41421356, 0, 0.29289322, 0, 0.29289322, 0};
+  const float mr51[6] = {0, 0.41421356, 0.29289322, 0, 0, 0.29289322};
+  lm_test_matrix("5.1", AV_CH_LAYOUT_5POINT1, 6, ml51, mr51);
+  lm_test_matrix("5.1(back)", AV_CH_LAYOUT_5POINT1_BACK, 6, ml51, mr51);
+
+  // FL FR FC LFE BL BR SL SR, normalized by 1 + 3 * sqrt(0.5)
+  const float ml71[8] = {0.32037724, 0, 0.22654092, 0,
+                         0.22654092, 0, 0.22654092, 0};
+  const float mr71[8] = {0, 0.32037724, 0.22654092, 0,
+                         0, 0.22654092, 0, 0.22654092};
+  lm_test_matrix("7.1", AV_CH_LAYOUT_7POINT1, 8, ml71, mr71);
+
+  // Two channels but not stereo must not be interleaved
+  if(!audio_direct_setup(&adc, AV_SAMPLE_FMT_FLTP,
+                         AV_CH_FRONT_CENTER | AV_CH_LOW_FREQUENCY, 48000,
+                         AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 48000)) {
+    printf("FC+LFE: accepted\n");
+    lm_errors++;
+  }
+  audio_direct_cleanup(&adc);
+
+  lm_test_format_switch();
+
+  printf("%s: %s\n", audio_kernels.ak_name, lm_errors ? "FAIL" : "OK");
+  return !!lm_errors;
+}
+#endif
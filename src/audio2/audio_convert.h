@@ -0,0 +1,99 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+/**
+ * Sample kernels used by the direct conversion path
+ *
+ * The scalar (_c) versions are the reference implementations. The SIMD
+ * versions must produce identical output (except for the last bit of
+ * the downmix if the compiler fuses the multiply-adds in the C version)
+ */
+typedef struct audio_kernels {
+  const char *ak_name;
+
+  // dst[i*2] = l[i], dst[i*2+1] = r[i]
+  void (*ak_interleave_flt)(float *dst, const float *l, const float *r,
+                            int num);
+
+  // dst[i*2] = sum(src[c][i] * ml[c]), dst[i*2+1] = sum(src[c][i] * mr[c])
+  void (*ak_downmix_flt)(float *dst, const float **src, int channels,
+                         const float *ml, const float *mr, int num);
+
+  // Same rounding and clipping as libavresample
+  void (*ak_flt_to_s16)(int16_t *dst, const float *src, int num);
+  void (*ak_flt_to_s32)(int32_t *dst, const float *src, int num);
+
+} audio_kernels_t;
+
+extern audio_kernels_t audio_kernels;
+
+extern const audio_kernels_t audio_kernels_c;
+
+void audio_convert_init(void);
+
+
+/**
+ * Direct conversion
+ *
+ * Used instead of libavresample when the sample rate does not change
+ * and the output is stereo. Converted samples are kept in a FIFO of
+ * interleaved output samples.
+ */
+typedef struct audio_direct {
+  int adc_channels;
+  enum AVSampleFormat adc_in_format;
+  enum AVSampleFormat adc_out_format;
+  int adc_sample_size;   // Bytes per output sample (all channels)
+
+  float adc_ml[8];       // Downmix matrix, left output
+  float adc_mr[8];       // Downmix matrix, right output
+
+  float *adc_mix;        // Interleaved stereo float scratch buffer
+  int adc_mix_size;      // In samples
+
+  uint8_t *adc_fifo;
+  int adc_fifo_rd;       // In samples
+  int adc_fifo_wr;       // In samples
+  int adc_fifo_size;     // In samples
+
+} audio_direct_t;
+
+int audio_direct_setup(audio_direct_t *adc,
+                       enum AVSampleFormat in_format, int64_t in_layout,
+                       int in_rate,
+                       enum AVSampleFormat out_format, int64_t out_layout,
+                       int out_rate);
+
+void audio_direct_convert(audio_direct_t *adc, uint8_t * const *data,
+                          int num);
+
+int audio_direct_read(audio_direct_t *adc, uint8_t **planes, int num);
+
+void audio_direct_cleanup(audio_direct_t *adc);
+
+static __inline int
+audio_direct_available(const audio_direct_t *adc)
+{
+  return adc->adc_fifo_wr - adc->adc_fifo_rd;
+}
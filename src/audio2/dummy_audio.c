@@ -17,11 +17,28 @@
  *  This program is also available under a commercial proprietary license.
  *  For more information, contact andreas@lonelycoder.com
  */
+#include <inttypes.h>
 #include <unistd.h>
 
 #include "main.h"
 #include "audio2/audio.h"
 #include "media/media.h"
+#include "backend/backend.h"
+#include "fileaccess/fa_audio.h"
+#include "event.h"
+
+#define DUMMY_RATE   48000
+#define DUMMY_BUFFER 4800 // 100ms of device buffer
+
+/**
+ * Virtual output device. It plays at DUMMY_RATE in wall clock time
+ * and counts every sample it had to play without having data (gap)
+ */
+static HTS_MUTEX_DECL(dummy_mutex);
+static int     dummy_running;
+static int64_t dummy_start;     // Wall clock time of sample 0
+static int64_t dummy_queued;    // Samples handed to the device
+static int64_t dummy_gap;       // Samples of silence due to underrun
 
 
 typedef struct decoder {
@@ -48,7 +65,7 @@ dummy_audio_reconfig(audio_decoder_t *ad)
   dummy_audio_fini(ad);
 
   ad->ad_out_sample_format = AV_SAMPLE_FMT_S16;
-  ad->ad_out_sample_rate = 48000;
+  ad->ad_out_sample_rate = DUMMY_RATE;
   ad->ad_out_channel_layout = AV_CH_LAYOUT_STEREO;
   ad->ad_tile_size = 1024;
 
@@ -56,14 +73,46 @@ dummy_audio_reconfig(audio_decoder_t *ad)
 }
 
 
+/**
+ *
+ */
+static int64_t
+dummy_played(int64_t now)
+{
+  return (now - dummy_start) * DUMMY_RATE / 1000000LL;
+}
+
+
 /**
  *
  */
 static int
 dummy_audio_deliver(audio_decoder_t *ad, int samples, int64_t pts, int epoch)
 {
-  int sleeptime = 1000000LL * samples / 48000;
-  usleep(sleeptime);
+  const int64_t now = arch_get_ts();
+  int64_t ahead;
+
+  audio_read(ad, NULL, samples);
+
+  hts_mutex_lock(&dummy_mutex);
+  if(!dummy_running) {
+    dummy_running = 1;
+    dummy_start = now;
+    dummy_queued = 0;
+  } else {
+    const int64_t played = dummy_played(now);
+    if(played > dummy_queued) {
+      // Device ran dry, it played silence for the difference
+      dummy_gap += played - dummy_queued;
+      dummy_start = now - dummy_queued * 1000000LL / DUMMY_RATE;
+    }
+  }
+  dummy_queued += samples;
+  ahead = dummy_queued - dummy_played(now);
+  hts_mutex_unlock(&dummy_mutex);
+
+  if(ahead > DUMMY_BUFFER)
+    usleep((ahead - DUMMY_BUFFER) * 1000000LL / DUMMY_RATE);
   return 0;
 }
 
@@ -74,6 +123,10 @@ dummy_audio_deliver(audio_decoder_t *ad, int samples, int64_t pts, int epoch)
 static void
 dummy_audio_pause(audio_decoder_t *ad)
 {
+  hts_mutex_lock(&dummy_mutex);
+  // Silence while paused is not a gap, restart the clock on play
+  dummy_running = 0;
+  hts_mutex_unlock(&dummy_mutex);
 }
 
 
@@ -92,6 +145,14 @@ dummy_audio_play(audio_decoder_t *ad)
 static void
 dummy_audio_flush(audio_decoder_t *ad)
 {
+  hts_mutex_lock(&dummy_mutex);
+  // Whatever is buffered in the device is dropped
+  if(dummy_running) {
+    const int64_t played = dummy_played(arch_get_ts());
+    if(dummy_queued > played)
+      dummy_queued = played;
+  }
+  hts_mutex_unlock(&dummy_mutex);
 }
 
 
@@ -114,8 +175,85 @@ static audio_class_t dummy_audio_class = {
  *
  */
 audio_class_t *
-audio_driver_init(struct prop *asettings)
+audio_dummy_init(struct prop *asettings)
 {
   return &dummy_audio_class;
 }
 
+
+/**
+ *
+ */
+static int64_t
+dummy_gap_get(void)
+{
+  hts_mutex_lock(&dummy_mutex);
+  int64_t r = dummy_gap;
+  hts_mutex_unlock(&dummy_mutex);
+  return r;
+}
+
+
+/**
+ * Play two tracks back to back the same way the playqueue does and
+ * check that the device never ran dry across the track change
+ */
+static void *
+gapless_test_thread(void *aux)
+{
+  const char **urls = aux;
+  media_pipe_t *mp = mp_create("gaplesstest", MP_PRIMABLE);
+  char errbuf[512];
+  int64_t gap = 0;
+  int rc = 1;
+  event_t *e;
+
+  for(int i = 0; i < 2; i++) {
+    mp_reset(mp);
+    mp_set_url(mp, urls[i], NULL, NULL);
+    mp_set_next_url(mp, i == 0 ? urls[1] : NULL, NULL);
+
+    // Startup of the first track is not a gap
+    if(i == 1)
+      gap = dummy_gap_get();
+
+    e = backend_play_audio(urls[i], mp, errbuf, sizeof(errbuf), 0, NULL);
+    if(e == NULL) {
+      TRACE(TRACE_ERROR, "gaplesstest", "Unable to play %s -- %s",
+            urls[i], errbuf);
+      goto done;
+    }
+    if(!event_is_type(e, EVENT_EOF)) {
+      TRACE(TRACE_ERROR, "gaplesstest", "%s did not play to end", urls[i]);
+      event_release(e);
+      goto done;
+    }
+    event_release(e);
+  }
+
+  gap = dummy_gap_get() - gap;
+  TRACE(gap ? TRACE_ERROR : TRACE_INFO, "gaplesstest",
+        "%"PRId64" samples (%d ms) of silence between tracks",
+        gap, (int)(gap * 1000 / DUMMY_RATE));
+  rc = gap != 0;
+
+ done:
+  audio_preroll_discard();
+  mp_set_url(mp, NULL, NULL, NULL);
+  mp_shutdown(mp);
+  mp_release(mp);
+  app_shutdown(rc);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+void
+audio_gapless_test_start(const char **urls)
+{
+  hts_thread_create_detached("gaplesstest", gapless_test_thread, urls,
+                             THREAD_PRIO_DEMUXER);
+}
+
@@ -34,6 +34,7 @@
 #include "image/pixmap.h"
 #include "htsmsg/htsmsg_json.h"
 #include "media/media.h"
+#include "fileaccess/fa_audio.h"
 #include "misc/minmax.h"
 
 #if ENABLE_PLUGINS
@@ -173,6 +174,11 @@ backend_play_audio(const char *url, struct media_pipe *mp,
     backend_release(be);
     return NULL;
   }
+
+  // Only the file backend can pick up a prerolled track
+  if(be->be_play_audio != be_file_playaudio)
+    audio_preroll_discard();
+
   event_t *e = be->be_play_audio(url, mp, errbuf, errlen, paused, mimetype,
                                  be->be_opaque);
   backend_release(be);
@@ -47,9 +47,23 @@ typedef struct ts_table {
 
 static const AVRational mpeg_tc = {1, 90000};
 
+#define TS_NUM_PIDS 8192
+
+// Amount of data read when probing for mux type
+#define TD_PROBE_SIZE 2048
+
+/**
+ * What a PID maps to, looked up for every TS packet
+ */
+typedef struct ts_pid {
+  struct ts_es *tp_es;
+  struct ts_service *tp_service;
+} ts_pid_t;
+
 typedef struct ts_demuxer {
   struct ts_service_list td_services;
   struct ts_es_list td_elemtary_streams;
+  ts_pid_t td_pids[TS_NUM_PIDS];
   ts_table_t td_pat;
   media_pipe_t *td_mp;
   hls_demuxer_t *td_hd;
@@ -62,7 +76,8 @@ typedef struct ts_demuxer {
     TD_MUX_MODE_RAW,
   } td_mux_mode;
 
-  uint8_t td_buf[2048];
+  // Transport streams are read and processed this many packets at a time
+  uint8_t td_buf[188 * 64];
   int td_buf_bytes;
 
 } ts_demuxer_t;
@@ -84,6 +99,7 @@ typedef struct ts_es {
   uint8_t *te_buf;
   int te_buf_size;
   int te_packet_size;
+  int te_pes_size; // From PES header, 0 if unbounded, -1 if done
 
   int te_data_type;
   int te_probe_frame;
@@ -132,8 +148,9 @@ td_flush_packets(ts_demuxer_t *td)
  *
  */
 static void
-te_destroy(ts_es_t *te)
+te_destroy(ts_demuxer_t *td, ts_es_t *te)
 {
+  td->td_pids[te->te_pid].tp_es = NULL;
   LIST_REMOVE(te, te_link);
   free(te->te_buf);
   if(te->te_codec != NULL)
@@ -146,8 +163,9 @@ te_destroy(ts_es_t *te)
  *
  */
 static void
-tss_destroy(ts_service_t *tss)
+tss_destroy(ts_demuxer_t *td, ts_service_t *tss)
 {
+  td->td_pids[tss->tss_pmtpid].tp_service = NULL;
   LIST_REMOVE(tss, tss_link);
   free(tss->tss_pmt.tt_data);
   free(tss);
@@ -166,10 +184,10 @@ ts_demuxer_destroy(ts_demuxer_t *td)
   td_flush_packets(td);
 
   while((te = LIST_FIRST(&td->td_elemtary_streams)) != NULL)
-    te_destroy(te);
+    te_destroy(td, te);
 
   while((tss = LIST_FIRST(&td->td_services)) != NULL)
-    tss_destroy(tss);
+    tss_destroy(td, tss);
 
   free(td->td_pat.tt_data);
 
@@ -265,16 +283,13 @@ parse_table(ts_table_t *tt, const uint8_t *tsb,
 static ts_service_t *
 find_service(ts_demuxer_t *td, uint16_t pmtpid, int create)
 {
-  ts_service_t *tss;
-  LIST_FOREACH(tss, &td->td_services, tss_link) {
-    if(tss->tss_pmtpid == pmtpid)
-      return tss;
-  }
-  if(create) {
+  ts_service_t *tss = td->td_pids[pmtpid].tp_service;
+  if(tss == NULL && create) {
     tss = calloc(1, sizeof(ts_service_t));
     tss->tss_demuxer = td;
     tss->tss_pmtpid = pmtpid;
     LIST_INSERT_HEAD(&td->td_services, tss, tss_link);
+    td->td_pids[pmtpid].tp_service = tss;
   }
   return tss;
 }
@@ -286,17 +301,14 @@ find_service(ts_demuxer_t *td, uint16_t pmtpid, int create)
 static ts_es_t *
 find_es(ts_demuxer_t *td, uint16_t pid, int create)
 {
-  ts_es_t *te;
-  LIST_FOREACH(te, &td->td_elemtary_streams, te_link) {
-    if(te->te_pid == pid)
-      return te;
-  }
-  if(create) {
+  ts_es_t *te = td->td_pids[pid].tp_es;
+  if(te == NULL && create) {
     te = calloc(1, sizeof(ts_es_t));
     te->te_pid = pid;
     te->te_pts = PTS_UNSET;
     te->te_dts = PTS_UNSET;
     LIST_INSERT_HEAD(&td->td_elemtary_streams, te, te_link);
+    td->td_pids[pid].tp_es = te;
   }
   return te;
 }
@@ -796,7 +808,7 @@ drain_parsers(ts_demuxer_t *td)
     if(te->te_codec != NULL)
       parse_data(td, NULL, te, NULL, 0);
 
-    te_destroy(te);
+    te_destroy(td, te);
   }
 }
 
@@ -852,27 +864,52 @@ process_es(ts_es_t *te, const uint8_t *tsb, ts_demuxer_t *td, hls_segment_t *hs)
   const uint8_t *data = tsb + off;
   int size            = 188 - off;
 
+  if(size <= 0)
+    return;
 
   if(pusi) {
-    if(te->te_buf != NULL)
+    if(te->te_packet_size) {
+      // Unbounded PES ends where the next one starts
       memset(te->te_buf + te->te_packet_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-    emit_packet(te, td, hs);
+      emit_packet(te, td, hs);
+    }
     te->te_packet_size = 0;
     te->te_current_seq = hs->hs_seq;
+
+    // Size the buffer for the entire PES upfront if the header tells us
+    te->te_pes_size = size >= 6 ? rd16_be(data + 4) : 0;
+    if(te->te_pes_size)
+      te->te_pes_size += 6;
+
+  } else if(te->te_pes_size < 0) {
+    return; // Junk after a complete PES
   }
 
-  if(te->te_packet_size + size > te->te_buf_size) {
-    te->te_buf_size = te->te_buf_size * 2 + size;
+  const int need = MAX(te->te_packet_size + size, te->te_pes_size);
+
+  if(need > te->te_buf_size) {
+    // A bounded PES gets all of its space at once
+    te->te_buf_size = MAX(need, te->te_buf_size * 2 + size);
     te->te_buf = myreallocf(te->te_buf,
                             te->te_buf_size + FF_INPUT_BUFFER_PADDING_SIZE);
     if(te->te_buf == NULL) {
       te->te_buf_size = 0;
+      te->te_packet_size = 0;
       return;
     }
   }
 
   memcpy(te->te_buf + te->te_packet_size, data, size);
   te->te_packet_size += size;
+
+  if(te->te_pes_size > 0 && te->te_packet_size >= te->te_pes_size) {
+    // Complete, no need to wait for the next PES to start
+    te->te_packet_size = te->te_pes_size;
+    memset(te->te_buf + te->te_packet_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    emit_packet(te, td, hs);
+    te->te_packet_size = 0;
+    te->te_pes_size = -1;
+  }
 }
 
 
@@ -882,32 +919,37 @@ process_es(ts_es_t *te, const uint8_t *tsb, ts_demuxer_t *td, hls_segment_t *hs)
 static void
 process_tsb(ts_demuxer_t *td, const uint8_t *tsb, hls_segment_t *hs)
 {
-  ts_service_t *tss;
-  ts_es_t *te;
   if(tsb[0] != 0x47)
     return;
 
   const unsigned int pid = (tsb[1] & 0x1f) << 8 | tsb[2];
+  const ts_pid_t *tp = &td->td_pids[pid];
 
-  LIST_FOREACH(te, &td->td_elemtary_streams, te_link) {
-    if(pid == te->te_pid) {
-      process_es(te, tsb, td, hs);
-      return;
-    }
+  if(tp->tp_es != NULL) {
+    process_es(tp->tp_es, tsb, td, hs);
+  } else if(tp->tp_service != NULL) {
+    parse_table(&tp->tp_service->tss_pmt, tsb, handle_pmt, tp->tp_service);
+  } else if(pid == 0) {
+    parse_table(&td->td_pat, tsb, handle_pat, td);
   }
+}
 
 
-  LIST_FOREACH(tss, &td->td_services, tss_link) {
-    if(pid == tss->tss_pmtpid) {
-      parse_table(&tss->tss_pmt, tsb, handle_pmt, tss);
-      return;
-    }
-  }
+/**
+ * Process all complete TS packets in td_buf starting at 'offset' and
+ * move the remainder to the start of the buffer
+ */
+static void
+process_tsbs(ts_demuxer_t *td, int offset, hls_segment_t *hs)
+{
+  const uint8_t *tsb = td->td_buf + offset;
+  const uint8_t *end = td->td_buf + td->td_buf_bytes;
 
-  if(pid == 0) {
-    parse_table(&td->td_pat, tsb, handle_pat, td);
-    return;
-  }
+  for(; tsb + 188 <= end; tsb += 188)
+    process_tsb(td, tsb, hs);
+
+  td->td_buf_bytes = end - tsb;
+  memmove(td->td_buf, tsb, td->td_buf_bytes);
 }
 
 
@@ -960,6 +1002,7 @@ hls_ts_demuxer_flush(hls_variant_t *hv)
     mc->parser_ctx = av_parser_init(mc->codec_id);
 
     te->te_packet_size = 0;
+    te->te_pes_size = -1;
     te->te_pts = PTS_UNSET;
     te->te_dts = PTS_UNSET;
     te->te_last_seq = 0;
@@ -1206,10 +1249,10 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
       HLS_TRACE(h, "Probing variant %s, sequence %d",
                 hv->hv_name, hs->hs_seq);
 
-      while(td->td_buf_bytes < sizeof(td->td_buf)) {
+      while(td->td_buf_bytes < TD_PROBE_SIZE) {
         r = fa_read(hs->hs_fh,
                     td->td_buf + td->td_buf_bytes,
-                    sizeof(td->td_buf) - td->td_buf_bytes);
+                    TD_PROBE_SIZE - td->td_buf_bytes);
 
         if(cancellable_is_cancelled(hd->hd_cancellable))
           return NULL;
@@ -1226,27 +1269,19 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
       // Search stream for TS mux lock, we want two continous packets
 
       int i;
-      for(i = 0; i < sizeof(td->td_buf) - 188 * 2; i++)
+      for(i = 0; i < TD_PROBE_SIZE - 188 * 2; i++)
         if(td->td_buf[i] == 0x47 &&
            td->td_buf[i + 188] == 0x47 &&
            td->td_buf[i + 188 * 2] == 0x47)
           break;
 
-      if(i != sizeof(td->td_buf) - 188 * 2) {
+      if(i != TD_PROBE_SIZE - 188 * 2) {
 
         td->td_mux_mode = TD_MUX_MODE_TS;
         HLS_TRACE(h, "Variant %s is a transport stream", hv->hv_name);
 
-        while(i <= sizeof(td->td_buf) - 188) {
-          process_tsb(td, td->td_buf + i, hs);
-          i += 188;
-        }
-
-        int spill = sizeof(td->td_buf) - i;
-        assert(spill < 188);
-
-        td->td_buf_bytes = spill;
-        memmove(td->td_buf, td->td_buf + i, spill);
+        process_tsbs(td, i, hs);
+        assert(td->td_buf_bytes < 188);
         break;
       }
 
@@ -1256,7 +1291,7 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
         return NULL;
       }
 
-      if(probe_non_muxed(td, td->td_buf, sizeof(td->td_buf), hs)) {
+      if(probe_non_muxed(td, td->td_buf, TD_PROBE_SIZE, hs)) {
         hls_bad_variant(hv, HLS_ERROR_VARIANT_UNKNOWN_AUDIO);
         return NULL;
       }
@@ -1266,7 +1301,7 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
       break;
 
     case TD_MUX_MODE_RAW:
-      r = fa_read(hs->hs_fh, td->td_buf, sizeof(td->td_buf));
+      r = fa_read(hs->hs_fh, td->td_buf, TD_PROBE_SIZE);
 
       if(cancellable_is_cancelled(hd->hd_cancellable))
         return NULL;
@@ -1288,7 +1323,7 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
       assert(td->td_buf_bytes < 188);
       r = fa_read(hs->hs_fh,
                   td->td_buf + td->td_buf_bytes,
-                  188 - td->td_buf_bytes);
+                  sizeof(td->td_buf) - td->td_buf_bytes);
 
       if(cancellable_is_cancelled(hd->hd_cancellable))
         return NULL;
@@ -1304,10 +1339,7 @@ hls_ts_demuxer_read(hls_demuxer_t *hd)
       td->td_buf_bytes += r;
       hd->hd_download_counter += r;
 
-      if(td->td_buf_bytes == 188) {
-        td->td_buf_bytes = 0;
-        process_tsb(td, td->td_buf, hs);
-      }
+      process_tsbs(td, 0, hs);
       break;
     }
   }
@@ -70,13 +70,361 @@ static const char *domain_to_name[] = {
   [KVSTORE_DOMAIN_SETTING] = "setting"
 };
 
+/**
+ * Read cache
+ *
+ * Values read from the database are cached per URL so decorating a
+ * list doesn't cost a couple of queries per item. A URL can be marked
+ * complete (see kv_url_opt_prefetch()) meaning all its keys in that
+ * domain are loaded and a key not found is known to be unset.
+ *
+ * Protected by deferred_mutex. Pending writes in deferred_writes take
+ * precedence over the cache and are written through to it once they
+ * have been flushed. Every modification bumps kvcache_generation so a
+ * fill from a database read that raced with a flush is dropped instead
+ * of inserting a stale value.
+ */
+
+#define KVCACHE_HASH_SIZE      1021
+#define KVCACHE_MAX_URLS       8192
+#define KVCACHE_PREFETCH_BATCH 100
+
+typedef struct kvcache_value {
+  int kv_type;  // KVSTORE_SET_INT is stored as KVSTORE_SET_INT64
+  int64_t kv_int64;
+  rstr_t *kv_string;
+} kvcache_value_t;
+
+LIST_HEAD(kvcache_key_list, kvcache_key);
+LIST_HEAD(kvcache_url_list, kvcache_url);
+TAILQ_HEAD(kvcache_url_queue, kvcache_url);
+
+typedef struct kvcache_key {
+  LIST_ENTRY(kvcache_key) kck_link;
+  char *kck_key;
+  kvcache_value_t kck_value;
+} kvcache_key_t;
+
+typedef struct kvcache_url {
+  LIST_ENTRY(kvcache_url) kcu_hash_link;
+  TAILQ_ENTRY(kvcache_url) kcu_lru_link;
+  struct kvcache_key_list kcu_keys;
+  char *kcu_url;
+  int kcu_domain;
+  int kcu_complete;
+} kvcache_url_t;
+
+static struct kvcache_url_list kvcache_hash[KVCACHE_HASH_SIZE];
+static struct kvcache_url_queue kvcache_lru;
+static int kvcache_num_urls;
+static int kvcache_generation;
+static int kvcache_hits;
+static int kvcache_misses;
+
+
+/**
+ *
+ */
+static void
+kvcache_value_from_write(kvcache_value_t *kv, const kvstore_write_t *kw)
+{
+  kv->kv_type = kw->kw_type;
+  kv->kv_int64 = 0;
+  kv->kv_string = NULL;
+
+  switch(kw->kw_type) {
+  case KVSTORE_SET_INT:
+    kv->kv_type = KVSTORE_SET_INT64;
+    kv->kv_int64 = kw->kw_int;
+    break;
+
+  case KVSTORE_SET_INT64:
+    kv->kv_int64 = kw->kw_int64;
+    break;
+
+  case KVSTORE_SET_STRING:
+    kv->kv_string = rstr_alloc(kw->kw_string);
+    break;
+
+  default:
+    kv->kv_type = KVSTORE_SET_VOID;
+    break;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+kvcache_value_from_column(kvcache_value_t *kv, sqlite3_stmt *stmt, int col)
+{
+  kv->kv_int64 = 0;
+  kv->kv_string = NULL;
+
+  switch(sqlite3_column_type(stmt, col)) {
+  case SQLITE_INTEGER:
+    kv->kv_type = KVSTORE_SET_INT64;
+    kv->kv_int64 = sqlite3_column_int64(stmt, col);
+    break;
+
+  case SQLITE_NULL:
+    kv->kv_type = KVSTORE_SET_VOID;
+    break;
+
+  default:
+    kv->kv_type = KVSTORE_SET_STRING;
+    kv->kv_string = db_rstr(stmt, col);
+    break;
+  }
+}
+
+
+/**
+ *
+ */
+static rstr_t *
+kvcache_value_rstr(const kvcache_value_t *kv)
+{
+  char vtmp[32];
+
+  switch(kv->kv_type) {
+  case KVSTORE_SET_INT64:
+    snprintf(vtmp, sizeof(vtmp), "%"PRId64, kv->kv_int64);
+    return rstr_alloc(vtmp);
+
+  case KVSTORE_SET_STRING:
+    return rstr_dup(kv->kv_string);
+
+  default:
+    return NULL;
+  }
+}
+
+
+/**
+ *
+ */
+static int64_t
+kvcache_value_int64(const kvcache_value_t *kv, int64_t def)
+{
+  switch(kv->kv_type) {
+  case KVSTORE_SET_INT64:
+    return kv->kv_int64;
+
+  case KVSTORE_SET_STRING:
+    return strtoll(rstr_get(kv->kv_string), NULL, 10);
+
+  default:
+    return def;
+  }
+}
+
+
+/**
+ *
+ */
+static kvcache_url_t *
+kvcache_url_find(const char *url, int domain)
+{
+  kvcache_url_t *kcu;
+  const unsigned int hash = mystrhash(url) % KVCACHE_HASH_SIZE;
+
+  LIST_FOREACH(kcu, &kvcache_hash[hash], kcu_hash_link)
+    if(kcu->kcu_domain == domain && !strcmp(kcu->kcu_url, url))
+      return kcu;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static kvcache_key_t *
+kvcache_key_find(kvcache_url_t *kcu, const char *key)
+{
+  kvcache_key_t *kck;
+  LIST_FOREACH(kck, &kcu->kcu_keys, kck_link)
+    if(!strcmp(kck->kck_key, key))
+      return kck;
+  return NULL;
+}
+
+
+/**
+ * Set value of key, takes ownership of the value
+ */
+static void
+kvcache_key_set(kvcache_url_t *kcu, const char *key, const kvcache_value_t *kv)
+{
+  kvcache_key_t *kck = kvcache_key_find(kcu, key);
+
+  if(kck == NULL) {
+    kck = malloc(sizeof(kvcache_key_t));
+    kck->kck_key = strdup(key);
+    LIST_INSERT_HEAD(&kcu->kcu_keys, kck, kck_link);
+  } else {
+    rstr_release(kck->kck_value.kv_string);
+  }
+  kck->kck_value = *kv;
+}
+
+
+/**
+ *
+ */
+static kvcache_url_t *
+kvcache_url_alloc(const char *url, int domain)
+{
+  kvcache_url_t *kcu = calloc(1, sizeof(kvcache_url_t));
+  kcu->kcu_url = strdup(url);
+  kcu->kcu_domain = domain;
+  return kcu;
+}
+
+
+/**
+ *
+ */
+static void
+kvcache_url_free(kvcache_url_t *kcu)
+{
+  kvcache_key_t *kck;
+
+  while((kck = LIST_FIRST(&kcu->kcu_keys)) != NULL) {
+    LIST_REMOVE(kck, kck_link);
+    rstr_release(kck->kck_value.kv_string);
+    free(kck->kck_key);
+    free(kck);
+  }
+  free(kcu->kcu_url);
+  free(kcu);
+}
+
+
+/**
+ *
+ */
+static void
+kvcache_url_destroy(kvcache_url_t *kcu)
+{
+  LIST_REMOVE(kcu, kcu_hash_link);
+  TAILQ_REMOVE(&kvcache_lru, kcu, kcu_lru_link);
+  kvcache_num_urls--;
+  kvcache_url_free(kcu);
+}
+
+
+/**
+ * Insert URL into cache, replacing any existing entry
+ */
+static void
+kvcache_url_link(kvcache_url_t *kcu)
+{
+  kvcache_url_t *old = kvcache_url_find(kcu->kcu_url, kcu->kcu_domain);
+  if(old != NULL)
+    kvcache_url_destroy(old);
+  else if(kvcache_num_urls >= KVCACHE_MAX_URLS)
+    kvcache_url_destroy(TAILQ_FIRST(&kvcache_lru));
+
+  const unsigned int hash = mystrhash(kcu->kcu_url) % KVCACHE_HASH_SIZE;
+  LIST_INSERT_HEAD(&kvcache_hash[hash], kcu, kcu_hash_link);
+  TAILQ_INSERT_TAIL(&kvcache_lru, kcu, kcu_lru_link);
+  kvcache_num_urls++;
+}
+
+
+/**
+ *
+ */
+static kvcache_url_t *
+kvcache_url_get(const char *url, int domain)
+{
+  kvcache_url_t *kcu = kvcache_url_find(url, domain);
+  if(kcu == NULL) {
+    kcu = kvcache_url_alloc(url, domain);
+    kvcache_url_link(kcu);
+  }
+  return kcu;
+}
+
+
+/**
+ * Returns 0 if found in cache. Value is a copy owned by caller
+ */
+static int
+kvcache_lookup(const char *url, int domain, const char *key,
+               kvcache_value_t *kv)
+{
+  kvcache_url_t *kcu = kvcache_url_find(url, domain);
+  if(kcu == NULL)
+    return -1;
+
+  kvcache_key_t *kck = kvcache_key_find(kcu, key);
+  if(kck != NULL) {
+    *kv = kck->kck_value;
+    kv->kv_string = rstr_dup(kv->kv_string);
+  } else if(kcu->kcu_complete) {
+    kv->kv_type = KVSTORE_SET_VOID;
+    kv->kv_int64 = 0;
+    kv->kv_string = NULL;
+  } else {
+    return -1;
+  }
+
+  TAILQ_REMOVE(&kvcache_lru, kcu, kcu_lru_link);
+  TAILQ_INSERT_TAIL(&kvcache_lru, kcu, kcu_lru_link);
+  return 0;
+}
+
+
+/**
+ * Update cache with a write that has been stored
+ */
+static void
+kvcache_write(const kvstore_write_t *kw)
+{
+  kvcache_value_t kv;
+
+  kvcache_generation++;
+  kvcache_url_t *kcu = kvcache_url_find(kw->kw_url, kw->kw_domain);
+  if(kcu == NULL)
+    return;
+
+  kvcache_value_from_write(&kv, kw);
+  kvcache_key_set(kcu, kw->kw_key, &kv);
+}
+
+
+/**
+ *
+ */
+static void
+kvcache_invalidate(const char *url, int domain)
+{
+  kvcache_generation++;
+  kvcache_url_t *kcu = kvcache_url_find(url, domain);
+  if(kcu != NULL)
+    kvcache_url_destroy(kcu);
+}
+
+
 /**
  *
  */
 void
 kvstore_fini(void)
 {
+  kvcache_url_t *kcu;
+
   db_pool_close(kvstore_pool);
+
+  hts_mutex_lock(&deferred_mutex);
+  TRACE(TRACE_DEBUG, "kvstore", "Read cache: %d hits, %d misses",
+        kvcache_hits, kvcache_misses);
+  while((kcu = TAILQ_FIRST(&kvcache_lru)) != NULL)
+    kvcache_url_destroy(kcu);
+  hts_mutex_unlock(&deferred_mutex);
 }
 
 
@@ -110,6 +458,7 @@ kvstore_init(void)
   char buf[256];
 
   hts_mutex_init(&deferred_mutex);
+  TAILQ_INIT(&kvcache_lru);
 
   snprintf(buf, sizeof(buf), "%s/kvstore", gconf.persistent_path);
   fa_makedir(buf);
@@ -323,6 +672,10 @@ kv_value_cb(void *opaque, prop_event_t event, ...)
     }
     db_commit(db);
     kvstore_close(db);
+
+    hts_mutex_lock(&deferred_mutex);
+    kvcache_invalidate(rstr_get(kpbv->kpbv_url), KVSTORE_DOMAIN_PROP);
+    hts_mutex_unlock(&deferred_mutex);
     break;
 
   default:
@@ -553,6 +906,179 @@ opt_get_ea(const char *url, int domain, const char *key,
 }
 
 
+/**
+ *
+ */
+static void
+kv_trace_get(const char *src, const char *url, int domain, const char *key,
+             const kvcache_value_t *kv)
+{
+  rstr_t *r = kvcache_value_rstr(kv);
+  TRACE(TRACE_DEBUG, "kvstore", "GET %s url=%s key=%s domain=%d value=%s",
+        src, url, key, domain, r ? rstr_get(r) : "UNSET");
+  rstr_release(r);
+}
+
+
+/**
+ * Get value from cache or database. Value is owned by caller
+ */
+static void
+kv_url_opt_lookup(const char *url, int domain, const char *key,
+                  kvcache_value_t *kv)
+{
+  hts_mutex_lock(&deferred_mutex);
+  if(!kvcache_lookup(url, domain, key, kv)) {
+    kvcache_hits++;
+    hts_mutex_unlock(&deferred_mutex);
+    if(gconf.enable_kvstore_debug)
+      kv_trace_get("CACHE", url, domain, key, kv);
+    return;
+  }
+  kvcache_misses++;
+  const int generation = kvcache_generation;
+  hts_mutex_unlock(&deferred_mutex);
+
+  kv->kv_type = KVSTORE_SET_VOID;
+  kv->kv_int64 = 0;
+  kv->kv_string = NULL;
+
+  void *db = kvstore_get();
+  if(db == NULL)
+    return;
+
+  sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
+  if(stmt != NULL) {
+    kvcache_value_from_column(kv, stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  kvstore_close(db);
+
+  if(gconf.enable_kvstore_debug)
+    kv_trace_get("DB", url, domain, key, kv);
+
+  hts_mutex_lock(&deferred_mutex);
+  if(generation == kvcache_generation) {
+    kvcache_value_t copy = *kv;
+    copy.kv_string = rstr_dup(kv->kv_string);
+    kvcache_key_set(kvcache_url_get(url, domain), key, &copy);
+  }
+  hts_mutex_unlock(&deferred_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+kv_url_opt_prefetch_batch(void *db, const char **urls, int num_urls,
+                          int domain, int generation)
+{
+  kvcache_url_t *kcus[KVCACHE_PREFETCH_BATCH];
+  char sql[256 + KVCACHE_PREFETCH_BATCH * 2];
+  sqlite3_stmt *stmt;
+  kvcache_value_t kv;
+  int i, rc;
+
+  snprintf(sql, sizeof(sql),
+           "SELECT url, key, value "
+           "FROM url, url_kv "
+           "WHERE domain = ?1 "
+           "AND url.id = url_id "
+           "AND url IN (");
+
+  for(i = 0; i < num_urls; i++)
+    strcat(sql, i ? ",?" : "?");
+  strcat(sql, ")");
+
+  rc = db_prepare(db, &stmt, sql);
+  if(rc != SQLITE_OK)
+    return;
+
+  sqlite3_bind_int(stmt, 1, domain);
+  for(i = 0; i < num_urls; i++) {
+    sqlite3_bind_text(stmt, i + 2, urls[i], -1, SQLITE_STATIC);
+    kcus[i] = kvcache_url_alloc(urls[i], domain);
+    kcus[i]->kcu_complete = 1;
+  }
+
+  i = 0;
+  while((rc = db_step(stmt)) == SQLITE_ROW) {
+    const char *url = (const char *)sqlite3_column_text(stmt, 0);
+    const char *key = (const char *)sqlite3_column_text(stmt, 1);
+
+    // Rows for the same URL tend to come together
+    if(strcmp(kcus[i]->kcu_url, url)) {
+      for(i = 0; i < num_urls; i++)
+        if(!strcmp(kcus[i]->kcu_url, url))
+          break;
+      if(i == num_urls) {
+        i = 0;
+        continue;
+      }
+    }
+
+    kvcache_value_from_column(&kv, stmt, 2);
+    kvcache_key_set(kcus[i], key, &kv);
+  }
+  sqlite3_finalize(stmt);
+
+  hts_mutex_lock(&deferred_mutex);
+  // If anything was written while we were reading, drop the result
+  const int ok = rc == SQLITE_DONE && generation == kvcache_generation;
+  for(i = 0; i < num_urls; i++) {
+    if(ok)
+      kvcache_url_link(kcus[i]);
+    else
+      kvcache_url_free(kcus[i]);
+  }
+  hts_mutex_unlock(&deferred_mutex);
+}
+
+
+/**
+ * Load all keys in the given domain for a set of URLs into the read
+ * cache. Intended to be called before binding a directory's items so
+ * their per item lookups don't need to hit the database
+ */
+void
+kv_url_opt_prefetch(const char **urls, int num_urls, int domain)
+{
+  const char *batch[KVCACHE_PREFETCH_BATCH];
+  int i = 0;
+
+  // No point in loading more than we can keep
+  if(num_urls > KVCACHE_MAX_URLS)
+    num_urls = KVCACHE_MAX_URLS;
+
+  void *db = kvstore_get();
+  if(db == NULL)
+    return;
+
+  while(i < num_urls) {
+    int n = 0;
+
+    hts_mutex_lock(&deferred_mutex);
+    for(; i < num_urls && n < KVCACHE_PREFETCH_BATCH; i++) {
+      const kvcache_url_t *kcu = kvcache_url_find(urls[i], domain);
+      if(kcu == NULL || !kcu->kcu_complete)
+        batch[n++] = urls[i];
+    }
+    const int generation = kvcache_generation;
+    hts_mutex_unlock(&deferred_mutex);
+
+    if(n > 0)
+      kv_url_opt_prefetch_batch(db, batch, n, domain, generation);
+  }
+  kvstore_close(db);
+
+  if(gconf.enable_kvstore_debug)
+    TRACE(TRACE_DEBUG, "kvstore",
+          "Prefetched %d URLs, cache: %d URLs, %d hits, %d misses",
+          num_urls, kvcache_num_urls, kvcache_hits, kvcache_misses);
+}
+
+
 /**
  *
  */
@@ -604,21 +1130,10 @@ kv_url_opt_get_rstr(const char *url, int domain, const char *key)
     return rval;
   }
 
-  void *db = kvstore_get();
-  sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
-  rstr_t *r = NULL;
-  if(stmt) {
-    r = db_rstr(stmt, 0);
-    sqlite3_finalize(stmt);
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore","GET DB url=%s key=%s domain=%d value=%s",
-            url, key, domain, rstr_get(r));
-  } else {
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore","GET DB url=%s key=%s domain=%d value=UNSET",
-            url, key, domain);
-  }
-  kvstore_close(db);
+  kvcache_value_t kv;
+  kv_url_opt_lookup(url, domain, key, &kv);
+  rstr_t *r = kvcache_value_rstr(&kv);
+  rstr_release(kv.kv_string);
   return r;
 }
 
@@ -674,21 +1189,10 @@ kv_url_opt_get_int(const char *url, int domain, const char *key, int def)
     return rval;
   }
 
-  void *db = kvstore_get();
-  sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
-  int v = def;
-  if(stmt) {
-    v = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore","GET DB url=%s key=%s domain=%d value=%d",
-            url, key, domain, v);
-  } else {
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore","GET DB url=%s key=%s domain=%d value=UNSET",
-            url, key, domain);
-  }
-  kvstore_close(db);
+  kvcache_value_t kv;
+  kv_url_opt_lookup(url, domain, key, &kv);
+  int v = kvcache_value_int64(&kv, def);
+  rstr_release(kv.kv_string);
   return v;
 }
 
@@ -757,22 +1261,10 @@ kv_url_opt_get_int64(const char *url, int domain, const char *key, int64_t def)
   }
 
 
-  void *db = kvstore_get();
-  sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
-  int64_t v = def;
-  if(stmt) {
-    v = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore",
-            "GET DB url=%s key=%s domain=%d value=%"PRId64,
-            url, key, domain, v);
-  } else {
-    if(gconf.enable_kvstore_debug)
-      TRACE(TRACE_DEBUG, "kvstore","GET DB url=%s key=%s domain=%d value=UNSET",
-            url, key, domain);
-  }
-  kvstore_close(db);
+  kvcache_value_t kv;
+  kv_url_opt_lookup(url, domain, key, &kv);
+  int64_t v = kvcache_value_int64(&kv, def);
+  rstr_release(kv.kv_string);
   return v;
 }
 
@@ -819,7 +1311,7 @@ kv_write_db(void *db, const kvstore_write_t *kw, int64_t id)
       break;
 
     case KVSTORE_SET_INT64:
-      sqlite3_bind_int(stmt, 4, kw->kw_int64);
+      sqlite3_bind_int64(stmt, 4, kw->kw_int64);
       snprintf(vtmp, sizeof(vtmp), "%"PRId64, kw->kw_int64);
       break;
 
@@ -921,6 +1413,7 @@ kvstore_deferred_flush(void)
   int rc;
   uint64_t id = 0;
   const char *current_url;
+  int stored = 0;
 
   db = kvstore_get();
   if(db == NULL)
@@ -972,12 +1465,20 @@ kvstore_deferred_flush(void)
     }
   }
 
-  db_commit(db);
+  stored = !db_commit(db);
 
  err:
 
   while((kw = LIST_FIRST(&deferred_writes)) != NULL) {
     LIST_REMOVE(kw, kw_link);
+    if(!stored
+#ifdef STOS
+       || kw->kw_unimportant
+#endif
+       )
+      kvcache_invalidate(kw->kw_url, kw->kw_domain);
+    else
+      kvcache_write(kw);
     free(kw->kw_url);
     free(kw->kw_key);
     if(kw->kw_type == KVSTORE_SET_STRING)
@@ -1104,6 +1605,11 @@ kv_url_opt_set(const char *url, int domain, const char *key,
 }
 
 
+void
+kv_url_opt_prefetch(const char **urls, int num_urls, int domain)
+{
+}
+
 void
 kvstore_deferred_flush(void)
 {
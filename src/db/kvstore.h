@@ -41,6 +41,8 @@ int kv_url_opt_get_int(const char *url, int domain, const char *key, int def);
 int64_t kv_url_opt_get_int64(const char *url, int domain,
                              const char *key, int64_t def);
 
+void kv_url_opt_prefetch(const char **urls, int num_urls, int domain);
+
 #define KVSTORE_SET_STRING 1
 #define KVSTORE_SET_INT    2
 #define KVSTORE_SET_VOID   3
@@ -33,6 +33,12 @@ static HTS_MUTEX_DECL(es_context_mutex);
 
 static LIST_HEAD(, ecmascript_module) modules;
 
+// Run GC when this much (or half the current heap size) has been allocated
+#define ES_GC_MIN_BYTES (1024 * 1024)
+
+// ... or when the context has been idle for this long
+#define ES_GC_IDLE_DELAY 2000000
+
 ES_NATIVE_CLASS(resource, &es_resource_release);
 
 
@@ -383,23 +389,44 @@ static const duk_function_list_entry fnlist_core[] = {
 
 
 /**
+ * Load, compile (or fetch from bytecode cache) and run a module
  *
+ * Duktape's require() can only compile modules itself, so we create
+ * and invoke the module wrapper function here instead, in the same
+ * way require() would have. modSearch() then returns undefined and
+ * require() just picks up module.exports
  */
 static int
-tryload(duk_context *ctx, const char *path, const char *id, es_context_t *ec)
+tryload(duk_context *ctx, const char *path, const char *id, es_context_t *ec,
+        const char *resolved_id)
 {
   char errbuf[256];
   buf_t *buf = fa_load(path,
                        FA_LOAD_ERRBUF(errbuf, sizeof(errbuf)),
                        NULL);
 
-  if(buf != NULL) {
-    es_debug(ec, "Module %s loaded from %s", id, path);
-    duk_push_lstring(ctx, buf_cstr(buf), buf_len(buf));
-    buf_release(buf);
-    return 1;
-  }
-  return 0;
+  if(buf == NULL)
+    return 0;
+
+  es_debug(ec, "Module %s loaded from %s", id, path);
+  int r = es_compile_cached(ec, ctx, resolved_id, buf_cstr(buf),
+                            buf_len(buf), ES_COMPILE_MODULE);
+  buf_release(buf);
+  if(r)
+    duk_throw(ctx);
+
+  // Name the wrapper after last component of the module id
+  const char *name = strrchr(resolved_id, '/');
+  duk_push_string(ctx, "name");
+  duk_push_string(ctx, name ? name + 1 : resolved_id);
+  duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_VALUE | DUK_DEFPROP_FORCE);
+
+  duk_dup(ctx, 2);                       // this = exports
+  duk_dup(ctx, 1);                       // require
+  duk_get_prop_string(ctx, 3, "exports"); // exports
+  duk_dup(ctx, 3);                       // module
+  duk_call_method(ctx, 3);
+  return 1;
 }
 
 /**
@@ -412,6 +439,7 @@ es_modsearch(duk_context *ctx)
 
   es_context_t *ec = es_get(ctx);
   const char *id = duk_require_string(ctx, 0);
+  const char *resolved_id = id;
 
   es_debug(ec, "Searching for module %s", id);
 
@@ -443,14 +471,14 @@ es_modsearch(duk_context *ctx)
   if(ec->ec_path != NULL) {
     fa_pathjoin(path, sizeof(path)-4, ec->ec_path, id);
     strcat(path, ".js");
-    if(tryload(ctx, path, id, ec))
-      return 1;
+    if(tryload(ctx, path, id, ec, resolved_id))
+      return 0;
   }
 
   snprintf(path, sizeof(path),
            "dataroot://res/ecmascript/modules/%s.js", id);
-  if(tryload(ctx, path, id, ec))
-    return 1;
+  if(tryload(ctx, path, id, ec, resolved_id))
+    return 0;
 
   duk_error(ctx, DUK_ERR_ERROR, "Can't find module %s", id);
 }
@@ -516,59 +544,6 @@ es_create_env(es_context_t *ec, const char *loaddir, const char *storage)
 }
 
 
-/**
- *
- */
-static void *
-es_mem_alloc(void *udata, duk_size_t size)
-{
-  es_context_t *ec = udata;
-  void *p = malloc(size);
-
-  if(p != NULL) {
-    ec->ec_mem_active += arch_malloc_size(p);
-    ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
-  }
-  return p;
-}
-
-
-/**
- *
- */
-static void *
-es_mem_realloc(void *udata, void *ptr, duk_size_t size)
-{
-  es_context_t *ec = udata;
-  size_t prev = 0;
-
-  if(udata != NULL)
-    prev = arch_malloc_size(ptr);
-
-  ptr = realloc(ptr, size);
-  if(ptr != NULL) {
-    ec->ec_mem_active -= prev;
-    ec->ec_mem_active += arch_malloc_size(ptr);
-    ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
-  }
-  return ptr;
-}
-
-
-/**
- *
- */
-static void
-es_mem_free(void *udata, void *ptr)
-{
-  es_context_t *ec = udata;
-  if(ptr == NULL)
-    return;
-  ec->ec_mem_active -= arch_malloc_size(ptr);
-  free(ptr);
-}
-
-
 /**
  *
  */
@@ -614,6 +589,9 @@ es_context_create(const char *id, int flags, const char *url,
 
   ec->ec_prop_dispatch_group = prop_dispatch_group_create();
 
+  if(es_mem_init(ec, ES_MEM_LIMIT_DEFAULT))
+    TRACE(TRACE_ERROR, id, "Unable to create memory arena");
+
   ec->ec_duk = duk_create_heap(es_mem_alloc, es_mem_realloc, es_mem_free,
                                ec, NULL);
 
@@ -707,6 +685,73 @@ es_context_resume(es_context_t *ec, duk_context *ctx, duk_thread_state *state)
 }
 
 
+/**
+ * Run a full mark-and-sweep. Caller must hold ec_mutex
+ */
+void
+es_context_gc(es_context_t *ec)
+{
+  if(ec->ec_duk == NULL)
+    return;
+
+  const int64_t ts = arch_get_ts();
+  duk_gc(ec->ec_duk, 0);
+  es_mem_trim(ec);
+  const int pause = arch_get_ts() - ts;
+
+  ec->ec_mem_alloc_since_gc = 0;
+  ec->ec_gc_runs++;
+  ec->ec_gc_time += pause;
+  ec->ec_gc_max_pause = MAX(ec->ec_gc_max_pause, pause);
+}
+
+
+/**
+ * Deferred GC, runs once the context has been idle for a while
+ */
+static void
+es_context_gc_idle(callout_t *c, void *aux)
+{
+  es_context_t *ec = aux;
+
+  if(ec->ec_duk == NULL || ec->ec_mem_alloc_since_gc == 0)
+    return;
+
+  const int64_t idle = arch_get_ts() - ec->ec_last_activity;
+  if(idle < ES_GC_IDLE_DELAY) {
+    callout_arm_managed(&ec->ec_gc_callout, es_context_gc_idle, ec,
+                        ES_GC_IDLE_DELAY - idle, ecmascript_context_lockmgr);
+    return;
+  }
+  ec->ec_gc_deferred_runs++;
+  es_context_gc(ec);
+}
+
+
+/**
+ * Reference counting in Duktape takes care of most garbage as soon as
+ * it's created. Mark-and-sweep is only needed for cycles, so instead of
+ * running it after every call into the context (which can be hundreds
+ * of times per second while populating lists) we run it once enough
+ * has been allocated since last time, or when the context goes idle.
+ */
+static void
+es_context_maybe_gc(es_context_t *ec)
+{
+  const size_t threshold = MAX(ES_GC_MIN_BYTES, ec->ec_mem_active / 2);
+
+  ec->ec_last_activity = arch_get_ts();
+
+  if(ec->ec_mem_alloc_since_gc >= threshold) {
+    es_context_gc(ec);
+  } else if(ec->ec_mem_alloc_since_gc > 0 &&
+            !callout_isarmed(&ec->ec_gc_callout)) {
+    callout_arm_managed(&ec->ec_gc_callout, es_context_gc_idle, ec,
+                        ES_GC_IDLE_DELAY, ecmascript_context_lockmgr);
+  }
+}
+
+
 /**
  *
  */
@@ -724,7 +769,7 @@ es_context_end(es_context_t *ec, int do_gc, duk_context *ctx)
     }
 
     if(do_gc)
-      duk_gc(ec->ec_duk, 0);
+      es_context_maybe_gc(ec);
 
     if(LIST_FIRST(&ec->ec_resources_permanent) == NULL) {
       // No more permanent resources, attached. Terminate context
@@ -734,6 +779,8 @@ es_context_end(es_context_t *ec, int do_gc, duk_context *ctx)
         ec->ec_thread = NULL;
       }
 
+      callout_disarm(&ec->ec_gc_callout);
+
       es_resource_t *er;
       while((er = LIST_FIRST(&ec->ec_resources_volatile)) != NULL) {
         assert(er->er_zombie == 0);
@@ -742,13 +789,15 @@ es_context_end(es_context_t *ec, int do_gc, duk_context *ctx)
 
       duk_destroy_heap(ec->ec_duk);
       ec->ec_duk = NULL;
+      es_mem_release(ec);
 
       prop_vec_destroy_entries(ec->ec_prop_unload_destroy);
       prop_vec_release(ec->ec_prop_unload_destroy);
 
       prop_dispatch_group_destroy(ec->ec_prop_dispatch_group);
 
-      TRACE(TRACE_DEBUG, rstr_get(ec->ec_id), "Unloaded");
+      TRACE(TRACE_DEBUG, rstr_get(ec->ec_id),
+            "Unloaded, peak memory usage %zd bytes", ec->ec_mem_peak);
     }
   }
   hts_mutex_unlock(&ec->ec_mutex);
@@ -832,11 +881,10 @@ es_load_and_compile(es_context_t *ec, const char *path, duk_context *ctx)
     return -1;
   }
 
-  duk_push_lstring(ctx, buf_cstr(buf), buf_len(buf));
+  int r = es_compile_cached(ec, ctx, path, buf_cstr(buf), buf_len(buf), 0);
   buf_release(buf);
-  duk_push_string(ctx, path);
 
-  if(duk_pcompile(ctx, 0)) {
+  if(r) {
 
     TRACE(TRACE_ERROR, rstr_get(ec->ec_id), "Unable to compile %s -- %s",
           path, duk_safe_to_string(ctx, -1));
@@ -22,6 +22,7 @@
 #include "ext/duktape/duktape.h"
 #include "misc/queue.h"
 #include "misc/lockmgr.h"
+#include "misc/callout.h"
 #include "arch/threads.h"
 #include "arch/atomic.h"
 #include "compiler.h"
@@ -96,8 +97,24 @@ typedef struct es_context {
   // This include stuff such as filedescriptors, database handles, etc
   struct es_resource_list ec_resources_volatile;
 
+  // Memory arena, see es_mem.c
+  void *ec_mem_pool;
+  struct es_mem_segment *ec_mem_segs;
   size_t ec_mem_active;
   size_t ec_mem_peak;
+  size_t ec_mem_arena;
+  size_t ec_mem_limit;
+  int ec_mem_segments;
+  int ec_mem_failures;
+  size_t ec_mem_alloc_since_gc;
+
+  // Garbage collection scheduling
+  callout_t ec_gc_callout;
+  int64_t ec_last_activity;
+  int ec_gc_runs;
+  int ec_gc_deferred_runs;
+  int64_t ec_gc_time;
+  int ec_gc_max_pause;
 
 
   struct htsmsg *ec_manifest; // plugin.json
@@ -211,6 +228,8 @@ duk_context * attribute_unused_result es_context_begin(es_context_t *ec);
 
 void es_context_end(es_context_t *ec, int do_gc, duk_context *ctx);
 
+void es_context_gc(es_context_t *ec);
+
 void es_context_suspend(es_context_t *ec, duk_context *ctx,
                         duk_thread_state *state);
 
@@ -219,6 +238,29 @@ void es_context_resume(es_context_t *ec, duk_context *ctx,
 
 es_context_t **ecmascript_get_all_contexts(void);
 
+#define ES_COMPILE_MODULE 0x1
+
+int es_compile_cached(es_context_t *ec, duk_context *ctx, const char *filename,
+                      const char *src, size_t srclen, int flags);
+
+void es_bytecode_stats(int *hits, int *misses, int64_t *load_time,
+                       int64_t *compile_time);
+
+#define ES_MEM_LIMIT_DEFAULT (64 * 1024 * 1024)
+
+int es_mem_init(es_context_t *ec, size_t limit);
+
+void es_mem_trim(es_context_t *ec);
+
+void es_mem_release(es_context_t *ec);
+
+void *es_mem_alloc(void *udata, duk_size_t size);
+
+void *es_mem_realloc(void *udata, void *ptr, duk_size_t size);
+
+void es_mem_free(void *udata, void *ptr);
+
+
 void ecmascript_release_context_vector(es_context_t **v);
 
 int ecmascript_context_lockmgr(void *ptr, lockmgr_op_t op);
@@ -0,0 +1,237 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+
+#include "main.h"
+#include "ecmascript.h"
+#include "blobcache.h"
+#include "misc/sha.h"
+#include "misc/str.h"
+
+/**
+ * Bytecode cache
+ *
+ * Compiled functions are dumped with duk_dump_function() and stored in
+ * the blobcache. The key is made of the app version, the Duktape
+ * version, the filename and a SHA-1 of the source. Bumping any of them,
+ * or editing the source, simply misses the cache.
+ *
+ * Duktape does not validate bytecode it loads, so every blob carries a
+ * header with the engine version and a checksum. Anything that does not
+ * match is evicted and compiled again.
+ */
+
+#define ES_BYTECODE_STASH  "esbytecode"
+#define ES_BYTECODE_MAXAGE (86400 * 30)
+#define ES_BYTECODE_MAGIC  0x45534243 // 'ESBC'
+
+typedef struct es_bytecode_hdr {
+  uint32_t magic;
+  uint32_t duk_version;
+  uint32_t len;
+  uint32_t checksum;
+} es_bytecode_hdr_t;
+
+// Updated from any thread running a Duktape context
+static HTS_MUTEX_DECL(es_bytecode_stats_mutex);
+static int es_bytecode_hits;
+static int es_bytecode_misses;
+static int64_t es_bytecode_load_time;
+static int64_t es_bytecode_compile_time;
+
+
+/**
+ * FNV-1a, just to catch truncated or damaged blobs
+ */
+static uint32_t
+es_bytecode_checksum(const uint8_t *data, size_t len)
+{
+  uint32_t h = 0x811c9dc5;
+  for(size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 0x01000193;
+  }
+  return h;
+}
+
+
+/**
+ *
+ */
+static void
+es_bytecode_key(char *key, size_t keylen, const char *filename,
+                const char *src, size_t srclen, int flags)
+{
+  uint8_t digest[20];
+  char hex[41];
+
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, (const void *)src, srclen);
+  sha1_final(shactx, digest);
+
+  bin2hex(hex, sizeof(hex), digest, sizeof(digest));
+
+  snprintf(key, keylen, "%s:%ld:%d:%s:%s",
+           appversion, (long)DUK_VERSION, flags, filename, hex);
+}
+
+
+/**
+ * Push function from cache, returns 0 if nothing was pushed
+ */
+static int
+es_bytecode_load(duk_context *ctx, const char *key)
+{
+  buf_t *b = blobcache_get(key, ES_BYTECODE_STASH, 0, NULL, NULL, NULL);
+  if(b == NULL)
+    return 0;
+
+  const es_bytecode_hdr_t *h = buf_data(b);
+  const uint8_t *bc = buf_data(b) + sizeof(es_bytecode_hdr_t);
+
+  if(buf_len(b) < sizeof(es_bytecode_hdr_t) ||
+     h->magic != ES_BYTECODE_MAGIC ||
+     h->duk_version != DUK_VERSION ||
+     h->len != buf_len(b) - sizeof(es_bytecode_hdr_t) ||
+     h->checksum != es_bytecode_checksum(bc, h->len)) {
+    buf_release(b);
+    blobcache_evict(key, ES_BYTECODE_STASH);
+    return 0;
+  }
+
+  void *dst = duk_push_fixed_buffer(ctx, h->len);
+  memcpy(dst, bc, h->len);
+  buf_release(b);
+  duk_load_function(ctx);
+  return 1;
+}
+
+
+/**
+ * Dump function at top of stack into cache
+ */
+static void
+es_bytecode_store(duk_context *ctx, const char *key)
+{
+  duk_size_t len;
+
+  duk_dup_top(ctx);
+  duk_dump_function(ctx);
+  const void *bc = duk_get_buffer(ctx, -1, &len);
+
+  buf_t *b = buf_create(sizeof(es_bytecode_hdr_t) + len);
+  es_bytecode_hdr_t *h = (void *)buf_str(b);
+  h->magic = ES_BYTECODE_MAGIC;
+  h->duk_version = DUK_VERSION;
+  h->len = len;
+  h->checksum = es_bytecode_checksum(bc, len);
+  memcpy(h + 1, bc, len);
+  duk_pop(ctx);
+
+  blobcache_put(key, ES_BYTECODE_STASH, b, ES_BYTECODE_MAXAGE,
+                NULL, 0, 0);
+  buf_release(b);
+}
+
+
+/**
+ *
+ */
+static int
+es_compile_module_wrapper(duk_context *ctx)
+{
+  // Compiled as eval code (just like Duktape's own require() does)
+  // and evaluated to get hold of the wrapper function
+  duk_compile(ctx, DUK_COMPILE_EVAL);
+  duk_call(ctx, 0);
+  return 1;
+}
+
+
+/**
+ * Compile source and push resulting function. Behaves as
+ * duk_pcompile() does, i.e. on error it returns non-zero and the
+ * error is pushed instead.
+ *
+ * If ES_COMPILE_MODULE is set the source is wrapped into a CommonJS
+ * module function: function(require, exports, module) { ... }
+ */
+int
+es_compile_cached(es_context_t *ec, duk_context *ctx, const char *filename,
+                  const char *src, size_t srclen, int flags)
+{
+  char key[1024];
+  int64_t ts = arch_get_ts();
+
+  es_bytecode_key(key, sizeof(key), filename, src, srclen, flags);
+
+  if(es_bytecode_load(ctx, key)) {
+    ts = arch_get_ts() - ts;
+    hts_mutex_lock(&es_bytecode_stats_mutex);
+    es_bytecode_hits++;
+    es_bytecode_load_time += ts;
+    hts_mutex_unlock(&es_bytecode_stats_mutex);
+    es_debug(ec, "Loaded %s from bytecode cache", filename);
+    return 0;
+  }
+
+  int r;
+
+  if(flags & ES_COMPILE_MODULE) {
+    duk_push_string(ctx, "(function(require,exports,module){");
+    duk_push_lstring(ctx, src, srclen);
+    duk_push_string(ctx, "})");
+    duk_concat(ctx, 3);
+    duk_push_string(ctx, filename);
+    r = duk_safe_call(ctx, es_compile_module_wrapper, 2, 1);
+  } else {
+    duk_push_lstring(ctx, src, srclen);
+    duk_push_string(ctx, filename);
+    r = duk_pcompile(ctx, 0);
+  }
+
+  if(r)
+    return r;
+
+  es_bytecode_store(ctx, key);
+  ts = arch_get_ts() - ts;
+  hts_mutex_lock(&es_bytecode_stats_mutex);
+  es_bytecode_misses++;
+  es_bytecode_compile_time += ts;
+  hts_mutex_unlock(&es_bytecode_stats_mutex);
+  return 0;
+}
+
+
+/**
+ *
+ */
+void
+es_bytecode_stats(int *hits, int *misses, int64_t *load_time,
+                  int64_t *compile_time)
+{
+  hts_mutex_lock(&es_bytecode_stats_mutex);
+  *hits = es_bytecode_hits;
+  *misses = es_bytecode_misses;
+  *load_time = es_bytecode_load_time;
+  *compile_time = es_bytecode_compile_time;
+  hts_mutex_unlock(&es_bytecode_stats_mutex);
+}
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include "main.h"
+#include "ecmascript.h"
+#include "misc/minmax.h"
+#include "ext/tlsf/tlsf.h"
+
+/**
+ * Per context memory arena
+ *
+ * Each context allocates from its own TLSF pool, so plugins don't
+ * fragment the process heap with their many small objects. The pool
+ * is made of segments obtained from the system. It starts with one
+ * segment and grows one segment at a time, up to the context's limit.
+ * Segments that become entirely free are returned after a GC, and the
+ * whole arena is returned in one go when the context is unloaded.
+ *
+ * All allocations are done from within Duktape, with ec_mutex held,
+ * so no additional locking is required.
+ */
+
+#define ES_MEM_SEGMENT_MIN (256 * 1024)
+#define ES_MEM_SEGMENT_MAX (4 * 1024 * 1024)
+
+typedef struct es_mem_segment {
+  struct es_mem_segment *ems_next;
+  size_t ems_size;
+} es_mem_segment_t;
+
+// Keep the memory handed to TLSF properly aligned
+#define ES_MEM_SEGMENT_HDR ((sizeof(es_mem_segment_t) + 15) & ~15)
+
+
+/**
+ *
+ */
+static es_mem_segment_t *
+es_mem_segment_alloc(es_context_t *ec, size_t size)
+{
+  if(ec->ec_mem_arena + size > ec->ec_mem_limit)
+    return NULL;
+
+  es_mem_segment_t *ems = malloc(size);
+  if(ems == NULL)
+    return NULL;
+
+  ems->ems_size = size;
+  ec->ec_mem_arena += size;
+  ec->ec_mem_segments++;
+  return ems;
+}
+
+
+/**
+ *
+ */
+static void
+es_mem_segment_free(es_context_t *ec, es_mem_segment_t *ems)
+{
+  ec->ec_mem_arena -= ems->ems_size;
+  ec->ec_mem_segments--;
+  free(ems);
+}
+
+
+/**
+ * Add a segment large enough to hold an allocation of 'size' bytes
+ */
+static int
+es_mem_grow(es_context_t *ec, size_t size)
+{
+  // TLSF rounds requests up to the next size class (at most 1/32 more)
+  const size_t overhead = ES_MEM_SEGMENT_HDR + tlsf_pool_overhead() + 64;
+  const size_t need = (size + size / 16 + overhead + 65535) & ~65535;
+
+  // Grow geometrically, roughly doubling the arena each time
+  size_t segsize = MIN(MAX(ec->ec_mem_arena, ES_MEM_SEGMENT_MIN),
+                       ES_MEM_SEGMENT_MAX);
+  segsize = MAX(segsize, need);
+
+  if(ec->ec_mem_arena + segsize > ec->ec_mem_limit)
+    segsize = need;
+
+  es_mem_segment_t *ems = es_mem_segment_alloc(ec, segsize);
+  if(ems == NULL)
+    return -1;
+
+  if(tlsf_add_pool(ec->ec_mem_pool, (char *)ems + ES_MEM_SEGMENT_HDR,
+                   segsize - ES_MEM_SEGMENT_HDR)) {
+    es_mem_segment_free(ec, ems);
+    return -1;
+  }
+
+  // The first segment holds the TLSF control structure, keep it first
+  ems->ems_next = ec->ec_mem_segs->ems_next;
+  ec->ec_mem_segs->ems_next = ems;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+es_mem_update_peak(es_context_t *ec)
+{
+  ec->ec_mem_active = tlsf_used(ec->ec_mem_pool);
+  ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
+}
+
+
+/**
+ *
+ */
+void *
+es_mem_alloc(void *udata, duk_size_t size)
+{
+  es_context_t *ec = udata;
+  void *p;
+
+  if(size == 0 || ec->ec_mem_pool == NULL)
+    return NULL;
+
+  while((p = tlsf_malloc(ec->ec_mem_pool, size)) == NULL) {
+    if(es_mem_grow(ec, size)) {
+      // Duktape will run an emergency GC and retry
+      ec->ec_mem_failures++;
+      return NULL;
+    }
+  }
+  ec->ec_mem_alloc_since_gc += size;
+  es_mem_update_peak(ec);
+  return p;
+}
+
+
+/**
+ *
+ */
+void *
+es_mem_realloc(void *udata, void *ptr, duk_size_t size)
+{
+  es_context_t *ec = udata;
+  void *p;
+
+  if(ptr == NULL)
+    return es_mem_alloc(udata, size);
+
+  if(size == 0) {
+    es_mem_free(udata, ptr);
+    return NULL;
+  }
+
+  // On failure tlsf_realloc() leaves the original block untouched
+  while((p = tlsf_realloc(ec->ec_mem_pool, ptr, size)) == NULL) {
+    if(es_mem_grow(ec, size)) {
+      ec->ec_mem_failures++;
+      return NULL;
+    }
+  }
+  ec->ec_mem_alloc_since_gc += size;
+  es_mem_update_peak(ec);
+  return p;
+}
+
+
+/**
+ *
+ */
+void
+es_mem_free(void *udata, void *ptr)
+{
+  es_context_t *ec = udata;
+  if(ptr == NULL)
+    return;
+  tlsf_free(ec->ec_mem_pool, ptr);
+  ec->ec_mem_active = tlsf_used(ec->ec_mem_pool);
+}
+
+
+/**
+ *
+ */
+int
+es_mem_init(es_context_t *ec, size_t limit)
+{
+  ec->ec_mem_limit = limit;
+
+  es_mem_segment_t *ems = es_mem_segment_alloc(ec, ES_MEM_SEGMENT_MIN);
+  if(ems == NULL)
+    return -1;
+
+  ec->ec_mem_pool = tlsf_create((char *)ems + ES_MEM_SEGMENT_HDR,
+                                ES_MEM_SEGMENT_MIN - ES_MEM_SEGMENT_HDR);
+  if(ec->ec_mem_pool == NULL) {
+    es_mem_segment_free(ec, ems);
+    return -1;
+  }
+  ems->ems_next = NULL;
+  ec->ec_mem_segs = ems;
+  return 0;
+}
+
+
+/**
+ * Return segments that no longer hold any live allocations
+ */
+void
+es_mem_trim(es_context_t *ec)
+{
+  es_mem_segment_t **pp, *ems;
+
+  if(ec->ec_mem_segs == NULL)
+    return;
+
+  pp = &ec->ec_mem_segs->ems_next;
+  while((ems = *pp) != NULL) {
+    if(!tlsf_remove_pool(ec->ec_mem_pool,
+                         (char *)ems + ES_MEM_SEGMENT_HDR)) {
+      *pp = ems->ems_next;
+      es_mem_segment_free(ec, ems);
+    } else {
+      pp = &ems->ems_next;
+    }
+  }
+}
+
+
+/**
+ * Release the entire arena. Must only be called once the Duktape heap
+ * has been destroyed
+ */
+void
+es_mem_release(es_context_t *ec)
+{
+  es_mem_segment_t *ems;
+
+  while((ems = ec->ec_mem_segs) != NULL) {
+    ec->ec_mem_segs = ems->ems_next;
+    es_mem_segment_free(ec, ems);
+  }
+  ec->ec_mem_pool = NULL;
+  ec->ec_mem_active = 0;
+}
@@ -18,6 +18,7 @@
  *  For more information, contact andreas@lonelycoder.com
  */
 #include <assert.h>
+#include <ctype.h>
 
 #include "ecmascript.h"
 #include "service.h"
@@ -35,14 +36,250 @@ typedef struct es_route {
   char *er_pattern;
   hts_regex_t er_regex;
   int er_prio;
+  int er_order; // Position in 'routes'
+
+  struct es_route_node *er_node;
+  LIST_ENTRY(es_route) er_node_link;
 } es_route_t;
 
 
+/**
+ * Routes are indexed in a trie by the literal prefix every URL they
+ * match must start with. Looking up an URL walks down the trie along
+ * the URL, so only the regexes of routes whose prefix matches are
+ * executed. Routes without a usable prefix sit at the root and are
+ * always tried.
+ *
+ * The routes on each node are kept in priority order, so the
+ * candidates along the path can be merged and tried in the very same
+ * order as a linear scan of all routes would.
+ */
+typedef struct es_route_node {
+  struct es_route_node *ern_parent;
+  struct es_route_node *ern_child;
+  struct es_route_node *ern_sibling;
+  struct es_route_list ern_routes;
+  char ern_c;
+} es_route_node_t;
+
+#define ES_ROUTE_MAX_PREFIX 256
+
 static struct es_route_list routes;
 
+static es_route_node_t route_root;
+
 static HTS_MUTEX_DECL(route_mutex);
 
 
+/**
+ * Extract the literal prefix of an anchored pattern. It's always safe
+ * to return a shorter prefix than possible, so bail out on anything
+ * that is not trivially a literal
+ */
+static int
+es_route_prefix(const char *pat, char *prefix, size_t prefixlen)
+{
+  const char *s;
+  int depth = 0, len = 0;
+
+  // A top-level alternation means there is no common prefix
+  for(s = pat; *s; s++) {
+    if(*s == '\\' && s[1]) {
+      s++;
+    } else if(*s == '[') {
+      while(s[1] && s[1] != ']')
+        s++;
+    } else if(*s == '(') {
+      depth++;
+    } else if(*s == ')') {
+      depth--;
+    } else if(*s == '|' && depth == 0) {
+      return 0;
+    }
+  }
+
+  if(*pat != '^')
+    return 0;
+
+  for(s = pat + 1; *s && len < prefixlen - 1; s++) {
+    char c = *s;
+
+    if(strchr(".[]()*+?{}|$^", c))
+      break;
+
+    if(c == '\\') {
+      if(s[1] == 0 || isalnum((unsigned char)s[1]))
+        break;
+      c = *++s;
+    }
+
+    if(s[1] == '*' || s[1] == '?' || s[1] == '{')
+      break; // Optional
+    prefix[len++] = c;
+    if(s[1] == '+')
+      break;
+  }
+  prefix[len] = 0;
+  return len;
+}
+
+
+/**
+ *
+ */
+static es_route_node_t *
+es_route_node_child(es_route_node_t *ern, char c)
+{
+  for(ern = ern->ern_child; ern != NULL; ern = ern->ern_sibling)
+    if(ern->ern_c == c)
+      return ern;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static int
+er_order_cmp(const es_route_t *a, const es_route_t *b)
+{
+  return a->er_order - b->er_order;
+}
+
+
+/**
+ * er_order must be up to date before the route is added
+ */
+static void
+es_route_index_add(es_route_t *er)
+{
+  char prefix[ES_ROUTE_MAX_PREFIX];
+  es_route_node_t *ern = &route_root, *c;
+
+  es_route_prefix(er->er_pattern, prefix, sizeof(prefix));
+
+  for(const char *s = prefix; *s; s++) {
+    if((c = es_route_node_child(ern, *s)) == NULL) {
+      c = calloc(1, sizeof(es_route_node_t));
+      c->ern_c = *s;
+      c->ern_parent = ern;
+      c->ern_sibling = ern->ern_child;
+      ern->ern_child = c;
+    }
+    ern = c;
+  }
+  er->er_node = ern;
+  LIST_INSERT_SORTED(&ern->ern_routes, er, er_node_link, er_order_cmp,
+                     es_route_t);
+}
+
+
+/**
+ *
+ */
+static void
+es_route_index_remove(es_route_t *er)
+{
+  es_route_node_t *ern = er->er_node, **pp;
+
+  LIST_REMOVE(er, er_node_link);
+
+  while(ern != &route_root && ern->ern_child == NULL &&
+        LIST_FIRST(&ern->ern_routes) == NULL) {
+    for(pp = &ern->ern_parent->ern_child; *pp != ern;
+        pp = &(*pp)->ern_sibling) {}
+    *pp = ern->ern_sibling;
+    es_route_node_t *parent = ern->ern_parent;
+    free(ern);
+    ern = parent;
+  }
+}
+
+
+/**
+ * Find the highest priority route matching 'url'
+ *
+ * Must be called with route_mutex held
+ */
+static es_route_t *
+es_route_find(const char *url, hts_regmatch_t *matches, int nmatches)
+{
+  // Trie depth is bounded by the prefix length
+  es_route_t *heads[ES_ROUTE_MAX_PREFIX];
+  es_route_node_t *ern = &route_root;
+  const char *s = url;
+  es_route_t *er;
+  int num = 0, i, best;
+
+  while(1) {
+    if((er = LIST_FIRST(&ern->ern_routes)) != NULL)
+      heads[num++] = er;
+    if(*s == 0 || (ern = es_route_node_child(ern, *s)) == NULL)
+      break;
+    s++;
+  }
+
+  // Merge the candidate lists, lowest er_order first
+  while(num > 0) {
+    best = 0;
+    for(i = 1; i < num; i++)
+      if(heads[i]->er_order < heads[best]->er_order)
+        best = i;
+
+    er = heads[best];
+    if(!hts_regexec(&er->er_regex, url, nmatches, matches))
+      return er;
+
+    if((heads[best] = LIST_NEXT(er, er_node_link)) == NULL)
+      heads[best] = heads[--num];
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static int
+er_cmp(const es_route_t *a, const es_route_t *b)
+{
+  return b->er_prio - a->er_prio;
+}
+
+
+/**
+ * Must be called with route_mutex held
+ */
+static void
+es_route_add(es_route_t *er)
+{
+  er->er_prio = strcspn(er->er_pattern, "()[]*?+$") ?: INT32_MAX;
+
+  LIST_INSERT_SORTED(&routes, er, er_link, er_cmp, es_route_t);
+
+  // Registration is rare, just renumber everything
+  es_route_t *r;
+  int order = 0;
+  LIST_FOREACH(r, &routes, er_link)
+    r->er_order = order++;
+
+  es_route_index_add(er);
+}
+
+
+/**
+ * Must be called with route_mutex held
+ */
+static void
+es_route_remove(es_route_t *er)
+{
+  LIST_REMOVE(er, er_link);
+  es_route_index_remove(er);
+}
+
+
+#ifndef LOCAL_MAIN
+
 /**
  *
  */
@@ -56,7 +293,7 @@ es_route_destroy(es_resource_t *eres)
   es_root_unregister(eres->er_ctx->ec_duk, eres);
 
   hts_mutex_lock(&route_mutex);
-  LIST_REMOVE(er, er_link);
+  es_route_remove(er);
   hts_mutex_unlock(&route_mutex);
 
   free(er->er_pattern);
@@ -88,16 +325,6 @@ static const es_resource_class_t es_resource_route = {
 };
 
 
-/**
- *
- */
-static int
-er_cmp(const es_route_t *a, const es_route_t *b)
-{
-  return b->er_prio - a->er_prio;
-}
-
-
 /**
  *
  */
@@ -142,9 +369,7 @@ es_route_create(duk_context *ctx)
 
   es_debug(ec, "Route %s added", er->er_pattern);
 
-  er->er_prio = strcspn(str, "()[]*?+$") ?: INT32_MAX;
-
-  LIST_INSERT_SORTED(&routes, er, er_link, er_cmp, es_route_t);
+  es_route_add(er);
 
   es_resource_link(&er->super, ec, 1);
 
@@ -167,14 +392,9 @@ es_route_test(duk_context *ctx)
 
   hts_mutex_lock(&route_mutex);
 
-  es_route_t *er;
   hts_regmatch_t matches[8];
 
-  LIST_FOREACH(er, &routes, er_link)
-    if(!hts_regexec(&er->er_regex, str, 8, matches))
-      break;
-
-  duk_push_boolean(ctx, er != NULL);
+  duk_push_boolean(ctx, es_route_find(str, matches, 8) != NULL);
 
   hts_mutex_unlock(&route_mutex);
 
@@ -192,11 +412,7 @@ ecmascript_openuri(prop_t *page, const char *url, int sync)
 
   hts_mutex_lock(&route_mutex);
 
-  es_route_t *er;
-
-  LIST_FOREACH(er, &routes, er_link)
-    if(!hts_regexec(&er->er_regex, url, 8, matches))
-      break;
+  es_route_t *er = es_route_find(url, matches, 8);
 
   if(er == NULL) {
     hts_mutex_unlock(&route_mutex);
@@ -284,3 +500,271 @@ static const duk_function_list_entry fnlist_route[] = {
 };
 
 ES_MODULE("route", fnlist_route);
+
+#endif
+
+
+/**
+ * Differential test of the route index against a linear scan of all
+ * routes (which is what es_route_find() used to do) and a benchmark
+ * of the two. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -I. -Ibuild.linux src/ecmascript/es_route.c \
+ *   src/misc/regex.c ext/minilibs/regexp.c -o /tmp/es_route -lpthread
+ */
+#ifdef LOCAL_MAIN
+#include <stdio.h>
+#include <sys/time.h>
+
+void
+tracelog(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+}
+
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+
+static uint32_t lm_seed = 1;
+
+static int
+lm_rand(int n)
+{
+  lm_seed = lm_seed * 1103515245 + 12345;
+  return (lm_seed >> 8) % n;
+}
+
+
+/**
+ * Same as es_route_create() minus the ecmascript parts
+ */
+static es_route_t *
+lm_route_create(const char *pattern)
+{
+  const char *errmsg;
+  es_route_t *er = calloc(1, sizeof(es_route_t));
+
+  if(hts_regcomp(&er->er_regex, pattern, &errmsg)) {
+    fprintf(stderr, "Invalid regex %s -- %s\n", pattern, errmsg);
+    exit(1);
+  }
+  er->er_pattern = strdup(pattern);
+  hts_mutex_lock(&route_mutex);
+  es_route_add(er);
+  hts_mutex_unlock(&route_mutex);
+  return er;
+}
+
+
+static void
+lm_route_destroy(es_route_t *er)
+{
+  hts_mutex_lock(&route_mutex);
+  es_route_remove(er);
+  hts_mutex_unlock(&route_mutex);
+  hts_regfree(&er->er_regex);
+  free(er->er_pattern);
+  free(er);
+}
+
+
+/**
+ * The old lookup
+ */
+static es_route_t *
+lm_linear_find(const char *url, hts_regmatch_t *matches, int nmatches)
+{
+  es_route_t *er;
+  LIST_FOREACH(er, &routes, er_link)
+    if(!hts_regexec(&er->er_regex, url, nmatches, matches))
+      break;
+  return er;
+}
+
+
+static int lm_fails;
+
+static void
+lm_check(const char *url, const char *expect)
+{
+  hts_regmatch_t m1[8], m2[8];
+  es_route_t *a = lm_linear_find(url, m1, 8);
+  es_route_t *b = es_route_find(url, m2, 8);
+  const char *got = b ? b->er_pattern : NULL;
+
+  if(a != b) {
+    printf("FAIL: %s: linear %s, index %s\n", url,
+           a ? a->er_pattern : "none", got ?: "none");
+    lm_fails++;
+  } else if(expect != NULL && (got == NULL || strcmp(got, expect))) {
+    printf("FAIL: %s: expected %s, got %s\n", url, expect, got ?: "none");
+    lm_fails++;
+  } else if(a != NULL && memcmp(m1, m2, sizeof(m1))) {
+    printf("FAIL: %s: captures differ\n", url);
+    lm_fails++;
+  }
+}
+
+
+/**
+ * Routes that must be found by priority, with and without literal
+ * prefixes
+ */
+static void
+lm_priority(void)
+{
+  static const char *patterns[] = {
+    "^foo:(.*)",
+    "^foo:bar:(.*)",
+    "^foo:bar:baz$",
+    "^foo:ba(.*)",
+    "^(.*):special$",
+    "^[a-z]+:item:([0-9]+)$",
+    "^a:(.*)|^b:(.*)",
+    "^x?y:(.*)",
+    "^.*\\.mp3$",
+    "^q\\:r:(.*)",
+  };
+  const int num = sizeof(patterns) / sizeof(patterns[0]);
+  es_route_t *ers[num];
+
+  for(int i = 0; i < num; i++)
+    ers[i] = lm_route_create(patterns[i]);
+
+  lm_check("foo:bar:baz",      "^foo:bar:baz$");
+  lm_check("foo:bar:qux",      "^foo:bar:(.*)");
+  lm_check("foo:baz",          "^foo:ba(.*)");
+  lm_check("foo:x",            "^foo:(.*)");
+  lm_check("foo:special",      "^foo:(.*)");
+  lm_check("zap:special",      "^(.*):special$");
+  lm_check("abc:item:42",      "^[a-z]+:item:([0-9]+)$");
+  lm_check("abc:item:x",       NULL);
+  lm_check("a:1",              "^a:(.*)|^b:(.*)");
+  lm_check("b:2",              "^a:(.*)|^b:(.*)");
+  lm_check("y:1",              "^x?y:(.*)");
+  lm_check("xy:1",             "^x?y:(.*)");
+  lm_check("song.mp3",         "^.*\\.mp3$");
+  lm_check("foo:bar:song.mp3", "^foo:bar:(.*)");
+  lm_check("q:r:1",            "^q\\:r:(.*)");
+  lm_check("",                 NULL);
+  lm_check("nomatch",          NULL);
+
+  // Removing a route must expose the next one in priority order
+  lm_route_destroy(ers[2]);
+  lm_check("foo:bar:baz",      "^foo:bar:(.*)");
+  lm_route_destroy(ers[1]);
+  lm_check("foo:bar:baz",      "^foo:ba(.*)");
+
+  for(int i = 0; i < num; i++)
+    if(i != 1 && i != 2)
+      lm_route_destroy(ers[i]);
+  assert(LIST_FIRST(&routes) == NULL);
+  assert(route_root.ern_child == NULL);
+}
+
+
+#define LM_PLUGINS 125
+#define LM_ROUTES  (LM_PLUGINS * 8)
+#define LM_URLS    2000
+
+/**
+ * What a large set of plugins typically register
+ */
+static void
+lm_route_pattern(char *buf, size_t len, int i)
+{
+  const int p = i / 8;
+
+  switch(i & 7) {
+  case 0: snprintf(buf, len, "^plugin%d:start", p); break;
+  case 1: snprintf(buf, len, "^plugin%d:search:(.*)", p); break;
+  case 2: snprintf(buf, len, "^plugin%d:list:([0-9]+):(.*)", p); break;
+  case 3: snprintf(buf, len, "^plugin%d:item:([0-9]+)$", p); break;
+  case 4: snprintf(buf, len, "^plugin%d:(.*)", p); break;
+  case 5: snprintf(buf, len, "^plugin%d:video:(.*):(.*)", p); break;
+  case 6: snprintf(buf, len, "^(.*):plugin%d$", p); break; // No prefix
+  case 7: snprintf(buf, len, "^[a-z]+%d:page:(.*)", p); break; // No prefix
+  }
+}
+
+
+static void
+lm_url(char *buf, size_t len)
+{
+  const int p = lm_rand(LM_PLUGINS + 10);
+
+  switch(lm_rand(8)) {
+  case 0: snprintf(buf, len, "plugin%d:start", p); break;
+  case 1: snprintf(buf, len, "plugin%d:search:foo bar", p); break;
+  case 2: snprintf(buf, len, "plugin%d:list:%d:x", p, lm_rand(100)); break;
+  case 3: snprintf(buf, len, "plugin%d:item:%d", p, lm_rand(100)); break;
+  case 4: snprintf(buf, len, "plugin%d:other", p); break;
+  case 5: snprintf(buf, len, "plugin%d:video:a:b", p); break;
+  case 6: snprintf(buf, len, "foo:plugin%d", p); break;
+  case 7: snprintf(buf, len, "abc%d:page:1", p); break;
+  }
+}
+
+
+static void
+lm_bench(void)
+{
+  static char urls[LM_URLS][64];
+  es_route_t *ers[LM_ROUTES];
+  hts_regmatch_t m[8];
+  char pat[64];
+  int64_t ts;
+
+  for(int i = 0; i < LM_ROUTES; i++) {
+    // Register in random order so priority, not insertion, decides
+    lm_route_pattern(pat, sizeof(pat), (i * 7 + 3) % LM_ROUTES);
+    ers[i] = lm_route_create(pat);
+  }
+
+  for(int i = 0; i < LM_URLS; i++) {
+    lm_url(urls[i], sizeof(urls[i]));
+    lm_check(urls[i], NULL);
+  }
+
+  ts = get_ts();
+  for(int i = 0; i < LM_URLS; i++)
+    lm_linear_find(urls[i], m, 8);
+  const int64_t linear = get_ts() - ts;
+
+  ts = get_ts();
+  for(int i = 0; i < LM_URLS; i++)
+    es_route_find(urls[i], m, 8);
+  const int64_t trie = get_ts() - ts;
+
+  printf("%d routes, %d lookups: linear %d us/lookup, trie %d us/lookup\n",
+         LM_ROUTES, LM_URLS, (int)(linear / LM_URLS), (int)(trie / LM_URLS));
+
+  // Remove half of them and check again
+  for(int i = 0; i < LM_ROUTES; i += 2)
+    lm_route_destroy(ers[i]);
+
+  for(int i = 0; i < LM_URLS; i++)
+    lm_check(urls[i], NULL);
+
+  for(int i = 1; i < LM_ROUTES; i += 2)
+    lm_route_destroy(ers[i]);
+  assert(route_root.ern_child == NULL);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  lm_priority();
+  lm_bench();
+  printf("%s\n", lm_fails ? "FAILED" : "OK");
+  return !!lm_fails;
+}
+
+#endif
@@ -64,6 +64,15 @@ dump_context(htsbuf_queue_t *out, es_context_t *ec)
 
   htsbuf_qprintf(out, "  Memory usage, current: %zd bytes, peak: %zd\n",
                  ec->ec_mem_active, ec->ec_mem_peak);
+  htsbuf_qprintf(out, "  Memory arena: %zd bytes in %d segments, "
+                 "limit: %zd, failed allocations: %d\n",
+                 ec->ec_mem_arena, ec->ec_mem_segments,
+                 ec->ec_mem_limit, ec->ec_mem_failures);
+  htsbuf_qprintf(out, "  GC runs: %d (%d when idle), total pause: %d ms, "
+                 "max pause: %d us, allocated since last GC: %zd bytes\n",
+                 ec->ec_gc_runs, ec->ec_gc_deferred_runs,
+                 (int)(ec->ec_gc_time / 1000), ec->ec_gc_max_pause,
+                 ec->ec_mem_alloc_since_gc);
   htsbuf_qprintf(out, "  Rooted Ecmascript objects: %d\n",
                  ec->ec_rooted_objects);
 
@@ -106,6 +115,16 @@ dumpstats(http_connection_t *hc, const char *remain, void *opaque,
 
   ecmascript_release_context_vector(vec);
 
+  int hits, misses;
+  int64_t load_time, compile_time;
+  es_bytecode_stats(&hits, &misses, &load_time, &compile_time);
+
+  htsbuf_qprintf(&out, "\n--- Bytecode cache ------------------------\n");
+  htsbuf_qprintf(&out, "  Hits: %d (%d ms spent loading)\n",
+                 hits, (int)(load_time / 1000));
+  htsbuf_qprintf(&out, "  Misses: %d (%d ms spent compiling)\n",
+                 misses, (int)(compile_time / 1000));
+
   htsbuf_qprintf(&out, "\n");
 
   return http_send_reply(hc, 0,
@@ -131,7 +150,7 @@ dogc(http_connection_t *hc, const char *remain, void *opaque,
   for(i = 0; vec[i] != NULL; i++) {
     es_context_t *ec = vec[i];
     hts_mutex_lock(&ec->ec_mutex);
-    duk_gc(ec->ec_duk, 0);
+    es_context_gc(ec);
     hts_mutex_unlock(&ec->ec_mutex);
   }
 
@@ -24,23 +24,29 @@
 #include "fileaccess.h"
 #include "fa_proto.h"
 #include "misc/minmax.h"
+#include "misc/aes128.h"
 
-#define MAX_BUFFER_BLOCKS 150
 #define BLOCKSIZE 16
 
 /**
- *
+ * Data is read from the source straight into the caller's buffer and
+ * decrypted in place. Only the last block (or a partial block) is held
+ * back, as we can't strip the padding until we know it's the final one.
+ * Reads too small for that go via a bounce buffer.
  */
 typedef struct aes_fh {
   fa_handle_t h;
   fa_handle_t *src;
   uint8_t iv[16];
-  struct AVAES *aes;
-  
-  uint8_t  inbuffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
-  uint8_t outbuffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
+  struct AVAES *aes;  // NULL if CPU has AES instructions
+  aes128_t hw;
+
+  uint8_t hold[BLOCKSIZE];
+  int hold_len;
+
+  uint8_t bounce[BLOCKSIZE * 16];
   uint8_t *outptr;
-  int inlen, inlen_used, outlen, eof;
+  int outlen, eof;
 
 } aes_fh_t;
 
@@ -83,54 +89,81 @@ aescbc_fsize(fa_handle_t *handle)
 /**
  *
  */
+static void
+aescbc_decrypt(aes_fh_t *a, uint8_t *data, int blocks)
+{
+  if(a->aes != NULL)
+    av_aes_crypt(a->aes, data, data, blocks, a->iv, 1);
+  else
+    aes128_cbc_decrypt(&a->hw, data, blocks, a->iv);
+}
+
+
+/**
+ * Read and decrypt into 'dst' which must fit at least two blocks
+ */
 static int
-aescbc_read(fa_handle_t *handle, void *buf, size_t size)
+aescbc_read_blocks(aes_fh_t *a, uint8_t *dst, size_t size)
 {
-  int blocks;
-  aes_fh_t *a = (aes_fh_t *)handle;
+  int len, blocks;
 
-  while(1) {
+  size &= ~(BLOCKSIZE - 1);
 
-    if(a->outlen > 0) {
-      size = MIN(size, a->outlen);
-      memcpy(buf, a->outptr, size);
-      a->outptr += size;
-      a->outlen -= size;
-      return size;
-    }
+  memcpy(dst, a->hold, a->hold_len);
+  len = a->hold_len;
+  a->hold_len = 0;
 
-    while(a->inlen - a->inlen_used < 2 * BLOCKSIZE) {
-      int n = a->src->fh_proto->fap_read(a->src, a->inbuffer + a->inlen,
-					 sizeof(a->inbuffer) - a->inlen);
-      if(n <= 0) {
-	a->eof = 1;
-	break;
-      }
-      a->inlen += n;
+  while(!a->eof && len < 2 * BLOCKSIZE) {
+    int n = a->src->fh_proto->fap_read(a->src, dst + len, size - len);
+    if(n <= 0) {
+      a->eof = 1;
+      break;
     }
+    len += n;
+  }
 
-    if((blocks = (a->inlen - a->inlen_used) / BLOCKSIZE) == 0)
-      return 0;
+  blocks = len / BLOCKSIZE;
 
-    if(!a->eof)
+  if(!a->eof) {
+    if(len % BLOCKSIZE == 0)
       blocks--;
+    a->hold_len = len - blocks * BLOCKSIZE;
+    memcpy(a->hold, dst + blocks * BLOCKSIZE, a->hold_len);
+  }
 
-    av_aes_crypt(a->aes, a->outbuffer, a->inbuffer + a->inlen_used, blocks,
-                 a->iv, 1);
+  if(blocks == 0)
+    return 0;
 
-    a->outlen = BLOCKSIZE * blocks;
-    a->outptr = a->outbuffer;
-    a->inlen_used += BLOCKSIZE * blocks;
+  aescbc_decrypt(a, dst, blocks);
 
-    if(a->inlen_used >= sizeof(a->inbuffer) / 2) {
-      memmove(a->inbuffer, a->inbuffer + a->inlen_used,
-	      a->inlen - a->inlen_used);
-      a->inlen -= a->inlen_used;
-      a->inlen_used = 0;
-    }
-    if(a->eof)
-      a->outlen -= a->outbuffer[a->outlen - 1];
+  len = blocks * BLOCKSIZE;
+  if(a->eof)
+    len -= MIN(dst[len - 1], len);
+  return len;
+}
+
+
+/**
+ *
+ */
+static int
+aescbc_read(fa_handle_t *handle, void *buf, size_t size)
+{
+  aes_fh_t *a = (aes_fh_t *)handle;
+
+  if(a->outlen == 0) {
+    if(size >= 2 * BLOCKSIZE)
+      return aescbc_read_blocks(a, buf, size);
+
+    a->outlen = aescbc_read_blocks(a, a->bounce, sizeof(a->bounce));
+    a->outptr = a->bounce;
   }
+
+  size = MIN(size, a->outlen);
+  memcpy(buf, a->outptr, size);
+  a->outptr += size;
+  a->outlen -= size;
+  return size;
 }
 
 
@@ -157,7 +190,11 @@ fa_aescbc_open(fa_handle_t *fa, const uint8_t *iv, const uint8_t *key)
   a->src = fa;
   memcpy(a->iv,  iv,  16);
 
-  a->aes = av_aes_alloc();
-  av_aes_init(a->aes, key, 128, 1);
+  if(aes128_hw_available()) {
+    aes128_init_decrypt(&a->hw, key);
+  } else {
+    a->aes = av_aes_alloc();
+    av_aes_init(a->aes, key, 128, 1);
+  }
   return &a->h;
 }
@@ -100,19 +100,292 @@ rescale(AVFormatContext *fctx, int64_t ts, int si)
 }
 
 
+/**
+ * Preroll
+ *
+ * When we reach end of file the queues still hold a few seconds of
+ * audio. If the media pipe knows what's going to be played next we use
+ * that time to open and probe it and to read its first packets. Once
+ * the next track is started all of that is just picked up, so it can
+ * continue right where the previous one ended without waiting for the
+ * (possibly remote) file to open.
+ *
+ * There is only one preroll slot. It's dropped if something else than
+ * the prerolled URL is played, also when that is done by some other
+ * backend (see backend_play_audio()).
+ */
+
+#define AUDIO_PREROLL_PACKETS 32
+
+typedef struct audio_preroll {
+  char *ap_url;
+  char *ap_mimetype;
+  AVFormatContext *ap_fctx;
+  AVPacket ap_pkts[AUDIO_PREROLL_PACKETS];
+  int ap_num_pkts;
+  int ap_rd_pkt;
+  int ap_done;
+  int ap_abandoned;
+} audio_preroll_t;
+
+static hts_mutex_t audio_preroll_mutex;
+static hts_cond_t audio_preroll_cond;
+static audio_preroll_t *audio_preroll;
+
+
+/**
+ *
+ */
+static void
+audio_preroll_drop_packets(audio_preroll_t *ap)
+{
+  while(ap->ap_rd_pkt < ap->ap_num_pkts)
+    av_free_packet(&ap->ap_pkts[ap->ap_rd_pkt++]);
+}
+
+
+/**
+ *
+ */
+static void
+audio_preroll_destroy(audio_preroll_t *ap)
+{
+  audio_preroll_drop_packets(ap);
+  if(ap->ap_fctx != NULL)
+    fa_libav_close_format(ap->ap_fctx, 0);
+  free(ap->ap_url);
+  free(ap->ap_mimetype);
+  free(ap);
+}
+
+
+/**
+ * Prerolled file is only usable if it was probed exactly as
+ * be_file_playaudio() would do it
+ */
+static int
+audio_preroll_match(const audio_preroll_t *ap, const char *url,
+                    const char *mimetype)
+{
+  if(strcmp(ap->ap_url, url))
+    return 0;
+  if(ap->ap_mimetype == NULL || mimetype == NULL)
+    return ap->ap_mimetype == mimetype;
+  return !strcmp(ap->ap_mimetype, mimetype);
+}
+
+
+/**
+ *
+ */
+static void
+audio_preroll_discard_locked(void)
+{
+  audio_preroll_t *ap = audio_preroll;
+  if(ap == NULL)
+    return;
+
+  audio_preroll = NULL;
+  if(ap->ap_done)
+    audio_preroll_destroy(ap);
+  else
+    ap->ap_abandoned = 1; // Thread will destroy it when done
+}
+
+
+/**
+ *
+ */
+void
+audio_preroll_discard(void)
+{
+  hts_mutex_lock(&audio_preroll_mutex);
+  audio_preroll_discard_locked();
+  hts_mutex_unlock(&audio_preroll_mutex);
+}
+
+
+/**
+ * Same as the normal open path in be_file_playaudio() but gives up
+ * for anything that needs special treatment
+ */
+static AVFormatContext *
+audio_preroll_open(const char *url, const char *mimetype)
+{
+  char errbuf[256];
+  uint8_t pb[4096];
+  size_t psiz;
+
+  fa_handle_t *fh = fa_open_ex(url, errbuf, sizeof(errbuf),
+                               FA_BUFFERED_SMALL, NULL);
+  if(fh == NULL)
+    return NULL;
+
+  psiz = fa_read(fh, pb, sizeof(pb));
+  if(psiz < 128 ||
+     (pb[0] == 0x50 && pb[1] == 0x4b && pb[2] == 0x03 && pb[3] == 0x04)) {
+    fa_close(fh);
+    return NULL;
+  }
+
+#if ENABLE_PLUGINS
+  plugin_probe_for_autoinstall(fh, pb, psiz, url);
+#endif
+
+#if ENABLE_VMIR
+  metadata_t *md = metadata_create();
+  if(np_fa_probe(fh, pb, psiz, md, url) == 0) {
+    metadata_destroy(md);
+    fa_close_with_park(fh, 1);
+    return NULL;
+  }
+  metadata_destroy(md);
+#endif
+
+  AVIOContext *avio = fa_libav_reopen(fh, 0);
+  if(avio == NULL) {
+    fa_close(fh);
+    return NULL;
+  }
+
+  AVFormatContext *fctx =
+    fa_libav_open_format(avio, url, errbuf, sizeof(errbuf), mimetype,
+                         FA_LIBAV_OPEN_STRATEGY_AUDIO);
+  if(fctx == NULL)
+    fa_libav_close(avio);
+  return fctx;
+}
+
+
+/**
+ *
+ */
+static void *
+audio_preroll_thread(void *aux)
+{
+  audio_preroll_t *ap = aux;
+  AVPacket pkt;
+
+  ap->ap_fctx = audio_preroll_open(ap->ap_url, ap->ap_mimetype);
+
+  if(ap->ap_fctx != NULL) {
+    while(ap->ap_num_pkts < AUDIO_PREROLL_PACKETS &&
+          av_read_frame(ap->ap_fctx, &pkt) == 0) {
+      // Make sure data is not owned by the demuxer
+      av_packet_ref(&ap->ap_pkts[ap->ap_num_pkts++], &pkt);
+      av_free_packet(&pkt);
+    }
+    TRACE(TRACE_DEBUG, "Audio", "Prerolled %s, %d packets",
+          ap->ap_url, ap->ap_num_pkts);
+  }
+
+  hts_mutex_lock(&audio_preroll_mutex);
+  ap->ap_done = 1;
+  if(ap->ap_abandoned)
+    audio_preroll_destroy(ap);
+  else
+    hts_cond_broadcast(&audio_preroll_cond);
+  hts_mutex_unlock(&audio_preroll_mutex);
+  return NULL;
+}
+
+
+/**
+ * Start preroll of whatever the media pipe says is up next
+ */
+static void
+audio_preroll_start(media_pipe_t *mp)
+{
+  hts_mutex_lock(&mp->mp_mutex);
+  char *url = mp->mp_next_url ? strdup(mp->mp_next_url) : NULL;
+  char *mimetype = mp->mp_next_mimetype ? strdup(mp->mp_next_mimetype) : NULL;
+  hts_mutex_unlock(&mp->mp_mutex);
+
+  if(url == NULL) {
+    free(mimetype);
+    return;
+  }
+
+  hts_mutex_lock(&audio_preroll_mutex);
+
+  if(audio_preroll != NULL && audio_preroll_match(audio_preroll, url,
+                                                  mimetype)) {
+    free(url);
+    free(mimetype);
+  } else {
+    audio_preroll_discard_locked();
+    audio_preroll_t *ap = calloc(1, sizeof(audio_preroll_t));
+    ap->ap_url = url;
+    ap->ap_mimetype = mimetype;
+    audio_preroll = ap;
+    hts_thread_create_detached("audio preroll", audio_preroll_thread, ap,
+                               THREAD_PRIO_DEMUXER);
+  }
+  hts_mutex_unlock(&audio_preroll_mutex);
+}
+
+
+/**
+ * Take ownership of preroll for 'url', waits for it to complete if
+ * it's still in progress
+ */
+static audio_preroll_t *
+audio_preroll_take(const char *url, const char *mimetype)
+{
+  hts_mutex_lock(&audio_preroll_mutex);
+
+  audio_preroll_t *ap = audio_preroll;
+
+  if(ap != NULL && !audio_preroll_match(ap, url, mimetype)) {
+    audio_preroll_discard_locked();
+    ap = NULL;
+  }
+
+  if(ap != NULL) {
+    audio_preroll = NULL;
+    while(!ap->ap_done)
+      hts_cond_wait(&audio_preroll_cond, &audio_preroll_mutex);
+  }
+
+  hts_mutex_unlock(&audio_preroll_mutex);
+
+  if(ap != NULL && ap->ap_fctx == NULL) {
+    audio_preroll_destroy(ap);
+    ap = NULL;
+  }
+  return ap;
+}
+
+
+/**
+ *
+ */
+static void
+audio_preroll_init(void)
+{
+  hts_mutex_init(&audio_preroll_mutex);
+  hts_cond_init(&audio_preroll_cond, &audio_preroll_mutex);
+}
+
+INITME(INIT_GROUP_API, audio_preroll_init, NULL, 0);
+
+
 #define MB_SPECIAL_EOF ((void *)-1)
 
 /**
  *
  */
 static void
-seekflush(media_pipe_t *mp, media_buf_t **mbp)
+seekflush(media_pipe_t *mp, media_buf_t **mbp, audio_preroll_t *ap)
 {
   mp_flush(mp);
   
   if(*mbp != NULL && *mbp != MB_SPECIAL_EOF)
     media_buf_free_unlocked(mp, *mbp);
   *mbp = NULL;
+
+  if(ap != NULL)
+    audio_preroll_drop_packets(ap);
 }
 
 /**
@@ -140,6 +413,13 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
 
   mp->mp_seek_base = 0;
 
+  audio_preroll_t *ap = audio_preroll_take(url, mimetype);
+  if(ap != NULL) {
+    fctx = ap->ap_fctx;
+    ap->ap_fctx = NULL;
+    goto opened;
+  }
+
   fa_handle_t *fh = fa_open_ex(url, errbuf, errlen, FA_BUFFERED_SMALL, NULL);
   if(fh == NULL)
     return NULL;
@@ -194,6 +474,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
     return NULL;
   }
 
+ opened:
   usage_event("Play audio", 1, USAGE_SEG("format", fctx->iformat->name));
 
   TRACE(TRACE_DEBUG, "Audio", "Starting playback of %s", url);
@@ -220,6 +501,8 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
   
   if(cw == NULL) {
     media_format_deref(fw);
+    if(ap != NULL)
+      audio_preroll_destroy(ap);
     snprintf(errbuf, errlen, "Unable to open codec");
     return NULL;
   }
@@ -238,13 +521,19 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
     if(mb == NULL) {
       
       mp->mp_eof = 0;
-      r = av_read_frame(fctx, &pkt);
+      if(ap != NULL && ap->ap_rd_pkt < ap->ap_num_pkts) {
+        pkt = ap->ap_pkts[ap->ap_rd_pkt++];
+        r = 0;
+      } else {
+        r = av_read_frame(fctx, &pkt);
+      }
       if(r == AVERROR(EAGAIN))
 	continue;
       
       if(r == AVERROR_EOF || r == AVERROR(EIO)) {
 	mb = MB_SPECIAL_EOF;
 	mp->mp_eof = 1;
+        audio_preroll_start(mp);
 	continue;
       }
       
@@ -340,7 +629,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
 	ts = MAX(ets->ts, 0);
       }
       av_seek_frame(fctx, -1, ts, AVSEEK_FLAG_BACKWARD);
-      seekflush(mp, &mb);
+      seekflush(mp, &mb, ap);
       
     } else if(event_is_action(e, ACTION_SKIP_BACKWARD)) {
 
@@ -348,7 +637,7 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
 	goto skip;
       int64_t z = fctx->start_time != PTS_UNSET ? fctx->start_time : 0;
       av_seek_frame(fctx, -1, z, AVSEEK_FLAG_BACKWARD);
-      seekflush(mp, &mb);
+      seekflush(mp, &mb, ap);
 
     } else if(event_is_action(e, ACTION_SKIP_FORWARD) ||
 	      event_is_action(e, ACTION_STOP)) {
@@ -362,6 +651,13 @@ be_file_playaudio(const char *url, media_pipe_t *mp,
   if(mb != NULL && mb != MB_SPECIAL_EOF)
     media_buf_free_unlocked(mp, mb);
 
+  if(ap != NULL)
+    audio_preroll_destroy(ap);
+
+  // Keep preroll only if we're moving on to the next track
+  if(!event_is_type(e, EVENT_EOF) && !event_is_action(e, ACTION_SKIP_FORWARD))
+    audio_preroll_discard();
+
   media_codec_deref(cw);
   media_format_deref(fw);
 
@@ -26,3 +26,5 @@ struct fa_handle;
 event_t *be_file_playaudio(const char *url, media_pipe_t *mp,
 			   char *errbuf, size_t errlen, int hold,
 			   const char *mimetype, void *opaque);
+
+void audio_preroll_discard(void);
@@ -82,12 +82,35 @@ static int http_tokenize(char *buf, char **vec, int vecsize, int delimiter);
 
 
 /**
- * Connection parking
+ * Connection pool
+ *
+ * Connections are grouped per (hostname, port, ssl) in a hash table.
+ * Each host keeps its active and parked (idle) connections. Parked
+ * connections are also linked on a global list in LRU order so the
+ * total number of idle connections can be capped without one busy host
+ * evicting every other host's keep-alive connections.
  */
+#define HTTP_HOST_HASH_SIZE 64
+
+#define HTTP_DEFAULT_MAX_PARKED          16
+#define HTTP_DEFAULT_MAX_PARKED_PER_HOST 4
+
 TAILQ_HEAD(http_connection_queue ,http_connection);
+LIST_HEAD(http_host_list, http_host);
+
+typedef struct http_host {
+  LIST_ENTRY(http_host) hh_link;
+  char *hh_hostname;
+  int hh_port;
+  char hh_ssl;
 
+  struct http_connection_queue hh_active;
+  struct http_connection_queue hh_parked;  // Least recently parked first
+  int hh_num_parked;
+} http_host_t;
+
+static struct http_host_list http_hosts[HTTP_HOST_HASH_SIZE];
 static struct http_connection_queue http_parked_connections;
-static struct http_connection_queue http_active_connections;
 static int http_num_parked_connections;
 
 static hts_mutex_t http_connections_mutex;
@@ -95,6 +118,12 @@ static hts_cond_t http_connections_cond;
 static atomic_t http_connection_tally;
 static atomic_t http_file_tally;
 
+// Protected by http_connections_mutex
+static int http_stats_connects;
+static int http_stats_reuses;
+static int http_stats_pending;
+static callout_t http_stats_timer;
+
 typedef struct http_connection {
   atomic_t hc_refcount;
 
@@ -103,7 +132,9 @@ typedef struct http_connection {
   int hc_id;
   tcpcon_t *hc_tc;
 
-  TAILQ_ENTRY(http_connection) hc_link;
+  http_host_t *hc_host;
+  TAILQ_ENTRY(http_connection) hc_link;      // hh_active or hh_parked
+  TAILQ_ENTRY(http_connection) hc_lru_link;  // http_parked_connections
 
   char hc_ssl;
   char hc_reused;
@@ -303,6 +334,129 @@ http_connection_destroy(http_connection_t *hc, int dbg, const char *reason)
 
 
 
+/**
+ * Limits for idle connections, see developer settings
+ */
+static int
+http_max_parked(void)
+{
+  return MAX(1, gconf.http_max_idle_connections ?: HTTP_DEFAULT_MAX_PARKED);
+}
+
+static int
+http_max_parked_per_host(void)
+{
+  return MAX(1, gconf.http_max_idle_connections_per_host ?:
+             HTTP_DEFAULT_MAX_PARKED_PER_HOST);
+}
+
+
+/**
+ * Props are updated from the callout thread, outside of
+ * http_connections_mutex and at most once per second
+ */
+static void
+http_stats_publish(struct callout *c, void *aux)
+{
+  hts_mutex_lock(&http_connections_mutex);
+  const int connects = http_stats_connects;
+  const int reuses = http_stats_reuses;
+  const int idle = http_num_parked_connections;
+  http_stats_pending = 0;
+  hts_mutex_unlock(&http_connections_mutex);
+
+  const int total = connects + reuses;
+  prop_t *p = prop_create(prop_create(prop_get_global(), "net"), "http");
+
+  prop_set(p, "connects", PROP_SET_INT, connects);
+  prop_set(p, "reuses", PROP_SET_INT, reuses);
+  prop_set(p, "reuseRate", PROP_SET_INT, total ? 100 * reuses / total : 0);
+  prop_set(p, "idle", PROP_SET_INT, idle);
+}
+
+
+/**
+ * Must be called with http_connections_mutex held
+ */
+static void
+http_stats_update(void)
+{
+  if(http_stats_pending)
+    return;
+  http_stats_pending = 1;
+  callout_arm(&http_stats_timer, http_stats_publish, NULL, 1);
+}
+
+
+/**
+ * Find (or create) host. Must be called with http_connections_mutex held
+ */
+static http_host_t *
+http_host_get(const char *hostname, int port, int ssl)
+{
+  const unsigned int bucket =
+    (mystrhash(hostname) ^ port ^ ssl) % HTTP_HOST_HASH_SIZE;
+  http_host_t *hh;
+
+  LIST_FOREACH(hh, &http_hosts[bucket], hh_link)
+    if(hh->hh_port == port && hh->hh_ssl == ssl &&
+       !strcmp(hh->hh_hostname, hostname))
+      return hh;
+
+  hh = calloc(1, sizeof(http_host_t));
+  hh->hh_hostname = strdup(hostname);
+  hh->hh_port = port;
+  hh->hh_ssl = ssl;
+  TAILQ_INIT(&hh->hh_active);
+  TAILQ_INIT(&hh->hh_parked);
+  LIST_INSERT_HEAD(&http_hosts[bucket], hh, hh_link);
+  return hh;
+}
+
+
+/**
+ *
+ */
+static void
+http_host_maybe_release(http_host_t *hh)
+{
+  if(TAILQ_FIRST(&hh->hh_active) != NULL ||
+     TAILQ_FIRST(&hh->hh_parked) != NULL)
+    return;
+
+  LIST_REMOVE(hh, hh_link);
+  free(hh->hh_hostname);
+  free(hh);
+}
+
+
+/**
+ * Must be called with http_connections_mutex held
+ */
+static void
+http_connection_unlink_active(http_connection_t *hc)
+{
+  http_host_t *hh = hc->hc_host;
+  TAILQ_REMOVE(&hh->hh_active, hc, hc_link);
+  hts_cond_broadcast(&http_connections_cond);
+  http_host_maybe_release(hh);
+}
+
+
+/**
+ * Must be called with http_connections_mutex held
+ */
+static void
+http_connection_unlink_parked(http_connection_t *hc)
+{
+  http_host_t *hh = hc->hc_host;
+  TAILQ_REMOVE(&hh->hh_parked, hc, hc_link);
+  hh->hh_num_parked--;
+  TAILQ_REMOVE(&http_parked_connections, hc, hc_lru_link);
+  http_num_parked_connections--;
+}
+
+
 /**
  *
  */
@@ -313,52 +467,46 @@ http_connection_get(const char *hostname, int port, int ssl,
                     int max_concurrent, int verify_ssl)
 {
   http_connection_t *hc;
+  http_host_t *hh;
   tcpcon_t *tc;
   char xerrbuf[256];
 
   hts_mutex_lock(&http_connections_mutex);
 
-  if(max_concurrent) {
+  while(1) {
+    // Host might go away while we wait, so look it up every round
+    hh = http_host_get(hostname, port, ssl);
 
-    while(1) {
-      int num_concurrent = 0;
-      TAILQ_FOREACH(hc, &http_active_connections, hc_link) {
-        if(!strcmp(hc->hc_hostname, hostname) &&
-           hc->hc_port == port &&
-           hc->hc_ssl == ssl &&
-           atomic_get(&hc->hc_inspecting) == 0) {
-          num_concurrent++;
-        }
-      }
-      if(num_concurrent < max_concurrent)
-        break;
+    if(!max_concurrent)
+      break;
 
-      hts_cond_wait(&http_connections_cond, &http_connections_mutex);
+    int num_concurrent = 0;
+    TAILQ_FOREACH(hc, &hh->hh_active, hc_link) {
+      if(atomic_get(&hc->hc_inspecting) == 0)
+        num_concurrent++;
     }
-  }
-
-  if(allow_reuse) {
-
-    time_t now;
+    if(num_concurrent < max_concurrent)
+      break;
 
-    time(&now);
+    hts_cond_wait(&http_connections_cond, &http_connections_mutex);
+  }
 
-    TAILQ_FOREACH(hc, &http_parked_connections, hc_link) {
+  // Most recently parked connection is the one least likely to have
+  // been timed out by the server
+  if(allow_reuse &&
+     (hc = TAILQ_LAST(&hh->hh_parked, http_connection_queue)) != NULL) {
 
-      if(!strcmp(hc->hc_hostname, hostname) && hc->hc_port == port &&
-         hc->hc_ssl == ssl) {
-        TAILQ_REMOVE(&http_parked_connections, hc, hc_link);
-        http_num_parked_connections--;
-        TAILQ_INSERT_TAIL(&http_active_connections, hc, hc_link);
-        callout_disarm(&hc->hc_callout);
-        hts_mutex_unlock(&http_connections_mutex);
-        HTTP_TRACE(dbg, "Reusing connection to %s:%d (cid=%d)",
-                   hc->hc_hostname, hc->hc_port, hc->hc_id);
-        hc->hc_reused = 1;
-        tcp_set_cancellable(hc->hc_tc, c);
-        return hc;
-      }
-    }
+    http_connection_unlink_parked(hc);
+    TAILQ_INSERT_TAIL(&hh->hh_active, hc, hc_link);
+    callout_disarm(&hc->hc_callout);
+    http_stats_reuses++;
+    http_stats_update();
+    hts_mutex_unlock(&http_connections_mutex);
+    HTTP_TRACE(dbg, "Reusing connection to %s:%d (cid=%d)",
+               hc->hc_hostname, hc->hc_port, hc->hc_id);
+    hc->hc_reused = 1;
+    tcp_set_cancellable(hc->hc_tc, c);
+    return hc;
   }
 
 
@@ -367,7 +515,10 @@ http_connection_get(const char *hostname, int port, int ssl,
   hc->hc_hostname = strdup(hostname);
   hc->hc_port = port;
   hc->hc_ssl = ssl;
-  TAILQ_INSERT_TAIL(&http_active_connections, hc, hc_link);
+  hc->hc_host = hh;
+  TAILQ_INSERT_TAIL(&hh->hh_active, hc, hc_link);
+  http_stats_connects++;
+  http_stats_update();
 
   hts_mutex_unlock(&http_connections_mutex);
 
@@ -415,21 +566,39 @@ http_connection_get(const char *hostname, int port, int ssl,
  bad:
 
   hts_mutex_lock(&http_connections_mutex);
-  hts_cond_broadcast(&http_connections_cond);
-  TAILQ_REMOVE(&http_active_connections, hc, hc_link);
+  http_connection_unlink_active(hc);
   hts_mutex_unlock(&http_connections_mutex);
+  free(hc->hc_hostname);
   free(hc);
   return NULL;
 }
 
 
+/**
+ * Invoked with http_connections_mutex held (via lockmgr)
+ */
 static void
 http_connection_ka_expired(struct callout *c, void *opaque)
 {
   http_connection_t *hc = opaque;
-  TAILQ_REMOVE(&http_parked_connections, hc, hc_link);
+  http_host_t *hh = hc->hc_host;
+  http_connection_unlink_parked(hc);
+  http_host_maybe_release(hh);
   http_connection_destroy(hc, gconf.enable_http_debug, "Keep alive expired");
-  http_num_parked_connections--;
+}
+
+
+/**
+ * Must be called with http_connections_mutex held
+ */
+static void
+http_connection_evict(http_connection_t *hc, int dbg, const char *reason)
+{
+  http_host_t *hh = hc->hc_host;
+  http_connection_unlink_parked(hc);
+  http_host_maybe_release(hh);
+  callout_disarm(&hc->hc_callout);
+  http_connection_destroy(hc, dbg, reason);
 }
 
 
@@ -440,9 +609,7 @@ static void
 http_connection_park(http_connection_t *hc, int dbg, int max_age,
                      const char *reason)
 {
-  time_t now;
-
-  time(&now);
+  http_host_t *hh = hc->hc_host;
 
   tcp_set_read_timeout(hc->hc_tc, 0);
   tcp_set_cancellable(hc->hc_tc, NULL);
@@ -455,19 +622,24 @@ http_connection_park(http_connection_t *hc, int dbg, int max_age,
   callout_arm_managed(&hc->hc_callout, http_connection_ka_expired,
                       hc, max_age * 1000000LL, http_connection_lockmgr);
 
-  TAILQ_REMOVE(&http_active_connections, hc, hc_link);
+  TAILQ_REMOVE(&hh->hh_active, hc, hc_link);
   hts_cond_broadcast(&http_connections_cond);
-  TAILQ_INSERT_TAIL(&http_parked_connections, hc, hc_link);
-
-  while(http_num_parked_connections > 5) {
-    hc = TAILQ_FIRST(&http_parked_connections);
-    assert(hc != NULL);
-    TAILQ_REMOVE(&http_parked_connections, hc, hc_link);
-    http_connection_destroy(hc, dbg, "Too many idle connections");
-    http_num_parked_connections--;
-    callout_disarm(&hc->hc_callout);
-  }
 
+  TAILQ_INSERT_TAIL(&hh->hh_parked, hc, hc_link);
+  hh->hh_num_parked++;
+  TAILQ_INSERT_TAIL(&http_parked_connections, hc, hc_lru_link);
+  http_num_parked_connections++;
+
+  // Limits are >= 1 so the host will not go away here
+  while(hh->hh_num_parked > http_max_parked_per_host())
+    http_connection_evict(TAILQ_FIRST(&hh->hh_parked), dbg,
+                          "Too many idle connections to host");
+
+  while(http_num_parked_connections > http_max_parked())
+    http_connection_evict(TAILQ_FIRST(&http_parked_connections), dbg,
+                          "Too many idle connections");
+
+  http_stats_update();
   hts_mutex_unlock(&http_connections_mutex);
 }
 
@@ -1118,6 +1290,72 @@ http_read_content(http_file_t *hf)
 }
 
 
+/**
+ * Read content and pass it to 'sink' piece by piece as it arrives
+ * instead of buffering all of it
+ */
+static int
+http_read_content_stream(http_file_t *hf,
+                         void (*sink)(void *opaque, const void *data,
+                                      size_t len),
+                         void *opaque)
+{
+  int64_t remain;
+  int csize, len;
+  char chunkheader[100];
+  http_connection_t *hc = hf->hf_connection;
+  const int bufsize = 65536;
+  char *buf;
+
+  if(!hf->hf_chunked_transfer && hf->hf_rsize < 0)
+    return -1;
+
+  buf = malloc(bufsize);
+
+  if(hf->hf_chunked_transfer) {
+
+    while(1) {
+      if(tcp_read_line(hc->hc_tc, chunkheader, sizeof(chunkheader)) < 0)
+	break;
+
+      csize = strtol(chunkheader, NULL, 16);
+
+      for(remain = csize; remain > 0; remain -= len) {
+        len = MIN(remain, bufsize);
+        if(tcp_read_data(hc->hc_tc, buf, len, NULL, 0))
+          goto bad;
+        sink(opaque, buf, len);
+      }
+
+      if(tcp_read_data(hc->hc_tc, chunkheader, 2, NULL, 0))
+	break;
+
+      if(csize == 0) {
+	hf->hf_rsize = 0;
+        free(buf);
+        return 0;
+      }
+    }
+  bad:
+    free(buf);
+    hf->hf_chunked_transfer = 0;
+    return -1;
+  }
+
+  for(remain = hf->hf_rsize; remain > 0; remain -= len) {
+    len = MIN(remain, bufsize);
+    if(tcp_read_data(hc->hc_tc, buf, len, NULL, 0)) {
+      free(buf);
+      return -1;
+    }
+    sink(opaque, buf, len);
+  }
+  free(buf);
+  hf->hf_rsize = 0;
+  return 0;
+}
+
+
 /**
  *
  */
@@ -1417,8 +1655,7 @@ http_detach(http_file_t *hf, int reusable, const char *reason)
     http_connection_park(hf->hf_connection, hf->hf_debug, hf->hf_max_age, reason);
   } else {
     hts_mutex_lock(&http_connections_mutex);
-    TAILQ_REMOVE(&http_active_connections, hf->hf_connection, hc_link);
-    hts_cond_broadcast(&http_connections_cond);
+    http_connection_unlink_active(hf->hf_connection);
     hts_mutex_unlock(&http_connections_mutex);
     http_connection_destroy(hf->hf_connection, hf->hf_debug, reason);
   }
@@ -2385,7 +2622,6 @@ http_no_parking(fa_handle_t *fh)
 static void
 http_init(void)
 {
-  TAILQ_INIT(&http_active_connections);
   TAILQ_INIT(&http_parked_connections);
   hts_mutex_init(&http_connections_mutex);
   hts_cond_init(&http_connections_cond, &http_connections_mutex);
@@ -2438,149 +2674,197 @@ static fa_protocol_t fa_protocol_https = {
 FAP_REGISTER(https);
 
 /**
- * Parse WEBDAV PROPFIND results
+ * State while parsing WEBDAV PROPFIND results
  */
-static int
-parse_propfind(http_file_t *hf, htsmsg_t *xml, fa_dir_t *fd,
-	       char *errbuf, size_t errlen)
+typedef struct propfind_parser {
+  http_file_t *pp_hf;
+  fa_dir_t *pp_fd;
+  int pp_found;
+  char pp_rpath[URL_MAX];
+  char pp_path[URL_MAX];
+  char pp_fname[URL_MAX];
+  char pp_ehref[URL_MAX]; // Escaped href
+  char pp_errmsg[128];
+  htsmsg_xml_stream_t *pp_xml;
+} propfind_parser_t;
+
+
+/**
+ * Parse one <DAV:response> of WEBDAV PROPFIND results
+ *
+ * Invoked from the streaming XML parser as soon as each response
+ * element has been received
+ */
+static void
+parse_propfind_response(void *opaque, htsmsg_field_t *f)
 {
-  htsmsg_t *m, *c;
-  htsmsg_field_t *f;
+  propfind_parser_t *pp = opaque;
+  http_file_t *hf = pp->pp_hf;
+  htsmsg_t *c;
   const char *href, *d, *q;
-  int isdir, i, r;
-  char *rpath = malloc(URL_MAX);
-  char *path  = malloc(URL_MAX);
-  char *fname = malloc(URL_MAX);
-  char *ehref = malloc(URL_MAX); // Escaped href
+  int isdir, i;
+  char *path  = pp->pp_path;
+  char *fname = pp->pp_fname;
   fa_dir_entry_t *fde;
 
-  // We need to compare paths and to do so, we must deescape the
-  // possible URL encoding. Do the searched-for path once
-  snprintf(rpath, URL_MAX, "%s", hf->hf_path);
-  url_deescape(rpath);
+  if(pp->pp_found || strcmp(f->hmf_name, "response"))
+    return;
+  if((c = htsmsg_get_map_by_field(f)) == NULL)
+    return;
 
-  if((m = htsmsg_get_map(xml, "multistatus")) == NULL) {
-    snprintf(errbuf, errlen, "WEBDAV: DAV:multistatus not found in XML");
-    goto err;
-  }
+  /* Some DAV servers seams to send an empty href tag for root path "/" */
+  href = htsmsg_get_str(c, "href") ?: "/";
 
-  HTSMSG_FOREACH(f, m) {
-    if(strcmp(f->hmf_name, "response"))
-      continue;
-    if((c = htsmsg_get_map_by_field(f)) == NULL)
-      continue;
+  // Get rid of http://hostname (lighttpd includes those)
+  if((q = strstr(href, "://")) != NULL)
+    href = strchr(q + strlen("://"), '/') ?: "/";
 
-    /* Some DAV servers seams to send an empty href tag for root path "/" */
-    href = htsmsg_get_str(c, "href") ?: "/";
+  snprintf(pp->pp_ehref, URL_MAX, "%s", href);
+  url_deescape(pp->pp_ehref);
 
-    // Get rid of http://hostname (lighttpd includes those)
-    if((q = strstr(href, "://")) != NULL)
-      href = strchr(q + strlen("://"), '/') ?: "/";
+  if((c = htsmsg_get_map_multi(c, "propstat", "prop", NULL)) == NULL)
+    return;
 
-    snprintf(ehref, URL_MAX, "%s", href);
-    url_deescape(ehref);
+  htsmsg_t *tr = htsmsg_get_map(c, "resourcetype");
+  isdir = tr != NULL ? !!htsmsg_field_find(tr, "collection") : 0;
 
-    if((c = htsmsg_get_map_multi(c, "propstat", "prop", NULL)) == NULL)
-      continue;
+  if(pp->pp_fd != NULL) {
 
-    htsmsg_t *tr = htsmsg_get_map(c, "resourcetype");
-    isdir = tr != NULL ? !!htsmsg_field_find(tr, "collection") : 0;
+    if(!strcmp(pp->pp_rpath, pp->pp_ehref))
+      return;
 
-    if(fd != NULL) {
+    http_connection_t *hc = hf->hf_connection;
 
-      if(strcmp(rpath, ehref)) {
-	http_connection_t *hc = hf->hf_connection;
+    if(!hc->hc_ssl && hc->hc_port == 80)
+      snprintf(path, URL_MAX, "webdav://%s%s",
+               hc->hc_hostname, href);
+    else if(hc->hc_ssl && hc->hc_port == 443)
+      snprintf(path, URL_MAX, "webdavs://%s%s",
+               hc->hc_hostname, href);
+    else
+      snprintf(path, URL_MAX, "%s://%s:%d%s",
+               hc->hc_ssl ? "webdavs" : "webdav", hc->hc_hostname,
+               hc->hc_port, href);
 
-        if(!hc->hc_ssl && hc->hc_port == 80)
-          snprintf(path, URL_MAX, "webdav://%s%s",
-                   hc->hc_hostname, href);
-        else if(hc->hc_ssl && hc->hc_port == 443)
-          snprintf(path, URL_MAX, "webdavs://%s%s",
-                   hc->hc_hostname, href);
-        else
-          snprintf(path, URL_MAX, "%s://%s:%d%s",
-                   hc->hc_ssl ? "webdavs" : "webdav", hc->hc_hostname,
-		   hc->hc_port, href);
-
-	if((q = strrchr(path, '/')) != NULL) {
-	  q++;
-
-	  if(*q == 0) {
-	    /* We have a trailing slash, can't piggy back filename
-	       on path (we want to keep the trailing '/' in the URL
-	       since some webdav servers require it and will force us
-	       to 301/redirect if we don't come back with it */
-	    q--;
-	    while(q != path && q[-1] != '/')
-	      q--;
-
-	    for(i = 0; i < URL_MAX - 1 && q[i] != '/'; i++)
-	      fname[i] = q[i];
-	    fname[i] = 0;
-
-	  } else {
-	    snprintf(fname, URL_MAX, "%s", q);
-	  }
-	  url_deescape(fname);
-	  
-	  fde = fa_dir_add(fd, path, fname, 
-			   isdir ? CONTENT_DIR : CONTENT_FILE);
+    if((q = strrchr(path, '/')) == NULL)
+      return;
+    q++;
 
-	  if(fde != NULL) {
+    if(*q == 0) {
+      /* We have a trailing slash, can't piggy back filename
+         on path (we want to keep the trailing '/' in the URL
+         since some webdav servers require it and will force us
+         to 301/redirect if we don't come back with it */
+      q--;
+      while(q != path && q[-1] != '/')
+        q--;
 
-	    fde->fde_statdone = 1;
+      for(i = 0; i < URL_MAX - 1 && q[i] != '/'; i++)
+        fname[i] = q[i];
+      fname[i] = 0;
 
-	    if(!isdir) {
-	      
-	      if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
-		fde->fde_stat.fs_size = strtoll(d, NULL, 10);
-	      else
-		fde->fde_statdone = 0;
-	    }
+    } else {
+      snprintf(fname, URL_MAX, "%s", q);
+    }
+    url_deescape(fname);
 
-	    if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
-	      http_ctime(&fde->fde_stat.fs_mtime, d);
-	  }
-	}
+    fde = fa_dir_add(pp->pp_fd, path, fname,
+                     isdir ? CONTENT_DIR : CONTENT_FILE);
+
+    if(fde != NULL) {
+
+      fde->fde_statdone = 1;
+
+      if(!isdir) {
+
+        if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
+          fde->fde_stat.fs_size = strtoll(d, NULL, 10);
+        else
+          fde->fde_statdone = 0;
       }
-    } else {
-      /* single entry stat(2) */
 
-      snprintf(fname, URL_MAX, "%s", href);
-      url_deescape(fname);
+      if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
+        http_ctime(&fde->fde_stat.fs_mtime, d);
+    }
+  } else {
+    /* single entry stat(2) */
+
+    snprintf(fname, URL_MAX, "%s", href);
+    url_deescape(fname);
 
-      if(!strcmp(rpath, fname)) {
-	/* This is the path we asked for */
+    if(strcmp(pp->pp_rpath, fname))
+      return;
 
-	hf->hf_isdir = isdir;
+    /* This is the path we asked for */
+    hf->hf_isdir = isdir;
 
-	if(!isdir) {
-	  if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
-	    hf->hf_filesize = strtoll(d, NULL, 10);
-        }
-        hf->hf_mtime = 0;
-        if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
-          http_ctime(&hf->hf_mtime, d);
-	goto ok;
-      } 
+    if(!isdir) {
+      if((d = htsmsg_get_str(c, "getcontentlength")) != NULL)
+        hf->hf_filesize = strtoll(d, NULL, 10);
     }
+    hf->hf_mtime = 0;
+    if((d = htsmsg_get_str(c, "getlastmodified")) != NULL)
+      http_ctime(&hf->hf_mtime, d);
+    pp->pp_found = 1;
   }
+}
+
 
-  if(fd == NULL) {
-    /* We should have returned earlier, server did not include the file 
-       we asked for in its reply. The server is probably broken. 
-       (It should respond with a 404 or something) */
+/**
+ * Body sink for PROPFIND responses. Once the XML is broken we just
+ * keep draining the body so the connection can be reused
+ */
+static void
+parse_propfind_feed(void *opaque, const void *data, size_t len)
+{
+  propfind_parser_t *pp = opaque;
+
+  if(pp->pp_errmsg[0])
+    return;
+
+  htsmsg_xml_stream_feed(pp->pp_xml, data, len,
+                         pp->pp_errmsg, sizeof(pp->pp_errmsg));
+}
+
+
+/**
+ * Parse WEBDAV PROPFIND results while they are being received
+ */
+static int
+parse_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen)
+{
+  propfind_parser_t *pp = calloc(1, sizeof(propfind_parser_t));
+  int r = -1;
+
+  pp->pp_hf = hf;
+  pp->pp_fd = fd;
+
+  // We need to compare paths and to do so, we must deescape the
+  // possible URL encoding. Do the searched-for path once
+  snprintf(pp->pp_rpath, URL_MAX, "%s", hf->hf_path);
+  url_deescape(pp->pp_rpath);
+
+  // Responses are children of <DAV:multistatus>
+  pp->pp_xml = htsmsg_xml_stream_create(2, parse_propfind_response, pp);
+
+  if(http_read_content_stream(hf, parse_propfind_feed, pp)) {
+    snprintf(errbuf, errlen, "Connection lost");
+  } else if(pp->pp_errmsg[0] ||
+            htsmsg_xml_stream_finish(pp->pp_xml, pp->pp_errmsg,
+                                     sizeof(pp->pp_errmsg))) {
+    snprintf(errbuf, errlen,
+             "WEBDAV/PROPFIND: XML parsing failed:\n%s", pp->pp_errmsg);
+  } else if(fd == NULL && !pp->pp_found) {
+    /* Server did not include the file we asked for in its reply.
+       The server is probably broken. (It should respond with a
+       404 or something) */
     snprintf(errbuf, errlen, "WEBDAV: File not found in XML reply");
-  err:
-    r = -1;
   } else {
-  ok:
     r = 0;
   }
-  free(rpath);
-  free(path);
-  free(fname);
-  free(ehref);
+
+  htsmsg_xml_stream_destroy(pp->pp_xml);
+  free(pp);
   return r;
 }
 
@@ -2592,12 +2876,9 @@ static int
 dav_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen,
 	     int *non_interactive)
 {
-  int code, retval;
+  int code;
   htsbuf_queue_t q;
-  buf_t *buf;
-  htsmsg_t *xml;
   int redircount = 0;
-  char err0[128];
   int i;
   struct http_header_list headers, cookies;
 
@@ -2646,20 +2927,7 @@ dav_propfind(http_file_t *hf, fa_dir_t *fd, char *errbuf, size_t errlen,
     switch(code) {
       
     case 207: /* 207 Multi-part */
-      if((buf = http_read_content(hf)) == NULL) {
-	snprintf(errbuf, errlen, "Connection lost");
-	return -1;
-      }
-
-      xml = htsmsg_xml_deserialize_buf(buf, err0, sizeof(err0));
-      if(xml == NULL) {
-	snprintf(errbuf, errlen,
-		 "WEBDAV/PROPFIND: XML parsing failed:\n%s", err0);
-	return -1;
-      }
-      retval = parse_propfind(hf, xml, fd, errbuf, errlen);
-      htsmsg_release(xml);
-      return retval;
+      return parse_propfind(hf, fd, errbuf, errlen);
 
     case 301:
     case 302:
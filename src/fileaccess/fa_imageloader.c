@@ -38,10 +38,12 @@
 #endif
 #include "misc/callout.h"
 #include "misc/minmax.h"
+#include "misc/str.h"
 #include "image/pixmap.h"
 #include "image/jpeg.h"
 #include "backend/backend.h"
 #include "blobcache.h"
+#include "metadata/metadata.h"
 
 static const uint8_t pngsig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
 static const uint8_t gif89sig[6] = {'G', 'I', 'F', '8', '9', 'a'};
@@ -51,8 +53,9 @@ static const uint8_t svgsig1[5] = {'<', '?', 'x', 'm', 'l'};
 static const uint8_t svgsig2[4] = {'<', 's', 'v', 'g'};
 
 #if ENABLE_LIBAV
-static hts_mutex_t image_from_video_mutex[2];
-static AVCodecContext *thumbctx;
+static hts_mutex_t image_from_video_mutex;
+static hts_mutex_t thumbsrc_mutex;
+static hts_cond_t thumbsrc_cond;
 static AVCodec *thumbcodec;
 static callout_t thumb_flush_callout;
 
@@ -61,6 +64,8 @@ static image_t *fa_image_from_video(const char *url, const image_meta_t *im,
                                     int *cache_control, cancellable_t *c);
 #endif
 
+static void *imageloader_bench_thread(void *aux);
+
 /**
  *
  */
@@ -68,10 +73,16 @@ void
 fa_imageloader_init(void)
 {
 #if ENABLE_LIBAV
-  hts_mutex_init(&image_from_video_mutex[0]);
-  hts_mutex_init(&image_from_video_mutex[1]);
+  hts_mutex_init(&image_from_video_mutex);
+  hts_mutex_init(&thumbsrc_mutex);
+  hts_cond_init(&thumbsrc_cond, &thumbsrc_mutex);
   thumbcodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
 #endif
+
+  if(gconf.imageloader_bench != NULL)
+    hts_thread_create_detached("imagebench", imageloader_bench_thread,
+                               (void *)gconf.imageloader_bench,
+                               THREAD_PRIO_BGTASK);
 }
 
 
@@ -181,11 +192,10 @@ jpeginfo_reader(void *handle, void *buf, int64_t offset, size_t size)
 /**
  *
  */
-image_t *
-fa_imageloader(const char *url, const struct image_meta *im,
-	       char *errbuf, size_t errlen,
-	       int *cache_control, cancellable_t *c,
-               backend_t *be)
+static image_t *
+fa_imageloader_load(const char *url, const struct image_meta *im,
+                    char *errbuf, size_t errlen,
+                    int *cache_control, cancellable_t *c)
 {
   uint8_t p[16];
   int r;
@@ -194,11 +204,6 @@ fa_imageloader(const char *url, const struct image_meta *im,
   image_t *img;
   image_coded_type_t fmt;
 
-#if ENABLE_LIBAV
-  if(strchr(url, '#'))
-    return fa_image_from_video(url, im, errbuf, errlen, cache_control, c);
-#endif
-
   if(!im->im_want_thumb) {
     image_t *img = fa_imageloader2(url, errbuf, errlen, cache_control, c);
     if(img != NO_LOAD_METHOD)
@@ -318,62 +323,507 @@ fa_imageloader(const char *url, const struct image_meta *im,
   return img;
 }
 
+
+/**
+ * Cache of fully decoded, rescaled and postprocessed images
+ *
+ * Grid views reload the same small images each time their textures are
+ * flushed. By keeping the final pixmap in blobcache we can skip reading
+ * the file, decoding and rescaling it.
+ */
+
+#define IMAGETHUMB_STASH    "imagethumb"
+#define IMAGETHUMB_MAGIC    0x69746801
+#define IMAGETHUMB_MAX_DIM  512
+#define IMAGETHUMB_MAX_SIZE (1024 * 1024)
+
+typedef struct imagethumb_hdr {
+  uint32_t ith_magic;
+  uint32_t ith_linesize;
+  uint16_t ith_width;
+  uint16_t ith_height;
+  uint16_t ith_margin;
+  uint16_t ith_pm_flags;
+  uint8_t ith_type;
+  uint8_t ith_orientation;
+  uint8_t ith_origin_coded_type;
+  uint8_t ith_pad;
+  float ith_aspect;
+  float ith_intensity;
+  float ith_primary_color[3];
+} imagethumb_hdr_t;
+
+
+/**
+ *
+ */
+static int
+imagethumb_eligible(const char *url, const image_meta_t *im)
+{
+  if(im->im_no_decoding)
+    return 0;
+
+  // HTTP already keeps the coded image in blobcache and a stat()
+  // would cost us an extra request
+  if(mystrbegins(url, "http://") || mystrbegins(url, "https://"))
+    return 0;
+
+  if(im->im_want_thumb)
+    return 1;
+
+  if(im->im_req_width == -1 && im->im_req_height == -1)
+    return 0;
+
+  return im->im_req_width  <= IMAGETHUMB_MAX_DIM &&
+         im->im_req_height <= IMAGETHUMB_MAX_DIM;
+}
+
+
+/**
+ *
+ */
+static char *
+imagethumb_key(const char *url, const image_meta_t *im, int64_t size)
+{
+  return fmtstr("%s;%"PRId64";%d;%d;%d;%d;%d;%d;%d;%d;%d%d%d%d",
+                url, size,
+                im->im_req_width, im->im_req_height,
+                im->im_max_width, im->im_max_height,
+                im->im_corner_radius, im->im_corner_selection,
+                im->im_shadow, im->im_margin,
+                !!im->im_can_mono, !!im->im_want_thumb,
+                !!im->im_intensity_analysis,
+                !!im->im_primary_color_analysis);
+}
+
+
+/**
+ *
+ */
+static image_t *
+imagethumb_get(const char *key, time_t mtime)
+{
+  time_t cached_mtime;
+  buf_t *b = blobcache_get(key, IMAGETHUMB_STASH, 0, NULL, NULL,
+                           &cached_mtime);
+  if(b == NULL)
+    return NULL;
+
+  image_t *img = NULL;
+  const imagethumb_hdr_t *ith = buf_data(b);
+
+  if(cached_mtime != mtime ||
+     buf_size(b) < sizeof(imagethumb_hdr_t) ||
+     ith->ith_magic != IMAGETHUMB_MAGIC ||
+     buf_size(b) != sizeof(imagethumb_hdr_t) +
+     ith->ith_linesize * ith->ith_height)
+    goto out;
+
+  pixmap_t *pm = pixmap_create(ith->ith_width  - ith->ith_margin * 2,
+                               ith->ith_height - ith->ith_margin * 2,
+                               ith->ith_type, ith->ith_margin);
+  if(pm == NULL)
+    goto out;
+
+  if(pm->pm_linesize != ith->ith_linesize) {
+    pixmap_release(pm);
+    goto out;
+  }
+
+  memcpy(pm->pm_data, ith + 1, ith->ith_linesize * ith->ith_height);
+  pm->pm_flags            = ith->ith_pm_flags;
+  pm->pm_aspect           = ith->ith_aspect;
+  pm->pm_intensity        = ith->ith_intensity;
+  pm->pm_primary_color[0] = ith->ith_primary_color[0];
+  pm->pm_primary_color[1] = ith->ith_primary_color[1];
+  pm->pm_primary_color[2] = ith->ith_primary_color[2];
+
+  img = image_create_from_pixmap(pm);
+  pixmap_release(pm);
+  img->im_orientation       = ith->ith_orientation;
+  img->im_origin_coded_type = ith->ith_origin_coded_type;
+  img->im_flags |= IMAGE_ADAPTED | IMAGE_POSTPROCESSED;
+ out:
+  buf_release(b);
+  return img;
+}
+
+
+/**
+ *
+ */
+static void
+imagethumb_put(const char *key, time_t mtime, image_t *img)
+{
+  image_component_t *ic = image_find_component(img, IMAGE_PIXMAP);
+  if(ic == NULL)
+    return;
+
+  const pixmap_t *pm = ic->pm;
+  const size_t size = pm->pm_linesize * pm->pm_height;
+
+  if(size > IMAGETHUMB_MAX_SIZE)
+    return;
+
+  buf_t *b = buf_create(sizeof(imagethumb_hdr_t) + size);
+  if(b == NULL)
+    return;
+
+  imagethumb_hdr_t *ith = (imagethumb_hdr_t *)buf_str(b);
+  memset(ith, 0, sizeof(imagethumb_hdr_t));
+  ith->ith_magic             = IMAGETHUMB_MAGIC;
+  ith->ith_linesize          = pm->pm_linesize;
+  ith->ith_width             = pm->pm_width;
+  ith->ith_height            = pm->pm_height;
+  ith->ith_margin            = pm->pm_margin;
+  ith->ith_pm_flags          = pm->pm_flags;
+  ith->ith_type              = pm->pm_type;
+  ith->ith_orientation       = img->im_orientation;
+  ith->ith_origin_coded_type = img->im_origin_coded_type;
+  ith->ith_aspect            = pm->pm_aspect;
+  ith->ith_intensity         = pm->pm_intensity;
+  ith->ith_primary_color[0]  = pm->pm_primary_color[0];
+  ith->ith_primary_color[1]  = pm->pm_primary_color[1];
+  ith->ith_primary_color[2]  = pm->pm_primary_color[2];
+  memcpy(ith + 1, pm->pm_data, size);
+
+  blobcache_put(key, IMAGETHUMB_STASH, b, INT32_MAX, NULL, mtime, 0);
+  buf_release(b);
+}
+
+
+/**
+ *
+ */
+image_t *
+fa_imageloader(const char *url, const struct image_meta *im,
+	       char *errbuf, size_t errlen,
+	       int *cache_control, cancellable_t *c,
+               backend_t *be)
+{
+  struct fa_stat fs;
+  image_t *img;
+
 #if ENABLE_LIBAV
+  if(strchr(url, '#'))
+    return fa_image_from_video(url, im, errbuf, errlen, cache_control, c);
+#endif
+
+  if(!imagethumb_eligible(url, im) ||
+     fa_stat_ex(url, &fs, NULL, 0, FA_NON_INTERACTIVE))
+    return fa_imageloader_load(url, im, errbuf, errlen, cache_control, c);
+
+  int64_t ts = arch_get_ts();
+  char *key = imagethumb_key(url, im, fs.fs_size);
+
+  img = imagethumb_get(key, fs.fs_mtime);
+  if(img != NULL) {
+    if(gconf.enable_image_debug)
+      TRACE(TRACE_DEBUG, "imagethumb", "Cache hit for %s in %d us",
+            url, (int)(arch_get_ts() - ts));
+    free(key);
+    return img;
+  }
 
-static char *ifv_url;
-static AVFormatContext *ifv_fctx;
-static AVCodecContext *ifv_ctx;
-int ifv_stream;
+  img = fa_imageloader_load(url, im, errbuf, errlen, cache_control, c);
 
+  if(img != NULL && img != NOT_MODIFIED) {
+    img = image_decode(img, im, errbuf, errlen);
+    if(img != NULL) {
+      imagethumb_put(key, fs.fs_mtime, img);
+      img->im_flags |= IMAGE_ADAPTED | IMAGE_POSTPROCESSED;
+
+      if(gconf.enable_image_debug)
+        TRACE(TRACE_DEBUG, "imagethumb", "Cache miss for %s, loaded in %d us",
+              url, (int)(arch_get_ts() - ts));
+    }
+  }
+  free(key);
+  return img;
+}
+
+
+/**
+ * Benchmark of a photo grid: Load (up to) 2000 images from a directory
+ * through fa_imageloader() with an empty imagethumb stash (cold) and
+ * then again (warm). Started with --imageloader-bench <dir>
+ */
+
+#define IMAGELOADER_BENCH_PHOTOS 2000
+
+/**
+ *
+ */
+static int64_t
+imageloader_bench_pass(char **urls, int num, const image_meta_t *im,
+                       int cold, int *failed)
+{
+  char errbuf[256];
+  int64_t ts = arch_get_ts();
+  *failed = 0;
+
+  for(int i = 0; i < num; i++) {
+    struct fa_stat fs;
+
+    if(cold && !fa_stat_ex(urls[i], &fs, NULL, 0, FA_NON_INTERACTIVE)) {
+      char *key = imagethumb_key(urls[i], im, fs.fs_size);
+      blobcache_evict(key, IMAGETHUMB_STASH);
+      free(key);
+    }
+
+    image_t *img = fa_imageloader(urls[i], im, errbuf, sizeof(errbuf),
+                                  NULL, NULL, NULL);
+    if(img != NULL && img != NOT_MODIFIED)
+      img = image_decode(img, im, errbuf, sizeof(errbuf));
+
+    if(img == NULL || img == NOT_MODIFIED) {
+      (*failed)++;
+      continue;
+    }
+    image_release(img);
+  }
+  return arch_get_ts() - ts;
+}
+
+
+/**
+ *
+ */
+static void *
+imageloader_bench_thread(void *aux)
+{
+  const char *dir = aux;
+  char errbuf[256];
+  char *urls[IMAGELOADER_BENCH_PHOTOS];
+  fa_dir_entry_t *fde;
+  int num = 0, failed;
+  image_meta_t im = {0};
+
+  fa_dir_t *fd = fa_scandir(dir, errbuf, sizeof(errbuf));
+  if(fd == NULL) {
+    TRACE(TRACE_ERROR, "imagebench", "Unable to scan %s -- %s", dir, errbuf);
+    app_shutdown(1);
+    return NULL;
+  }
+
+  RB_FOREACH(fde, &fd->fd_entries, fde_link) {
+    if(num == IMAGELOADER_BENCH_PHOTOS)
+      break;
+    if(fde->fde_type != CONTENT_DIR)
+      urls[num++] = strdup(rstr_get(fde->fde_url));
+  }
+  fa_dir_free(fd);
+
+  // Grid cell sized request, with and without embedded thumbnails
+  im.im_req_width = 256;
+  im.im_req_height = 256;
+
+  for(int thumb = 0; thumb < 2; thumb++) {
+    im.im_want_thumb = thumb;
+
+    for(int cold = 1; cold >= 0; cold--) {
+      int64_t t = imageloader_bench_pass(urls, num, &im, cold, &failed);
+      TRACE(TRACE_INFO, "imagebench",
+            "%d images%s, %s: %d ms total, %d us/image, %d failed",
+            num, thumb ? " (thumbnails)" : "", cold ? "cold" : "warm",
+            (int)(t / 1000), num ? (int)(t / num) : 0, failed);
+    }
+  }
+
+  for(int i = 0; i < num; i++)
+    free(urls[i]);
+  app_shutdown(0);
+  return NULL;
+}
+
+
+#if ENABLE_LIBAV
+
+/**
+ * Video thumbnail sources
+ *
+ * Thumbnails are extracted by the image loader threads. An open movie
+ * is parked in a slot for a few seconds so requests for other
+ * timestamps in the same file (seek index, chapters) reuse the
+ * demuxer and decoder instead of opening the file again. Different
+ * files are processed in parallel, one per slot. A request for a file
+ * that is already being worked on waits for that slot.
+ */
+
+#define THUMB_SOURCES 4
+
+typedef struct thumbsrc {
+  char *ts_url;
+  AVFormatContext *ts_fctx;
+  AVCodecContext *ts_ctx;
+  AVCodecContext *ts_enc;  // MJPEG encoder for the blobcache copy
+  int ts_stream;
+  int ts_busy;
+  int64_t ts_last_use;
+} thumbsrc_t;
+
+static thumbsrc_t thumbsrcs[THUMB_SOURCES];
+
+
+/**
+ * Must be called with the slot held (ts_busy set)
+ */
 static void
-ifv_close(void)
+thumbsrc_close(thumbsrc_t *ts)
 {
-  free(ifv_url);
-  ifv_url = NULL;
+  if(ts->ts_ctx != NULL) {
+    avcodec_close(ts->ts_ctx);
+    ts->ts_ctx = NULL;
+  }
+
+  if(ts->ts_fctx != NULL) {
+    fa_libav_close_format(ts->ts_fctx, 0);
+    ts->ts_fctx = NULL;
+  }
 
-  if(ifv_ctx != NULL) {
-    avcodec_close(ifv_ctx);
-    ifv_ctx = NULL;
+  if(ts->ts_enc != NULL) {
+    avcodec_close(ts->ts_enc);
+    av_free(ts->ts_enc);
+    ts->ts_enc = NULL;
   }
+}
+
+
+/**
+ * Get the slot for 'url', or reclaim the least recently used idle one
+ */
+static thumbsrc_t *
+thumbsrc_acquire(const char *url)
+{
+  thumbsrc_t *ts, *victim;
+  int i, reclaim = 0;
 
-  if(ifv_fctx != NULL) {
-    fa_libav_close_format(ifv_fctx, 0);
-    ifv_fctx = NULL;
+  hts_mutex_lock(&thumbsrc_mutex);
+
+  while(1) {
+    victim = NULL;
+    for(i = 0; i < THUMB_SOURCES; i++) {
+      ts = &thumbsrcs[i];
+      if(ts->ts_url != NULL && !strcmp(ts->ts_url, url))
+        break;
+
+      if(ts->ts_busy)
+        continue;
+
+      if(victim == NULL || ts->ts_url == NULL ||
+         (victim->ts_url != NULL && ts->ts_last_use < victim->ts_last_use))
+        victim = ts;
+    }
+
+    if(i < THUMB_SOURCES) {
+      if(!ts->ts_busy)
+        break;
+    } else if(victim != NULL) {
+      ts = victim;
+      reclaim = ts->ts_url != NULL;
+      free(ts->ts_url);
+      ts->ts_url = strdup(url);
+      break;
+    }
+    hts_cond_wait(&thumbsrc_cond, &thumbsrc_mutex);
   }
+
+  ts->ts_busy = 1;
+  hts_mutex_unlock(&thumbsrc_mutex);
+
+  if(reclaim)
+    thumbsrc_close(ts);
+  return ts;
 }
 
+
 /**
  *
  */
 static void
-ifv_autoclose(callout_t *c, void *aux)
+thumbsrc_autoclose(callout_t *c, void *aux)
 {
-  if(hts_mutex_trylock(&image_from_video_mutex[1])) {
-    callout_arm(&thumb_flush_callout, ifv_autoclose, NULL, 5);
-  } else {
-    TRACE(TRACE_DEBUG, "Thumb", "Closing movie for thumb sources"); 
-    ifv_close();
-    hts_mutex_unlock(&image_from_video_mutex[1]);
+  const int64_t now = arch_get_ts();
+  int pending = 0;
+  int i;
+
+  hts_mutex_lock(&thumbsrc_mutex);
+
+  for(i = 0; i < THUMB_SOURCES; i++) {
+    thumbsrc_t *ts = &thumbsrcs[i];
+
+    if(ts->ts_url == NULL)
+      continue;
+
+    if(ts->ts_busy || now - ts->ts_last_use < 5000000) {
+      pending = 1;
+      continue;
+    }
+
+    TRACE(TRACE_DEBUG, "Thumb", "Closing movie %s for thumb sources",
+          ts->ts_url);
+
+    ts->ts_busy = 1;
+    hts_mutex_unlock(&thumbsrc_mutex);
+    thumbsrc_close(ts);
+    hts_mutex_lock(&thumbsrc_mutex);
+
+    free(ts->ts_url);
+    ts->ts_url = NULL;
+    ts->ts_busy = 0;
+    hts_cond_broadcast(&thumbsrc_cond);
   }
+
+  hts_mutex_unlock(&thumbsrc_mutex);
+
+  if(pending)
+    callout_arm(&thumb_flush_callout, thumbsrc_autoclose, NULL, 5);
 }
 
+
+/**
+ *
+ */
+static void
+thumbsrc_release(thumbsrc_t *ts)
+{
+  hts_mutex_lock(&thumbsrc_mutex);
+
+  const int is_open = ts->ts_fctx != NULL;
+  if(!is_open) {
+    free(ts->ts_url);
+    ts->ts_url = NULL;
+  }
+  ts->ts_busy = 0;
+  ts->ts_last_use = arch_get_ts();
+  hts_cond_broadcast(&thumbsrc_cond);
+  hts_mutex_unlock(&thumbsrc_mutex);
+
+  if(is_open)
+    callout_arm(&thumb_flush_callout, thumbsrc_autoclose, NULL, 5);
+}
+
+
 /**
  *
  */
 static void
-write_thumb(const AVCodecContext *src, const AVFrame *sframe, 
+write_thumb(thumbsrc_t *ts, const AVFrame *sframe,
             int width, int height, const char *cacheid, time_t mtime)
 {
+  const AVCodecContext *src = ts->ts_ctx;
+
   if(thumbcodec == NULL)
     return;
 
-  AVCodecContext *ctx = thumbctx;
+  AVCodecContext *ctx = ts->ts_enc;
 
   if(ctx == NULL || ctx->width  != width || ctx->height != height) {
-    
+
     if(ctx != NULL) {
       avcodec_close(ctx);
-      free(ctx);
+      av_free(ctx);
+      ts->ts_enc = NULL;
     }
 
     ctx = avcodec_alloc_context3(thumbcodec);
@@ -387,16 +837,16 @@ write_thumb(const AVCodecContext *src, const AVFrame *sframe,
 
     if(avcodec_open2(ctx, thumbcodec, NULL) < 0) {
       TRACE(TRACE_ERROR, "THUMB", "Unable to open thumb encoder");
-      thumbctx = NULL;
+      av_free(ctx);
       return;
     }
-    thumbctx = ctx;
+    ts->ts_enc = ctx;
   }
 
   AVFrame *oframe = av_frame_alloc();
 
   avpicture_alloc((AVPicture *)oframe, ctx->pix_fmt, width, height);
-      
+
   struct SwsContext *sws;
   sws = sws_getContext(src->width, src->height, src->pix_fmt,
                        width, height, ctx->pix_fmt, SWS_BILINEAR,
@@ -461,17 +911,43 @@ thumb_from_attachment(const char *url, int64_t offset, int size,
 }
 
 
+/**
+ * Open decoder, downscaled in the IDCT (lowres) if the codec can and
+ * the thumb is small enough
+ */
+static int
+thumbsrc_open_codec(thumbsrc_t *ts, AVCodecContext *ctx,
+                    const image_meta_t *im)
+{
+  AVCodec *codec = avcodec_find_decoder(ctx->codec_id);
+  if(codec == NULL)
+    return -1;
+
+  const int w = ctx->coded_width  ?: ctx->width;
+  const int h = ctx->coded_height ?: ctx->height;
+
+  ctx->lowres = MIN(codec->max_lowres,
+                    pixmap_compute_jpeg_downscale(im, w, h));
+
+  if(avcodec_open2(ctx, codec, NULL) < 0)
+    return -1;
+
+  ts->ts_ctx = ctx;
+  return 0;
+}
+
+
 /**
  *
  */
 static image_t *
-fa_image_from_video2(const char *url, const image_meta_t *im,
+fa_image_from_video2(thumbsrc_t *ts, const char *url, const image_meta_t *im,
 		     const char *cacheid, char *errbuf, size_t errlen,
 		     int sec, time_t mtime, cancellable_t *c)
 {
   image_t *img = NULL;
 
-  if(ifv_url == NULL || strcmp(url, ifv_url)) {
+  if(ts->ts_fctx == NULL) {
     // Need to open
     int i;
     AVFormatContext *fctx;
@@ -548,25 +1024,28 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
       return NULL;
     }
 
-    AVCodec *codec = avcodec_find_decoder(ctx->codec_id);
-    if(codec == NULL) {
+    if(thumbsrc_open_codec(ts, ctx, im)) {
       fa_libav_close_format(fctx, 0);
-      snprintf(errbuf, errlen, "Unable to find codec");
+      snprintf(errbuf, errlen, "Unable to open codec");
       return NULL;
     }
 
-    if(avcodec_open2(ctx, codec, NULL) < 0) {
-      fa_libav_close_format(fctx, 0);
+    ts->ts_stream = vstream;
+    ts->ts_fctx = fctx;
+
+  } else if(ts->ts_ctx->lowres > 0 &&
+            pixmap_compute_jpeg_downscale(im, ts->ts_ctx->coded_width,
+                                          ts->ts_ctx->coded_height) <
+            ts->ts_ctx->lowres) {
+    // Opened for a smaller thumb than this, reopen at higher resolution
+    AVCodecContext *ctx = ts->ts_ctx;
+    avcodec_close(ctx);
+    ts->ts_ctx = NULL;
+    if(thumbsrc_open_codec(ts, ctx, im)) {
+      thumbsrc_close(ts);
       snprintf(errbuf, errlen, "Unable to open codec");
       return NULL;
     }
-
-    ifv_close();
-
-    ifv_stream = vstream;
-    ifv_url = strdup(url);
-    ifv_fctx = fctx;
-    ifv_ctx = ctx;
   }
 
   AVPacket pkt;
@@ -575,14 +1054,18 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
 
 #define MAX_FRAME_SCAN 500
 
+  // Number of packets we look for a keyframe before decoding everything
+#define KEYFRAME_SCAN 30
+
   int cnt = MAX_FRAME_SCAN;
 
-  AVStream *st = ifv_fctx->streams[ifv_stream];
+  AVStream *st = ts->ts_fctx->streams[ts->ts_stream];
+  AVCodecContext *ctx = ts->ts_ctx;
 
   if(sec == -1) {
     // Automatically try to find a good frame
 
-    int duration_in_seconds = ifv_fctx->duration / 1000000;
+    int duration_in_seconds = ts->ts_fctx->duration / 1000000;
 
 
     sec = MAX(1, duration_in_seconds * 0.05); // 5% of duration
@@ -593,30 +1076,41 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
   }
 
 
-  int64_t ts = av_rescale(sec, st->time_base.den, st->time_base.num);
+  int64_t ts_pts = av_rescale(sec, st->time_base.den, st->time_base.num);
   int delayed_seek = 0;
 
-  if(ifv_ctx->codec_id == AV_CODEC_ID_RV40 ||
-     ifv_ctx->codec_id == AV_CODEC_ID_RV30) {
+  if(ctx->codec_id == AV_CODEC_ID_RV40 ||
+     ctx->codec_id == AV_CODEC_ID_RV30) {
     // Must decode one frame
     delayed_seek = 1;
   } else {
-    if(av_seek_frame(ifv_fctx, ifv_stream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
-      ifv_close();
-      snprintf(errbuf, errlen, "Unable to seek to %"PRId64, ts);
+    if(av_seek_frame(ts->ts_fctx, ts->ts_stream, ts_pts,
+                     AVSEEK_FLAG_BACKWARD) < 0) {
+      thumbsrc_close(ts);
+      snprintf(errbuf, errlen, "Unable to seek to %"PRId64, ts_pts);
+      av_frame_free(&frame);
       return NULL;
     }
   }
 
-  avcodec_flush_buffers(ifv_ctx);
-  
+  avcodec_flush_buffers(ctx);
+
+  /*
+   * The backward seek lands on the keyframe at or before the requested
+   * position, which is good enough for a thumbnail. So only decode
+   * keyframes, and skip the loop filter as well. If the stream doesn't
+   * flag its keyframes we fall back to decoding our way up to the
+   * requested position
+   */
+  int keyframe_only = !delayed_seek;
+
   int i = 0;
   while(1) {
     int r;
 
     i++;
-    
-    r = av_read_frame(ifv_fctx, &pkt);
+
+    r = av_read_frame(ts->ts_fctx, &pkt);
 
     if(r == AVERROR(EAGAIN))
       continue;
@@ -631,26 +1125,47 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     }
 
     if(r != 0) {
-      ifv_close();
+      thumbsrc_close(ts);
       break;
     }
 
-    if(pkt.stream_index != ifv_stream) {
+    if(pkt.stream_index != ts->ts_stream) {
       av_free_packet(&pkt);
       continue;
     }
     cnt--;
-    int want_pic = pkt.pts >= ts || cnt <= 0;
 
-    ifv_ctx->skip_frame = want_pic ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
+    if(keyframe_only && i > KEYFRAME_SCAN)
+      keyframe_only = 0;
+
+    int want_pic = keyframe_only || pkt.pts >= ts_pts || cnt <= 0;
+
+    if(keyframe_only) {
+      ctx->skip_frame = AVDISCARD_NONKEY;
+      ctx->skip_loop_filter = AVDISCARD_ALL;
+    } else {
+      ctx->skip_frame = want_pic ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
+      ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+    }
+
+    const int is_key = pkt.flags & AV_PKT_FLAG_KEY;
 
-    avcodec_decode_video2(ifv_ctx, frame, &got_pic, &pkt);
+    avcodec_decode_video2(ctx, frame, &got_pic, &pkt);
     av_free_packet(&pkt);
 
+    if(keyframe_only && is_key && !got_pic) {
+      // Drain the decoder, it may hold on to the picture for reordering
+      av_init_packet(&pkt);
+      pkt.data = NULL;
+      pkt.size = 0;
+      avcodec_decode_video2(ctx, frame, &got_pic, &pkt);
+    }
+
     if(delayed_seek) {
       delayed_seek = 0;
-      if(av_seek_frame(ifv_fctx, ifv_stream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
-        ifv_close();
+      if(av_seek_frame(ts->ts_fctx, ts->ts_stream, ts_pts,
+                       AVSEEK_FLAG_BACKWARD) < 0) {
+        thumbsrc_close(ts);
         break;
       }
       continue;
@@ -672,10 +1187,10 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
       h = im->im_req_height;
     } else if(im->im_req_width != -1) {
       w = im->im_req_width;
-      h = im->im_req_width * ifv_ctx->height / ifv_ctx->width;
+      h = im->im_req_width * ctx->height / ctx->width;
 
     } else if(im->im_req_height != -1) {
-      w = im->im_req_height * ifv_ctx->width / ifv_ctx->height;
+      w = im->im_req_height * ctx->width / ctx->height;
       h = im->im_req_height;
     } else {
       w = im->im_req_width;
@@ -685,24 +1200,24 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     pixmap_t *pm = pixmap_create(w, h, PIXMAP_BGR32, 0);
 
     if(pm == NULL) {
-      ifv_close();
+      thumbsrc_close(ts);
       snprintf(errbuf, errlen, "Out of memory");
-      av_free(frame);
+      av_frame_free(&frame);
       return NULL;
     }
 
     struct SwsContext *sws;
-    sws = sws_getContext(ifv_ctx->width, ifv_ctx->height, ifv_ctx->pix_fmt,
+    sws = sws_getContext(ctx->width, ctx->height, ctx->pix_fmt,
 			 w, h, AV_PIX_FMT_BGR32, SWS_BILINEAR,
                          NULL, NULL, NULL);
     if(sws == NULL) {
-      ifv_close();
+      thumbsrc_close(ts);
       snprintf(errbuf, errlen, "Scaling failed");
       pixmap_release(pm);
-      av_free(frame);
+      av_frame_free(&frame);
       return NULL;
     }
-    
+
     uint8_t *ptr[4] = {0,0,0,0};
     int strides[4] = {0,0,0,0};
 
@@ -710,11 +1225,11 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     strides[0] = pm->pm_linesize;
 
     sws_scale(sws, (const uint8_t **)frame->data, frame->linesize,
-	      0, ifv_ctx->height, ptr, strides);
+	      0, ctx->height, ptr, strides);
 
     sws_freeContext(sws);
 
-    write_thumb(ifv_ctx, frame, w, h, cacheid, mtime);
+    write_thumb(ts, frame, w, h, cacheid, mtime);
 
     img = image_create_from_pixmap(pm);
     pixmap_release(pm);
@@ -724,13 +1239,11 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
 
   av_frame_free(&frame);
   if(img == NULL)
-    snprintf(errbuf, errlen, "Frame not found (scanned %d)", 
+    snprintf(errbuf, errlen, "Frame not found (scanned %d)",
 	     MAX_FRAME_SCAN - cnt);
 
-  if(ifv_ctx != NULL) {
-    avcodec_flush_buffers(ifv_ctx);
-    callout_arm(&thumb_flush_callout, ifv_autoclose, NULL, 5);
-  }
+  if(ts->ts_ctx != NULL)
+    avcodec_flush_buffers(ts->ts_ctx);
   return img;
 }
 
@@ -760,19 +1273,19 @@ fa_image_from_video(const char *url0, const image_meta_t *im,
   else
     secs = atoi(tim);
 
-  hts_mutex_lock(&image_from_video_mutex[0]);
+  hts_mutex_lock(&image_from_video_mutex);
 
   if(strcmp(url, stated_url ?: "")) {
     free(stated_url);
     stated_url = NULL;
     if(fa_stat_ex(url, &fs, errbuf, errlen, FA_NON_INTERACTIVE)) {
-      hts_mutex_unlock(&image_from_video_mutex[0]);
+      hts_mutex_unlock(&image_from_video_mutex);
       return NULL;
     }
     stated_url = strdup(url);
   }
   stattime = fs.fs_mtime;
-  hts_mutex_unlock(&image_from_video_mutex[0]);
+  hts_mutex_unlock(&image_from_video_mutex);
 
   if(im->im_req_width < 100 && im->im_req_height < 100) {
     siz = "min";
@@ -796,10 +1309,21 @@ fa_image_from_video(const char *url0, const image_meta_t *im,
     return NULL;
   }
 
-  hts_mutex_lock(&image_from_video_mutex[1]);
-  img = fa_image_from_video2(url, im, cacheid, errbuf, errlen,
+  thumbsrc_t *ts = thumbsrc_acquire(url);
+
+  // Someone else may have produced it while we were waiting for the slot
+  b = blobcache_get(cacheid, "videothumb", 0, 0, NULL, &mtime);
+  if(b != NULL && mtime == stattime) {
+    thumbsrc_release(ts);
+    img = image_coded_create_from_buf(b, IMAGE_JPEG);
+    buf_release(b);
+    return img;
+  }
+  buf_release(b);
+
+  img = fa_image_from_video2(ts, url, im, cacheid, errbuf, errlen,
                              secs, stattime, c);
-  hts_mutex_unlock(&image_from_video_mutex[1]);
+  thumbsrc_release(ts);
   if(img != NULL)
     img->im_flags |= IMAGE_ADAPTED;
   return img;
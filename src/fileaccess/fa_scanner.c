@@ -295,6 +295,30 @@ tryplay(scanner_t *s)
 }
 
 
+/**
+ * Load play counts, etc for all entries with a single query instead of
+ * a few per item when they are bound by deep_probe()
+ */
+static void
+prefetch_kvstore(scanner_t *s)
+{
+  fa_dir_entry_t *fde;
+  int n = 0;
+
+  if(s->s_fd->fd_count == 0)
+    return;
+
+  const char **urls = malloc(sizeof(char *) * s->s_fd->fd_count);
+  RB_FOREACH(fde, &s->s_fd->fd_entries, fde_link) {
+    if(n == s->s_fd->fd_count)
+      break;
+    urls[n++] = rstr_get(fde->fde_url);
+  }
+  kv_url_opt_prefetch(urls, n, KVSTORE_DOMAIN_SYS);
+  free(urls);
+}
+
+
 /**
  *
  */
@@ -563,6 +587,7 @@ doscan(scanner_t *s)
 
   if(s->s_fd != NULL) {
 
+    prefetch_kvstore(s);
     analyzer(s, 0);
 
     if(s->s_nodes != NULL) {
@@ -28,6 +28,234 @@
 #include "htsmsg.h"
 
 #include "main.h"
+
+#ifdef LOCAL_MAIN
+static int lm_no_arena;
+#endif
+
+#define HTSMSG_ARENA_CHUNK_MIN  4096
+#define HTSMSG_ARENA_CHUNK_MAX  65536
+
+// Maps with at least this many fields get a name lookup hash
+#define HTSMSG_INDEX_THRESHOLD  16
+
+typedef struct htsmsg_arena_chunk {
+  struct htsmsg_arena_chunk *hac_next;
+  char hac_data[0] __attribute__((aligned(16)));
+} htsmsg_arena_chunk_t;
+
+struct htsmsg_arena {
+  atomic_t ha_refcount;
+  int ha_sealed;
+  htsmsg_arena_chunk_t *ha_chunks;
+  char *ha_ptr;
+  size_t ha_avail;
+  size_t ha_chunk_size;
+};
+
+
+/**
+ *
+ */
+htsmsg_arena_t *
+htsmsg_arena_create(void)
+{
+#ifdef LOCAL_MAIN
+  if(lm_no_arena)
+    return NULL; // Messages are created on the heap then
+#endif
+  htsmsg_arena_t *ha = calloc(1, sizeof(htsmsg_arena_t));
+  atomic_set(&ha->ha_refcount, 1);
+  ha->ha_chunk_size = HTSMSG_ARENA_CHUNK_MIN;
+  return ha;
+}
+
+
+/**
+ *
+ */
+static void
+htsmsg_arena_release(htsmsg_arena_t *ha)
+{
+  htsmsg_arena_chunk_t *hac;
+
+  if(atomic_dec(&ha->ha_refcount))
+    return;
+
+  while((hac = ha->ha_chunks) != NULL) {
+    ha->ha_chunks = hac->hac_next;
+    free(hac);
+  }
+  free(ha);
+}
+
+
+/**
+ *
+ */
+void
+htsmsg_arena_finish(htsmsg_arena_t *ha)
+{
+  if(ha == NULL)
+    return;
+  ha->ha_sealed = 1;
+  htsmsg_arena_release(ha);
+}
+
+
+/**
+ * Chunks double in size (up to a limit) so large documents end up in
+ * a handful of blocks. Allocations that are large compared to the chunk
+ * size get a chunk of their own so we don't waste the current one.
+ *
+ * Returns NULL if out of memory, callers fall back to the heap.
+ */
+static void *
+htsmsg_arena_alloc(htsmsg_arena_t *ha, size_t size)
+{
+  htsmsg_arena_chunk_t *hac;
+  void *r;
+
+  size = (size + 7) & ~7;
+
+  if(size <= ha->ha_avail) {
+    r = ha->ha_ptr;
+    ha->ha_ptr += size;
+    ha->ha_avail -= size;
+    return r;
+  }
+
+  if(size > ha->ha_chunk_size / 4) {
+    hac = malloc(sizeof(htsmsg_arena_chunk_t) + size);
+    if(hac == NULL)
+      return NULL;
+    hac->hac_next = ha->ha_chunks;
+    ha->ha_chunks = hac;
+    return hac->hac_data;
+  }
+
+  hac = malloc(sizeof(htsmsg_arena_chunk_t) + ha->ha_chunk_size);
+  if(hac == NULL)
+    return NULL;
+  hac->hac_next = ha->ha_chunks;
+  ha->ha_chunks = hac;
+  ha->ha_ptr = hac->hac_data + size;
+  ha->ha_avail = ha->ha_chunk_size - size;
+
+  if(ha->ha_chunk_size < HTSMSG_ARENA_CHUNK_MAX)
+    ha->ha_chunk_size *= 2;
+  return hac->hac_data;
+}
+
+
+/**
+ *
+ */
+static htsmsg_arena_t *
+htsmsg_arena_get(htsmsg_t *msg)
+{
+  htsmsg_arena_t *ha = msg->hm_arena;
+  return ha != NULL && !ha->ha_sealed ? ha : NULL;
+}
+
+
+/**
+ *
+ */
+static char *
+htsmsg_arena_strdupl(htsmsg_arena_t *ha, const char *str, size_t len)
+{
+  char *r = htsmsg_arena_alloc(ha, len + 1);
+  if(r == NULL)
+    return NULL;
+  memcpy(r, str, len);
+  r[len] = 0;
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+htsmsg_index_drop(htsmsg_t *msg)
+{
+  free(msg->hm_index);
+  msg->hm_index = NULL;
+}
+
+
+/**
+ * Insert into open addressing hash of field names. For duplicate names
+ * only the first one (in message order) is kept as that is what a
+ * linear search would find.
+ */
+static void
+htsmsg_index_insert(htsmsg_field_t **index, unsigned int mask,
+                    htsmsg_field_t *f)
+{
+  htsmsg_field_t *g;
+  unsigned int h;
+
+  if(f->hmf_name == NULL)
+    return;
+
+  h = mystrhash(f->hmf_name) & mask;
+  while((g = index[h]) != NULL) {
+    if(!strcmp(g->hmf_name, f->hmf_name))
+      return;
+    h = (h + 1) & mask;
+  }
+  index[h] = f;
+}
+
+
+/**
+ * The index is kept up to date by the functions modifying the message
+ * so htsmsg_field_find() never writes to it. Since a message can be
+ * shared (retained) that would otherwise not be safe for readers.
+ */
+static void
+htsmsg_index_build(htsmsg_t *msg)
+{
+  htsmsg_field_t *f, **index;
+  unsigned int size = 32;
+
+  while(size < msg->hm_num_fields * 2)
+    size *= 2;
+
+  index = calloc(size, sizeof(htsmsg_field_t *));
+  if(index == NULL)
+    return; // Lookups will just do linear search
+
+  HTSMSG_FOREACH(f, msg)
+    htsmsg_index_insert(index, size - 1, f);
+
+  msg->hm_index_mask = size - 1;
+  msg->hm_index = index;
+}
+
+
+/**
+ * Called when 'f' has been appended to 'msg'
+ */
+static void
+htsmsg_index_add(htsmsg_t *msg, htsmsg_field_t *f)
+{
+  if(msg->hm_islist || msg->hm_num_fields < HTSMSG_INDEX_THRESHOLD)
+    return;
+
+  if(msg->hm_index != NULL && msg->hm_num_fields * 2 <= msg->hm_index_mask) {
+    htsmsg_index_insert(msg->hm_index, msg->hm_index_mask, f);
+    return;
+  }
+
+  // Not built yet or too full
+  htsmsg_index_drop(msg);
+  htsmsg_index_build(msg);
+}
+
+
 /**
  *
  */
@@ -35,6 +263,13 @@ void
 htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f)
 {
   TAILQ_REMOVE(&msg->hm_fields, f, hmf_link);
+  msg->hm_num_fields--;
+  if(msg->hm_index != NULL) {
+    // Entries can't be removed from an open addressing hash, start over
+    htsmsg_index_drop(msg);
+    if(msg->hm_num_fields >= HTSMSG_INDEX_THRESHOLD)
+      htsmsg_index_build(msg);
+  }
 
   htsmsg_release(f->hmf_childs);
 
@@ -51,37 +286,64 @@ htsmsg_field_destroy(htsmsg_t *msg, htsmsg_field_t *f)
   if(f->hmf_flags & HMF_NAME_ALLOCED)
     free(f->hmf_name);
   rstr_release(f->hmf_namespace);
-  free(f);
+  if(!(f->hmf_flags & HMF_IN_ARENA))
+    free(f);
 }
 
 /**
  *
  */
 htsmsg_field_t *
-htsmsg_field_add(htsmsg_t *msg, const char *name, int type, int flags)
+htsmsg_field_add_raw(htsmsg_t *msg, const char *name, int type, int flags)
 {
-  htsmsg_field_t *f = malloc(sizeof(htsmsg_field_t));
+  htsmsg_arena_t *ha = htsmsg_arena_get(msg);
+  htsmsg_field_t *f = NULL;
+
+  if(ha != NULL && (f = htsmsg_arena_alloc(ha, sizeof(htsmsg_field_t))))
+    flags |= HMF_IN_ARENA;
+  else
+    f = malloc(sizeof(htsmsg_field_t));
+
   f->hmf_childs = NULL;
   f->hmf_namespace = NULL;
   TAILQ_INSERT_TAIL(&msg->hm_fields, f, hmf_link);
-
-  if(msg->hm_islist) {
-    assert(name == NULL);
+  msg->hm_num_fields++;
+
+  if(flags & HMF_NAME_ALLOCED) {
+    if(name == NULL) {
+      f->hmf_name = NULL;
+    } else if(ha != NULL &&
+              (f->hmf_name = htsmsg_arena_strdupl(ha, name, strlen(name)))) {
+      flags &= ~HMF_NAME_ALLOCED;
+    } else {
+      f->hmf_name = strdup(name);
+    }
   } else {
-    assert(name != NULL);
-  }
-
-  if(flags & HMF_NAME_ALLOCED)
-    f->hmf_name = name ? strdup(name) : NULL;
-  else
     f->hmf_name = (char *)name;
+  }
 
   f->hmf_type = type;
   f->hmf_flags = flags;
+  htsmsg_index_add(msg, f);
   return f;
 }
 
 
+/**
+ *
+ */
+htsmsg_field_t *
+htsmsg_field_add(htsmsg_t *msg, const char *name, int type, int flags)
+{
+  if(msg->hm_islist) {
+    assert(name == NULL);
+  } else {
+    assert(name != NULL);
+  }
+  return htsmsg_field_add_raw(msg, name, type, flags);
+}
+
+
 /*
  *
  */
@@ -99,6 +361,16 @@ htsmsg_field_find(htsmsg_t *msg, const char *name)
     return NULL;
   }
 
+  if(msg->hm_index != NULL) {
+    unsigned int h = mystrhash(name) & msg->hm_index_mask;
+    while((f = msg->hm_index[h]) != NULL) {
+      if(!strcmp(f->hmf_name, name))
+        return f;
+      h = (h + 1) & msg->hm_index_mask;
+    }
+    return NULL;
+  }
+
   TAILQ_FOREACH(f, &msg->hm_fields, hmf_link) {
     if(f->hmf_name != NULL && !strcmp(f->hmf_name, name))
       return f;
@@ -149,6 +421,68 @@ htsmsg_create_list(void)
 }
 
 
+/**
+ *
+ */
+static htsmsg_t *
+htsmsg_create_in(htsmsg_arena_t *ha, int islist)
+{
+  htsmsg_t *msg = NULL;
+
+  if(ha == NULL || ha->ha_sealed ||
+     (msg = htsmsg_arena_alloc(ha, sizeof(htsmsg_t))) == NULL)
+    return islist ? htsmsg_create_list() : htsmsg_create_map();
+
+  memset(msg, 0, sizeof(htsmsg_t));
+  msg->hm_refcount = 1;
+  TAILQ_INIT(&msg->hm_fields);
+  msg->hm_islist = islist;
+  msg->hm_in_arena = 1;
+  msg->hm_arena = ha;
+  atomic_inc(&ha->ha_refcount);
+  return msg;
+}
+
+
+/**
+ *
+ */
+htsmsg_t *
+htsmsg_create_map_in(htsmsg_arena_t *ha)
+{
+  return htsmsg_create_in(ha, 0);
+}
+
+
+/**
+ *
+ */
+htsmsg_t *
+htsmsg_create_list_in(htsmsg_arena_t *ha)
+{
+  return htsmsg_create_in(ha, 1);
+}
+
+
+/**
+ *
+ */
+void
+htsmsg_field_set_strl(htsmsg_t *msg, htsmsg_field_t *f,
+                      const char *str, size_t len)
+{
+  htsmsg_arena_t *ha = htsmsg_arena_get(msg);
+
+  if(ha != NULL && (f->hmf_str = htsmsg_arena_strdupl(ha, str, len)) != NULL)
+    return;
+
+  f->hmf_str = malloc(len + 1);
+  memcpy(f->hmf_str, str, len);
+  f->hmf_str[len] = 0;
+  f->hmf_flags |= HMF_ALLOCED;
+}
+
+
 /**
  *
  */
@@ -164,12 +498,18 @@ htsmsg_release(htsmsg_t *msg)
   if(msg->hm_refcount > 0)
     return;
 
+  // Don't make htsmsg_field_destroy() rebuild it for every field
+  htsmsg_index_drop(msg);
 
   while((f = TAILQ_FIRST(&msg->hm_fields)) != NULL)
     htsmsg_field_destroy(msg, f);
 
   buf_release(msg->hm_backing_store);
-  free(msg);
+
+  if(msg->hm_in_arena)
+    htsmsg_arena_release(msg->hm_arena);
+  else
+    free(msg);
 }
 
 /**
@@ -252,9 +592,8 @@ htsmsg_add_dbl(htsmsg_t *msg, const char *name, double dbl)
 void
 htsmsg_add_str(htsmsg_t *msg, const char *name, const char *str)
 {
-  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_STR, 
-				        HMF_ALLOCED | HMF_NAME_ALLOCED);
-  f->hmf_str = strdup(str);
+  htsmsg_field_t *f = htsmsg_field_add(msg, name, HMF_STR, HMF_NAME_ALLOCED);
+  htsmsg_field_set_strl(msg, f, str, strlen(str));
 }
 
 /*
@@ -721,9 +1060,184 @@ htsmsg_get_map_by_field_if_name(htsmsg_field_t *f, const char *name)
 int
 htsmsg_get_children(htsmsg_t *msg)
 {
-  htsmsg_field_t *f;
-  int cnt = 0;
-  TAILQ_FOREACH(f, &msg->hm_fields, hmf_link)
-    cnt++;
-  return cnt;
+  return msg->hm_num_fields;
+}
+
+
+
+/**
+ * Parse benchmark, arena vs. plain heap allocation. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Iext -Ibuild.linux -c src/htsmsg/htsmsg.c \
+ *   -o /tmp/htsmsg.o
+ * gcc -O2 -Isrc -Iext -Ibuild.linux /tmp/htsmsg.o src/htsmsg/htsmsg_json.c \
+ *   src/htsmsg/htsmsg_xml.c src/htsmsg/htsbuf.c src/misc/json.c \
+ *   src/misc/dbl.c src/misc/buf.c src/misc/rstr.c -o /tmp/htsmsgbench -lm
+ *
+ * (htsmsg_xml.c and json.c have test mains of their own, so only this
+ * file is compiled with LOCAL_MAIN)
+ */
+#ifdef LOCAL_MAIN
+#include <sys/time.h>
+#include "htsmsg_json.h"
+#include "htsmsg_xml.h"
+#include "misc/str.h"
+
+void *
+mymalloc(size_t size)
+{
+  return malloc(size);
+}
+
+void
+tracelog(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+}
+
+void
+hexdump(const char *pfx, const void *data, int len)
+{
+}
+
+int
+html_entity_lookup(const char *name)
+{
+  return -1;
+}
+
+int
+utf8_get(const char **s)
+{
+  const uint8_t *p = (const uint8_t *)*s;
+  int c = *p++, l = 0;
+
+  if(c >= 0xf0)
+    c &= 0x07, l = 3;
+  else if(c >= 0xe0)
+    c &= 0x0f, l = 2;
+  else if(c >= 0xc0)
+    c &= 0x1f, l = 1;
+
+  for(; l > 0 && (*p & 0xc0) == 0x80; l--)
+    c = c << 6 | (*p++ & 0x3f);
+  *s = (const char *)p;
+  return l ? 0xfffd : c;
+}
+
+int
+utf8_put(char *out, int c)
+{
+  int l = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+  if(out) {
+    static const uint8_t lead[5] = {0, 0, 0xc0, 0xe0, 0xf0};
+    for(int i = l - 1; i > 0; i--, c >>= 6)
+      out[i] = 0x80 | (c & 0x3f);
+    out[0] = lead[l] | c;
+  }
+  return l;
+}
+
+
+static int64_t
+lm_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+
+/**
+ * Something like a catalog response from a plugin API
+ */
+static char *
+lm_json_doc(int entries)
+{
+  size_t size = entries * 400 + 100, off = 0;
+  char *doc = malloc(size);
+
+  off += snprintf(doc + off, size - off, "{\"items\":[");
+  for(int i = 0; i < entries; i++)
+    off += snprintf(doc + off, size - off,
+                    "%s{\"id\":%d,\"title\":\"Title number %d\","
+                    "\"description\":\"Some words about item %d\","
+                    "\"rating\":%d.5,\"year\":%d,\"hd\":true,"
+                    "\"url\":\"http://example.com/items/%d\","
+                    "\"tags\":[\"one\",\"two\",\"three\"],\"parent\":null}",
+                    i ? "," : "", i, i, i, i % 10, 1950 + i % 70, i);
+  snprintf(doc + off, size - off, "]}");
+  return doc;
+}
+
+
+/**
+ * Something like an UPnP DIDL-Lite browse response
+ */
+static char *
+lm_xml_doc(int entries)
+{
+  size_t size = entries * 500 + 200, off = 0;
+  char *doc = malloc(size);
+
+  off += snprintf(doc + off, size - off,
+                  "<?xml version=\"1.0\"?>"
+                  "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/"
+                  "DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+                  " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">");
+  for(int i = 0; i < entries; i++)
+    off += snprintf(doc + off, size - off,
+                    "<item id=\"%d\" parentID=\"0\" restricted=\"1\">"
+                    "<dc:title>Track number %d</dc:title>"
+                    "<dc:creator>Some artist</dc:creator>"
+                    "<upnp:album>Some album</upnp:album>"
+                    "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+                    "<res protocolInfo=\"http-get:*:audio/mpeg:*\" "
+                    "duration=\"0:03:%02d\">http://10.0.0.1/track/%d.mp3</res>"
+                    "</item>", i, i, i % 60, i);
+  snprintf(doc + off, size - off, "</DIDL-Lite>");
+  return doc;
+}
+
+
+static void
+lm_bench(const char *name, const char *doc, int xml)
+{
+  const int rounds = 20;
+  char errbuf[256];
+
+  for(int mode = 0; mode < 2; mode++) {
+    lm_no_arena = !mode;
+    int64_t ts = lm_ts();
+    for(int i = 0; i < rounds; i++) {
+      htsmsg_t *m = xml ?
+        htsmsg_xml_deserialize_cstr(doc, errbuf, sizeof(errbuf)) :
+        htsmsg_json_deserialize2(doc, errbuf, sizeof(errbuf));
+      if(m == NULL) {
+        printf("%s: parse failed: %s\n", name, errbuf);
+        exit(1);
+      }
+      htsmsg_release(m);
+    }
+    ts = lm_ts() - ts;
+    printf("%s %-5s: %6.2f ms per document (parse + release)\n",
+           name, mode ? "arena" : "heap", ts / 1000.0 / rounds);
+  }
+}
+
+
+int
+main(int argc, char **argv)
+{
+  const int entries = argc > 1 ? atoi(argv[1]) : 20000;
+  char *doc;
+
+  doc = lm_json_doc(entries);
+  lm_bench("JSON", doc, 0);
+  free(doc);
+
+  doc = lm_xml_doc(entries);
+  lm_bench("XML ", doc, 1);
+  free(doc);
+  return 0;
 }
+#endif
@@ -30,10 +30,17 @@
 
 TAILQ_HEAD(htsmsg_field_queue, htsmsg_field);
 
+typedef struct htsmsg_arena htsmsg_arena_t;
+
 typedef struct htsmsg {
   struct htsmsg_field_queue hm_fields;
   buf_t *hm_backing_store;
+  htsmsg_arena_t *hm_arena;
+  struct htsmsg_field **hm_index; // Name lookup hash for large maps
+  unsigned int hm_index_mask;
+  unsigned int hm_num_fields;
   uint8_t hm_islist;
+  uint8_t hm_in_arena;
   int hm_refcount;
 } htsmsg_t;
 
@@ -54,6 +61,7 @@ typedef struct htsmsg_field {
 #define HMF_ALLOCED       0x1
 #define HMF_NAME_ALLOCED  0x2
 #define HMF_XML_ATTRIBUTE 0x4 // XML attribute
+#define HMF_IN_ARENA      0x8 // Field struct is allocated from msg's arena
 
   union {
     int64_t  s64;
@@ -98,6 +106,36 @@ htsmsg_t *htsmsg_create_map(void);
  */
 htsmsg_t *htsmsg_create_list(void);
 
+/**
+ * Arenas
+ *
+ * Parsers allocate all messages, fields, names and strings of a document
+ * from one arena so the entire tree is just a few blocks of memory that
+ * are freed when the last message referring to the arena is released.
+ *
+ * Once the parser is done it calls htsmsg_arena_finish() which drops the
+ * parser's reference and seals the arena. Fields added to the messages
+ * after that are allocated from the heap as usual. This means the arena
+ * itself never needs locking.
+ */
+htsmsg_arena_t *htsmsg_arena_create(void);
+
+void htsmsg_arena_finish(htsmsg_arena_t *ha);
+
+/**
+ * Create a new map / list in the given arena
+ */
+htsmsg_t *htsmsg_create_map_in(htsmsg_arena_t *ha);
+
+htsmsg_t *htsmsg_create_list_in(htsmsg_arena_t *ha);
+
+/**
+ * Set string of field \p f to a copy of \p str (\p len bytes).
+ * Allocates from msg's arena if possible.
+ */
+void htsmsg_field_set_strl(htsmsg_t *msg, htsmsg_field_t *f,
+                           const char *str, size_t len);
+
 /**
  * Remove a given field from a msg
  */
@@ -287,6 +325,14 @@ htsmsg_t *htsmsg_detach_submsg(htsmsg_field_t *f);
  */
 void htsmsg_print(const char *prefix, htsmsg_t *msg);
 
+/**
+ * Same as htsmsg_field_add() but does not require maps to have named
+ * fields and lists to have unnamed ones. For deserializers that must
+ * keep whatever is on the wire.
+ */
+htsmsg_field_t *htsmsg_field_add_raw(htsmsg_t *msg, const char *name,
+                                     int type, int flags);
+
 /**
  * Create a new field. Primarily intended for htsmsg internal functions.
  */
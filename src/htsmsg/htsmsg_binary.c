@@ -34,7 +34,7 @@ htsmsg_binary_des0(htsmsg_t *msg, const uint8_t *buf, size_t len, buf_t *src)
   unsigned type, namelen, datalen;
   htsmsg_field_t *f;
   htsmsg_t *sub;
-  char *n;
+  char name[256];
   uint64_t u64;
   int i;
 
@@ -53,31 +53,29 @@ htsmsg_binary_des0(htsmsg_t *msg, const uint8_t *buf, size_t len, buf_t *src)
     if(len < namelen + datalen)
       return -1;
 
-    f = calloc(1, sizeof(htsmsg_field_t));
-    f->hmf_type  = type;
-
-    if(namelen > 0) {
-      n = malloc(namelen + 1);
-      memcpy(n, buf, namelen);
-      n[namelen] = 0;
-
-      buf += namelen;
-      len -= namelen;
-      f->hmf_flags = HMF_NAME_ALLOCED;
-
-    } else {
-      n = NULL;
-      f->hmf_flags = 0;
+    switch(type) {
+    case HMF_STR:
+    case HMF_BIN:
+    case HMF_S64:
+    case HMF_MAP:
+    case HMF_LIST:
+      break;
+    default:
+      return -1;
     }
 
-    f->hmf_name  = n;
+    memcpy(name, buf, namelen);
+    name[namelen] = 0;
+    buf += namelen;
+    len -= namelen;
+
+    // Unnamed fields in maps (and named in lists) are kept as they are
+    f = htsmsg_field_add_raw(msg, namelen ? name : NULL, type,
+                             HMF_NAME_ALLOCED);
 
     switch(type) {
     case HMF_STR:
-      f->hmf_str = n = malloc(datalen + 1);
-      memcpy(n, buf, datalen);
-      n[datalen] = 0;
-      f->hmf_flags |= HMF_ALLOCED;
+      htsmsg_field_set_strl(msg, f, (const char *)buf, datalen);
       break;
 
     case HMF_BIN:
@@ -96,23 +94,17 @@ htsmsg_binary_des0(htsmsg_t *msg, const uint8_t *buf, size_t len, buf_t *src)
       break;
 
     case HMF_MAP:
-      sub = htsmsg_create_map();
+      sub = htsmsg_create_map_in(msg->hm_arena);
       if(0)
     case HMF_LIST:
-        sub = htsmsg_create_list();
+        sub = htsmsg_create_list_in(msg->hm_arena);
 
       f->hmf_childs = sub;
       if(htsmsg_binary_des0(sub, buf, datalen, src) < 0)
 	return -1;
       break;
-
-    default:
-      free(n);
-      free(f);
-      return -1;
     }
 
-    TAILQ_INSERT_TAIL(&msg->hm_fields, f, hmf_link);
     buf += datalen;
     len -= datalen;
   }
@@ -126,11 +118,13 @@ htsmsg_binary_des0(htsmsg_t *msg, const uint8_t *buf, size_t len, buf_t *src)
 htsmsg_t *
 htsmsg_binary_deserialize(buf_t *buf)
 {
-  htsmsg_t *msg = htsmsg_create_map();
+  htsmsg_arena_t *ha = htsmsg_arena_create();
+  htsmsg_t *msg = htsmsg_create_map_in(ha);
   if(htsmsg_binary_des0(msg, buf_data(buf), buf_len(buf), buf) < 0) {
     htsmsg_release(msg);
-    return NULL;
+    msg = NULL;
   }
+  htsmsg_arena_finish(ha);
   return msg;
 }
 
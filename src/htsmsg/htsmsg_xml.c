@@ -54,6 +54,7 @@
 #include "htsmsg_xml.h"
 #include "htsbuf.h"
 #include "misc/str.h"
+#include "misc/minmax.h"
 
 TAILQ_HEAD(cdata_content_queue, cdata_content);
 
@@ -84,6 +85,8 @@ typedef struct xmlparser {
 
   struct xmlns_list xp_namespaces;
 
+  htsmsg_arena_t *xp_arena;
+
 } xmlparser_t;
 
 #define xmlerr2(xp, pos, fmt, ...) do {                                 \
@@ -333,11 +336,8 @@ htsmsg_xml_parse_attrib(xmlparser_t *xp, htsmsg_t *msg, char *src,
     char *a = mystrndupa(attribname, attriblen);
 
     htsmsg_field_t *f = add_xml_field(xp, msg, a, HMF_STR,
-                                      HMF_XML_ATTRIBUTE | HMF_NAME_ALLOCED |
-                                      HMF_ALLOCED);
-    f->hmf_str = malloc(payloadlen + 1);
-    memcpy(f->hmf_str, payload, payloadlen);
-    f->hmf_str[payloadlen] = 0;
+                                      HMF_XML_ATTRIBUTE | HMF_NAME_ALLOCED);
+    htsmsg_field_set_strl(msg, f, payload, payloadlen);
 
   } else {
 
@@ -362,6 +362,7 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
                      buf_t *buf)
 {
   struct xmlns_list nslist;
+  xmlns_t *ns;
   char *tagname;
   int taglen, empty = 0;
 
@@ -369,12 +370,12 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
 
   LIST_INIT(&nslist);
 
-  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_t *m = htsmsg_create_map_in(xp->xp_arena);
 
   while(1) {
     if(*src == 0) {
       xmlerr2(xp, src, "Unexpected end of file during tag name parsing");
-      return NULL;
+      goto bad;
     }
     if(is_xmlws(*src) || *src == '>' || *src == '/')
       break;
@@ -384,7 +385,7 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
   taglen = src - tagname;
   if(taglen < 1 || taglen > 65535) {
     xmlerr2(xp, tagname, "Invalid tag name");
-    return NULL;
+    goto bad;
   }
 
   while(1) {
@@ -394,7 +395,7 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
 
     if(*src == 0) {
       xmlerr2(xp, src, "Unexpected end of file in tag");
-      return NULL;
+      goto bad;
     }
 
     if(src[0] == '/' && src[1] == '>') {
@@ -409,7 +410,7 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
     }
 
     if((src = htsmsg_xml_parse_attrib(xp, m, src, &nslist, buf)) == NULL)
-      return NULL;
+      goto bad;
   }
 
   htsmsg_field_t *f;
@@ -438,10 +439,16 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src,
     htsmsg_release(m);
   }
 
-  xmlns_t *ns;
   while((ns = LIST_FIRST(&nslist)) != NULL)
     xmlns_destroy(ns);
   return src;
+
+ bad:
+  // Messages keep the arena alive so we must not leak any on error
+  htsmsg_release(m);
+  while((ns = LIST_FIRST(&nslist)) != NULL)
+    xmlns_destroy(ns);
+  return NULL;
 }
 
 
@@ -927,12 +934,15 @@ htsmsg_xml_deserialize_buf(buf_t *buf, char *errbuf, size_t errbufsize)
   if((src = htsmsg_parse_prolog(&xp, src, buf)) == NULL)
     goto err;
 
-  m = htsmsg_create_map();
+  xp.xp_arena = htsmsg_arena_create();
+  m = htsmsg_create_map_in(xp.xp_arena);
 
   if(htsmsg_xml_parse_cd(&xp, m, NULL, src, buf) == NULL) {
     htsmsg_release(m);
+    htsmsg_arena_finish(xp.xp_arena);
     goto err;
   }
+  htsmsg_arena_finish(xp.xp_arena);
   buf_release(buf);
   return m;
 
@@ -968,3 +978,488 @@ htsmsg_xml_deserialize_cstr(const char *str, char *errbuf, size_t errbufsize)
   return htsmsg_xml_deserialize_buf(b, errbuf, errbufsize);
 }
 
+
+
+
+/**
+ * Streaming parser
+ *
+ * This is not a full XML parser by itself. It just tracks element
+ * nesting across chunk boundaries (skipping over comments, PIs, CDATA,
+ * DOCTYPE and quoted attribute values). Once an element at the
+ * requested depth is complete its source text is wrapped in a dummy
+ * element carrying the namespace declarations of its ancestors and
+ * handed to the regular parser above.
+ */
+#define XML_STREAM_MAX_DEPTH 16
+#define XML_STREAM_WRAPPER   "htsmsg-xml-stream"
+
+struct htsmsg_xml_stream {
+  htsmsg_xml_stream_cb_t *hxs_cb;
+  void *hxs_opaque;
+  int hxs_emit_depth;
+  int hxs_depth;
+
+  char *hxs_buf;
+  size_t hxs_len;
+  size_t hxs_size;
+  size_t hxs_pos;       // Scan position
+  ssize_t hxs_frag;     // Start of element being collected, or -1
+
+  char *hxs_xmldecl;
+  char *hxs_ns[XML_STREAM_MAX_DEPTH]; // xmlns attributes per ancestor
+
+  char hxs_errmsg[128];
+};
+
+
+/**
+ *
+ */
+htsmsg_xml_stream_t *
+htsmsg_xml_stream_create(int depth, htsmsg_xml_stream_cb_t *cb, void *opaque)
+{
+  assert(depth > 0 && depth < XML_STREAM_MAX_DEPTH);
+  htsmsg_xml_stream_t *hxs = calloc(1, sizeof(htsmsg_xml_stream_t));
+  hxs->hxs_cb = cb;
+  hxs->hxs_opaque = opaque;
+  hxs->hxs_emit_depth = depth;
+  hxs->hxs_frag = -1;
+  return hxs;
+}
+
+
+/**
+ *
+ */
+void
+htsmsg_xml_stream_destroy(htsmsg_xml_stream_t *hxs)
+{
+  int i;
+  for(i = 0; i < XML_STREAM_MAX_DEPTH; i++)
+    free(hxs->hxs_ns[i]);
+  free(hxs->hxs_xmldecl);
+  free(hxs->hxs_buf);
+  free(hxs);
+}
+
+
+/**
+ * Collect all xmlns attributes in the start tag [s, e)
+ */
+static char *
+xml_stream_get_ns(const char *s, const char *e)
+{
+  const char *a;
+  char quote;
+  int len = 0;
+  char *r = NULL;
+
+  while(s < e && !is_xmlws(*s) && *s != '>' && *s != '/')
+    s++;
+
+  while(s < e) {
+    while(s < e && is_xmlws(*s))
+      s++;
+    a = s;
+    while(s < e && !is_xmlws(*s) && *s != '=' && *s != '>' && *s != '/')
+      s++;
+    if(s == a) {
+      s++;
+      continue;
+    }
+    const int alen = s - a;
+    while(s < e && is_xmlws(*s))
+      s++;
+    if(s == e || *s != '=')
+      continue;
+    s++;
+    while(s < e && is_xmlws(*s))
+      s++;
+    if(s == e || (*s != '"' && *s != '\''))
+      continue;
+    quote = *s++;
+    while(s < e && *s != quote)
+      s++;
+    if(s == e)
+      break;
+    s++;
+
+    if(alen >= 5 && !memcmp(a, "xmlns", 5) && (alen == 5 || a[5] == ':')) {
+      const int l = 1 + (s - a);
+      r = realloc(r, len + l + 1);
+      r[len] = ' ';
+      memcpy(r + len + 1, a, s - a);
+      len += l;
+      r[len] = 0;
+    }
+  }
+  return r;
+}
+
+
+/**
+ *
+ */
+static int
+xml_stream_emit(htsmsg_xml_stream_t *hxs, const char *src, size_t srclen)
+{
+  const char *decl = hxs->hxs_xmldecl ?: "";
+  size_t len = strlen(decl) + strlen("<"XML_STREAM_WRAPPER">") + srclen +
+    strlen("</"XML_STREAM_WRAPPER">");
+  char errbuf[128];
+  int i;
+
+  for(i = 1; i < hxs->hxs_emit_depth; i++)
+    if(hxs->hxs_ns[i] != NULL)
+      len += strlen(hxs->hxs_ns[i]);
+
+  buf_t *b = buf_create(len);
+  char *d = b->b_ptr;
+
+  d += sprintf(d, "%s<"XML_STREAM_WRAPPER, decl);
+  for(i = 1; i < hxs->hxs_emit_depth; i++)
+    if(hxs->hxs_ns[i] != NULL)
+      d += sprintf(d, "%s", hxs->hxs_ns[i]);
+  *d++ = '>';
+  memcpy(d, src, srclen);
+  d += srclen;
+  strcpy(d, "</"XML_STREAM_WRAPPER">");
+
+  htsmsg_t *m = htsmsg_xml_deserialize_buf(b, errbuf, sizeof(errbuf));
+  if(m == NULL) {
+    snprintf(hxs->hxs_errmsg, sizeof(hxs->hxs_errmsg), "%s", errbuf);
+    return -1;
+  }
+
+  htsmsg_t *w = htsmsg_get_map(m, XML_STREAM_WRAPPER);
+  if(w != NULL) {
+    htsmsg_field_t *f;
+    HTSMSG_FOREACH(f, w) {
+      if(f->hmf_flags & HMF_XML_ATTRIBUTE)
+        continue;
+      hxs->hxs_cb(hxs->hxs_opaque, f);
+      break;
+    }
+  }
+  htsmsg_release(m);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static const char *
+xml_stream_find(const char *s, const char *e, const char *needle)
+{
+  const int nlen = strlen(needle);
+  for(; e - s >= nlen; s++)
+    if(*s == needle[0] && !memcmp(s, needle, nlen))
+      return s;
+  return NULL;
+}
+
+
+/**
+ * Returns 1 if 's' starts with 'lit', 0 if it does not and -1 if there
+ * is not enough data to tell yet
+ */
+static int
+xml_stream_prefix(const char *s, const char *e, const char *lit)
+{
+  const size_t llen = strlen(lit);
+  const size_t avail = e - s;
+
+  if(memcmp(s, lit, MIN(avail, llen)))
+    return 0;
+  return avail >= llen ? 1 : -1;
+}
+
+
+/**
+ * Returns -1 on error, otherwise 0 once everything that can be scanned
+ * has been scanned
+ */
+static int
+xml_stream_scan(htsmsg_xml_stream_t *hxs)
+{
+  char *buf = hxs->hxs_buf;
+  const char *end = buf + hxs->hxs_len;
+  const char *p, *q;
+
+  while((p = buf + hxs->hxs_pos) < end) {
+
+    if(*p != '<') {
+      q = memchr(p, '<', end - p);
+      hxs->hxs_pos = (q ?: end) - buf;
+      continue;
+    }
+
+    if(end - p < 2)
+      return 0; // Need more to classify
+
+    if(p[1] == '?') {
+      if((q = xml_stream_find(p + 2, end, "?>")) == NULL)
+        return 0;
+      q += 2;
+      if(hxs->hxs_depth == 0 && !memcmp(p, "<?xml", 5) && is_xmlws(p[5])) {
+        free(hxs->hxs_xmldecl);
+        hxs->hxs_xmldecl = strndup(p, q - p);
+      }
+      hxs->hxs_pos = q - buf;
+      continue;
+    }
+
+    if(p[1] == '!') {
+      const int comment = xml_stream_prefix(p, end, "<!--");
+      const int cdata = xml_stream_prefix(p, end, "<![CDATA[");
+
+      if(comment == -1 || cdata == -1)
+        return 0;
+
+      if(comment) {
+        if((q = xml_stream_find(p + 4, end, "-->")) == NULL)
+          return 0;
+        hxs->hxs_pos = q + 3 - buf;
+        continue;
+      }
+
+      if(cdata) {
+        if((q = xml_stream_find(p + 9, end, "]]>")) == NULL)
+          return 0;
+        hxs->hxs_pos = q + 3 - buf;
+        continue;
+      }
+
+      // DOCTYPE and friends, might contain nested declarations
+      int depth = 0;
+      for(q = p; q < end; q++) {
+        if(*q == '<')
+          depth++;
+        else if(*q == '>' && --depth == 0)
+          break;
+      }
+      if(q == end)
+        return 0;
+      hxs->hxs_pos = q + 1 - buf;
+      continue;
+    }
+
+    // Start or end tag, find the closing '>' outside of quotes
+    char quote = 0;
+    for(q = p + 1; q < end; q++) {
+      if(quote) {
+        if(*q == quote)
+          quote = 0;
+      } else if(*q == '"' || *q == '\'') {
+        quote = *q;
+      } else if(*q == '>') {
+        break;
+      }
+    }
+    if(q == end)
+      return 0;
+
+    const size_t tagstart = p - buf;
+    const size_t tagend = q + 1 - buf;
+
+    if(p[1] == '/') {
+      if(hxs->hxs_depth == 0) {
+        snprintf(hxs->hxs_errmsg, sizeof(hxs->hxs_errmsg),
+                 "Unbalanced end tag");
+        return -1;
+      }
+
+      if(hxs->hxs_depth == hxs->hxs_emit_depth) {
+        assert(hxs->hxs_frag >= 0);
+        if(xml_stream_emit(hxs, buf + hxs->hxs_frag,
+                           tagend - hxs->hxs_frag))
+          return -1;
+        hxs->hxs_frag = -1;
+      } else if(hxs->hxs_depth < hxs->hxs_emit_depth) {
+        free(hxs->hxs_ns[hxs->hxs_depth]);
+        hxs->hxs_ns[hxs->hxs_depth] = NULL;
+      }
+      hxs->hxs_depth--;
+
+    } else {
+      const int empty = q[-1] == '/';
+      const int depth = hxs->hxs_depth + 1;
+
+      if(depth == hxs->hxs_emit_depth) {
+        if(empty) {
+          if(xml_stream_emit(hxs, p, tagend - tagstart))
+            return -1;
+        } else {
+          hxs->hxs_frag = tagstart;
+        }
+      } else if(depth < hxs->hxs_emit_depth && !empty) {
+        hxs->hxs_ns[depth] = xml_stream_get_ns(p + 1, q);
+      }
+
+      if(!empty)
+        hxs->hxs_depth = depth;
+    }
+    hxs->hxs_pos = tagend;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+int
+htsmsg_xml_stream_feed(htsmsg_xml_stream_t *hxs, const void *data, size_t len,
+                       char *errbuf, size_t errsize)
+{
+  if(hxs->hxs_errmsg[0]) {
+    snprintf(errbuf, errsize, "%s", hxs->hxs_errmsg);
+    return -1;
+  }
+
+  if(hxs->hxs_len + len + 1 > hxs->hxs_size) {
+    hxs->hxs_size = MAX(hxs->hxs_size * 2, hxs->hxs_len + len + 1);
+    hxs->hxs_buf = realloc(hxs->hxs_buf, hxs->hxs_size);
+  }
+  memcpy(hxs->hxs_buf + hxs->hxs_len, data, len);
+  hxs->hxs_len += len;
+  hxs->hxs_buf[hxs->hxs_len] = 0;
+
+  if(xml_stream_scan(hxs)) {
+    snprintf(errbuf, errsize, "%s", hxs->hxs_errmsg);
+    return -1;
+  }
+
+  // Drop everything we don't need anymore
+  const size_t keep = hxs->hxs_frag >= 0 ?
+    MIN(hxs->hxs_frag, hxs->hxs_pos) : hxs->hxs_pos;
+
+  if(keep > 0) {
+    memmove(hxs->hxs_buf, hxs->hxs_buf + keep, hxs->hxs_len - keep);
+    hxs->hxs_len -= keep;
+    hxs->hxs_pos -= keep;
+    if(hxs->hxs_frag >= 0)
+      hxs->hxs_frag -= keep;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+int
+htsmsg_xml_stream_finish(htsmsg_xml_stream_t *hxs,
+                         char *errbuf, size_t errsize)
+{
+  if(hxs->hxs_errmsg[0]) {
+    snprintf(errbuf, errsize, "%s", hxs->hxs_errmsg);
+    return -1;
+  }
+  if(hxs->hxs_depth != 0) {
+    snprintf(errbuf, errsize, "Unexpected end of document");
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Regression test for the stream parser. Each document is fed in
+ * chunks of various sizes and must produce the same elements as when
+ * fed in one go. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Iext -Ibuild.linux src/htsmsg/htsmsg_xml.c \
+ *   src/htsmsg/htsmsg.c src/misc/buf.c src/misc/rstr.c -o /tmp/xmlstream
+ */
+#ifdef LOCAL_MAIN
+
+void *
+mymalloc(size_t size)
+{
+  return malloc(size);
+}
+
+void
+tracelog(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+}
+
+int
+utf8_put(char *out, int c)
+{
+  if(out)
+    *out = c;
+  return 1;
+}
+
+int
+html_entity_lookup(const char *name)
+{
+  return !strcmp(name, "amp") ? '&' : -1;
+}
+
+
+static char lm_names[256];
+
+static void
+lm_cb(void *opaque, htsmsg_field_t *f)
+{
+  snprintf(lm_names + strlen(lm_names), sizeof(lm_names) - strlen(lm_names),
+           "%s ", f->hmf_name);
+}
+
+
+static int
+lm_check(const char *doc, const char *expect)
+{
+  static const int steps[] = {1, 2, 3, 7, 100};
+  char errbuf[128];
+  int bad = 0;
+
+  for(int i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    const size_t len = strlen(doc);
+    const int step = steps[i];
+    int r = 0;
+
+    lm_names[0] = 0;
+    htsmsg_xml_stream_t *hxs = htsmsg_xml_stream_create(2, lm_cb, NULL);
+    for(size_t o = 0; o < len && !r; o += step)
+      r = htsmsg_xml_stream_feed(hxs, doc + o, MIN(step, len - o),
+                                 errbuf, sizeof(errbuf));
+    if(!r)
+      r = htsmsg_xml_stream_finish(hxs, errbuf, sizeof(errbuf));
+    htsmsg_xml_stream_destroy(hxs);
+
+    if(r || strcmp(lm_names, expect)) {
+      printf("FAIL step %d: %s\n  got [%s] expected [%s] %s\n",
+             step, doc, lm_names, expect, r ? errbuf : "");
+      bad = 1;
+    }
+  }
+  return bad;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int err = 0;
+
+  err |= lm_check("<root><item>1</item></root>", "item ");
+  err |= lm_check("<a><b/><c>x</c></a>", "b c ");
+  err |= lm_check("<a><b/><c>x</c></a>\n", "b c ");
+  err |= lm_check("<?xml version=\"1.0\"?><!-- x --><a><!----><b>"
+                  "<![CDATA[</b>]]></b><c/></a>", "b c ");
+  err |= lm_check("<!DOCTYPE a [<!ENTITY x \"y\">]><a><b q=\"</b>\"/></a>",
+                  "b ");
+  err |= lm_check("<D:multistatus xmlns:D=\"DAV:\"><D:response>"
+                  "<D:href>/</D:href></D:response></D:multistatus>",
+                  "response ");
+
+  printf("%s\n", err ? "FAIL" : "OK");
+  return err;
+}
+#endif
@@ -31,4 +31,34 @@ htsmsg_t *htsmsg_xml_deserialize_cstr(const char *str,
 
 htsmsg_t *htsmsg_xml_deserialize_buf(buf_t *b, char *errbuf, size_t errsize);
 
+/**
+ * Incremental parsing
+ *
+ * The document is fed in arbitrary sized chunks. Every element at
+ * 'depth' (the document's root element is at depth 1) is delivered to
+ * the callback as soon as its end tag has been seen. The field is
+ * what htsmsg_xml_deserialize_buf() would have produced for that
+ * element and is only valid during the callback.
+ *
+ * Namespace declarations and encoding of enclosing elements are
+ * honored. Memory use is bounded by the largest delivered element
+ * rather than the entire document.
+ */
+typedef struct htsmsg_xml_stream htsmsg_xml_stream_t;
+
+typedef void (htsmsg_xml_stream_cb_t)(void *opaque, htsmsg_field_t *f);
+
+htsmsg_xml_stream_t *htsmsg_xml_stream_create(int depth,
+                                              htsmsg_xml_stream_cb_t *cb,
+                                              void *opaque);
+
+int htsmsg_xml_stream_feed(htsmsg_xml_stream_t *hxs,
+                           const void *data, size_t len,
+                           char *errbuf, size_t errsize);
+
+int htsmsg_xml_stream_finish(htsmsg_xml_stream_t *hxs,
+                             char *errbuf, size_t errsize);
+
+void htsmsg_xml_stream_destroy(htsmsg_xml_stream_t *hxs);
+
 #endif /* HTSMSG_XML_H_ */
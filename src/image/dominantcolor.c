@@ -21,10 +21,24 @@
 #include "image.h"
 #include "pixmap.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define DC_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define DC_NEON
+#include <arm_neon.h>
+#endif
+
 
 #define LOW_THRESHOLD  60
 #define HIGH_THRESHOLD 220
 
+#define DC_K            8
+#define DC_MAX_SAMPLES  16384
+#define DC_MAX_ITER     24
+#define DC_CONVERGED    2   // Max squared centroid movement when converged
+#define DC_MERGE        (40 * 40) // Squared distance for joining centroids
+
 typedef struct centroid {
   int r, g, b;
   int num_pixels;
@@ -32,41 +46,58 @@ typedef struct centroid {
 } centroid_t;
 
 
-static void
-randomize_centroids(centroid_t *c, int K)
+/**
+ * Samples are stored as separate arrays for each component so
+ * distance computation can be vectorized
+ */
+typedef struct samples {
+  int num;
+  int16_t *r, *g, *b;
+  uint8_t *c;
+} samples_t;
+
+
+/**
+ *
+ */
+static int
+sample_ok(int pR, int pG, int pB)
 {
-  for(int i = 0; i < K; i++) {
-    c->r = rand() & 0xff;
-    c->g = rand() & 0xff;
-    c->b = rand() & 0xff;
+  if(pR > HIGH_THRESHOLD && pG > HIGH_THRESHOLD && pB > HIGH_THRESHOLD)
+    return 0;
 
-    c->or = 0;
-    c->og = 0;
-    c->ob = 0;
-    c++;
-  }
+  if(pR < LOW_THRESHOLD && pG < LOW_THRESHOLD && pB < LOW_THRESHOLD)
+    return 0;
+
+  return 1;
 }
 
 
-typedef struct pixel {
-  uint8_t r,g,b,c;
-} pixel_t;
+/**
+ *
+ */
+static void
+sample_add(samples_t *s, int pR, int pG, int pB)
+{
+  s->r[s->num] = pR;
+  s->g[s->num] = pG;
+  s->b[s->num] = pB;
+  s->num++;
+}
 
 
 /**
  *
  */
-static int
-extract_pixels_bgr32(pixel_t *out, const pixmap_t *pm)
+static void
+extract_samples_bgr32(samples_t *s, const pixmap_t *pm, int step)
 {
-  int num = 0;
+  for(int y = 0; y < pm->pm_height; y += step) {
+    const uint32_t *src = (const uint32_t *)(pm->pm_data +
+                                             y * pm->pm_linesize);
+    for(int x = 0; x < pm->pm_width; x += step) {
 
-  const uint8_t *s = pm->pm_data;
-  for(int y = 0; y < pm->pm_height; y++) {
-    const uint32_t *src = (const uint32_t *)s;
-    for(int x = 0; x < pm->pm_width; x++) {
-
-      const uint32_t u32 = *src++;
+      const uint32_t u32 = src[x];
 
       // Pixel values
       const int pR =  u32        & 0xff;
@@ -77,113 +108,281 @@ extract_pixels_bgr32(pixel_t *out, const pixmap_t *pm)
       if(pA < 128)
         continue;
 
-      if(pR > HIGH_THRESHOLD && pG > HIGH_THRESHOLD && pB > HIGH_THRESHOLD)
-        continue;
+      if(sample_ok(pR, pG, pB))
+        sample_add(s, pR, pG, pB);
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+extract_samples_rgb24(samples_t *s, const pixmap_t *pm, int step)
+{
+  for(int y = 0; y < pm->pm_height; y += step) {
+    const uint8_t *src = pm->pm_data + y * pm->pm_linesize;
+    for(int x = 0; x < pm->pm_width; x += step) {
+
+      const int pR = src[x * 3 + 0];
+      const int pG = src[x * 3 + 1];
+      const int pB = src[x * 3 + 2];
+
+      if(sample_ok(pR, pG, pB))
+        sample_add(s, pR, pG, pB);
+    }
+  }
+}
 
-      if(pR < LOW_THRESHOLD && pG < LOW_THRESHOLD && pB < LOW_THRESHOLD)
-        continue;
 
-      num++;
-      if(out) {
-        out->r = pR;
-        out->g = pG;
-        out->b = pB;
-        out->c = -1;
-        out++;
+/**
+ * Assign each sample to its closest centroid
+ */
+static void
+assign_clusters_c(samples_t *s, int start, const centroid_t *centroids)
+{
+  for(int i = start; i < s->num; i++) {
+    int best = INT32_MAX;
+    const int r = s->r[i];
+    const int g = s->g[i];
+    const int b = s->b[i];
+
+    for(int j = 0; j < DC_K; j++) {
+      const centroid_t *c = centroids + j;
+
+      int d =
+        ((c->r - r) * (c->r - r)) +
+        ((c->g - g) * (c->g - g)) +
+        ((c->b - b) * (c->b - b));
+
+      if(d < best) {
+        best = d;
+        s->c[i] = j;
       }
     }
-    s += pm->pm_linesize;
   }
-  return num;
 }
 
 
-static int
-extract_pixels_rgb24(pixel_t *out, const pixmap_t *pm)
+#if defined(DC_SSE2)
+
+/**
+ * Squared distance for 4 samples (given as interleaved 16 bit r,g and
+ * b,0 pairs) to a centroid, pmaddwd does the squaring and summing
+ */
+static inline __m128i
+dist4_sse2(__m128i rg, __m128i b0, __m128i crg, __m128i cb0)
 {
-  int num = 0;
+  __m128i drg = _mm_sub_epi16(rg, crg);
+  __m128i db0 = _mm_sub_epi16(b0, cb0);
+  return _mm_add_epi32(_mm_madd_epi16(drg, drg), _mm_madd_epi16(db0, db0));
+}
 
-  const uint8_t *s = pm->pm_data;
-  for(int y = 0; y < pm->pm_height; y++) {
-    const uint8_t *src = (const uint8_t *)s;
-    for(int x = 0; x < pm->pm_width; x++) {
 
-      const int pR = *src++;
-      const int pG = *src++;
-      const int pB = *src++;
+/**
+ *
+ */
+static void
+assign_clusters(samples_t *s, const centroid_t *centroids)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+
+  for(; i + 8 <= s->num; i += 8) {
+    __m128i r = _mm_loadu_si128((const __m128i *)(s->r + i));
+    __m128i g = _mm_loadu_si128((const __m128i *)(s->g + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(s->b + i));
+
+    __m128i rg_lo = _mm_unpacklo_epi16(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi16(r, g);
+    __m128i b0_lo = _mm_unpacklo_epi16(b, zero);
+    __m128i b0_hi = _mm_unpackhi_epi16(b, zero);
+
+    __m128i best_lo = _mm_set1_epi32(INT32_MAX);
+    __m128i best_hi = _mm_set1_epi32(INT32_MAX);
+    __m128i idx_lo = zero;
+    __m128i idx_hi = zero;
+
+    for(int j = 0; j < DC_K; j++) {
+      const centroid_t *c = centroids + j;
+      const __m128i crg = _mm_set1_epi32((c->g << 16) | (c->r & 0xffff));
+      const __m128i cb0 = _mm_set1_epi32(c->b);
+      const __m128i jj = _mm_set1_epi32(j);
+
+      __m128i d_lo = dist4_sse2(rg_lo, b0_lo, crg, cb0);
+      __m128i d_hi = dist4_sse2(rg_hi, b0_hi, crg, cb0);
+
+      __m128i m_lo = _mm_cmplt_epi32(d_lo, best_lo);
+      __m128i m_hi = _mm_cmplt_epi32(d_hi, best_hi);
+
+      best_lo = _mm_or_si128(_mm_and_si128(m_lo, d_lo),
+                             _mm_andnot_si128(m_lo, best_lo));
+      best_hi = _mm_or_si128(_mm_and_si128(m_hi, d_hi),
+                             _mm_andnot_si128(m_hi, best_hi));
+      idx_lo  = _mm_or_si128(_mm_and_si128(m_lo, jj),
+                             _mm_andnot_si128(m_lo, idx_lo));
+      idx_hi  = _mm_or_si128(_mm_and_si128(m_hi, jj),
+                             _mm_andnot_si128(m_hi, idx_hi));
+    }
+
+    __m128i idx = _mm_packs_epi32(idx_lo, idx_hi);
+    _mm_storel_epi64((__m128i *)(s->c + i), _mm_packus_epi16(idx, idx));
+  }
+  assign_clusters_c(s, i, centroids);
+}
+
+#elif defined(DC_NEON)
+
+/**
+ *
+ */
+static void
+assign_clusters(samples_t *s, const centroid_t *centroids)
+{
+  int i = 0;
+
+  for(; i + 8 <= s->num; i += 8) {
+    int16x8_t r = vld1q_s16(s->r + i);
+    int16x8_t g = vld1q_s16(s->g + i);
+    int16x8_t b = vld1q_s16(s->b + i);
+
+    int32x4_t best_lo = vdupq_n_s32(INT32_MAX);
+    int32x4_t best_hi = vdupq_n_s32(INT32_MAX);
+    uint32x4_t idx_lo = vdupq_n_u32(0);
+    uint32x4_t idx_hi = vdupq_n_u32(0);
+
+    for(int j = 0; j < DC_K; j++) {
+      const centroid_t *c = centroids + j;
+      int16x8_t dr = vsubq_s16(r, vdupq_n_s16(c->r));
+      int16x8_t dg = vsubq_s16(g, vdupq_n_s16(c->g));
+      int16x8_t db = vsubq_s16(b, vdupq_n_s16(c->b));
+
+      int32x4_t d_lo = vmull_s16(vget_low_s16(dr), vget_low_s16(dr));
+      d_lo = vmlal_s16(d_lo, vget_low_s16(dg), vget_low_s16(dg));
+      d_lo = vmlal_s16(d_lo, vget_low_s16(db), vget_low_s16(db));
+
+      int32x4_t d_hi = vmull_s16(vget_high_s16(dr), vget_high_s16(dr));
+      d_hi = vmlal_s16(d_hi, vget_high_s16(dg), vget_high_s16(dg));
+      d_hi = vmlal_s16(d_hi, vget_high_s16(db), vget_high_s16(db));
+
+      uint32x4_t m_lo = vcltq_s32(d_lo, best_lo);
+      uint32x4_t m_hi = vcltq_s32(d_hi, best_hi);
+
+      best_lo = vbslq_s32(m_lo, d_lo, best_lo);
+      best_hi = vbslq_s32(m_hi, d_hi, best_hi);
+      idx_lo  = vbslq_u32(m_lo, vdupq_n_u32(j), idx_lo);
+      idx_hi  = vbslq_u32(m_hi, vdupq_n_u32(j), idx_hi);
+    }
 
-      if(pR > HIGH_THRESHOLD && pG > HIGH_THRESHOLD && pB > HIGH_THRESHOLD)
+    uint16x8_t idx = vcombine_u16(vmovn_u32(idx_lo), vmovn_u32(idx_hi));
+    vst1_u8(s->c + i, vmovn_u16(idx));
+  }
+  assign_clusters_c(s, i, centroids);
+}
+
+#else
+
+static void
+assign_clusters(samples_t *s, const centroid_t *centroids)
+{
+  assign_clusters_c(s, 0, centroids);
+}
+
+#endif
+
+
+/**
+ * With K larger than the number of distinct colors in the image a
+ * single color tends to get split over several centroids. Join
+ * centroids that are close so the pixel count reflects the color
+ * and not how the seeds happened to fall
+ */
+static void
+merge_centroids(centroid_t *centroids)
+{
+  for(int i = 0; i < DC_K; i++) {
+    centroid_t *a = centroids + i;
+    if(a->num_pixels == 0)
+      continue;
+
+    for(int j = i + 1; j < DC_K; j++) {
+      centroid_t *b = centroids + j;
+      if(b->num_pixels == 0)
         continue;
 
-      if(pR < LOW_THRESHOLD && pG < LOW_THRESHOLD && pB < LOW_THRESHOLD)
+      const int d =
+        (a->r - b->r) * (a->r - b->r) +
+        (a->g - b->g) * (a->g - b->g) +
+        (a->b - b->b) * (a->b - b->b);
+
+      if(d > DC_MERGE)
         continue;
 
-      num++;
-      if(out) {
-        out->r = pR;
-        out->g = pG;
-        out->b = pB;
-        out->c = -1;
-        out++;
-      }
+      const int n = a->num_pixels + b->num_pixels;
+      a->r = (a->r * a->num_pixels + b->r * b->num_pixels) / n;
+      a->g = (a->g * a->num_pixels + b->g * b->num_pixels) / n;
+      a->b = (a->b * a->num_pixels + b->b * b->num_pixels) / n;
+      a->num_pixels = n;
+      b->num_pixels = 0;
     }
-    s += pm->pm_linesize;
   }
-  return num;
 }
 
 
 /**
- *
+ * k-means over a deterministic subset of the image pixels
  */
 void
 dominant_color(pixmap_t *pm)
 {
-  int K = 8;
-  int num_pixels;
-  pixel_t *pixels;
-  centroid_t centroids[K];
-
+  samples_t s = {0};
+  centroid_t centroids[DC_K];
+  const int step = pixmap_sample_step(pm, DC_MAX_SAMPLES);
+  const int max_samples = ((pm->pm_width  + step - 1) / step) *
+                          ((pm->pm_height + step - 1) / step);
 
   switch(pm->pm_type) {
   case PIXMAP_RGB24:
-    num_pixels = extract_pixels_rgb24(NULL, pm);
-    pixels = malloc(num_pixels * sizeof(pixel_t));
-    extract_pixels_rgb24(pixels, pm);
-    break;
-
   case PIXMAP_BGR32:
-    num_pixels = extract_pixels_bgr32(NULL, pm);
-    pixels = malloc(num_pixels * sizeof(pixel_t));
-    extract_pixels_bgr32(pixels, pm);
     break;
   default:
     return;
   }
-  randomize_centroids(centroids, K);
-
-  while(1) {
-    pixel_t *p = pixels;
-    for(int i = 0; i < num_pixels; i++) {
-      int s = INT32_MAX;
 
-      for(int j = 0; j < K; j++) {
-        const centroid_t *c = centroids + j;
+  s.r = malloc(max_samples * sizeof(int16_t));
+  s.g = malloc(max_samples * sizeof(int16_t));
+  s.b = malloc(max_samples * sizeof(int16_t));
+  s.c = malloc(max_samples);
+
+  if(s.r == NULL || s.g == NULL || s.b == NULL || s.c == NULL)
+    goto out;
+
+  if(pm->pm_type == PIXMAP_RGB24)
+    extract_samples_rgb24(&s, pm, step);
+  else
+    extract_samples_bgr32(&s, pm, step);
+
+  // Seed centroids with evenly spaced samples
+
+  for(int j = 0; j < DC_K; j++) {
+    centroid_t *c = centroids + j;
+    if(s.num) {
+      const int i = (int)((int64_t)s.num * (2 * j + 1) / (2 * DC_K));
+      c->r = s.r[i];
+      c->g = s.g[i];
+      c->b = s.b[i];
+    } else {
+      c->r = c->g = c->b = 0;
+    }
+    c->num_pixels = 0;
+  }
 
-        int d =
-          ((c->r - (int)p->r) * (c->r - (int)p->r)) +
-          ((c->g - (int)p->g) * (c->g - (int)p->g)) +
-          ((c->b - (int)p->b) * (c->b - (int)p->b));
+  for(int iter = 0; iter < DC_MAX_ITER; iter++) {
 
-        if(d < s) {
-          s = d;
-          p->c = j;
-        }
-      }
-      p++;
-    }
+    assign_clusters(&s, centroids);
 
-    for(int j = 0; j < K; j++) {
+    for(int j = 0; j < DC_K; j++) {
       centroid_t *c = centroids + j;
       c->or = c->r;
       c->og = c->g;
@@ -194,17 +393,17 @@ dominant_color(pixmap_t *pm)
       c->num_pixels = 0;
     }
 
-    for(int i = 0; i < num_pixels; i++) {
-      centroid_t *c = centroids + pixels[i].c;
-      c->r += pixels[i].r;
-      c->g += pixels[i].g;
-      c->b += pixels[i].b;
+    for(int i = 0; i < s.num; i++) {
+      centroid_t *c = centroids + s.c[i];
+      c->r += s.r[i];
+      c->g += s.g[i];
+      c->b += s.b[i];
       c->num_pixels++;
     }
 
     int move = 0;
 
-    for(int j = 0; j < K; j++) {
+    for(int j = 0; j < DC_K; j++) {
       centroid_t *c = centroids + j;
       if(c->num_pixels) {
         c->r /= c->num_pixels;
@@ -212,18 +411,22 @@ dominant_color(pixmap_t *pm)
         c->b /= c->num_pixels;
       }
 
-      if(c->r != c->or ||
-         c->g != c->og ||
-         c->b != c->ob) {
-        move = 1;
-      }
+      const int d =
+        (c->r - c->or) * (c->r - c->or) +
+        (c->g - c->og) * (c->g - c->og) +
+        (c->b - c->ob) * (c->b - c->ob);
+
+      if(d > move)
+        move = d;
     }
-    if(!move)
+    if(move <= DC_CONVERGED)
       break;
   }
 
+  merge_centroids(centroids);
+
   const centroid_t *best = NULL;
-  for(int j = 0; j < K; j++) {
+  for(int j = 0; j < DC_K; j++) {
     const centroid_t *c = centroids + j;
     if(best == NULL || c->num_pixels > best->num_pixels)
       best = c;
@@ -233,5 +436,256 @@ dominant_color(pixmap_t *pm)
     pm->pm_primary_color[1] = best->g / 255.0f;
     pm->pm_primary_color[2] = best->b / 255.0f;
   }
-  free(pixels);
+ out:
+  free(s.r);
+  free(s.g);
+  free(s.b);
+  free(s.c);
+}
+
+
+
+/**
+ * Benchmark and regression test against the original full-image,
+ * unbounded k-means. Reads binary PPM (P6) files given as arguments,
+ * otherwise uses a set of generated images. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Ibuild.linux src/image/dominantcolor.c \
+ *   -o /tmp/dominantcolor
+ */
+
+#ifdef LOCAL_MAIN
+
+#include <sys/time.h>
+#include <math.h>
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+
+/**
+ * The original implementation
+ */
+static void
+dominant_color_reference(const pixmap_t *pm, int out[3])
+{
+  const int K = DC_K;
+  centroid_t centroids[K];
+  int num_pixels = 0;
+  int16_t *r = malloc(pm->pm_width * pm->pm_height * sizeof(int16_t));
+  int16_t *g = malloc(pm->pm_width * pm->pm_height * sizeof(int16_t));
+  int16_t *b = malloc(pm->pm_width * pm->pm_height * sizeof(int16_t));
+  uint8_t *cl = malloc(pm->pm_width * pm->pm_height);
+
+  for(int y = 0; y < pm->pm_height; y++) {
+    const uint8_t *src = pm->pm_data + y * pm->pm_linesize;
+    for(int x = 0; x < pm->pm_width; x++, src += 3) {
+      if(!sample_ok(src[0], src[1], src[2]))
+        continue;
+      r[num_pixels] = src[0];
+      g[num_pixels] = src[1];
+      b[num_pixels] = src[2];
+      num_pixels++;
+    }
+  }
+
+  srand(1);
+  for(int j = 0; j < K; j++) {
+    centroids[j].r = rand() & 0xff;
+    centroids[j].g = rand() & 0xff;
+    centroids[j].b = rand() & 0xff;
+  }
+
+  while(1) {
+    for(int i = 0; i < num_pixels; i++) {
+      int s = INT32_MAX;
+      for(int j = 0; j < K; j++) {
+        const centroid_t *c = centroids + j;
+        int d =
+          (c->r - r[i]) * (c->r - r[i]) +
+          (c->g - g[i]) * (c->g - g[i]) +
+          (c->b - b[i]) * (c->b - b[i]);
+        if(d < s) {
+          s = d;
+          cl[i] = j;
+        }
+      }
+    }
+
+    for(int j = 0; j < K; j++) {
+      centroid_t *c = centroids + j;
+      c->or = c->r;
+      c->og = c->g;
+      c->ob = c->b;
+      c->r = c->g = c->b = c->num_pixels = 0;
+    }
+
+    for(int i = 0; i < num_pixels; i++) {
+      centroid_t *c = centroids + cl[i];
+      c->r += r[i];
+      c->g += g[i];
+      c->b += b[i];
+      c->num_pixels++;
+    }
+
+    int move = 0;
+    for(int j = 0; j < K; j++) {
+      centroid_t *c = centroids + j;
+      if(c->num_pixels) {
+        c->r /= c->num_pixels;
+        c->g /= c->num_pixels;
+        c->b /= c->num_pixels;
+      }
+      if(c->r != c->or || c->g != c->og || c->b != c->ob)
+        move = 1;
+    }
+    if(!move)
+      break;
+  }
+
+  const centroid_t *best = centroids;
+  for(int j = 1; j < K; j++)
+    if(centroids[j].num_pixels > best->num_pixels)
+      best = centroids + j;
+
+  out[0] = best->r;
+  out[1] = best->g;
+  out[2] = best->b;
+  free(r);
+  free(g);
+  free(b);
+  free(cl);
 }
+
+
+static pixmap_t *
+lm_pixmap(int w, int h)
+{
+  pixmap_t *pm = calloc(1, sizeof(pixmap_t));
+  pm->pm_width = w;
+  pm->pm_height = h;
+  pm->pm_linesize = w * 3;
+  pm->pm_type = PIXMAP_RGB24;
+  pm->pm_data = malloc(pm->pm_linesize * h);
+  return pm;
+}
+
+
+static pixmap_t *
+lm_load_ppm(const char *path)
+{
+  int w, h, maxval;
+  FILE *f = fopen(path, "rb");
+  if(f == NULL)
+    return NULL;
+
+  if(fscanf(f, "P6 %d %d %d", &w, &h, &maxval) != 3 || maxval != 255) {
+    fclose(f);
+    return NULL;
+  }
+  fgetc(f);
+  pixmap_t *pm = lm_pixmap(w, h);
+  if(fread(pm->pm_data, pm->pm_linesize, h, f) != h) {
+    free(pm->pm_data);
+    free(pm);
+    pm = NULL;
+  }
+  fclose(f);
+  return pm;
+}
+
+
+/**
+ * Blobs of a few colors with different coverage plus noise
+ */
+static pixmap_t *
+lm_generate(int variant)
+{
+  static const uint8_t palette[4][3] = {
+    {200, 40, 30}, {30, 120, 200}, {90, 180, 70}, {230, 200, 90}
+  };
+  const int w = 1024, h = 768;
+  pixmap_t *pm = lm_pixmap(w, h);
+  uint32_t seed = variant + 1;
+
+  for(int y = 0; y < h; y++) {
+    uint8_t *d = pm->pm_data + y * pm->pm_linesize;
+    for(int x = 0; x < w; x++) {
+      int c;
+      switch(variant) {
+      case 0:  c = x < w / 2 ? 0 : y < h / 3 ? 1 : 2;          break;
+      case 1:  c = ((x / 64) + (y / 64)) % 4 == 0 ? 3 : 1;      break;
+      default: c = (x - w / 2) * (x - w / 2) + (y - h / 2) * (y - h / 2)
+                 < 300 * 300 ? 2 : 0;                           break;
+      }
+      for(int i = 0; i < 3; i++) {
+        seed = seed * 1103515245 + 12345;
+        int v = palette[c][i] + (int)((seed >> 16) % 41) - 20;
+        d[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+      }
+      d += 3;
+    }
+  }
+  return pm;
+}
+
+
+static int
+lm_test(const char *name, pixmap_t *pm)
+{
+  int ref[3];
+  int64_t t0 = get_ts();
+  dominant_color_reference(pm, ref);
+  int64_t t1 = get_ts();
+  dominant_color(pm);
+  int64_t t2 = get_ts();
+
+  float dr = pm->pm_primary_color[0] * 255 - ref[0];
+  float dg = pm->pm_primary_color[1] * 255 - ref[1];
+  float db = pm->pm_primary_color[2] * 255 - ref[2];
+  float dist = sqrtf(dr * dr + dg * dg + db * db);
+  int bad = dist > 24;
+
+  printf("%-20s ref: %3d,%3d,%3d %8dus  new: %3.0f,%3.0f,%3.0f %8dus  "
+         "distance: %5.1f %s\n", name,
+         ref[0], ref[1], ref[2], (int)(t1 - t0),
+         pm->pm_primary_color[0] * 255, pm->pm_primary_color[1] * 255,
+         pm->pm_primary_color[2] * 255, (int)(t2 - t1),
+         dist, bad ? "FAIL" : "OK");
+  free(pm->pm_data);
+  free(pm);
+  return bad;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int err = 0;
+  char name[32];
+
+  if(argc > 1) {
+    for(int i = 1; i < argc; i++) {
+      pixmap_t *pm = lm_load_ppm(argv[i]);
+      if(pm == NULL) {
+        fprintf(stderr, "Unable to load %s\n", argv[i]);
+        err = 1;
+        continue;
+      }
+      err |= lm_test(argv[i], pm);
+    }
+  } else {
+    for(int i = 0; i < 3; i++) {
+      snprintf(name, sizeof(name), "generated-%d", i);
+      err |= lm_test(name, lm_generate(i));
+    }
+  }
+  return err;
+}
+
+#endif
@@ -314,7 +314,8 @@ image_decode(image_t *im, const image_meta_t *meta,
     return im;
 
   case IMAGE_PIXMAP:
-    image_postprocess_pixmap(im, meta);
+    if(!(im->im_flags & IMAGE_POSTPROCESSED))
+      image_postprocess_pixmap(im, meta);
     return im;
 
   case IMAGE_CODED:
@@ -157,6 +157,8 @@ typedef struct image {
 #define IMAGE_ADAPTED     0x4  /* When an image is loaded and this flag
                                   is set the returned image is also dependant
                                   on the image_meta parameters. */
+#define IMAGE_POSTPROCESSED 0x8  /* Pixmap already has shadow, corners
+                                    and analysis applied */
   uint8_t im_color_planes;
   uint8_t im_origin_coded_type;
   uint8_t im_orientation;
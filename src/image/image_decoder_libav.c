@@ -387,6 +387,31 @@ pixmap_compute_rescale_dim(const image_meta_t *im,
 }
 
 
+/**
+ * Return how many steps (log2) a JPEG of the given size can be
+ * downscaled by the DCT (1/2, 1/4, 1/8) while still being at least
+ * as large as the dimensions we are going to rescale it to anyway
+ */
+int
+pixmap_compute_jpeg_downscale(const image_meta_t *im,
+                              int src_width, int src_height)
+{
+  int w, h, shift;
+
+  if(src_width <= 0 || src_height <= 0)
+    return 0;
+
+  pixmap_compute_rescale_dim(im, src_width, src_height, &w, &h);
+
+  for(shift = 3; shift > 0; shift--) {
+    const int d = 1 << shift;
+    if((src_width + d - 1) / d >= w && (src_height + d - 1) / d >= h)
+      break;
+  }
+  return shift;
+}
+
+
 /**
  *
  */
@@ -436,6 +461,11 @@ image_decode_libav(image_coded_type_t type,
 
   ctx = avcodec_alloc_context3(codec);
 
+  if(type == IMAGE_JPEG)
+    ctx->lowres = MIN(codec->max_lowres,
+                      pixmap_compute_jpeg_downscale(im, ji.ji_width,
+                                                    ji.ji_height));
+
   if(avcodec_open2(ctx, codec, NULL) < 0) {
     av_free(ctx);
     snprintf(errbuf, errlen, "Unable to open codec");
@@ -459,14 +489,9 @@ image_decode_libav(image_coded_type_t type,
     return NULL;
   }
 
-#if 0
-  printf("%d x %d => %d x %d (lowres=%d) req = %d x %d%s%s\n",
-	 ji.ji_width, ji.ji_height,
-	 ctx->width, ctx->height, lowres,
-	 im->im_req_width, im->im_req_height,
-	 im->im_want_thumb ? ", want thumb" : "",
-	 pm->pm_flags & PIXMAP_THUMBNAIL ? ", is thumb" : "");
-#endif
+  if(gconf.enable_image_debug && ctx->lowres)
+    TRACE(TRACE_DEBUG, "image", "JPEG %d x %d decoded at %d x %d (lowres=%d)",
+          ji.ji_width, ji.ji_height, ctx->width, ctx->height, ctx->lowres);
 
   pixmap_compute_rescale_dim(im, ctx->width, ctx->height, &w, &h);
 
@@ -75,6 +75,12 @@ libjpeg_decode(fa_handle_t *fh, const image_meta_t *im,
 
   jpeg_read_header(&cinfo, TRUE);
 
+  // Let the IDCT do the downscaling if we are going to shrink it anyway
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1 << pixmap_compute_jpeg_downscale(im,
+                                                         cinfo.image_width,
+                                                         cinfo.image_height);
+
   cinfo.buffered_image = 1;
   cinfo.out_color_space = JCS_RGB;
   cinfo.output_components = 3;
@@ -30,10 +30,22 @@
 #include "misc/minmax.h"
 #include "image/jpeg.h"
 #include "backend/backend.h"
+#include "pixmap_simd.h"
 
 
 #define DIV255(x) (((((x)+255)>>8)+(x))>>8)
 
+pixmap_kernels_t pixmap_kernels;
+
+/**
+ *
+ */
+INITIALIZER(pixmap_kernels_init)
+{
+  pixmap_kernels = pixmap_kernels_c;
+  pixmap_simd_init(&pixmap_kernels, 0);
+}
+
 /**
  *
  */
@@ -204,6 +216,20 @@ pixmap_horizontal_gradient(pixmap_t *pm, const int *top, const int *bottom)
 }
 
 
+/**
+ *
+ */
+void
+pixmap_rgb24_to_bgr32_c(uint32_t *d, const uint8_t *s, int width)
+{
+  int x;
+  for(x = 0; x < width; x++) {
+    *d++ = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+    s+= 3;
+  }
+}
+
+
 /**
  *
  */
@@ -217,11 +243,7 @@ rgb24_to_bgr32(pixmap_t *src)
   for(y = 0; y < src->pm_height; y++) {
     const uint8_t *s = src->pm_data + y * src->pm_linesize;
     uint32_t *d = (uint32_t *)(dst->pm_data + y * dst->pm_linesize);
-    int x;
-    for(x = 0; x < src->pm_width; x++) {
-      *d++ = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0]; 
-      s+= 3;
-    }
+    pixmap_kernels.pk_rgb24_to_bgr32(d, s, src->pm_width);
   }
   return dst;
 }
@@ -409,10 +431,10 @@ composite_GRAY8_on_BGR32(uint8_t *dst_, const uint8_t *src,
 
 
 
-static void
-composite_GRAY8_on_BGR32(uint8_t *dst_, const uint8_t *src,
-			 int CR, int CG, int CB, int CA,
-			 int width)
+void
+pixmap_composite_GRAY8_on_BGR32_c(uint8_t *dst_, const uint8_t *src,
+                                  int CR, int CG, int CB, int CA,
+                                  int width)
 {
   int x;
   uint32_t *dst = (uint32_t *)dst_;
@@ -485,7 +507,7 @@ pixmap_composite(pixmap_t *dst, const pixmap_t *src,
   else if(src->pm_type == PIXMAP_I && dst->pm_type == PIXMAP_IA)
     fn = composite_GRAY8_on_IA;
   else if(src->pm_type == PIXMAP_I && dst->pm_type == PIXMAP_BGR32)
-    fn = composite_GRAY8_on_BGR32;
+    fn = pixmap_kernels.pk_composite_GRAY8_on_BGR32;
   else
     return;
   
@@ -521,91 +543,70 @@ pixmap_composite(pixmap_t *dst, const pixmap_t *src,
 
 
 
-static void
-box_blur_line_2chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
-		    int width, int boxw, int m)
+/**
+ *
+ */
+void
+pixmap_box_sum_c(uint8_t *d, const uint32_t *a, const uint32_t *b,
+                 int off, int num, unsigned int m)
 {
-  int x;
+  int i;
   unsigned int v;
-  for(x = 0; x < boxw; x++) {
-    const int x1 = 2 * MIN(x + boxw, width - 1);
-    const int x2 = 0;
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-  }
-
-  for(; x < width - boxw; x++) {
-    const int x1 = 2 * (x + boxw);
-    const int x2 = 2 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
+  for(i = 0; i < num; i++) {
+    v = b[i + off] + a[i - off] - b[i - off] - a[i + off];
+    d[i] = (v * m) >> 16;
   }
+}
 
-  for(; x < width; x++) {
-    const int x1 = 2 * (width - 1);
-    const int x2 = 2 * (x - boxw);
 
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-  }
+/**
+ *
+ */
+void
+pixmap_integral_add_c(uint32_t *d, const uint32_t *above, int num)
+{
+  int i;
+  for(i = 0; i < num; i++)
+    d[i] += above[i];
 }
 
 
-
+/**
+ * Produce one line of box filtered output from the two integral
+ * image rows 'a' (top) and 'b' (bottom). 'z' is number of interleaved
+ * channels
+ */
 static void
-box_blur_line_4chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
-		    int width, int boxw, int m)
+box_blur_line(uint8_t *d, const uint32_t *a, const uint32_t *b,
+              int width, int boxw, int m, int z)
 {
-  int x;
+  int x, c;
   unsigned int v;
   for(x = 0; x < boxw; x++) {
-    const int x1 = 4 * MIN(x + boxw, width - 1);
+    const int x1 = z * MIN(x + boxw, width - 1);
     const int x2 = 0;
 
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
+    for(c = 0; c < z; c++) {
+      v = b[x1 + c] + a[x2 + c] - b[x2 + c] - a[x1 + c];
+      *d++ = (v * m) >> 16;
+    }
   }
 
-  for(; x < width - boxw; x++) {
-    const int x1 = 4 * (x + boxw);
-    const int x2 = 4 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
+  if(x < width - boxw) {
+    const int num = width - boxw - x;
+    pixmap_kernels.pk_box_sum(d, a + z * x, b + z * x, z * boxw, z * num, m);
+    d += z * num;
+    x += num;
   }
 
   for(; x < width; x++) {
-    const int x1 = 4 * (width - 1);
-    const int x2 = 4 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
+    const int x1 = z * (width - 1);
+    const int x2 = z * (x - boxw);
+
+    for(c = 0; c < z; c++) {
+      v = b[x1 + c] + a[x2 + c] - b[x2 + c] - a[x1 + c];
+      *d++ = (v * m) >> 16;
+    }
   }
 }
 
@@ -626,23 +627,8 @@ pixmap_box_blur(pixmap_t *pm, int boxw, int boxh)
 
   boxw = MIN(boxw, w);
 
-  void (*fn)(uint8_t *dst, const uint32_t *a, const uint32_t *b, int width,
-	     int boxw, int m);
-
-  switch(z) {
-  case 2:
-    fn = box_blur_line_2chan;
-    break;
-  case 4:
-    fn = box_blur_line_4chan;
-    break;
-
-
-  default:
+  if(z != 2 && z != 4)
     return;
-  }
-
-
 
   tmp = mymalloc(ls * h * sizeof(unsigned int));
   if(tmp == NULL)
@@ -664,15 +650,15 @@ pixmap_box_blur(pixmap_t *pm, int boxw, int boxh)
     s = pm->pm_data + y * ls;
     t = tmp + y * ls;
 
-    for(i = 0; i < z; i++) {
-      t[0] = *s++ + t[-ls];
-      t++;
-    }
+    // Horizontal prefix sum, then add the row above (vectorizable)
 
-    for(x = 0; x < (w-1)*z; x++) {
-      t[0] = *s++ + t[-z] + t[-ls] - t[-ls - z];
-      t++;
-    }
+    for(i = 0; i < z; i++)
+      t[i] = s[i];
+
+    for(x = z; x < w * z; x++)
+      t[x] = s[x] + t[x - z];
+
+    pixmap_kernels.pk_integral_add(t, t - ls, w * z);
   }
 
   int m = 65536 / ((boxw * 2 + 1) * (boxh * 2 + 1));
@@ -684,7 +670,7 @@ pixmap_box_blur(pixmap_t *pm, int boxw, int boxh)
 
     const unsigned int *a = tmp + ls * MAX(0, y - boxh);
     const unsigned int *b = tmp + ls * MIN(h - 1, y + boxh);
-    fn(d, a, b, w, boxw, m);
+    box_blur_line(d, a, b, w, boxw, m, z);
   }
 
   free(tmp);
@@ -732,45 +718,12 @@ mix_bgr32(uint32_t src, uint32_t dst)
 /**
  *
  */
-static void
-drop_shadow_rgba(uint8_t *D, const uint32_t *a, const uint32_t *b,
-                 int width, int boxw, int m)
+void
+pixmap_shadow_mix_bgr32_c(uint32_t *d, const uint8_t *s, int num)
 {
-  uint32_t *d = (uint32_t *)D;
-
-  int x;
-  unsigned int v;
-  int s;
-  for(x = 0; x < boxw; x++) {
-    const int x1 = MIN(x + boxw, width - 1);
-    const int x2 = 0;
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
-
-  for(; x < width - boxw; x++) {
-    const int x1 = (x + boxw);
-    const int x2 = (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
-
-  for(; x < width; x++) {
-    const int x1 = (width - 1);
-    const int x2 = (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
+  int i;
+  for(i = 0; i < num; i++)
+    d[i] = mix_bgr32(d[i], s[i] << 24);
 }
 
 
@@ -803,46 +756,17 @@ mix_ia(uint8_t *src, uint8_t *dst, int DR, int DA)
   }
 }
 
+
 /**
  *
  */
-static void
-drop_shadow_ia(uint8_t *d, const uint32_t *a, const uint32_t *b,
-               int width, int boxw, int m)
+void
+pixmap_shadow_mix_ia_c(uint8_t *d, const uint8_t *s, int num)
 {
-
-  int x;
-  unsigned int v;
-  int s;
-  for(x = 0; x < boxw; x++) {
-    const int x1 = 2 * MIN(x + boxw, width - 1);
-    const int x2 = 0;
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-
-    mix_ia(d, d, 0, s);
-    d+=2;
-  }
-
-  for(; x < width - boxw; x++) {
-    const int x1 = 2 * (x + boxw);
-    const int x2 = 2 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    mix_ia(d, d, 0, s);
-    d+=2;
-  }
-
-  for(; x < width; x++) {
-    const int x1 = 2 * (width - 1);
-    const int x2 = 2 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    mix_ia(d, d, 0, s);
-    d+=2;
+  int i;
+  for(i = 0; i < num; i++) {
+    mix_ia(d, d, 0, s[i]);
+    d += 2;
   }
 }
 
@@ -855,6 +779,7 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
 {
   const uint8_t *s;
   unsigned int *tmp, *t;
+  uint8_t *shadow;
   int ach;   // Alpha channel
   int z;
   int w = pm->pm_width;
@@ -867,20 +792,15 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
 
   boxw = MIN(boxw, w);
 
-  void (*fn)(uint8_t *dst, const uint32_t *a, const uint32_t *b, int width,
-	     int boxw, int m);
-
   switch(pm->pm_type) {
   case PIXMAP_BGR32:
     ach = 3;
     z = 4;
-    fn = drop_shadow_rgba;
     break;
 
   case PIXMAP_IA:
     ach = 1;
     z = 2;
-    fn = drop_shadow_ia;
     break;
 
   default:
@@ -891,6 +811,12 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
   if(tmp == NULL)
     return;
 
+  shadow = mymalloc(w);
+  if(shadow == NULL) {
+    free(tmp);
+    return;
+  }
+
   s = pm->pm_data + ach;
   t = tmp;
 
@@ -902,13 +828,17 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
 
     s = pm->pm_data + (y - boxh) * ls + ach;
     for(x = 0; x < boxw; x++)
-      *t++ = 0;
-    
+      t[x] = 0;
+
+    // Horizontal prefix sum, then add the row above (vectorizable)
+
     for(; x < w; x++) {
-      t[0] = *s + t[-1] + t[-w] - t[-w - 1];
+      t[x] = *s + t[x - 1];
       s += z;
-      t++;
     }
+
+    pixmap_kernels.pk_integral_add(t + boxw, t + boxw - w, w - boxw);
+    t += w;
   }
   
   int m = 65536 / ((boxw * 2 + 1) * (boxh * 2 + 1));
@@ -918,11 +848,18 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
 
     const unsigned int *a = tmp + pm->pm_width * MAX(0, y - boxh);
     const unsigned int *b = tmp + pm->pm_width * MIN(h - 1, y + boxh);
-    fn(d, a, b, w, boxw, m);
+    box_blur_line(shadow, a, b, w, boxw, m, 1);
+
+    if(z == 4)
+      pixmap_kernels.pk_shadow_mix_bgr32((uint32_t *)d, shadow, w);
+    else
+      pixmap_kernels.pk_shadow_mix_ia(d, shadow, w);
   }
+  free(shadow);
   free(tmp);
 }
 
+
 #if 0
 /**
  *
@@ -971,35 +908,46 @@ pixmap_intensity_analysis(pixmap_t *pm)
 #endif
 
 
+#define INTENSITY_MAX_SAMPLES 65536
+
 /**
- *
+ * Intensity is computed from a histogram over an evenly spaced
+ * subset of the pixels
  */
 void
 pixmap_intensity_analysis(pixmap_t *pm)
 {
   int bin[256] = {0};
+  int pixels = 0;
+  const int step = pixmap_sample_step(pm, INTENSITY_MAX_SAMPLES);
+  const int w = pm->pm_width  - pm->pm_margin * 2;
+  const int h = pm->pm_height - pm->pm_margin * 2;
 
   switch(pm->pm_type) {
   case PIXMAP_RGB24:
-    for(int y = 0; y < pm->pm_height; y++) {
+    for(int y = 0; y < h; y += step) {
       const uint8_t *src = pm_pixel(pm, 0, y);
-      for(int x = 0; x < pm->pm_width; x++) {
-        unsigned int v = (src[0] + src[1] + src[2]);
+      for(int x = 0; x < w; x += step) {
+        unsigned int v = src[0] + src[1] + src[2];
         bin[v / 3]++;
+        pixels++;
+        src += 3 * step;
       }
     }
     break;
 
   case PIXMAP_BGR32:
-    for(int y = 0; y < pm->pm_height; y++) {
+    for(int y = 0; y < h; y += step) {
       const uint32_t *src = pm_pixel(pm, 0, y);
-      for(int x = 0; x < pm->pm_width; x++) {
-        unsigned int u32 = *src++;
+      for(int x = 0; x < w; x += step) {
+        unsigned int u32 = *src;
         unsigned int r = u32 & 0xff;
         unsigned int g = (u32 >> 8) & 0xff;
         unsigned int b = (u32 >> 16) & 0xff;
         unsigned int v = r + g + b;
         bin[v / 3]++;
+        pixels++;
+        src += step;
       }
     }
     break;
@@ -1008,7 +956,6 @@ pixmap_intensity_analysis(pixmap_t *pm)
     printf("Cant do intensity analysis for pixfmt %d\n", pm->pm_type);
   }
 
-  int pixels = pm->pm_width * pm->pm_height;
   int limit = pixels * 0.95;
   int i;
   for(i = 255; i >= 0; i--) {
@@ -1024,10 +971,44 @@ pixmap_intensity_analysis(pixmap_t *pm)
 
 
 
-// gcc -O3 src/misc/pixmap.c -o /tmp/pixmap -Isrc -DLOCAL_MAIN
+/**
+ * Scalar reference kernels
+ */
+const pixmap_kernels_t pixmap_kernels_c = {
+  .pk_name                     = "C",
+  .pk_rgb24_to_bgr32           = pixmap_rgb24_to_bgr32_c,
+  .pk_integral_add             = pixmap_integral_add_c,
+  .pk_box_sum                  = pixmap_box_sum_c,
+  .pk_composite_GRAY8_on_BGR32 = pixmap_composite_GRAY8_on_BGR32_c,
+  .pk_shadow_mix_bgr32         = pixmap_shadow_mix_bgr32_c,
+  .pk_shadow_mix_ia            = pixmap_shadow_mix_ia_c,
+};
+
+
+
+/**
+ * Bit-exactness test and benchmark of the SIMD kernels vs. the
+ * scalar reference implementation. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Ibuild.linux src/image/pixmap.c \
+ *   src/image/pixmap_simd.c -o /tmp/pixmap -lm
+ */
 
 #ifdef LOCAL_MAIN
 
+void *
+mymalloc(size_t size)
+{
+  return malloc(size);
+}
+
+void *
+mymemalign(size_t align, size_t size)
+{
+  void *p;
+  return posix_memalign(&p, align, size) ? NULL : p;
+}
+
 static int64_t
 get_ts(void)
 {
@@ -1036,22 +1017,160 @@ get_ts(void)
   return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
 }
 
-int
-main(int argc, char **argv)
+
+static uint32_t lm_seed;
+
+static uint8_t
+lm_rand(void)
 {
-  pixmap_t *dst = pixmap_create(2048, 2048, PIXMAP_BGR32);
-  pixmap_t *src = pixmap_create(2048, 2048, PIXMAP_GRAY8);
+  lm_seed = lm_seed * 1103515245 + 12345;
+  return lm_seed >> 16;
+}
 
-  memset(src->pm_pixels, 0xff, src->pm_linesize * src->pm_height);
 
-  int64_t a = get_ts();
-  pixmap_composite(dst, src, 0, 0, 0xffffffff);
-  printf("Compositing in %dµs\n",(int)( get_ts() - a));
-  printf("dst pixel(0,0) = 0x%x\n", dst->pm_pixels[0]);
-  return 0;
+/**
+ * Mix of transparent, opaque and random areas so all fast and slow
+ * paths in the kernels are exercised
+ */
+static pixmap_t *
+lm_create(pixmap_type_t type, int w, int h)
+{
+  pixmap_t *pm = pixmap_create(w, h, type, 0);
+  const int bpp = bytes_per_pixel(type);
+  const int ach = bpp == 4 ? 3 : bpp == 2 ? 1 : 0;
+
+  lm_seed = 1;
+  for(int y = 0; y < h; y++) {
+    uint8_t *p = pm->pm_data + y * pm->pm_linesize;
+    for(int x = 0; x < w; x++) {
+      int region = ((x / 37) + (y / 23)) % 4;
+      for(int c = 0; c < bpp; c++)
+        p[c] = region ? lm_rand() : 0;
+
+      if(region == 1)
+        p[ach] = 255;
+      else if(region == 2 && bpp != 3)
+        p[ach] = 0;
+      p += bpp;
+    }
+  }
+  return pm;
 }
 
-#endif
+
+static pixmap_t *
+lm_clone(const pixmap_t *src)
+{
+  pixmap_t *pm = pixmap_create(src->pm_width, src->pm_height,
+                               src->pm_type, 0);
+  memcpy(pm->pm_data, src->pm_data, src->pm_linesize * src->pm_height);
+  return pm;
+}
+
+
+static pixmap_t *lm_glyph;
+
+static pixmap_t *
+lm_composite(pixmap_t *pm)
+{
+  pixmap_composite(pm, lm_glyph, 0, 0, 0xffc0a080);
+  return pm;
+}
+
+static pixmap_t *
+lm_composite_translucent(pixmap_t *pm)
+{
+  pixmap_composite(pm, lm_glyph, 0, 0, 0x80ffffff);
+  return pm;
+}
+
+static pixmap_t *
+lm_box_blur(pixmap_t *pm)
+{
+  pixmap_box_blur(pm, 4, 4);
+  return pm;
+}
+
+static pixmap_t *
+lm_drop_shadow(pixmap_t *pm)
+{
+  pixmap_drop_shadow(pm, 6, 6);
+  return pm;
+}
+
+static pixmap_t *
+lm_rounded_corners(pixmap_t *pm)
+{
+  return pixmap_rounded_corners(pm, 16, 0xf);
+}
+
+
+static int
+lm_test(const char *name, pixmap_type_t type, pixmap_t *(*op)(pixmap_t *),
+        const pixmap_kernels_t *simd)
+{
+  const int w = 1920, h = 1080, iterations = 20;
+  pixmap_t *src = lm_create(type, w, h);
+  pixmap_t *out[2];
+  int64_t ts[2];
+
+  for(int i = 0; i < 2; i++) {
+    pixmap_kernels = i ? *simd : pixmap_kernels_c;
+    out[i] = op(lm_clone(src));
+
+    ts[i] = get_ts();
+    for(int j = 0; j < iterations; j++)
+      pixmap_release(op(lm_clone(src)));
+    ts[i] = get_ts() - ts[i];
+  }
+
+  int bad = 0;
+  const int rowsize = out[0]->pm_width * bytes_per_pixel(out[0]->pm_type);
+  for(int y = 0; y < out[0]->pm_height; y++) {
+    if(memcmp(out[0]->pm_data + y * out[0]->pm_linesize,
+              out[1]->pm_data + y * out[1]->pm_linesize, rowsize)) {
+      printf("%s: Mismatch at row %d\n", name, y);
+      bad = 1;
+      break;
+    }
+  }
+
+  const double mpix = (double)w * h * iterations;
+  printf("%-24s %8.1f MP/s (%s) %8.1f MP/s (%s) %s\n", name,
+         mpix / ts[0], pixmap_kernels_c.pk_name,
+         mpix / ts[1], simd->pk_name,
+         bad ? "FAIL" : "OK");
+
+  pixmap_release(out[0]);
+  pixmap_release(out[1]);
+  pixmap_release(src);
+  return bad;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  pixmap_kernels_t simd = pixmap_kernels_c;
+  int err = 0;
+
+  pixmap_simd_init(&simd, argc > 1 ? PIXMAP_SIMD_NO_AVX2 : 0);
+
+  lm_glyph = lm_create(PIXMAP_I, 1920, 1080);
+
+  err |= lm_test("composite", PIXMAP_BGR32, lm_composite, &simd);
+  err |= lm_test("composite translucent", PIXMAP_BGR32,
+                 lm_composite_translucent, &simd);
+  err |= lm_test("box blur BGR32", PIXMAP_BGR32, lm_box_blur, &simd);
+  err |= lm_test("box blur IA", PIXMAP_IA, lm_box_blur, &simd);
+  err |= lm_test("drop shadow BGR32", PIXMAP_BGR32, lm_drop_shadow, &simd);
+  err |= lm_test("drop shadow IA", PIXMAP_IA, lm_drop_shadow, &simd);
+  err |= lm_test("rounded corners RGB24", PIXMAP_RGB24,
+                 lm_rounded_corners, &simd);
+  return err;
+}
+
+#else
 
 
 /**
@@ -1114,3 +1233,5 @@ static backend_t be_pixmap = {
 };
 
 BE_REGISTER(pixmap);
+
+#endif
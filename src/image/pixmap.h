@@ -114,6 +114,9 @@ void pixmap_compute_rescale_dim(const image_meta_t *im,
 				int src_width, int src_height,
 				int *dst_width, int *dst_height);
 
+int pixmap_compute_jpeg_downscale(const image_meta_t *im,
+                                  int src_width, int src_height);
+
 void pixmap_intensity_analysis(pixmap_t *pm);
 
 /**
@@ -148,3 +151,18 @@ pm_pixel(pixmap_t *pm, unsigned int x, unsigned int y)
   return pm->pm_data + (y + pm->pm_margin) * pm->pm_linesize +
     (x + pm->pm_margin) * bytes_per_pixel(pm->pm_type);
 }
+
+
+/**
+ * Pixel step in both directions to use when analyzing an image so
+ * that at most (roughly) 'max_samples' pixels are visited
+ */
+static __inline int
+pixmap_sample_step(const pixmap_t *pm, int max_samples)
+{
+  int step = 1;
+  while(((pm->pm_width + step - 1) / step) *
+        ((pm->pm_height + step - 1) / step) > max_samples)
+    step++;
+  return step;
+}
@@ -0,0 +1,563 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+
+#include "compiler.h"
+#include "pixmap_simd.h"
+
+/**
+ * SIMD versions of the kernels in pixmap.c
+ *
+ * Compositing and shadow mixing only vectorize the cases where the
+ * alpha blend degenerates to a copy or a constant (fully transparent or
+ * fully opaque source/destination). That covers almost every pixel of
+ * rendered text and thumbnails. Groups of pixels that need a real blend
+ * are handed back to the scalar code so output stays bit-exact.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+  defined(__GNUC__)
+#define PIXMAP_SIMD_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#elif (defined(__ARM_NEON__) || defined(__ARM_NEON)) && \
+  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PIXMAP_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+
+#ifdef PIXMAP_SIMD_X86
+
+/**
+ * 32bit multiply (low part) for SSE2, pmulld is SSE4.1
+ */
+static inline __m128i
+mullo32_sse2(__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+
+/**
+ *
+ */
+static void
+integral_add_sse2(uint32_t *d, const uint32_t *above, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(d + i));
+    __m128i y = _mm_loadu_si128((const __m128i *)(above + i));
+    _mm_storeu_si128((__m128i *)(d + i), _mm_add_epi32(x, y));
+  }
+  pixmap_integral_add_c(d + i, above + i, num - i);
+}
+
+
+/**
+ *
+ */
+static inline __m128i
+box_sum4_sse2(const uint32_t *a, const uint32_t *b, int off)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)(b + off));
+  v = _mm_add_epi32(v, _mm_loadu_si128((const __m128i *)(a - off)));
+  v = _mm_sub_epi32(v, _mm_loadu_si128((const __m128i *)(b - off)));
+  v = _mm_sub_epi32(v, _mm_loadu_si128((const __m128i *)(a + off)));
+  return v;
+}
+
+
+/**
+ *
+ */
+static void
+box_sum_sse2(uint8_t *d, const uint32_t *a, const uint32_t *b,
+             int off, int num, unsigned int m)
+{
+  const __m128i mm = _mm_set1_epi32(m);
+  const __m128i lowbyte = _mm_set1_epi32(0xff);
+  int i = 0;
+
+  for(; i + 8 <= num; i += 8) {
+    __m128i v0 = mullo32_sse2(box_sum4_sse2(a + i,     b + i,     off), mm);
+    __m128i v1 = mullo32_sse2(box_sum4_sse2(a + i + 4, b + i + 4, off), mm);
+    v0 = _mm_and_si128(_mm_srli_epi32(v0, 16), lowbyte);
+    v1 = _mm_and_si128(_mm_srli_epi32(v1, 16), lowbyte);
+    __m128i p = _mm_packs_epi32(v0, v1);
+    _mm_storel_epi64((__m128i *)(d + i), _mm_packus_epi16(p, p));
+  }
+  pixmap_box_sum_c(d + i, a + i, b + i, off, num - i, m);
+}
+
+
+/**
+ * RGB24 -> BGR32 using pshufb, 16 pixels (48 bytes) per iteration
+ */
+__attribute__((target("ssse3"))) static void
+rgb24_to_bgr32_ssse3(uint32_t *d, const uint8_t *s, int width)
+{
+  const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                     6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  int x = 0;
+
+  for(; x + 16 <= width; x += 16) {
+    __m128i i0 = _mm_loadu_si128((const __m128i *)(s + 0));
+    __m128i i1 = _mm_loadu_si128((const __m128i *)(s + 16));
+    __m128i i2 = _mm_loadu_si128((const __m128i *)(s + 32));
+
+    __m128i p0 = i0;
+    __m128i p1 = _mm_alignr_epi8(i1, i0, 12);
+    __m128i p2 = _mm_alignr_epi8(i2, i1, 8);
+    __m128i p3 = _mm_srli_si128(i2, 4);
+
+    _mm_storeu_si128((__m128i *)(d +  0),
+                     _mm_or_si128(_mm_shuffle_epi8(p0, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(d +  4),
+                     _mm_or_si128(_mm_shuffle_epi8(p1, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(d +  8),
+                     _mm_or_si128(_mm_shuffle_epi8(p2, shuf), alpha));
+    _mm_storeu_si128((__m128i *)(d + 12),
+                     _mm_or_si128(_mm_shuffle_epi8(p3, shuf), alpha));
+    s += 48;
+    d += 16;
+  }
+  pixmap_rgb24_to_bgr32_c(d, s, width - x);
+}
+
+
+/**
+ * DIV255(src * CA) for 4 pixels, result in 32bit lanes
+ */
+static inline __m128i
+source_alpha_sse2(const uint8_t *src, __m128i ca)
+{
+  uint32_t u32;
+  memcpy(&u32, src, 4);
+  __m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u32), _mm_setzero_si128());
+  x = _mm_mullo_epi16(x, ca);
+  __m128i t = _mm_srli_epi16(_mm_add_epi16(x, _mm_set1_epi16(255)), 8);
+  x = _mm_srli_epi16(_mm_add_epi16(t, x), 8);
+  return _mm_unpacklo_epi16(x, _mm_setzero_si128());
+}
+
+
+/**
+ *
+ */
+static void
+composite_GRAY8_on_BGR32_sse2(uint8_t *dst_, const uint8_t *src,
+                              int CR, int CG, int CB, int CA, int width)
+{
+  uint32_t *dst = (uint32_t *)dst_;
+  const __m128i ca = _mm_set1_epi16(CA);
+  const __m128i color = _mm_set1_epi32(CB << 16 | CG << 8 | CR);
+  const __m128i amask = _mm_set1_epi32(0xff000000);
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+
+  for(; x + 4 <= width; x += 4) {
+    __m128i sa = source_alpha_sse2(src + x, ca);
+    __m128i d  = _mm_loadu_si128((const __m128i *)(dst + x));
+    __m128i sa0 = _mm_cmpeq_epi32(sa, zero);
+    __m128i o;
+
+    if(_mm_movemask_epi8(sa0) == 0xffff) {
+      // Source fully transparent, only fully transparent dst is touched
+      o = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(d, amask), zero), d);
+    } else if(_mm_movemask_epi8(_mm_cmpeq_epi32(sa, _mm_set1_epi32(255)))
+              == 0xffff) {
+      o = _mm_or_si128(color, amask);
+    } else if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, amask),
+                                                zero)) == 0xffff) {
+      // Destination fully transparent, result is source color + alpha
+      o = _mm_andnot_si128(sa0, _mm_or_si128(_mm_slli_epi32(sa, 24), color));
+    } else {
+      pixmap_composite_GRAY8_on_BGR32_c((uint8_t *)(dst + x), src + x,
+                                        CR, CG, CB, CA, 4);
+      continue;
+    }
+    _mm_storeu_si128((__m128i *)(dst + x), o);
+  }
+  pixmap_composite_GRAY8_on_BGR32_c((uint8_t *)(dst + x), src + x,
+                                    CR, CG, CB, CA, width - x);
+}
+
+
+/**
+ *
+ */
+static void
+shadow_mix_bgr32_sse2(uint32_t *d, const uint8_t *s, int num)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+
+  for(; i + 4 <= num; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(d + i));
+    __m128i a = _mm_srli_epi32(v, 24);
+    __m128i opaque = _mm_cmpeq_epi32(a, _mm_set1_epi32(255));
+    __m128i transp = _mm_cmpeq_epi32(a, zero);
+
+    if(_mm_movemask_epi8(_mm_or_si128(opaque, transp)) != 0xffff) {
+      pixmap_shadow_mix_bgr32_c(d + i, s + i, 4);
+      continue;
+    }
+
+    if(_mm_movemask_epi8(opaque) == 0xffff)
+      continue;
+
+    uint32_t u32;
+    memcpy(&u32, s + i, 4);
+    __m128i sh = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u32), zero);
+    sh = _mm_slli_epi32(_mm_unpacklo_epi16(sh, zero), 24);
+
+    v = _mm_or_si128(_mm_and_si128(opaque, v), _mm_and_si128(transp, sh));
+    _mm_storeu_si128((__m128i *)(d + i), v);
+  }
+  pixmap_shadow_mix_bgr32_c(d + i, s + i, num - i);
+}
+
+
+/**
+ *
+ */
+static void
+shadow_mix_ia_sse2(uint8_t *d, const uint8_t *s, int num)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+
+  for(; i + 8 <= num; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(d + i * 2));
+    __m128i a = _mm_srli_epi16(v, 8);
+    __m128i opaque = _mm_cmpeq_epi16(a, _mm_set1_epi16(255));
+    __m128i transp = _mm_cmpeq_epi16(a, zero);
+
+    if(_mm_movemask_epi8(_mm_or_si128(opaque, transp)) != 0xffff) {
+      pixmap_shadow_mix_ia_c(d + i * 2, s + i, 8);
+      continue;
+    }
+
+    if(_mm_movemask_epi8(opaque) == 0xffff)
+      continue;
+
+    __m128i sh = _mm_unpacklo_epi8(zero,
+                                   _mm_loadl_epi64((const __m128i *)(s + i)));
+    v = _mm_or_si128(_mm_and_si128(opaque, v), _mm_and_si128(transp, sh));
+    _mm_storeu_si128((__m128i *)(d + i * 2), v);
+  }
+  pixmap_shadow_mix_ia_c(d + i * 2, s + i, num - i);
+}
+
+
+/**
+ *
+ */
+__attribute__((target("avx2"))) static void
+integral_add_avx2(uint32_t *d, const uint32_t *above, int num)
+{
+  int i = 0;
+  for(; i + 8 <= num; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(d + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(above + i));
+    _mm256_storeu_si256((__m256i *)(d + i), _mm256_add_epi32(x, y));
+  }
+  pixmap_integral_add_c(d + i, above + i, num - i);
+}
+
+
+/**
+ *
+ */
+__attribute__((target("avx2"))) static inline __m256i
+box_sum8_avx2(const uint32_t *a, const uint32_t *b, int off, __m256i mm)
+{
+  __m256i v = _mm256_loadu_si256((const __m256i *)(b + off));
+  v = _mm256_add_epi32(v, _mm256_loadu_si256((const __m256i *)(a - off)));
+  v = _mm256_sub_epi32(v, _mm256_loadu_si256((const __m256i *)(b - off)));
+  v = _mm256_sub_epi32(v, _mm256_loadu_si256((const __m256i *)(a + off)));
+  v = _mm256_srli_epi32(_mm256_mullo_epi32(v, mm), 16);
+  return _mm256_and_si256(v, _mm256_set1_epi32(0xff));
+}
+
+
+/**
+ *
+ */
+__attribute__((target("avx2"))) static void
+box_sum_avx2(uint8_t *d, const uint32_t *a, const uint32_t *b,
+             int off, int num, unsigned int m)
+{
+  const __m256i mm = _mm256_set1_epi32(m);
+  int i = 0;
+
+  for(; i + 16 <= num; i += 16) {
+    __m256i v0 = box_sum8_avx2(a + i,     b + i,     off, mm);
+    __m256i v1 = box_sum8_avx2(a + i + 8, b + i + 8, off, mm);
+    // packs works per 128 bit lane, restore order before final pack
+    __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(v0, v1), 0xd8);
+    __m128i r = _mm_packus_epi16(_mm256_castsi256_si128(p),
+                                 _mm256_extracti128_si256(p, 1));
+    _mm_storeu_si128((__m128i *)(d + i), r);
+  }
+  box_sum_sse2(d + i, a + i, b + i, off, num - i, m);
+}
+
+#endif // PIXMAP_SIMD_X86
+
+
+#ifdef PIXMAP_SIMD_NEON
+
+/**
+ *
+ */
+static inline int
+neon_all_set_u32(uint32x4_t v)
+{
+  uint32x2_t t = vand_u32(vget_low_u32(v), vget_high_u32(v));
+  return (vget_lane_u32(t, 0) & vget_lane_u32(t, 1)) == 0xffffffff;
+}
+
+
+/**
+ *
+ */
+static inline int
+neon_all_set_u16(uint16x8_t v)
+{
+  return neon_all_set_u32(vreinterpretq_u32_u16(v));
+}
+
+
+/**
+ *
+ */
+static void
+rgb24_to_bgr32_neon(uint32_t *d, const uint8_t *s, int width)
+{
+  int x = 0;
+  for(; x + 16 <= width; x += 16) {
+    uint8x16x3_t in = vld3q_u8(s);
+    uint8x16x4_t out;
+    out.val[0] = in.val[0];
+    out.val[1] = in.val[1];
+    out.val[2] = in.val[2];
+    out.val[3] = vdupq_n_u8(0xff);
+    vst4q_u8((uint8_t *)d, out);
+    s += 48;
+    d += 16;
+  }
+  pixmap_rgb24_to_bgr32_c(d, s, width - x);
+}
+
+
+/**
+ *
+ */
+static void
+integral_add_neon(uint32_t *d, const uint32_t *above, int num)
+{
+  int i = 0;
+  for(; i + 4 <= num; i += 4)
+    vst1q_u32(d + i, vaddq_u32(vld1q_u32(d + i), vld1q_u32(above + i)));
+  pixmap_integral_add_c(d + i, above + i, num - i);
+}
+
+
+/**
+ *
+ */
+static inline uint16x4_t
+box_sum4_neon(const uint32_t *a, const uint32_t *b, int off, unsigned int m)
+{
+  uint32x4_t v = vaddq_u32(vld1q_u32(b + off), vld1q_u32(a - off));
+  v = vsubq_u32(v, vld1q_u32(b - off));
+  v = vsubq_u32(v, vld1q_u32(a + off));
+  return vmovn_u32(vshrq_n_u32(vmulq_n_u32(v, m), 16));
+}
+
+
+/**
+ *
+ */
+static void
+box_sum_neon(uint8_t *d, const uint32_t *a, const uint32_t *b,
+             int off, int num, unsigned int m)
+{
+  int i = 0;
+  for(; i + 8 <= num; i += 8) {
+    uint16x8_t v = vcombine_u16(box_sum4_neon(a + i,     b + i,     off, m),
+                                box_sum4_neon(a + i + 4, b + i + 4, off, m));
+    vst1_u8(d + i, vmovn_u16(v));
+  }
+  pixmap_box_sum_c(d + i, a + i, b + i, off, num - i, m);
+}
+
+
+/**
+ *
+ */
+static void
+composite_GRAY8_on_BGR32_neon(uint8_t *dst_, const uint8_t *src,
+                              int CR, int CG, int CB, int CA, int width)
+{
+  uint32_t *dst = (uint32_t *)dst_;
+  const uint32x4_t color = vdupq_n_u32(CB << 16 | CG << 8 | CR);
+  const uint32x4_t amask = vdupq_n_u32(0xff000000);
+  const uint8x8_t ca = vdup_n_u8(CA);
+  int x = 0;
+
+  for(; x + 8 <= width; x += 8) {
+    uint16x8_t t = vmull_u8(vld1_u8(src + x), ca);
+    uint16x8_t sa = vshrq_n_u16(vaddq_u16(vshrq_n_u16(vaddq_u16(t, vdupq_n_u16(255)), 8), t), 8);
+
+    for(int h = 0; h < 2; h++) {
+      uint32_t *dp = dst + x + h * 4;
+      uint32x4_t sa32 = vmovl_u16(h ? vget_high_u16(sa) : vget_low_u16(sa));
+      uint32x4_t d = vld1q_u32(dp);
+      uint32x4_t sa0 = vceqq_u32(sa32, vdupq_n_u32(0));
+      uint32x4_t da0 = vceqq_u32(vandq_u32(d, amask), vdupq_n_u32(0));
+
+      if(neon_all_set_u32(sa0)) {
+        d = vbicq_u32(d, da0);
+      } else if(neon_all_set_u32(vceqq_u32(sa32, vdupq_n_u32(255)))) {
+        d = vorrq_u32(color, amask);
+      } else if(neon_all_set_u32(da0)) {
+        d = vbicq_u32(vorrq_u32(vshlq_n_u32(sa32, 24), color), sa0);
+      } else {
+        pixmap_composite_GRAY8_on_BGR32_c((uint8_t *)dp, src + x + h * 4,
+                                          CR, CG, CB, CA, 4);
+        continue;
+      }
+      vst1q_u32(dp, d);
+    }
+  }
+  pixmap_composite_GRAY8_on_BGR32_c((uint8_t *)(dst + x), src + x,
+                                    CR, CG, CB, CA, width - x);
+}
+
+
+/**
+ *
+ */
+static void
+shadow_mix_bgr32_neon(uint32_t *d, const uint8_t *s, int num)
+{
+  int i = 0;
+
+  for(; i + 4 <= num; i += 4) {
+    uint32x4_t v = vld1q_u32(d + i);
+    uint32x4_t a = vshrq_n_u32(v, 24);
+    uint32x4_t opaque = vceqq_u32(a, vdupq_n_u32(255));
+    uint32x4_t transp = vceqq_u32(a, vdupq_n_u32(0));
+
+    if(!neon_all_set_u32(vorrq_u32(opaque, transp))) {
+      pixmap_shadow_mix_bgr32_c(d + i, s + i, 4);
+      continue;
+    }
+
+    if(neon_all_set_u32(opaque))
+      continue;
+
+    uint32x4_t sh = {s[i], s[i + 1], s[i + 2], s[i + 3]};
+    sh = vshlq_n_u32(sh, 24);
+    vst1q_u32(d + i, vorrq_u32(vandq_u32(opaque, v), vandq_u32(transp, sh)));
+  }
+  pixmap_shadow_mix_bgr32_c(d + i, s + i, num - i);
+}
+
+
+/**
+ *
+ */
+static void
+shadow_mix_ia_neon(uint8_t *d, const uint8_t *s, int num)
+{
+  int i = 0;
+
+  for(; i + 8 <= num; i += 8) {
+    uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(d + i * 2));
+    uint16x8_t a = vshrq_n_u16(v, 8);
+    uint16x8_t opaque = vceqq_u16(a, vdupq_n_u16(255));
+    uint16x8_t transp = vceqq_u16(a, vdupq_n_u16(0));
+
+    if(!neon_all_set_u16(vorrq_u16(opaque, transp))) {
+      pixmap_shadow_mix_ia_c(d + i * 2, s + i, 8);
+      continue;
+    }
+
+    if(neon_all_set_u16(opaque))
+      continue;
+
+    uint16x8_t sh = vshlq_n_u16(vmovl_u8(vld1_u8(s + i)), 8);
+    v = vorrq_u16(vandq_u16(opaque, v), vandq_u16(transp, sh));
+    vst1q_u8(d + i * 2, vreinterpretq_u8_u16(v));
+  }
+  pixmap_shadow_mix_ia_c(d + i * 2, s + i, num - i);
+}
+
+#endif // PIXMAP_SIMD_NEON
+
+
+/**
+ * Select the best kernels for the CPU we're running on
+ */
+void
+pixmap_simd_init(pixmap_kernels_t *pk, int flags)
+{
+#ifdef PIXMAP_SIMD_X86
+  __builtin_cpu_init();
+
+  pk->pk_name                     = "SSE2";
+  pk->pk_integral_add             = integral_add_sse2;
+  pk->pk_box_sum                  = box_sum_sse2;
+  pk->pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32_sse2;
+  pk->pk_shadow_mix_bgr32         = shadow_mix_bgr32_sse2;
+  pk->pk_shadow_mix_ia            = shadow_mix_ia_sse2;
+
+  if(__builtin_cpu_supports("ssse3")) {
+    pk->pk_name                   = "SSSE3";
+    pk->pk_rgb24_to_bgr32         = rgb24_to_bgr32_ssse3;
+  }
+
+  if(__builtin_cpu_supports("avx2") && !(flags & PIXMAP_SIMD_NO_AVX2)) {
+    pk->pk_name                   = "AVX2";
+    pk->pk_integral_add           = integral_add_avx2;
+    pk->pk_box_sum                = box_sum_avx2;
+  }
+#endif
+
+#ifdef PIXMAP_SIMD_NEON
+  pk->pk_name                     = "NEON";
+  pk->pk_rgb24_to_bgr32           = rgb24_to_bgr32_neon;
+  pk->pk_integral_add             = integral_add_neon;
+  pk->pk_box_sum                  = box_sum_neon;
+  pk->pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32_neon;
+  pk->pk_shadow_mix_bgr32         = shadow_mix_bgr32_neon;
+  pk->pk_shadow_mix_ia            = shadow_mix_ia_neon;
+#endif
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Per-line pixel kernels used by pixmap.c
+ *
+ * The scalar (_c) versions are the reference implementations. The SIMD
+ * versions must produce bit-exact identical output and are free to
+ * call back into the scalar versions for pixels they don't want to deal
+ * with (tails, mixed alpha, etc)
+ */
+typedef struct pixmap_kernels {
+  const char *pk_name;
+
+  // dst[x] = 0xff000000 | src[x*3+2] << 16 | src[x*3+1] << 8 | src[x*3]
+  void (*pk_rgb24_to_bgr32)(uint32_t *dst, const uint8_t *src, int width);
+
+  // dst[i] += above[i]
+  void (*pk_integral_add)(uint32_t *dst, const uint32_t *above, int num);
+
+  // dst[i] = ((b[i+off] + a[i-off] - b[i-off] - a[i+off]) * m) >> 16
+  void (*pk_box_sum)(uint8_t *dst, const uint32_t *a, const uint32_t *b,
+                     int off, int num, unsigned int m);
+
+  void (*pk_composite_GRAY8_on_BGR32)(uint8_t *dst, const uint8_t *src,
+                                      int CR, int CG, int CB, int CA,
+                                      int width);
+
+  // Blend shadow (black with alpha from 'alpha') under 'dst'
+  void (*pk_shadow_mix_bgr32)(uint32_t *dst, const uint8_t *alpha, int num);
+  void (*pk_shadow_mix_ia)(uint8_t *dst, const uint8_t *alpha, int num);
+
+} pixmap_kernels_t;
+
+extern pixmap_kernels_t pixmap_kernels;
+
+extern const pixmap_kernels_t pixmap_kernels_c;
+
+void pixmap_simd_init(pixmap_kernels_t *pk, int flags);
+
+#define PIXMAP_SIMD_NO_AVX2 0x1
+
+void pixmap_rgb24_to_bgr32_c(uint32_t *dst, const uint8_t *src, int width);
+
+void pixmap_integral_add_c(uint32_t *dst, const uint32_t *above, int num);
+
+void pixmap_box_sum_c(uint8_t *dst, const uint32_t *a, const uint32_t *b,
+                      int off, int num, unsigned int m);
+
+void pixmap_composite_GRAY8_on_BGR32_c(uint8_t *dst, const uint8_t *src,
+                                       int CR, int CG, int CB, int CA,
+                                       int width);
+
+void pixmap_shadow_mix_bgr32_c(uint32_t *dst, const uint8_t *alpha, int num);
+
+void pixmap_shadow_mix_ia_c(uint8_t *dst, const uint8_t *alpha, int num);
@@ -533,6 +533,14 @@ parse_opts(int argc, char **argv)
 	     "   --proxy <host:port> - Use SOCKS 4/5 proxy for http requests.\n"
 	     "   -j <path>           - Load javascript file\n"
 	     "   --skin <skin>       - Select skin (for GLW ui)\n"
+	     "   --imageloader-bench <dir>\n"
+	     "                       - Time cold and warm loads of the photos\n"
+	     "                         in <dir> as a grid would, then exit\n"
+#if CONFIG_AUDIOTEST
+	     "   --gapless-test <url1> <url2>\n"
+	     "                       - Play two tracks on a dummy audio device\n"
+	     "                         and exit non-zero if there is a gap\n"
+#endif
 	     "\n"
 	     "  URL is any URL-type supported, "
 	     "e.g., \"file:///...\"\n"
@@ -632,6 +640,15 @@ parse_opts(int argc, char **argv)
       gconf.load_ecmascript = argv[1];
       argc -= 2; argv += 2;
       continue;
+    } else if(!strcmp(argv[0], "--gapless-test") && argc > 2) {
+      gconf.gapless_test_urls[0] = argv[1];
+      gconf.gapless_test_urls[1] = argv[2];
+      argc -= 3; argv += 3;
+      continue;
+    } else if(!strcmp(argv[0], "--imageloader-bench") && argc > 1) {
+      gconf.imageloader_bench = argv[1];
+      argc -= 2; argv += 2;
+      continue;
     } else if(!strcmp(argv[0], "--vmir-bitcode") && argc > 1) {
       gconf.load_np = argv[1];
       argc -= 2; argv += 2;
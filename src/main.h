@@ -235,6 +235,8 @@ typedef struct gconf {
   int enable_omnigrade;
   int enable_http_debug;
   int disable_http_reuse;
+  int http_max_idle_connections;
+  int http_max_idle_connections_per_host;
   int enable_experimental;
   int enable_indexer;
   int enable_detailed_avdiff;
@@ -275,6 +277,9 @@ typedef struct gconf {
 
   const char *load_np;
 
+  const char *gapless_test_urls[2];
+  const char *imageloader_bench;
+
   const char *initial_url;
   const char *initial_view;
 
@@ -363,6 +363,8 @@ mp_final_release(void *aux)
 {
   media_pipe_t *mp = aux;
   prop_destroy(mp->mp_prop_root);
+  free(mp->mp_next_url);
+  free(mp->mp_next_mimetype);
   free(mp);
 }
 
@@ -676,6 +678,19 @@ mp_set_url(media_pipe_t *mp, const char *url, const char *parent_url,
 }
 
 
+/**
+ *
+ */
+void
+mp_set_next_url(media_pipe_t *mp, const char *url, const char *mimetype)
+{
+  hts_mutex_lock(&mp->mp_mutex);
+  mystrset(&mp->mp_next_url, url);
+  mystrset(&mp->mp_next_mimetype, mimetype);
+  hts_mutex_unlock(&mp->mp_mutex);
+}
+
+
 /**
  *
  */
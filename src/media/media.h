@@ -376,6 +376,14 @@ typedef struct media_pipe {
   char *mp_subtitle_loader_url;
   int mp_subtitle_loader_status;
 
+  /**
+   * URL (and mimetype, if any) expected to be played after the current
+   * one. Backends may use this to prepare playback of it in advance.
+   * Protected by mp_mutex
+   */
+  char *mp_next_url;
+  char *mp_next_mimetype;
+
 
   int64_t mp_reset_time;
   int mp_reset_epoch;
@@ -493,6 +501,13 @@ void mp_unhold(media_pipe_t *mp, int flag);
 void mp_set_url(media_pipe_t *mp, const char *url, const char *parent_url,
                 const char *parent_title);
 
+/**
+ * Set URL that will (most likely) be played after the current one.
+ * 'mimetype' should be what will be passed to backend_play_audio()
+ */
+void mp_set_next_url(media_pipe_t *mp, const char *url,
+                     const char *mimetype);
+
 #define MP_BUFFER_NONE    0
 #define MP_BUFFER_SHALLOW 2
 #define MP_BUFFER_DEEP    3
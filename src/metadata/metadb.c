@@ -2037,6 +2037,41 @@ metadb_get_videoinfo(void *db, const char *url,
 }
 
 
+/**
+ * Add stream from a row with the columns streamindex, info, isolang,
+ * codec, mediatype, disposition and title starting at 'col'
+ */
+static void
+metadb_stream_from_row(metadata_t *md, sqlite3_stmt *sel, int col,
+                       int tracks[3])
+{
+  int type;
+  int tn;
+  const char *str = (const char *)sqlite3_column_text(sel, col + 4);
+  if(!strcmp(str, "audio")) {
+    type = MEDIA_TYPE_AUDIO;
+    tn = ++tracks[0];
+  } else if(!strcmp(str, "video")) {
+    type = MEDIA_TYPE_VIDEO;
+    tn = ++tracks[1];
+  } else if(!strcmp(str, "subtitle")) {
+    type = MEDIA_TYPE_SUBTITLE;
+    tn = ++tracks[2];
+  } else {
+    return;
+  }
+  metadata_add_stream(md,
+                      (const char *)sqlite3_column_text(sel, col + 3),
+                      type,
+                      sqlite3_column_int(sel, col),
+                      (const char *)sqlite3_column_text(sel, col + 6),
+                      (const char *)sqlite3_column_text(sel, col + 1),
+                      (const char *)sqlite3_column_text(sel, col + 2),
+                      sqlite3_column_int(sel, col + 5),
+                      tn, -1);
+}
+
+
 /**
  *
  */
@@ -2045,9 +2080,7 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t videoitem_id)
 {
   int rc;
   sqlite3_stmt *sel;
-  int atrack = 0;
-  int strack = 0;
-  int vtrack = 0;
+  int tracks[3] = {0};
 
   rc = db_prepare(db, &sel,
 		  "SELECT streamindex, info, isolang, codec, "
@@ -2062,32 +2095,9 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t videoitem_id)
 
   sqlite3_bind_int64(sel, 1, videoitem_id);
 
-  while((rc = db_step(sel)) == SQLITE_ROW) {
-    int type;
-    int tn;
-    const char *str = (const char *)sqlite3_column_text(sel, 4);
-    if(!strcmp(str, "audio")) {
-      type = MEDIA_TYPE_AUDIO;
-      tn = ++atrack;
-    } else if(!strcmp(str, "video")) {
-      type = MEDIA_TYPE_VIDEO;
-      tn = ++vtrack;
-    } else if(!strcmp(str, "subtitle")) {
-      type = MEDIA_TYPE_SUBTITLE;
-      tn = ++strack;
-    } else {
-      continue;
-    }
-    metadata_add_stream(md, 
-			(const char *)sqlite3_column_text(sel, 3),
-			type,
-			sqlite3_column_int(sel, 0),
-			(const char *)sqlite3_column_text(sel, 6),
-			(const char *)sqlite3_column_text(sel, 1),
-			(const char *)sqlite3_column_text(sel, 2),
-			sqlite3_column_int(sel, 5),
-			tn, -1);
-  }
+  while((rc = db_step(sel)) == SQLITE_ROW)
+    metadb_stream_from_row(md, sel, 0, tracks);
+
   sqlite3_finalize(sel);
   return 0;
 }
@@ -2229,6 +2239,246 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
 }
 
 
+/**
+ * Directory batch
+ *
+ * Metadata for all items in a directory is loaded with one query per
+ * item type (JOINed with the item table) instead of a handful of
+ * queries per item. All queries are ordered by item id so the rows can
+ * be matched with the items by walking through them in parallel.
+ */
+typedef struct metadb_batch_item {
+  int64_t mbi_item_id;
+  int64_t mbi_videoitem_id;
+  fa_dir_entry_t *mbi_fde;
+  metadata_t *mbi_md;
+  int mbi_contenttype;
+  int mbi_indexstatus;
+  int mbi_tracks[3];  // Audio, video and subtitle tracks seen so far
+} metadb_batch_item_t;
+
+
+typedef struct metadb_batch {
+  metadb_batch_item_t *mb_items;
+  int mb_num_items;
+  int mb_cursor;
+} metadb_batch_t;
+
+
+/**
+ * Find item, ids must be looked up in ascending order
+ */
+static metadb_batch_item_t *
+metadb_batch_find(metadb_batch_t *mb, int64_t item_id)
+{
+  while(mb->mb_cursor < mb->mb_num_items &&
+        mb->mb_items[mb->mb_cursor].mbi_item_id < item_id)
+    mb->mb_cursor++;
+
+  if(mb->mb_cursor == mb->mb_num_items ||
+     mb->mb_items[mb->mb_cursor].mbi_item_id != item_id)
+    return NULL;
+  return &mb->mb_items[mb->mb_cursor];
+}
+
+
+/**
+ * Get metadata for item, create if it does not exist yet
+ */
+static metadata_t *
+metadb_batch_md(metadb_batch_item_t *mbi)
+{
+  if(mbi->mbi_md == NULL) {
+    mbi->mbi_md = metadata_create();
+    mbi->mbi_md->md_contenttype = mbi->mbi_contenttype;
+  }
+  return mbi->mbi_md;
+}
+
+
+/**
+ * Run one of the batch queries. The first column must be the item id
+ */
+static int
+metadb_batch_query(sqlite3 *db, metadb_batch_t *mb, int64_t parent_id,
+                   const char *sql,
+                   void (*cb)(metadb_batch_item_t *mbi, sqlite3_stmt *sel,
+                              get_cache_t *gc),
+                   get_cache_t *gc)
+{
+  sqlite3_stmt *sel;
+  int rc = db_prepare(db, &sel, sql);
+  if(rc != SQLITE_OK)
+    return rc;
+
+  sqlite3_bind_int64(sel, 1, parent_id);
+  mb->mb_cursor = 0;
+
+  while((rc = db_step(sel)) == SQLITE_ROW) {
+    metadb_batch_item_t *mbi =
+      metadb_batch_find(mb, sqlite3_column_int64(sel, 0));
+    if(mbi != NULL && mbi->mbi_fde != NULL)
+      cb(mbi, sel, gc);
+  }
+  sqlite3_finalize(sel);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+/**
+ *
+ */
+static void
+metadb_batch_audio(metadb_batch_item_t *mbi, sqlite3_stmt *sel,
+                   get_cache_t *gc)
+{
+  if(mbi->mbi_contenttype != CONTENT_AUDIO || mbi->mbi_md != NULL)
+    return;
+
+  metadata_t *md = metadb_batch_md(mbi);
+
+  md->md_title = rstr_alloc((void *)sqlite3_column_text(sel, 1));
+
+  if(sqlite3_column_type(sel, 3) == SQLITE_TEXT) {
+    int64_t id = sqlite3_column_int64(sel, 2);
+    if(id != gc->gc_album_id) {
+      gc->gc_album_id = id;
+      rstr_release(gc->gc_album_title);
+      gc->gc_album_title = rstr_alloc((void *)sqlite3_column_text(sel, 3));
+    }
+    md->md_album = rstr_dup(gc->gc_album_title);
+  }
+
+  if(sqlite3_column_type(sel, 5) == SQLITE_TEXT) {
+    int64_t id = sqlite3_column_int64(sel, 4);
+    if(id != gc->gc_artist_id) {
+      gc->gc_artist_id = id;
+      rstr_release(gc->gc_artist_title);
+      gc->gc_artist_title = rstr_alloc((void *)sqlite3_column_text(sel, 5));
+    }
+    md->md_artist = rstr_dup(gc->gc_artist_title);
+  }
+
+  md->md_duration = sqlite3_column_int(sel, 6) / 1000.0f;
+  md->md_track = sqlite3_column_int(sel, 7);
+}
+
+
+/**
+ *
+ */
+static void
+metadb_batch_video(metadb_batch_item_t *mbi, sqlite3_stmt *sel,
+                   get_cache_t *gc)
+{
+  if(mbi->mbi_contenttype != CONTENT_VIDEO || mbi->mbi_md != NULL)
+    return;
+
+  metadata_t *md = metadb_batch_md(mbi);
+
+  mbi->mbi_videoitem_id = sqlite3_column_int64(sel, 1);
+  md->md_title = rstr_alloc((void *)sqlite3_column_text(sel, 2));
+  md->md_duration = sqlite3_column_int(sel, 3) / 1000.0f;
+  md->md_format = rstr_alloc((void *)sqlite3_column_text(sel, 4));
+  md->md_year = sqlite3_column_int(sel, 5);
+}
+
+
+/**
+ *
+ */
+static void
+metadb_batch_stream(metadb_batch_item_t *mbi, sqlite3_stmt *sel,
+                    get_cache_t *gc)
+{
+  if(mbi->mbi_md == NULL ||
+     mbi->mbi_videoitem_id != sqlite3_column_int64(sel, 1))
+    return;
+
+  metadb_stream_from_row(mbi->mbi_md, sel, 2, mbi->mbi_tracks);
+}
+
+
+/**
+ *
+ */
+static void
+metadb_batch_image(metadb_batch_item_t *mbi, sqlite3_stmt *sel,
+                   get_cache_t *gc)
+{
+  if(mbi->mbi_contenttype != CONTENT_IMAGE || mbi->mbi_md != NULL)
+    return;
+
+  metadata_t *md = metadb_batch_md(mbi);
+
+  md->md_time = sqlite3_column_int(sel, 1);
+  md->md_manufacturer = rstr_alloc((void *)sqlite3_column_text(sel, 2));
+  md->md_equipment = rstr_alloc((void *)sqlite3_column_text(sel, 3));
+}
+
+
+/**
+ *
+ */
+static int
+metadb_batch_load(sqlite3 *db, metadb_batch_t *mb, int64_t parent_id)
+{
+  get_cache_t gc = {0};
+  int rc;
+
+  rc = metadb_batch_query(db, mb, parent_id,
+                          "SELECT item.id, audioitem.title, "
+                          "audioitem.album_id, album.title, "
+                          "audioitem.artist_id, artist.title, "
+                          "audioitem.duration, track "
+                          "FROM item "
+                          "JOIN audioitem ON audioitem.item_id = item.id "
+                          "AND audioitem.ds_id = 1 "
+                          "LEFT JOIN album ON album.id = audioitem.album_id "
+                          "AND album.ds_id = 1 "
+                          "LEFT JOIN artist ON artist.id = audioitem.artist_id "
+                          "AND artist.ds_id = 1 "
+                          "WHERE item.parent = ?1 "
+                          "ORDER BY item.id",
+                          metadb_batch_audio, &gc);
+  if(rc == SQLITE_OK)
+    rc = metadb_batch_query(db, mb, parent_id,
+                            "SELECT item.id, videoitem.id, videoitem.title, "
+                            "videoitem.duration, format, year "
+                            "FROM item "
+                            "JOIN videoitem ON videoitem.item_id = item.id "
+                            "AND videoitem.ds_id = 1 "
+                            "WHERE item.parent = ?1 "
+                            "ORDER BY item.id",
+                            metadb_batch_video, &gc);
+  if(rc == SQLITE_OK)
+    rc = metadb_batch_query(db, mb, parent_id,
+                            "SELECT item.id, videoitem.id, "
+                            "streamindex, info, isolang, codec, "
+                            "mediatype, disposition, videostream.title "
+                            "FROM item "
+                            "JOIN videoitem ON videoitem.item_id = item.id "
+                            "AND videoitem.ds_id = 1 "
+                            "JOIN videostream "
+                            "ON videostream.videoitem_id = videoitem.id "
+                            "WHERE item.parent = ?1 "
+                            "ORDER BY item.id, streamindex",
+                            metadb_batch_stream, &gc);
+  if(rc == SQLITE_OK)
+    rc = metadb_batch_query(db, mb, parent_id,
+                            "SELECT item.id, "
+                            "original_time, manufacturer, equipment "
+                            "FROM item "
+                            "JOIN imageitem ON imageitem.item_id = item.id "
+                            "WHERE item.parent = ?1 "
+                            "ORDER BY item.id",
+                            metadb_batch_image, &gc);
+
+  get_cache_release(&gc);
+  return rc;
+}
+
+
 /**
  *
  */
@@ -2256,7 +2506,8 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
   rc = db_prepare(db, &sel,
 		  "SELECT id, url, contenttype, mtime, indexstatus "
 		  "FROM item "
-		  "WHERE parent = ?1"
+		  "WHERE parent = ?1 "
+		  "ORDER BY id"
 		  );
 
   if(rc != SQLITE_OK) {
@@ -2267,14 +2518,13 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
   sqlite3_bind_int64(sel, 1, parent_id);
 
   fa_dir_t *fd = fa_dir_alloc();
-
-  get_cache_t gc = {0};
+  metadb_batch_t mb = {0};
+  int capacity = 0;
 
   while((rc = db_step(sel)) == SQLITE_ROW) {
     if(sqlite3_column_type(sel, 2) != SQLITE_INTEGER)
       continue;
 
-    int64_t item_id = sqlite3_column_int64(sel, 0);
     const char *url = (const char *)sqlite3_column_text(sel, 1);
     int contenttype = sqlite3_column_int(sel, 2);
     char fname[256];
@@ -2283,27 +2533,62 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
     fa_url_get_last_component(fname, sizeof(fname), url);
 
     fde = fa_dir_add(fd, url, fname, contenttype);
-    if(fde != NULL) {
-      if(sqlite3_column_type(sel, 3) == SQLITE_INTEGER) {
-	fde->fde_statdone = 1;
-	fde->fde_stat.fs_mtime = sqlite3_column_int(sel, 3);
-      }
+    if(fde == NULL)
+      continue;
 
-      fde->fde_md = metadata_get(db, item_id, contenttype, &gc);
-      if(fde->fde_md != NULL) {
-	fde->fde_md->md_cache_status = METADATA_CACHE_STATUS_FULL;
-        fde->fde_md->md_index_status = sqlite3_column_int(sel, 4);
-      }
+    if(sqlite3_column_type(sel, 3) == SQLITE_INTEGER) {
+      fde->fde_statdone = 1;
+      fde->fde_stat.fs_mtime = sqlite3_column_int(sel, 3);
     }
+
+    if(mb.mb_num_items == capacity) {
+      capacity = MAX(capacity * 2, 64);
+      mb.mb_items = realloc(mb.mb_items,
+                            capacity * sizeof(metadb_batch_item_t));
+    }
+
+    metadb_batch_item_t *mbi = &mb.mb_items[mb.mb_num_items++];
+    memset(mbi, 0, sizeof(metadb_batch_item_t));
+    mbi->mbi_item_id = sqlite3_column_int64(sel, 0);
+    mbi->mbi_fde = fde;
+    mbi->mbi_contenttype = contenttype;
+    mbi->mbi_indexstatus = sqlite3_column_int(sel, 4);
   }
 
   sqlite3_finalize(sel);
 
-  get_cache_release(&gc);
+  if(rc == SQLITE_DONE)
+    rc = metadb_batch_load(db, &mb, parent_id);
 
   db_rollback(db);
 
-  if(fd->fd_count == 0) {
+  for(int i = 0; i < mb.mb_num_items; i++) {
+    metadb_batch_item_t *mbi = &mb.mb_items[i];
+
+    switch(mbi->mbi_contenttype) {
+    case CONTENT_DIR:
+    case CONTENT_SHARE:
+    case CONTENT_DVD:
+      metadb_batch_md(mbi);
+      break;
+    }
+
+    if(mbi->mbi_md == NULL)
+      continue;
+
+    if(rc != SQLITE_OK) {
+      metadata_destroy(mbi->mbi_md);
+      continue;
+    }
+
+    mbi->mbi_md->md_cache_status = METADATA_CACHE_STATUS_FULL;
+    mbi->mbi_md->md_index_status = mbi->mbi_indexstatus;
+    mbi->mbi_fde->fde_md = mbi->mbi_md;
+  }
+
+  free(mb.mb_items);
+
+  if(rc != SQLITE_OK || fd->fd_count == 0) {
     fa_dir_free(fd);
     fd = NULL;
   }
@@ -54,8 +54,20 @@ static int metadata_num_threads;
 
 static void metadata_threads_start(void);
 
+/**
+ * Loads are queued in two classes. Something showing the item (a
+ * subscriber appeared on one of its metadata props) is served before
+ * items that just are bound and want a (re)load because some of their
+ * attributes changed, such as the duration found when probing a file.
+ */
+#define MLP_PRIO_VISIBLE 0
+#define MLP_PRIO_BOUND   1
+#define MLP_PRIO_NUM     2
+
 TAILQ_HEAD(metadata_lazy_prop_queue, metadata_lazy_prop);
-static struct metadata_lazy_prop_queue mlpqueue;
+LIST_HEAD(metadata_lazy_prop_list, metadata_lazy_prop);
+static struct metadata_lazy_prop_queue mlpqueue[MLP_PRIO_NUM];
+static struct metadata_lazy_prop_list mlpinflight;
 struct metadata_lazy_prop;
 
 /**
@@ -74,13 +86,23 @@ typedef struct metadata_lazy_class {
  */
 typedef struct metadata_lazy_prop {
   TAILQ_ENTRY(metadata_lazy_prop) mlp_link;
+  LIST_ENTRY(metadata_lazy_prop) mlp_inflight_link;
   const metadata_lazy_class_t *mlp_class;
   uint64_t mlp_req_items;
   int16_t mlp_refcount;
 
+  /**
+   * Hash of what is being looked up (url, artist+album, ...). Items
+   * with the same key are not loaded concurrently, the second one is
+   * held back until the first is done and then finds the result in the
+   * database. 0 if no such coalescing should be done
+   */
+  unsigned int mlp_key;
+
   unsigned char mlp_zombie : 1;
   unsigned char mlp_queued : 1;
   unsigned char mlp_loading : 1;
+  unsigned char mlp_prio : 1;
 
 } metadata_lazy_prop_t;
 
@@ -102,11 +124,20 @@ mlp_alloc(const metadata_lazy_class_t *class)
  *
  */
 static void
-mlp_enqueue(metadata_lazy_prop_t *mlp)
+mlp_enqueue(metadata_lazy_prop_t *mlp, int prio)
 {
-  if(mlp->mlp_zombie || mlp->mlp_queued)
+  if(mlp->mlp_zombie)
     return;
-  TAILQ_INSERT_TAIL(&mlpqueue, mlp, mlp_link);
+
+  if(mlp->mlp_queued) {
+    if(prio >= mlp->mlp_prio)
+      return;
+    // Became visible while waiting, bump it
+    TAILQ_REMOVE(&mlpqueue[mlp->mlp_prio], mlp, mlp_link);
+  }
+
+  mlp->mlp_prio = prio;
+  TAILQ_INSERT_TAIL(&mlpqueue[prio], mlp, mlp_link);
   mlp->mlp_queued = 1;
   metadata_threads_start();
 }
@@ -121,7 +152,7 @@ mlp_unqueue(metadata_lazy_prop_t *mlp)
   if(!mlp->mlp_queued)
     return;
 
-  TAILQ_REMOVE(&mlpqueue, mlp, mlp_link);
+  TAILQ_REMOVE(&mlpqueue[mlp->mlp_prio], mlp, mlp_link);
   mlp->mlp_queued = 0;
 }
 
@@ -187,7 +218,7 @@ mlp_sub_cb(void *opaque, prop_event_t event, ...)
     if(!(mlp->mlp_req_items & id)) {
 
       mlp->mlp_req_items |= id;
-      mlp_enqueue(mlp);
+      mlp_enqueue(mlp, MLP_PRIO_VISIBLE);
     }
     break;
   case PROP_DESTROYED:
@@ -374,6 +405,9 @@ metadata_bind_albumart(prop_t *prop, rstr_t *artist, rstr_t *album)
   mla->mla_prop = prop_ref_inc(prop);
   mla->mla_artist = rstr_spn(artist, ";:,-[", 1);
   mla->mla_album  = rstr_spn(album, "[(", 1);
+  mla->mla_mlp.mlp_key =
+    mystrhash(rstr_get(mla->mla_artist)) * 31 +
+    mystrhash(rstr_get(mla->mla_album));
   mla->mla_sub =
     prop_subscribe(PROP_SUB_TRACK_DESTROY_EXP | PROP_SUB_SUBSCRIPTION_MONITOR,
 		   PROP_TAG_CALLBACK_USER_INT, mlp_sub_cb, mla,
@@ -1858,6 +1892,7 @@ metadata_bind_video_info(rstr_t *url, rstr_t *filename,
   mlv->mlv_filename = rstr_dup(filename);
   mlv->mlv_folder = rstr_dup(folder);
   mlv->mlv_url = rstr_dup(url);
+  mlv->mlv_mlp.mlp_key = mystrhash(rstr_get(url));
   mlv->mlv_duration = duration;
   mlv->mlv_imdb_id = rstr_dup(imdb_id);
   mlv->mlv_type = METADATA_TYPE_VIDEO;
@@ -1917,7 +1952,7 @@ mlv_set_imdb_id(metadata_lazy_video_t *mlv, rstr_t *imdb_id)
   hts_mutex_lock(&metadata_mutex);
   if(!rstr_eq(mlv->mlv_imdb_id, imdb_id)) {
     rstr_set(&mlv->mlv_imdb_id, imdb_id);
-    mlp_enqueue(&mlv->mlv_mlp);
+    mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_BOUND);
   }
   hts_mutex_unlock(&metadata_mutex);
 }
@@ -1932,7 +1967,7 @@ mlv_set_duration(metadata_lazy_video_t *mlv, int duration)
   hts_mutex_lock(&metadata_mutex);
   if(mlv->mlv_duration != duration) {
     mlv->mlv_duration = duration;
-    mlp_enqueue(&mlv->mlv_mlp);
+    mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_BOUND);
   }
   hts_mutex_unlock(&metadata_mutex);
 }
@@ -1950,7 +1985,7 @@ mlv_set_lonely(metadata_lazy_video_t *mlv, int lonely)
                    lonely ? "" : "not ");
 
     mlv->mlv_lonely = lonely;
-    mlp_enqueue(&mlv->mlv_mlp);
+    mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_BOUND);
   }
   hts_mutex_unlock(&metadata_mutex);
 }
@@ -1986,6 +2021,43 @@ mlv_direct_query(void *db, rstr_t *url, rstr_t *filename,
 }
 
 
+/**
+ *
+ */
+static int
+mlp_key_inflight(unsigned int key)
+{
+  const metadata_lazy_prop_t *mlp;
+  LIST_FOREACH(mlp, &mlpinflight, mlp_inflight_link)
+    if(mlp->mlp_key == key)
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Get next item to load, highest priority first, skipping items with
+ * an identical lookup already in progress
+ */
+static metadata_lazy_prop_t *
+mlp_dequeue(void)
+{
+  metadata_lazy_prop_t *mlp;
+
+  for(int i = 0; i < MLP_PRIO_NUM; i++) {
+    TAILQ_FOREACH(mlp, &mlpqueue[i], mlp_link) {
+      if(mlp->mlp_key && mlp_key_inflight(mlp->mlp_key))
+        continue;
+
+      TAILQ_REMOVE(&mlpqueue[i], mlp, mlp_link);
+      mlp->mlp_queued = 0;
+      return mlp;
+    }
+  }
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -2000,17 +2072,25 @@ metadata_thread(void *aux)
 
     metadata_lazy_prop_t *mlp;
 
-    mlp = TAILQ_FIRST(&mlpqueue);
+    /*
+     * If everything left is held back by a load in progress we just
+     * quit, the thread doing that load will pick them up when done
+     */
+    mlp = mlp_dequeue();
     if(mlp == NULL)
       break;
 
+    if(mlp->mlp_zombie)
+      continue;
+
     if(db == NULL)
       db = metadb_get();
 
-    TAILQ_REMOVE(&mlpqueue, mlp, mlp_link);
-    mlp->mlp_queued = 0;
-    if(!mlp->mlp_zombie)
-      mlp->mlp_class->mlc_load(db, mlp);
+    mlp_retain(mlp);
+    LIST_INSERT_HEAD(&mlpinflight, mlp, mlp_inflight_link);
+    mlp->mlp_class->mlc_load(db, mlp);
+    LIST_REMOVE(mlp, mlp_inflight_link);
+    mlp_release(mlp);
   }
 
   metadata_num_threads--;
@@ -2044,7 +2124,8 @@ metadata_threads_start(void)
 void
 mlp_init(void)
 {
-  TAILQ_INIT(&mlpqueue);
+  for(int i = 0; i < MLP_PRIO_NUM; i++)
+    TAILQ_INIT(&mlpqueue[i]);
   hts_mutex_init(&metadata_mutex);
   hts_cond_init(&metadata_loading_cond, &metadata_mutex);
 }
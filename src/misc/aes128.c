@@ -0,0 +1,416 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes128.h"
+
+/**
+ * CBC decryption has no dependency between blocks (except for the
+ * final XOR with the previous ciphertext) so four blocks are kept in
+ * flight to hide the latency of the AES instructions.
+ *
+ * The key schedule is computed in C. It's only done once per key and
+ * the same round keys work for both AES-NI (AESDEC) and ARMv8 (AESD +
+ * AESIMC).
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+  defined(__GNUC__)
+#define AES128_HW_X86
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) && \
+  (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define AES128_HW_ARMV8
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+#endif
+
+
+static const uint8_t aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+  0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+  0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+  0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+  0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+  0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+  0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+  0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+  0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+  0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+  0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+  0xb0, 0x54, 0xbb, 0x16,
+};
+
+
+/**
+ *
+ */
+static uint8_t
+gf_mul(uint8_t a, uint8_t b)
+{
+  uint8_t r = 0;
+  while(b) {
+    if(b & 1)
+      r ^= a;
+    a = (a << 1) ^ (a & 0x80 ? 0x1b : 0);
+    b >>= 1;
+  }
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+inv_mix_columns(uint8_t *s)
+{
+  for(int c = 0; c < 4; c++) {
+    const uint8_t a0 = s[c * 4 + 0];
+    const uint8_t a1 = s[c * 4 + 1];
+    const uint8_t a2 = s[c * 4 + 2];
+    const uint8_t a3 = s[c * 4 + 3];
+
+    s[c * 4 + 0] =
+      gf_mul(a0, 14) ^ gf_mul(a1, 11) ^ gf_mul(a2, 13) ^ gf_mul(a3, 9);
+    s[c * 4 + 1] =
+      gf_mul(a0, 9) ^ gf_mul(a1, 14) ^ gf_mul(a2, 11) ^ gf_mul(a3, 13);
+    s[c * 4 + 2] =
+      gf_mul(a0, 13) ^ gf_mul(a1, 9) ^ gf_mul(a2, 14) ^ gf_mul(a3, 11);
+    s[c * 4 + 3] =
+      gf_mul(a0, 11) ^ gf_mul(a1, 13) ^ gf_mul(a2, 9) ^ gf_mul(a3, 14);
+  }
+}
+
+
+/**
+ *
+ */
+void
+aes128_init_decrypt(aes128_t *ak, const uint8_t *key)
+{
+  uint8_t ek[176];
+  uint8_t rcon = 1;
+
+  memcpy(ek, key, 16);
+
+  for(int i = 16; i < 176; i += 4) {
+    uint8_t t[4];
+    memcpy(t, ek + i - 4, 4);
+
+    if(i % 16 == 0) {
+      const uint8_t t0 = t[0];
+      t[0] = aes_sbox[t[1]] ^ rcon;
+      t[1] = aes_sbox[t[2]];
+      t[2] = aes_sbox[t[3]];
+      t[3] = aes_sbox[t0];
+      rcon = gf_mul(rcon, 2);
+    }
+    for(int j = 0; j < 4; j++)
+      ek[i + j] = ek[i - 16 + j] ^ t[j];
+  }
+
+  memcpy(ak->ak_rk[0], ek + 160, 16);
+  for(int r = 1; r < 10; r++) {
+    memcpy(ak->ak_rk[r], ek + (10 - r) * 16, 16);
+    inv_mix_columns(ak->ak_rk[r]);
+  }
+  memcpy(ak->ak_rk[10], ek, 16);
+}
+
+
+#ifdef AES128_HW_X86
+
+/**
+ *
+ */
+__attribute__((target("aes,sse2"))) static void
+cbc_decrypt_aesni(const aes128_t *ak, uint8_t *data, int blocks, uint8_t *iv)
+{
+  __m128i k[11];
+  int r;
+
+  for(r = 0; r < 11; r++)
+    k[r] = _mm_loadu_si128((const __m128i *)ak->ak_rk[r]);
+
+  __m128i prev = _mm_loadu_si128((const __m128i *)iv);
+
+  for(; blocks >= 4; blocks -= 4, data += 64) {
+    const __m128i c0 = _mm_loadu_si128((const __m128i *)(data + 0));
+    const __m128i c1 = _mm_loadu_si128((const __m128i *)(data + 16));
+    const __m128i c2 = _mm_loadu_si128((const __m128i *)(data + 32));
+    const __m128i c3 = _mm_loadu_si128((const __m128i *)(data + 48));
+
+    __m128i b0 = _mm_xor_si128(c0, k[0]);
+    __m128i b1 = _mm_xor_si128(c1, k[0]);
+    __m128i b2 = _mm_xor_si128(c2, k[0]);
+    __m128i b3 = _mm_xor_si128(c3, k[0]);
+
+    for(r = 1; r < 10; r++) {
+      b0 = _mm_aesdec_si128(b0, k[r]);
+      b1 = _mm_aesdec_si128(b1, k[r]);
+      b2 = _mm_aesdec_si128(b2, k[r]);
+      b3 = _mm_aesdec_si128(b3, k[r]);
+    }
+
+    b0 = _mm_aesdeclast_si128(b0, k[10]);
+    b1 = _mm_aesdeclast_si128(b1, k[10]);
+    b2 = _mm_aesdeclast_si128(b2, k[10]);
+    b3 = _mm_aesdeclast_si128(b3, k[10]);
+
+    _mm_storeu_si128((__m128i *)(data + 0),  _mm_xor_si128(b0, prev));
+    _mm_storeu_si128((__m128i *)(data + 16), _mm_xor_si128(b1, c0));
+    _mm_storeu_si128((__m128i *)(data + 32), _mm_xor_si128(b2, c1));
+    _mm_storeu_si128((__m128i *)(data + 48), _mm_xor_si128(b3, c2));
+    prev = c3;
+  }
+
+  for(; blocks > 0; blocks--, data += 16) {
+    const __m128i c = _mm_loadu_si128((const __m128i *)data);
+    __m128i b = _mm_xor_si128(c, k[0]);
+    for(r = 1; r < 10; r++)
+      b = _mm_aesdec_si128(b, k[r]);
+    b = _mm_aesdeclast_si128(b, k[10]);
+    _mm_storeu_si128((__m128i *)data, _mm_xor_si128(b, prev));
+    prev = c;
+  }
+
+  _mm_storeu_si128((__m128i *)iv, prev);
+}
+
+#endif // AES128_HW_X86
+
+
+#ifdef AES128_HW_ARMV8
+
+/**
+ * AESD does AddRoundKey before the inverse S-box / shift rows, so the
+ * whitening key goes first and the last round key is XORed at the end
+ */
+static void
+cbc_decrypt_armv8(const aes128_t *ak, uint8_t *data, int blocks, uint8_t *iv)
+{
+  uint8x16_t k[11];
+  int r;
+
+  for(r = 0; r < 11; r++)
+    k[r] = vld1q_u8(ak->ak_rk[r]);
+
+  uint8x16_t prev = vld1q_u8(iv);
+
+  for(; blocks >= 4; blocks -= 4, data += 64) {
+    const uint8x16_t c0 = vld1q_u8(data + 0);
+    const uint8x16_t c1 = vld1q_u8(data + 16);
+    const uint8x16_t c2 = vld1q_u8(data + 32);
+    const uint8x16_t c3 = vld1q_u8(data + 48);
+
+    uint8x16_t b0 = c0, b1 = c1, b2 = c2, b3 = c3;
+
+    for(r = 0; r < 9; r++) {
+      b0 = vaesimcq_u8(vaesdq_u8(b0, k[r]));
+      b1 = vaesimcq_u8(vaesdq_u8(b1, k[r]));
+      b2 = vaesimcq_u8(vaesdq_u8(b2, k[r]));
+      b3 = vaesimcq_u8(vaesdq_u8(b3, k[r]));
+    }
+
+    b0 = veorq_u8(vaesdq_u8(b0, k[9]), k[10]);
+    b1 = veorq_u8(vaesdq_u8(b1, k[9]), k[10]);
+    b2 = veorq_u8(vaesdq_u8(b2, k[9]), k[10]);
+    b3 = veorq_u8(vaesdq_u8(b3, k[9]), k[10]);
+
+    vst1q_u8(data + 0,  veorq_u8(b0, prev));
+    vst1q_u8(data + 16, veorq_u8(b1, c0));
+    vst1q_u8(data + 32, veorq_u8(b2, c1));
+    vst1q_u8(data + 48, veorq_u8(b3, c2));
+    prev = c3;
+  }
+
+  for(; blocks > 0; blocks--, data += 16) {
+    const uint8x16_t c = vld1q_u8(data);
+    uint8x16_t b = c;
+    for(r = 0; r < 9; r++)
+      b = vaesimcq_u8(vaesdq_u8(b, k[r]));
+    b = veorq_u8(vaesdq_u8(b, k[9]), k[10]);
+    vst1q_u8(data, veorq_u8(b, prev));
+    prev = c;
+  }
+
+  vst1q_u8(iv, prev);
+}
+
+#endif // AES128_HW_ARMV8
+
+
+/**
+ *
+ */
+const char *
+aes128_hw_available(void)
+{
+#ifdef AES128_HW_X86
+  unsigned int eax, ebx, ecx, edx;
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES))
+    return "AES-NI";
+#endif
+
+#ifdef AES128_HW_ARMV8
+#if defined(__linux__)
+  if(getauxval(AT_HWCAP) & HWCAP_AES)
+    return "ARMv8";
+#elif defined(__APPLE__)
+  return "ARMv8";
+#endif
+#endif
+  return NULL;
+}
+
+
+/**
+ *
+ */
+void
+aes128_cbc_decrypt(const aes128_t *ak, uint8_t *data, int blocks,
+                   uint8_t *iv)
+{
+#if defined(AES128_HW_X86)
+  cbc_decrypt_aesni(ak, data, blocks, iv);
+#elif defined(AES128_HW_ARMV8)
+  cbc_decrypt_armv8(ak, data, blocks, iv);
+#else
+  abort();
+#endif
+}
+
+
+/**
+ * Known answer tests and benchmark. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc src/misc/aes128.c -o /tmp/aes128
+ */
+#ifdef LOCAL_MAIN
+#include <stdio.h>
+#include <sys/time.h>
+
+static void
+lm_hex(uint8_t *out, const char *hex)
+{
+  for(; *hex; hex += 2)
+    sscanf(hex, "%2hhx", out++);
+}
+
+
+static int
+lm_check(const char *name, const char *key, const char *iv,
+         const char *ct, const char *pt)
+{
+  uint8_t k[16], v[16], data[64], expect[64];
+  const int len = strlen(ct) / 2;
+  aes128_t ak;
+
+  lm_hex(k, key);
+  lm_hex(v, iv);
+  lm_hex(data, ct);
+  lm_hex(expect, pt);
+
+  aes128_init_decrypt(&ak, k);
+
+  // Split in two calls to check IV chaining
+  const int first = len / 16 > 1 ? 1 : 0;
+  aes128_cbc_decrypt(&ak, data, first, v);
+  aes128_cbc_decrypt(&ak, data + first * 16, len / 16 - first, v);
+
+  // The IV must have been advanced to the last ciphertext block
+  lm_hex(k, ct + (len - 16) * 2);
+
+  const int bad = memcmp(data, expect, len) || memcmp(v, k, 16);
+  printf("%-24s %s\n", name, bad ? "FAIL" : "OK");
+  return bad;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  const char *impl = aes128_hw_available();
+  int err = 0;
+
+  if(impl == NULL) {
+    printf("No AES instructions available\n");
+    return 0;
+  }
+  printf("Using %s\n", impl);
+
+  // FIPS-197 appendix C.1
+  err |= lm_check("FIPS-197 C.1",
+                  "000102030405060708090a0b0c0d0e0f",
+                  "00000000000000000000000000000000",
+                  "69c4e0d86a7b0430d8cdb78070b4c55a",
+                  "00112233445566778899aabbccddeeff");
+
+  // NIST SP 800-38A F.2.2 CBC-AES128.Decrypt
+  err |= lm_check("SP 800-38A F.2.2",
+                  "2b7e151628aed2a6abf7158809cf4f3c",
+                  "000102030405060708090a0b0c0d0e0f",
+                  "7649abac8119b246cee98e9b12e9197d"
+                  "5086cb9b507219ee95db113a917678b2"
+                  "73bed6b8e3c1743b7116e69e22229516"
+                  "3ff1caa1681fac09120eca307586e1a7",
+                  "6bc1bee22e409f96e93d7e117393172a"
+                  "ae2d8a571e03ac9c9eb76fac45af8e51"
+                  "30c81c46a35ce411e5fbc1191a0a52ef"
+                  "f69f2445df4f9b17ad2b417be66c3710");
+
+  const int size = 1024 * 1024;
+  uint8_t *buf = calloc(1, size);
+  uint8_t key[16] = {0}, iv[16] = {0};
+  aes128_t ak;
+  struct timeval tv0, tv1;
+
+  aes128_init_decrypt(&ak, key);
+  gettimeofday(&tv0, NULL);
+  for(int i = 0; i < 256; i++)
+    aes128_cbc_decrypt(&ak, buf, size / 16, iv);
+  gettimeofday(&tv1, NULL);
+
+  const double t = (tv1.tv_sec - tv0.tv_sec) +
+    (tv1.tv_usec - tv0.tv_usec) / 1000000.0;
+  printf("%-24s %8.1f MB/s\n", "CBC decrypt", 256 / t);
+  free(buf);
+  return err;
+}
+#endif
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * AES-128 CBC decryption using the CPU's AES instructions
+ * (AES-NI on x86, Crypto Extensions on ARMv8)
+ */
+typedef struct aes128 {
+  uint8_t ak_rk[11][16];  // Round keys for the equivalent inverse cipher
+} aes128_t;
+
+/**
+ * Returns name of the implementation, or NULL if the CPU
+ * (or this build) lacks AES instructions
+ */
+const char *aes128_hw_available(void);
+
+void aes128_init_decrypt(aes128_t *ak, const uint8_t *key);
+
+/**
+ * Decrypt 'blocks' 16 byte blocks in place. 'iv' is updated so the
+ * chain can be continued with the next call. Must only be used if
+ * aes128_hw_available() returns non-NULL
+ */
+void aes128_cbc_decrypt(const aes128_t *ak, uint8_t *data, int blocks,
+                        uint8_t *iv);
@@ -20,56 +20,115 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include "bitstream.h"
+#include "bytestream.h"
+
+/**
+ * Bits are read from a 64 bit cache which is refilled with up to eight
+ * bytes at a time. Bits in the cache below 'cache_bits' are always zero
+ * so reading past the end of data just yields zeroes.
+ *
+ * In RBSP mode (H.264 NAL units) the position of the next emulation
+ * prevention byte (0x03 in 00 00 03) is looked up in advance. As long
+ * as it's not within the next eight bytes the cache is refilled with
+ * a single load.
+ */
 
 
+/**
+ * Find emulation prevention byte at or after 'from'
+ */
 static int
-bs_eof(const bitstream_t *bs)
+find_escape(const bitstream_t *bs, int from)
 {
-  return bs->bytes_offset >= bs->bytes_length;
+  const uint8_t *d = bs->rdata;
+  int p;
+
+  for(p = from < 2 ? 2 : from; p < bs->bytes_length; p++) {
+    if(d[p] == 3 && d[p - 1] == 0 && d[p - 2] == 0)
+      return p;
+  }
+  return bs->bytes_length;
 }
 
-static unsigned int
-read_bits(bitstream_t *bs, int num)
+
+/**
+ *
+ */
+static void
+refill(bitstream_t *bs)
 {
-  int r = 0;
+  if(bs->bytes_offset + 8 <= bs->escape) {
+    const int bytes = (63 - bs->cache_bits) >> 3;
+    bs->cache |= rd64_be(bs->rdata + bs->bytes_offset) >> bs->cache_bits;
+    bs->cache_bits += bytes * 8;
+    bs->cache &= ~0ULL << (64 - bs->cache_bits);
+    bs->bytes_offset += bytes;
+    return;
+  }
 
-  while(num > 0) {
-    if(bs->bytes_offset >= bs->bytes_length)
-      return 0;
-    
-    if(bs->remain == 0) {
-      bs->tmp = bs->rdata[bs->bytes_offset];
-      bs->bytes_offset++;
+  while(bs->cache_bits <= 56 && bs->bytes_offset < bs->bytes_length) {
+    bs->cache |= (uint64_t)bs->rdata[bs->bytes_offset] <<
+      (56 - bs->cache_bits);
+    bs->cache_bits += 8;
+    bs->bytes_offset++;
 
-      if(bs->rbsp && bs->bytes_offset >= 2 &&
-	 bs->bytes_offset < bs->bytes_length) {
-	if(bs->rdata[bs->bytes_offset - 2] == 0 &&
-	   bs->rdata[bs->bytes_offset - 1] == 0 &&
-	   bs->rdata[bs->bytes_offset    ] == 3) {
-	  bs->bytes_offset++;
-	}
-      }
-      bs->remain = 8;
+    if(bs->bytes_offset == bs->escape && bs->escape < bs->bytes_length) {
+      bs->bytes_offset++;
+      bs->escape = find_escape(bs, bs->bytes_offset);
     }
-
-    num--;
-    bs->remain--;
-    if(bs->tmp & (1 << bs->remain))
-      r |= 1 << num;
   }
+}
+
+
+/**
+ *
+ */
+static void
+consume(bitstream_t *bs, int num)
+{
+  bs->cache <<= num;
+  bs->cache_bits -= num;
+  if(bs->cache_bits < 0)
+    bs->cache_bits = 0;
+}
+
+
+/**
+ * Read up to 32 bits
+ */
+static unsigned int
+read_bits(bitstream_t *bs, int num)
+{
+  if(num == 0)
+    return 0;
+
+  if(bs->cache_bits < num)
+    refill(bs);
+
+  unsigned int r = bs->cache >> (64 - num);
+  consume(bs, num);
   return r;
 }
 
 static unsigned int
 read_bits1(bitstream_t *bs)
 {
-  return read_bits(bs, 1);
+  if(bs->cache_bits == 0)
+    refill(bs);
+
+  unsigned int r = bs->cache >> 63;
+  consume(bs, 1);
+  return r;
 }
 
 
 static void
 skip_bits(bitstream_t *bs, int num)
 {
+  while(num > 32) {
+    read_bits(bs, 32);
+    num -= 32;
+  }
   read_bits(bs, num);
 }
 
@@ -77,12 +136,28 @@ skip_bits(bitstream_t *bs, int num)
 static unsigned int
 read_golomb_ue(bitstream_t *bs)
 {
-  int b, lzb = -1;
-  for(b = 0; !b && !bs_eof(bs); lzb++) {
-    b = read_bits1(bs);
+  if(bs->cache_bits < 32)
+    refill(bs);
+
+  const int lzb = bs->cache ? __builtin_clzll(bs->cache) : 64;
+
+  if(lzb >= bs->cache_bits || lzb > 31) {
+    // Corrupt or truncated, nothing sensible left to read
+    bs->cache = 0;
+    bs->cache_bits = 0;
+    bs->bytes_offset = bs->bytes_length;
+    return 0;
   }
 
-  return (1 << lzb) - 1 + read_bits(bs, lzb);
+  const int len = lzb * 2 + 1;
+  if(len <= bs->cache_bits) {
+    unsigned int r = bs->cache >> (64 - len);
+    consume(bs, len);
+    return r - 1;
+  }
+
+  consume(bs, lzb + 1);
+  return (1U << lzb) - 1 + read_bits(bs, lzb);
 }
 
 
@@ -103,7 +178,7 @@ read_golomb_se(bitstream_t *bs)
 static int
 bits_left(struct bitstream *bs)
 {
-  return bs->remain + (bs->bytes_length - bs->bytes_offset) * 8;
+  return bs->cache_bits + (bs->bytes_length - bs->bytes_offset) * 8;
 }
 
 
@@ -113,8 +188,10 @@ init_rbits(bitstream_t *bs, const uint8_t *data, int length, int rbsp)
   bs->rdata = data;
   bs->bytes_offset = 0;
   bs->bytes_length = length;
-  bs->remain = 0;
+  bs->cache = 0;
+  bs->cache_bits = 0;
   bs->rbsp = rbsp;
+  bs->escape = rbsp ? find_escape(bs, 0) : length;
 
   bs->skip_bits      = skip_bits;
   bs->read_bits      = read_bits;
@@ -123,3 +200,302 @@ init_rbits(bitstream_t *bs, const uint8_t *data, int length, int rbsp)
   bs->read_golomb_se = read_golomb_se;
   bs->bits_left      = bits_left;
 }
+
+
+/**
+ * Differential test against the previous byte at a time reader and
+ * benchmark of the two. Build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc src/misc/bitstream.c -o /tmp/bitstream
+ */
+#ifdef LOCAL_MAIN
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/**
+ * The old reader, verbatim except for naming. Shifts in it overflow
+ * on Exp-Golomb codes with more than 31 leading zeroes
+ */
+typedef struct lm_old {
+  const uint8_t *rdata;
+  int bytes_length;
+  int bytes_offset;
+  int remain;
+  uint8_t tmp;
+  uint8_t rbsp;
+} lm_old_t;
+
+
+static int
+old_eof(const lm_old_t *bs)
+{
+  return bs->bytes_offset >= bs->bytes_length;
+}
+
+static unsigned int
+old_read_bits(lm_old_t *bs, int num)
+{
+  int r = 0;
+
+  while(num > 0) {
+    if(bs->bytes_offset >= bs->bytes_length)
+      return 0;
+
+    if(bs->remain == 0) {
+      bs->tmp = bs->rdata[bs->bytes_offset];
+      bs->bytes_offset++;
+
+      if(bs->rbsp && bs->bytes_offset >= 2 &&
+	 bs->bytes_offset < bs->bytes_length) {
+	if(bs->rdata[bs->bytes_offset - 2] == 0 &&
+	   bs->rdata[bs->bytes_offset - 1] == 0 &&
+	   bs->rdata[bs->bytes_offset    ] == 3) {
+	  bs->bytes_offset++;
+	}
+      }
+      bs->remain = 8;
+    }
+
+    num--;
+    bs->remain--;
+    if(bs->tmp & (1 << bs->remain))
+      r |= 1 << num;
+  }
+  return r;
+}
+
+static unsigned int
+old_read_golomb_ue(lm_old_t *bs)
+{
+  int b, lzb = -1;
+  for(b = 0; !b && !old_eof(bs); lzb++) {
+    b = old_read_bits(bs, 1);
+  }
+
+  return (1 << lzb) - 1 + old_read_bits(bs, lzb);
+}
+
+static signed int
+old_read_golomb_se(lm_old_t *bs)
+{
+  int v, pos;
+  v = old_read_golomb_ue(bs);
+  if(v == 0)
+    return 0;
+
+  pos = v & 1;
+  v = (v + 1) >> 1;
+  return pos ? v : -v;
+}
+
+
+/**
+ * Slice header style mix of reads. Each op is the type in the low
+ * three bits and the bit count above that
+ */
+#define LM_OPS     64
+#define LM_BUFSIZE 256
+#define LM_BUFFERS 20000
+#define LM_ROUNDS  20
+
+enum { LM_UE, LM_SE, LM_BITS, LM_BITS1, LM_SKIP };
+
+typedef struct lm_buf {
+  uint8_t data[LM_BUFSIZE];
+  uint8_t ops[LM_OPS];
+} lm_buf_t;
+
+static uint32_t lm_seed = 1;
+
+static int
+lm_rand(int n)
+{
+  lm_seed = lm_seed * 1103515245 + 12345;
+  return (lm_seed >> 8) % n;
+}
+
+
+/**
+ * Random data with runs of zero bytes (for long Exp-Golomb codes) and,
+ * if 'rbsp', emulation prevention sequences
+ */
+static void
+lm_fill(lm_buf_t *b, int rbsp)
+{
+  for(int i = 0; i < LM_BUFSIZE; i++) {
+    const int r = lm_rand(32);
+    if(r == 0 && i + 3 <= LM_BUFSIZE && rbsp) {
+      b->data[i++] = 0;
+      b->data[i++] = 0;
+      b->data[i] = 3;
+    } else if(r < 3) {
+      b->data[i] = 0;
+    } else {
+      b->data[i] = lm_rand(256);
+    }
+  }
+
+  for(int i = 0; i < LM_OPS; i++) {
+    switch(lm_rand(8)) {
+    case 0: case 1: case 2: b->ops[i] = LM_UE; break;
+    case 3:             b->ops[i] = LM_SE; break;
+    case 4:             b->ops[i] = LM_BITS1; break;
+    case 5:             b->ops[i] = LM_SKIP | (1 + lm_rand(31)) << 3; break;
+    default:            b->ops[i] = LM_BITS | (1 + lm_rand(31)) << 3; break;
+    }
+  }
+}
+
+
+/**
+ * Run the ops on both readers. The old one never reads the last byte,
+ * so stop comparing well before the end. Also stop at Exp-Golomb codes
+ * with more than 31 leading zeroes, the old reader returned garbage
+ * for those.
+ */
+static int lm_corrupt;
+
+static int
+lm_compare(const lm_buf_t *b, int rbsp)
+{
+  bitstream_t bs, peek;
+  lm_old_t old = { .rdata = b->data, .bytes_length = LM_BUFSIZE,
+                   .rbsp = rbsp };
+  unsigned int x, y;
+
+  init_rbits(&bs, b->data, LM_BUFSIZE, rbsp);
+
+  for(int i = 0; i < LM_OPS; i++) {
+    const int n = b->ops[i] >> 3;
+    if(old.bytes_offset > LM_BUFSIZE - 16)
+      break;
+
+    if((b->ops[i] & 7) <= LM_SE) {
+      peek = bs;
+      if(peek.read_bits(&peek, 32) == 0) {
+        lm_corrupt++;
+        break;
+      }
+    }
+
+    switch(b->ops[i] & 7) {
+    case LM_UE:
+      x = bs.read_golomb_ue(&bs);
+      y = old_read_golomb_ue(&old);
+      break;
+    case LM_SE:
+      x = bs.read_golomb_se(&bs);
+      y = old_read_golomb_se(&old);
+      break;
+    case LM_BITS1:
+      x = bs.read_bits1(&bs);
+      y = old_read_bits(&old, 1);
+      break;
+    case LM_SKIP:
+      bs.skip_bits(&bs, n);
+      old_read_bits(&old, n);
+      x = bs.read_bits(&bs, 8);
+      y = old_read_bits(&old, 8);
+      break;
+    default:
+      x = bs.read_bits(&bs, n);
+      y = old_read_bits(&old, n);
+      break;
+    }
+    if(x != y) {
+      printf("Mismatch at op %d (0x%02x): new %u, old %u\n",
+             i, b->ops[i], x, y);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+
+static unsigned int lm_sink;
+
+static void
+lm_bench_new(const lm_buf_t *bufs, int rbsp)
+{
+  bitstream_t bs;
+  for(int j = 0; j < LM_BUFFERS; j++) {
+    const lm_buf_t *b = &bufs[j];
+    init_rbits(&bs, b->data, LM_BUFSIZE, rbsp);
+    for(int i = 0; i < LM_OPS; i++) {
+      switch(b->ops[i] & 7) {
+      case LM_UE:    lm_sink += bs.read_golomb_ue(&bs); break;
+      case LM_SE:    lm_sink += bs.read_golomb_se(&bs); break;
+      case LM_BITS1: lm_sink += bs.read_bits1(&bs); break;
+      case LM_SKIP:  bs.skip_bits(&bs, b->ops[i] >> 3); break;
+      default:       lm_sink += bs.read_bits(&bs, b->ops[i] >> 3); break;
+      }
+    }
+  }
+}
+
+
+static void
+lm_bench_old(const lm_buf_t *bufs, int rbsp)
+{
+  for(int j = 0; j < LM_BUFFERS; j++) {
+    const lm_buf_t *b = &bufs[j];
+    lm_old_t old = { .rdata = b->data, .bytes_length = LM_BUFSIZE,
+                     .rbsp = rbsp };
+    for(int i = 0; i < LM_OPS; i++) {
+      switch(b->ops[i] & 7) {
+      case LM_UE:    lm_sink += old_read_golomb_ue(&old); break;
+      case LM_SE:    lm_sink += old_read_golomb_se(&old); break;
+      case LM_BITS1: lm_sink += old_read_bits(&old, 1); break;
+      case LM_SKIP:  old_read_bits(&old, b->ops[i] >> 3); break;
+      default:       lm_sink += old_read_bits(&old, b->ops[i] >> 3); break;
+      }
+    }
+  }
+}
+
+
+int
+main(int argc, char **argv)
+{
+  lm_buf_t *bufs = malloc(sizeof(lm_buf_t) * LM_BUFFERS);
+  int err = 0;
+
+  for(int rbsp = 0; rbsp < 2; rbsp++) {
+    int fails = 0;
+    lm_corrupt = 0;
+    for(int j = 0; j < LM_BUFFERS; j++) {
+      lm_fill(&bufs[j], rbsp);
+      fails += lm_compare(&bufs[j], rbsp);
+    }
+    printf("%-6s %d buffers compared, %d mismatches, "
+           "%d stopped at corrupt codes\n",
+           rbsp ? "RBSP" : "plain", LM_BUFFERS, fails, lm_corrupt);
+    err |= !!fails;
+
+    int64_t ts = get_ts();
+    for(int i = 0; i < LM_ROUNDS; i++)
+      lm_bench_old(bufs, rbsp);
+    const int64_t t_old = get_ts() - ts;
+
+    ts = get_ts();
+    for(int i = 0; i < LM_ROUNDS; i++)
+      lm_bench_new(bufs, rbsp);
+    const int64_t t_new = get_ts() - ts;
+
+    printf("%-6s old %5d ms, new %5d ms\n", rbsp ? "RBSP" : "plain",
+           (int)(t_old / 1000), (int)(t_new / 1000));
+  }
+  free(bufs);
+  return err;
+}
+#endif
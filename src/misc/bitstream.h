@@ -49,10 +49,12 @@ typedef struct bitstream {
   signed int (*read_golomb_se)(struct bitstream *bs);
   int (*bits_left)(struct bitstream *bs);
 
+  uint64_t cache;    // Next bits to be read, MSB first
+  int cache_bits;    // Number of valid bits in cache
+
   int bytes_length;
-  int bytes_offset;
-  int remain;
-  uint8_t tmp;
+  int bytes_offset;  // Next byte to load into cache
+  int escape;        // Next emulation prevention byte (or bytes_length)
   uint8_t rbsp;
 } bitstream_t;
 
@@ -27,8 +27,20 @@
 #include "dbl.h"
 #include "compiler.h"
 
+#if defined(JSON_NO_SIMD)
+// Scalar only (for benchmarking)
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define JSON_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define JSON_NEON
+#include <arm_neon.h>
+#endif
+
 #define NOT_THIS_TYPE ((void *)-1)
 
+#define json_skip_ws(s) do { while(*(s) > 0 && *(s) < 33) (s)++; } while(0)
+
 static const char *json_parse_value(const char *s, void *parent, 
 				    const char *name,
 				    const json_deserializer_t *jd,
@@ -36,6 +48,101 @@ static const char *json_parse_value(const char *s, void *parent,
 				    const char **failp, const char **failmsg);
 
 
+/**
+ * Return pointer to first byte in 's' that is not plain 7-bit string
+ * content, ie. '"', '\\', NUL or any byte with the high bit set.
+ *
+ * Such runs can be copied verbatim. Everything else goes through
+ * json_str_read_char() which takes care of escapes and UTF-8 decoding.
+ *
+ * Most strings are short so the vector versions use unaligned loads
+ * directly, except when a load would straddle a page boundary (as it
+ * might read past the terminating NUL into an unmapped page).
+ */
+#define JSON_PAGE_SAFE(s) (((uintptr_t)(s) & 4095) <= 4096 - 16)
+
+#if defined(__SANITIZE_ADDRESS__)
+__attribute__((no_sanitize_address))
+#endif
+static const char *
+json_scan_plain(const char *s)
+{
+#if defined(JSON_SSE2) || defined(JSON_NEON)
+  while(!JSON_PAGE_SAFE(s)) {
+    const uint8_t c = *s;
+    if(c == '"' || c == '\\' || c == 0 || c >= 0x80)
+      return s;
+    s++;
+  }
+
+#if defined(JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i zero = _mm_setzero_si128();
+
+  while(1) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)s);
+    const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                      _mm_cmpeq_epi8(v, bslash)),
+                                         _mm_cmpeq_epi8(v, zero));
+    // movemask picks the high bit, so non-ASCII bytes are flagged directly
+    const int mask = _mm_movemask_epi8(_mm_or_si128(special, v));
+    if(mask)
+      return s + __builtin_ctz(mask);
+    s += 16;
+    while(!JSON_PAGE_SAFE(s)) {
+      const uint8_t c = *s;
+      if(c == '"' || c == '\\' || c == 0 || c >= 0x80)
+        return s;
+      s++;
+    }
+  }
+#else
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t bslash = vdupq_n_u8('\\');
+  const uint8x16_t high = vdupq_n_u8(0x80);
+  const uint8x16_t zero = vdupq_n_u8(0);
+
+  while(1) {
+    const uint8x16_t v = vld1q_u8((const uint8_t *)s);
+    const uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(v, quote),
+                                                 vceqq_u8(v, bslash)),
+                                        vorrq_u8(vceqq_u8(v, zero),
+                                                 vcgeq_u8(v, high)));
+    const uint64x2_t w = vreinterpretq_u64_u8(special);
+    if(vgetq_lane_u64(w, 0) | vgetq_lane_u64(w, 1))
+      break;
+    s += 16;
+    while(!JSON_PAGE_SAFE(s)) {
+      const uint8_t c = *s;
+      if(c == '"' || c == '\\' || c == 0 || c >= 0x80)
+        return s;
+      s++;
+    }
+  }
+  // Pinpoint the byte in the block
+  while(1) {
+    const uint8_t c = *s;
+    if(c == '"' || c == '\\' || c == 0 || c >= 0x80)
+      return s;
+    s++;
+  }
+#endif
+
+#else
+  while(1) {
+    const uint8_t c = *s;
+    if(c == '"' || c == '\\' || c == 0 || c >= 0x80)
+      return s;
+    s++;
+  }
+#endif
+}
+
+
+/**
+ *
+ */
 static int
 json_str_read_char(const char **ptr)
 {
@@ -91,9 +198,8 @@ static char *
 json_parse_string(const char *start, const char **endp,
 		  const char **failp, const char **failmsg)
 {
-  const char *s;
-  while(*start > 0 && *start < 33)
-    start++;
+  const char *s, *e;
+  json_skip_ws(start);
 
   if(*start != '"')
     return NOT_THIS_TYPE;
@@ -101,7 +207,13 @@ json_parse_string(const char *start, const char **endp,
   start++;
 
   int len = 0;
-  for(s = start; *s != '"';) {
+  for(s = start; ; ) {
+
+    e = json_scan_plain(s);
+    len += e - s;
+    s = e;
+    if(*s == '"')
+      break;
 
     int v = json_str_read_char(&s);
     if(v == -1) {
@@ -121,7 +233,14 @@ json_parse_string(const char *start, const char **endp,
   char *dst = r;
   r[len] = 0;
 
-  for(s = start; *s != '"';) {
+  for(s = start; ; ) {
+    e = json_scan_plain(s);
+    memcpy(dst, s, e - s);
+    dst += e - s;
+    s = e;
+    if(*s == '"')
+      break;
+
     int v = json_str_read_char(&s);
     assert(v > 0);
     dst += utf8_put(dst, v);
@@ -143,8 +262,7 @@ json_parse_map(const char *s, const char **endp, const json_deserializer_t *jd,
   const char *s2;
   void *r;
 
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
 
   if(*s != '{')
     return NOT_THIS_TYPE;
@@ -153,26 +271,27 @@ json_parse_map(const char *s, const char **endp, const json_deserializer_t *jd,
 
   r = jd->jd_create_map(opaque);
   
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
 
   if(*s != '}') {
 
     while(1) {
       name = json_parse_string(s, &s2, failp, failmsg);
       if(name == NOT_THIS_TYPE) {
+	jd->jd_destroy_obj(opaque, r);
 	*failmsg = "Expected string";
 	*failp = s;
 	return NULL;
       }
 
-      if(name == NULL)
+      if(name == NULL) {
+	jd->jd_destroy_obj(opaque, r);
 	return NULL;
+      }
 
       s = s2;
     
-      while(*s > 0 && *s < 33)
-	s++;
+      json_skip_ws(s);
 
       if(*s != ':') {
 	jd->jd_destroy_obj(opaque, r);
@@ -193,8 +312,7 @@ json_parse_map(const char *s, const char **endp, const json_deserializer_t *jd,
 
       s = s2;
 
-      while(*s > 0 && *s < 33)
-	s++;
+      json_skip_ws(s);
 
       if(*s == '}')
 	break;
@@ -225,8 +343,7 @@ json_parse_list(const char *s, const char **endp, const json_deserializer_t *jd,
   const char *s2;
   void *r;
 
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
 
   if(*s != '[')
     return NOT_THIS_TYPE;
@@ -235,8 +352,7 @@ json_parse_list(const char *s, const char **endp, const json_deserializer_t *jd,
 
   r = jd->jd_create_list(opaque);
   
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
 
   if(*s != ']') {
 
@@ -251,8 +367,7 @@ json_parse_list(const char *s, const char **endp, const json_deserializer_t *jd,
 
       s = s2;
 
-      while(*s > 0 && *s < 33)
-	s++;
+      json_skip_ws(s);
 
       if(*s == ']')
 	break;
@@ -278,8 +393,7 @@ static const char *
 json_parse_double(const char *s, double *dp)
 {
   const char *ep;
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
 
   double d = my_str2double(s, &ep);
 
@@ -298,8 +412,7 @@ static char *
 json_parse_integer(const char *s, long *lp)
 {
   char *ep;
-  while(*s > 0 && *s < 33)
-    s++;
+  json_skip_ws(s);
   const char *s2 = s;
   if(*s2 == '-')
     s2++;
@@ -336,26 +449,25 @@ json_parse_value(const char *s, void *parent, const char *name,
   long l = 0;
   void *c;
 
-  if((c = json_parse_map(s, &s2, jd, opaque, failp, failmsg)) == NULL)
-    return NULL;
+  json_skip_ws(s);
 
-  if(c != NOT_THIS_TYPE) {
+  // Dispatch on first character instead of trying each type in turn
+  switch(*s) {
+  case '{':
+    if((c = json_parse_map(s, &s2, jd, opaque, failp, failmsg)) == NULL)
+      return NULL;
     jd->jd_add_obj(opaque, parent, name, c);
     return s2;
-  }
 
-  if((c = json_parse_list(s, &s2, jd, opaque, failp, failmsg)) == NULL)
-    return NULL;
-  
-  if(c != NOT_THIS_TYPE) {
+  case '[':
+    if((c = json_parse_list(s, &s2, jd, opaque, failp, failmsg)) == NULL)
+      return NULL;
     jd->jd_add_obj(opaque, parent, name, c);
     return s2;
-  }
-
-  if((str = json_parse_string(s, &s2, failp, failmsg)) == NULL)
-    return NULL;
 
-  if(str != NOT_THIS_TYPE) {
+  case '"':
+    if((str = json_parse_string(s, &s2, failp, failmsg)) == NULL)
+      return NULL;
     jd->jd_add_string(opaque, parent, name, str);
     return s2;
   }
@@ -368,9 +480,6 @@ json_parse_value(const char *s, void *parent, const char *name,
     return s2;
   }
 
-  while(*s > 0 && *s < 33)
-    s++;
-
   if(!strncmp(s, "true", 4)) {
     jd->jd_add_bool(opaque, parent, name, 1);
     return s + 4;
@@ -428,3 +537,128 @@ json_deserialize(const char *src, const json_deserializer_t *jd, void *opaque,
   }
   return c;
 }
+
+
+/**
+ * Throughput benchmark, build with:
+ *
+ * gcc -O2 -DLOCAL_MAIN -Isrc -Ibuild.linux src/misc/json.c src/misc/dbl.c \
+ *   -o /tmp/json -lm
+ *
+ * Add -DJSON_NO_SIMD to compare against the scalar string scanner
+ */
+#ifdef LOCAL_MAIN
+#include <sys/time.h>
+
+/**
+ * Simplified versions of the ones in misc/str.c (which drags in too
+ * much to link standalone), good enough for valid input
+ */
+int
+utf8_get(const char **s)
+{
+  const uint8_t *p = (const uint8_t *)*s;
+  int c = *p++, l = 0;
+
+  if(c >= 0xf0)
+    c &= 0x07, l = 3;
+  else if(c >= 0xe0)
+    c &= 0x0f, l = 2;
+  else if(c >= 0xc0)
+    c &= 0x1f, l = 1;
+
+  for(; l > 0 && (*p & 0xc0) == 0x80; l--)
+    c = c << 6 | (*p++ & 0x3f);
+  *s = (const char *)p;
+  return l ? 0xfffd : c;
+}
+
+int
+utf8_put(char *out, int c)
+{
+  int l = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+  if(out) {
+    static const uint8_t lead[5] = {0, 0, 0xc0, 0xe0, 0xf0};
+    for(int i = l - 1; i > 0; i--, c >>= 6)
+      out[i] = 0x80 | (c & 0x3f);
+    out[0] = lead[l] | c;
+  }
+  return l;
+}
+
+static int lm_obj;
+
+static void *lm_create(void *opaque) { return &lm_obj; }
+static void lm_destroy(void *opaque, void *obj) {}
+static void lm_add_obj(void *opaque, void *p, const char *n, void *c) {}
+static void lm_add_str(void *opaque, void *p, const char *n, char *str)
+{
+  free(str);
+}
+static void lm_add_long(void *opaque, void *p, const char *n, long v) {}
+static void lm_add_dbl(void *opaque, void *p, const char *n, double d) {}
+static void lm_add_bool(void *opaque, void *p, const char *n, int v) {}
+static void lm_add_null(void *opaque, void *p, const char *n) {}
+
+static const json_deserializer_t lm_jd = {
+  .jd_create_map      = lm_create,
+  .jd_create_list     = lm_create,
+  .jd_destroy_obj     = lm_destroy,
+  .jd_add_obj         = lm_add_obj,
+  .jd_add_string      = lm_add_str,
+  .jd_add_long        = lm_add_long,
+  .jd_add_double      = lm_add_dbl,
+  .jd_add_bool        = lm_add_bool,
+  .jd_add_null        = lm_add_null,
+};
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+int
+main(int argc, char **argv)
+{
+  // Something resembling a large catalog response from a plugin API
+  const int entries = 20000;
+  size_t size = entries * 600 + 100, off = 0;
+  char *doc = malloc(size);
+  char errbuf[256];
+  int i;
+
+  off += snprintf(doc + off, size - off, "{\"items\":[");
+  for(i = 0; i < entries; i++)
+    off += snprintf(doc + off, size - off,
+                    "%s{\"id\":%d,\"title\":\"Some kind of title number %d\","
+                    "\"description\":\"A longer description, much like "
+                    "the synopsis of a movie or an episode. It goes on for "
+                    "a few sentences about the plot and the people in it "
+                    "and sometimes it also mentions where and when it was "
+                    "made. Every now and then there is an "
+                    "escaped \\\"quote\\\" and some unicode \\u00e5\\u00e4 "
+                    "and Gr\xc3\xbc\xc3\x9f" "e in it\",\"rating\":%d.5,"
+                    "\"url\":\"http:\\/\\/example.com\\/items\\/%d\","
+                    "\"tags\":[\"one\",\"two\",\"three\"],\"hd\":true,"
+                    "\"parent\":null}",
+                    i ? "," : "", i, i, i % 10, i);
+  off += snprintf(doc + off, size - off, "]}");
+
+  const int rounds = 20;
+  int64_t ts = get_ts();
+  for(i = 0; i < rounds; i++) {
+    if(json_deserialize(doc, &lm_jd, NULL, errbuf, sizeof(errbuf)) == NULL) {
+      printf("Parse failed: %s\n", errbuf);
+      return 1;
+    }
+  }
+  ts = get_ts() - ts;
+
+  printf("%zd bytes, %.1f MB/s\n", off,
+         (double)off * rounds / ts);
+  return 0;
+}
+#endif
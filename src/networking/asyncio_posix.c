@@ -1214,7 +1214,7 @@ static int adr_resolver_running;
 static int
 adr_resolve(asyncio_dns_req_t *adr)
 {
-  return net_resolve(adr->adr_hostname, &adr->adr_addr, &adr->adr_errmsg);
+  return net_resolve_cached(adr->adr_hostname, &adr->adr_addr, &adr->adr_errmsg);
 }
 
 
@@ -93,6 +93,11 @@ int net_resolve(const char *hostname, net_addr_t *addr, const char **errmsg);
 
 int net_resolve_numeric(const char *hostname, net_addr_t *addr);
 
+int net_resolve_cached(const char *hostname, net_addr_t *addr,
+                       const char **errmsg);
+
+void net_resolve_flush(void);
+
 void net_change_nonblocking(int fd, int on);
 
 void net_change_ndelay(int fd, int on);
@@ -97,7 +97,7 @@ ssl_write_func(SSLConnectionRef connection, const void *data, size_t *len)
  */
 int
 tcp_ssl_open(tcpcon_t *tc, char *errbuf, size_t errlen, const char *hostname,
-             int verify)
+             int port, int verify)
 {
   tc->ssl = SSLCreateContext(NULL, kSSLClientSide, kSSLStreamType);
 
@@ -508,7 +508,7 @@ tcp_connect(const char *hostname, int port,
     goto connected;
 
   } else {
-    if(net_resolve(hostname, &addr, &errmsg)) {
+    if(net_resolve_cached(hostname, &addr, &errmsg)) {
 
       snprintf(errbuf, errlen, "Unable to resolve %s -- %s", hostname, errmsg);
 
@@ -528,7 +528,8 @@ tcp_connect(const char *hostname, int port,
  connected:
   if(flags & TCP_SSL) {
 
-    if(tcp_ssl_open(tc, errbuf, errlen, hostname, flags & TCP_SSL_VERIFY)) {
+    if(tcp_ssl_open(tc, errbuf, errlen, hostname, port,
+                    flags & TCP_SSL_VERIFY)) {
       tcp_close(tc);
       return NULL;
     }
@@ -576,6 +577,9 @@ net_refresh_network_status(void)
   prop_t *np = prop_create(prop_get_global(), "net");
   prop_t *interfaces = prop_create(np, "interfaces");
 
+  // Addresses might resolve differently on the new network
+  net_resolve_flush();
+
   if(ni == NULL || ni->ifname[0] == 0) {
     prop_set(np, "connectivity", PROP_SET_INT, 0);
     prop_destroy_childs(interfaces);
@@ -0,0 +1,335 @@
+/*
+ *  Copyright (C) 2007-2018 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "net.h"
+#include "prop/prop.h"
+#include "htsmsg/htsmsg.h"
+#include "htsmsg/htsmsg_store.h"
+
+/**
+ * Process wide cache in front of the platform resolver (net_resolve())
+ *
+ * The platform resolvers don't tell us the TTL of the records so we
+ * use fixed lifetimes. Failures are cached too (for a shorter while) so
+ * a dead host doesn't cause a resolver round trip for every request.
+ *
+ * Concurrent lookups of the same name are coalesced: The first thread
+ * does the actual resolve while the others wait for the result.
+ *
+ * Names that were looked up frequently are remembered across restarts
+ * and resolved in the background during startup.
+ */
+
+#define DNSCACHE_HASH_SIZE   32
+#define DNSCACHE_MAX_ENTRIES 128
+
+#define DNSCACHE_POSITIVE_TTL (300 * 1000000LL)
+#define DNSCACHE_NEGATIVE_TTL (15 * 1000000LL)
+
+#define DNSCACHE_PREFETCH_HOSTS 8
+
+LIST_HEAD(dnscache_entry_list, dnscache_entry);
+
+typedef enum {
+  DNSCACHE_PENDING,
+  DNSCACHE_RESOLVED,
+  DNSCACHE_FAILED,
+} dnscache_state_t;
+
+typedef struct dnscache_entry {
+  LIST_ENTRY(dnscache_entry) de_hash_link;
+  char *de_hostname;
+  dnscache_state_t de_state;
+  net_addr_t de_addr;
+  const char *de_errmsg;
+  int64_t de_expire;
+  int64_t de_last_used;
+  int de_lookups;
+} dnscache_entry_t;
+
+static struct dnscache_entry_list dnscache_hash[DNSCACHE_HASH_SIZE];
+static int dnscache_num_entries;
+static hts_mutex_t dnscache_mutex;
+static hts_cond_t dnscache_cond;
+
+static int dnscache_hits;
+static int dnscache_misses;
+static int dnscache_coalesced;
+
+static htsmsg_t *dnscache_persisted;
+
+
+/**
+ *
+ */
+static void
+dnscache_update_stats(void)
+{
+  prop_t *p = prop_create(prop_create(prop_get_global(), "net"), "dns");
+  prop_set(p, "hits", PROP_SET_INT, dnscache_hits);
+  prop_set(p, "misses", PROP_SET_INT, dnscache_misses);
+  prop_set(p, "coalesced", PROP_SET_INT, dnscache_coalesced);
+  prop_set(p, "entries", PROP_SET_INT, dnscache_num_entries);
+}
+
+
+/**
+ *
+ */
+static void
+dnscache_entry_destroy(dnscache_entry_t *de)
+{
+  LIST_REMOVE(de, de_hash_link);
+  free(de->de_hostname);
+  free(de);
+  dnscache_num_entries--;
+}
+
+
+/**
+ * Evict least recently used entry (that is not currently resolving)
+ */
+static void
+dnscache_evict(void)
+{
+  dnscache_entry_t *de, *victim = NULL;
+  int i;
+
+  for(i = 0; i < DNSCACHE_HASH_SIZE; i++) {
+    LIST_FOREACH(de, &dnscache_hash[i], de_hash_link) {
+      if(de->de_state == DNSCACHE_PENDING)
+        continue;
+      if(victim == NULL || de->de_last_used < victim->de_last_used)
+        victim = de;
+    }
+  }
+  if(victim != NULL)
+    dnscache_entry_destroy(victim);
+}
+
+
+/**
+ * Remember names that are looked up more than once so they can be
+ * prefetched next time we start
+ */
+static void
+dnscache_remember(const dnscache_entry_t *de)
+{
+  if(dnscache_persisted == NULL || de->de_lookups < 2)
+    return;
+
+  int prev = htsmsg_get_u32_or_default(dnscache_persisted, de->de_hostname, 0);
+  if(prev >= de->de_lookups)
+    return;
+
+  htsmsg_delete_field(dnscache_persisted, de->de_hostname);
+  htsmsg_add_u32(dnscache_persisted, de->de_hostname, de->de_lookups);
+
+  int cnt = 0;
+  htsmsg_field_t *f, *least = NULL;
+  HTSMSG_FOREACH(f, dnscache_persisted) {
+    cnt++;
+    if(least == NULL || f->hmf_s64 < least->hmf_s64)
+      least = f;
+  }
+  if(cnt > DNSCACHE_PREFETCH_HOSTS * 2)
+    htsmsg_field_destroy(dnscache_persisted, least);
+
+  htsmsg_store_save(dnscache_persisted, "dnscache");
+}
+
+
+/**
+ *
+ */
+int
+net_resolve_cached(const char *hostname, net_addr_t *addr, const char **err)
+{
+  const unsigned int bucket = mystrhash(hostname) % DNSCACHE_HASH_SIZE;
+  dnscache_entry_t *de;
+  int64_t now;
+  int rval;
+
+  if(!net_resolve_numeric(hostname, addr))
+    return 0;
+
+  hts_mutex_lock(&dnscache_mutex);
+
+  while(1) {
+    now = arch_get_ts();
+
+    LIST_FOREACH(de, &dnscache_hash[bucket], de_hash_link)
+      if(!strcmp(de->de_hostname, hostname))
+        break;
+
+    if(de == NULL) {
+      if(dnscache_num_entries >= DNSCACHE_MAX_ENTRIES)
+        dnscache_evict();
+
+      de = calloc(1, sizeof(dnscache_entry_t));
+      de->de_hostname = strdup(hostname);
+      LIST_INSERT_HEAD(&dnscache_hash[bucket], de, de_hash_link);
+      dnscache_num_entries++;
+      break;
+    }
+
+    if(de->de_state == DNSCACHE_PENDING) {
+      dnscache_coalesced++;
+      hts_cond_wait(&dnscache_cond, &dnscache_mutex);
+      continue;
+    }
+
+    if(de->de_expire > now) {
+      de->de_last_used = now;
+      de->de_lookups++;
+      dnscache_hits++;
+
+      if(de->de_state == DNSCACHE_RESOLVED) {
+        *addr = de->de_addr;
+        rval = 0;
+      } else {
+        *err = de->de_errmsg;
+        rval = -1;
+      }
+      dnscache_update_stats();
+      hts_mutex_unlock(&dnscache_mutex);
+      return rval;
+    }
+    break; // Expired, refresh
+  }
+
+  de->de_state = DNSCACHE_PENDING;
+  dnscache_misses++;
+  hts_mutex_unlock(&dnscache_mutex);
+
+  rval = net_resolve(hostname, addr, err);
+
+  hts_mutex_lock(&dnscache_mutex);
+  now = arch_get_ts();
+  if(rval) {
+    de->de_state = DNSCACHE_FAILED;
+    de->de_errmsg = *err;
+    de->de_expire = now + DNSCACHE_NEGATIVE_TTL;
+  } else {
+    de->de_state = DNSCACHE_RESOLVED;
+    de->de_addr = *addr;
+    de->de_expire = now + DNSCACHE_POSITIVE_TTL;
+  }
+  de->de_last_used = now;
+  de->de_lookups++;
+  if(!rval)
+    dnscache_remember(de);
+  dnscache_update_stats();
+  hts_cond_broadcast(&dnscache_cond);
+  hts_mutex_unlock(&dnscache_mutex);
+  return rval;
+}
+
+
+/**
+ * Drop everything, called when network configuration changes
+ */
+void
+net_resolve_flush(void)
+{
+  dnscache_entry_t *de, *next;
+  int i;
+
+  hts_mutex_lock(&dnscache_mutex);
+  for(i = 0; i < DNSCACHE_HASH_SIZE; i++) {
+    for(de = LIST_FIRST(&dnscache_hash[i]); de != NULL; de = next) {
+      next = LIST_NEXT(de, de_hash_link);
+      // Resolves in flight will complete into their entry
+      if(de->de_state != DNSCACHE_PENDING)
+        dnscache_entry_destroy(de);
+    }
+  }
+  dnscache_update_stats();
+  hts_mutex_unlock(&dnscache_mutex);
+}
+
+
+/**
+ *
+ */
+static void *
+dnscache_prefetch_thread(void *aux)
+{
+  htsmsg_t *m = aux;
+  htsmsg_field_t *f;
+  net_addr_t addr;
+  const char *errmsg;
+  int i;
+
+  for(i = 0; i < DNSCACHE_PREFETCH_HOSTS; i++) {
+    htsmsg_field_t *best = NULL;
+    HTSMSG_FOREACH(f, m) {
+      if(f->hmf_name == NULL)
+        continue;
+      if(best == NULL || f->hmf_s64 > best->hmf_s64)
+        best = f;
+    }
+    if(best == NULL)
+      break;
+
+    if(net_resolve_cached(best->hmf_name, &addr, &errmsg))
+      TRACE(TRACE_DEBUG, "DNS", "Prefetch of %s failed -- %s",
+            best->hmf_name, errmsg);
+    htsmsg_field_destroy(m, best);
+  }
+  htsmsg_release(m);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+net_dnscache_init(void)
+{
+  hts_mutex_init(&dnscache_mutex);
+  hts_cond_init(&dnscache_cond, &dnscache_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+net_dnscache_prefetch(void)
+{
+  htsmsg_t *m = htsmsg_store_load("dnscache");
+  if(m == NULL)
+    m = htsmsg_create_map();
+
+  hts_mutex_lock(&dnscache_mutex);
+  dnscache_persisted = htsmsg_copy(m);
+  hts_mutex_unlock(&dnscache_mutex);
+
+  hts_thread_create_detached("DNS prefetch", dnscache_prefetch_thread, m,
+                             THREAD_PRIO_BGTASK);
+}
+
+INITME(INIT_GROUP_NET, net_dnscache_init, NULL, -1);
+INITME(INIT_GROUP_API, net_dnscache_prefetch, NULL, 0);
@@ -25,9 +25,35 @@
 
 #include <openssl/x509v3.h>
 
+#include "prop/prop.h"
+
 static SSL_CTX *app_ssl_ctx;
 static pthread_mutex_t *ssl_locks;
 
+/**
+ * Client side session cache
+ *
+ * Reconnects to a host we've recently talked to will offer the previous
+ * session which lets the server skip the full handshake (saves a round
+ * trip and the expensive key exchange).
+ *
+ * Entries are keyed on hostname and port as different ports on the same
+ * host may very well be different servers.
+ */
+#define SSL_SESSION_CACHE_SIZE 32
+
+typedef struct ssl_session_entry {
+  char *sse_hostname;
+  int sse_port;
+  SSL_SESSION *sse_session;
+  int64_t sse_last_used;
+} ssl_session_entry_t;
+
+static ssl_session_entry_t ssl_session_cache[SSL_SESSION_CACHE_SIZE];
+static hts_mutex_t ssl_session_mutex;
+static int ssl_handshakes_full;
+static int ssl_handshakes_resumed;
+
 static unsigned long
 ssl_tid_fn(void)
 {
@@ -46,6 +72,120 @@ ssl_lock_fn(int mode, int n, const char *file, int line)
 
 
 
+/**
+ *
+ */
+static int
+ssl_session_match(const ssl_session_entry_t *sse, const char *hostname,
+                  int port)
+{
+  return sse->sse_hostname != NULL && sse->sse_port == port &&
+    !strcmp(sse->sse_hostname, hostname);
+}
+
+
+/**
+ * Offer a cached session for 'hostname':'port' (if any).
+ * Returns 1 if offered
+ */
+static int
+ssl_session_offer(SSL *ssl, const char *hostname, int port)
+{
+  int offered = 0;
+  int i;
+
+  hts_mutex_lock(&ssl_session_mutex);
+  for(i = 0; i < SSL_SESSION_CACHE_SIZE; i++) {
+    ssl_session_entry_t *sse = &ssl_session_cache[i];
+    if(ssl_session_match(sse, hostname, port)) {
+      // SSL_set_session() grabs its own reference
+      offered = SSL_set_session(ssl, sse->sse_session);
+      sse->sse_last_used = arch_get_ts();
+      break;
+    }
+  }
+  hts_mutex_unlock(&ssl_session_mutex);
+  return offered;
+}
+
+
+/**
+ * Steals the reference to 'ss'
+ */
+static void
+ssl_session_put(const char *hostname, int port, SSL_SESSION *ss)
+{
+  ssl_session_entry_t *sse, *victim = NULL;
+  int i;
+
+  hts_mutex_lock(&ssl_session_mutex);
+  for(i = 0; i < SSL_SESSION_CACHE_SIZE; i++) {
+    sse = &ssl_session_cache[i];
+    if(ssl_session_match(sse, hostname, port)) {
+      victim = sse;
+      break;
+    }
+    if(victim == NULL || sse->sse_last_used < victim->sse_last_used)
+      victim = sse;
+  }
+
+  if(victim->sse_session != NULL)
+    SSL_SESSION_free(victim->sse_session);
+
+  if(victim->sse_hostname == NULL || strcmp(victim->sse_hostname, hostname))
+    mystrset(&victim->sse_hostname, hostname);
+  victim->sse_port = port;
+
+  victim->sse_session = ss;
+  victim->sse_last_used = arch_get_ts();
+  hts_mutex_unlock(&ssl_session_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+ssl_session_forget(const char *hostname, int port)
+{
+  int i;
+
+  hts_mutex_lock(&ssl_session_mutex);
+  for(i = 0; i < SSL_SESSION_CACHE_SIZE; i++) {
+    ssl_session_entry_t *sse = &ssl_session_cache[i];
+    if(ssl_session_match(sse, hostname, port)) {
+      SSL_SESSION_free(sse->sse_session);
+      sse->sse_session = NULL;
+      mystrset(&sse->sse_hostname, NULL);
+      sse->sse_port = 0;
+      sse->sse_last_used = 0;
+    }
+  }
+  hts_mutex_unlock(&ssl_session_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+ssl_handshake_done(int resumed)
+{
+  prop_t *p;
+
+  hts_mutex_lock(&ssl_session_mutex);
+  if(resumed)
+    ssl_handshakes_resumed++;
+  else
+    ssl_handshakes_full++;
+
+  p = prop_create(prop_create(prop_get_global(), "net"), "tls");
+  prop_set(p, "fullHandshakes", PROP_SET_INT, ssl_handshakes_full);
+  prop_set(p, "resumedHandshakes", PROP_SET_INT, ssl_handshakes_resumed);
+  hts_mutex_unlock(&ssl_session_mutex);
+}
+
+
 /**
  *
  */
@@ -86,7 +226,7 @@ ssl_write(tcpcon_t *tc, const void *data, size_t len)
 
 int
 tcp_ssl_open(tcpcon_t *tc, char *errbuf, size_t errlen, const char *hostname,
-             int verify)
+             int port, int verify)
 {
   if(app_ssl_ctx == NULL) {
     snprintf(errbuf, errlen, "SSL not initialized");
@@ -101,6 +241,8 @@ tcp_ssl_open(tcpcon_t *tc, char *errbuf, size_t errlen, const char *hostname,
   }
   SSL_set_tlsext_host_name(tc->ssl, hostname);
 
+  const int offered = ssl_session_offer(tc->ssl, hostname, port);
+
   if(SSL_set_fd(tc->ssl, tc->fd) == 0) {
     ERR_error_string(ERR_get_error(), errmsg);
     snprintf(errbuf, errlen, "SSL fd: %s", errmsg);
@@ -110,12 +252,24 @@ tcp_ssl_open(tcpcon_t *tc, char *errbuf, size_t errlen, const char *hostname,
   if(SSL_connect(tc->ssl) <= 0) {
     ERR_error_string(ERR_get_error(), errmsg);
     snprintf(errbuf, errlen, "SSL connect: %s", errmsg);
+    if(offered)
+      ssl_session_forget(hostname, port);
     return -1;
   }
 
   if(verify) {
-    if(openssl_verify_connection(tc->ssl, hostname, errbuf, errlen, 1))
+    if(openssl_verify_connection(tc->ssl, hostname, errbuf, errlen, 1)) {
+      ssl_session_forget(hostname, port);
       return -1;
+    }
+  }
+
+  const int resumed = SSL_session_reused(tc->ssl);
+  ssl_handshake_done(resumed);
+  if(!resumed) {
+    SSL_SESSION *ss = SSL_get1_session(tc->ssl);
+    if(ss != NULL)
+      ssl_session_put(hostname, port, ss);
   }
 
   SSL_set_mode(tc->ssl, SSL_MODE_AUTO_RETRY);
@@ -244,6 +398,8 @@ net_ssl_init(void)
   app_ssl_ctx = SSL_CTX_new(SSLv23_client_method()); // should be TLS_client_method() on openssl >=1.1.0
 
   SSL_CTX_load_verify_locations(app_ssl_ctx, NULL, "/etc/ssl/certs");
+  SSL_CTX_set_session_cache_mode(app_ssl_ctx, SSL_SESS_CACHE_CLIENT);
+  hts_mutex_init(&ssl_session_mutex);
 
   int i, n = CRYPTO_num_locks();
   ssl_locks = malloc(sizeof(pthread_mutex_t) * n);
@@ -28,6 +28,7 @@
 #include "main.h"
 #include "navigator.h"
 #include "backend/backend.h"
+#include "fileaccess/fa_audio.h"
 #include "playqueue.h"
 #include "media/media.h"
 #include "event.h"
@@ -1070,6 +1071,8 @@ player_thread(void *aux)
         prop_set(playqueue_root, "active", PROP_SET_INT, 0);
 	/* Make sure we no longer claim current playback focus */
 	mp_set_url(mp, NULL, NULL, NULL);
+	mp_set_next_url(mp, NULL, NULL);
+	audio_preroll_discard();
 	mp_shutdown(playqueue_mp);
     
 	prop_unlink(mp->mp_prop_metadata);
@@ -1126,7 +1129,11 @@ player_thread(void *aux)
     pqe_current = pqe;
     update_pq_meta();
 
-    if(playqueue_advance0(pqe, 0) == NULL && playqueue_source_sub != NULL)
+    playqueue_entry_t *next = playqueue_advance0(pqe, 0);
+    // Entries are played without mimetype, see backend_play_audio() below
+    mp_set_next_url(mp, next != NULL ? next->pqe_url : NULL, NULL);
+
+    if(next == NULL && playqueue_source_sub != NULL)
       prop_want_more_childs(playqueue_source_sub);
 
     hts_mutex_unlock(&playqueue_mutex);
@@ -1568,6 +1568,22 @@ init_dev_settings(void)
   add_dev_bool("Disable HTTP connection reuse",
 	       "nohttpreuse", &gconf.disable_http_reuse);
 
+  setting_create(SETTING_INT, gconf.settings_dev, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE_CSTR("Max idle HTTP connections"),
+                 SETTING_VALUE(16),
+                 SETTING_RANGE(1, 64),
+                 SETTING_WRITE_INT(&gconf.http_max_idle_connections),
+                 SETTING_STORE("dev", "httpmaxidle"),
+                 NULL);
+
+  setting_create(SETTING_INT, gconf.settings_dev, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE_CSTR("Max idle HTTP connections per host"),
+                 SETTING_VALUE(4),
+                 SETTING_RANGE(1, 16),
+                 SETTING_WRITE_INT(&gconf.http_max_idle_connections_per_host),
+                 SETTING_STORE("dev", "httpmaxidleperhost"),
+                 NULL);
+
   add_dev_bool("Enable indexer option",
 	       "enable_indexer", &gconf.enable_indexer);
 
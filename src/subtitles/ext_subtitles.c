@@ -721,7 +721,13 @@ vocmp(const void *A, const void *B)
 
 
 /**
+ * Sort entries on start time and build the lookup index
  *
+ * The entries are kept in a sorted array augmented with an implicit
+ * binary tree where each node holds the max stop time of its subtree.
+ * This makes it possible to find the first entry active at any given
+ * time in O(log n) even with long or overlapping cues (which is very
+ * common in ASS karaoke files)
  */
 static void
 es_sort(ext_subtitles_t *es, int trim_stop)
@@ -733,11 +739,11 @@ es_sort(ext_subtitles_t *es, int trim_stop)
     cnt++;
 
   vec = malloc(sizeof(video_overlay_t *) * cnt);
-  
+
   cnt = 0;
   TAILQ_FOREACH(vo, &es->es_entries, vo_link)
     vec[cnt++] = vo;
-  
+
   qsort(vec, cnt, sizeof(video_overlay_t *), vocmp);
 
   if(trim_stop) {
@@ -749,7 +755,74 @@ es_sort(ext_subtitles_t *es, int trim_stop)
   TAILQ_INIT(&es->es_entries);
   for(i = 0; i < cnt; i++)
     TAILQ_INSERT_TAIL(&es->es_entries, vec[i], vo_link);
-  free(vec);
+
+  int size = 1;
+  while(size < cnt)
+    size *= 2;
+
+  int64_t *t = malloc(sizeof(int64_t) * size * 2);
+  for(i = 0; i < size; i++)
+    t[size + i] = i < cnt ? vec[i]->vo_stop : INT64_MIN;
+  for(i = size - 1; i > 0; i--)
+    t[i] = MAX(t[i * 2], t[i * 2 + 1]);
+
+  es->es_vec = vec;
+  es->es_maxstop = t;
+  es->es_num_entries = cnt;
+  es->es_tree_size = size;
+  es->es_cur = -1;
+}
+
+
+/**
+ * Return number of entries with start time <= ts
+ */
+static int
+es_count_started(const ext_subtitles_t *es, int64_t ts)
+{
+  int lo = 0, hi = es->es_num_entries;
+  while(lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if(es->es_vec[mid]->vo_start <= ts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+
+/**
+ * Find first entry in [from, to) that stops after ts, -1 if none
+ */
+static int
+es_find_stop_after(const ext_subtitles_t *es, int node, int nlo, int nhi,
+                   int from, int to, int64_t ts)
+{
+  if(nhi <= from || nlo >= to || es->es_maxstop[node] <= ts)
+    return -1;
+
+  if(nhi - nlo == 1)
+    return nlo;
+
+  const int mid = (nlo + nhi) / 2;
+  int r = es_find_stop_after(es, node * 2, nlo, mid, from, to, ts);
+  if(r == -1)
+    r = es_find_stop_after(es, node * 2 + 1, mid, nhi, from, to, ts);
+  return r;
+}
+
+
+/**
+ * Find first entry at or after index 'from' that is active at ts
+ */
+static int
+es_find_active(const ext_subtitles_t *es, int from, int64_t ts)
+{
+  const int to = es_count_started(es, ts);
+  if(from >= to)
+    return -1;
+  return es_find_stop_after(es, 1, 0, es->es_tree_size, from, to, ts);
 }
 
 
@@ -840,6 +913,8 @@ subtitles_destroy(ext_subtitles_t *es)
   }
   if(es->es_dtor)
     es->es_dtor(es);
+  free(es->es_vec);
+  free(es->es_maxstop);
   free(es);
 }
 
@@ -848,22 +923,24 @@ subtitles_destroy(ext_subtitles_t *es)
  *
  */
 static void
-vo_deliver(ext_subtitles_t *es, video_overlay_t *vo, media_pipe_t *mp,
+vo_deliver(ext_subtitles_t *es, int idx, media_pipe_t *mp,
 	   int64_t user_time, int64_t user_time_to_pts)
 {
-  int64_t s = vo->vo_start;
+  const int64_t s = es->es_vec[idx]->vo_start;
+
   do {
-        es->es_cur = vo;
+        es->es_cur = idx;
 
-        video_overlay_t *dup = video_overlay_dup(vo);
+        video_overlay_t *dup = video_overlay_dup(es->es_vec[idx]);
 
         dup->vo_start += user_time_to_pts;
         dup->vo_stop  += user_time_to_pts;
 
         video_overlay_enqueue(mp, dup);
-        //printf("delivery %" PRId64 " %" PRId64 " - %" PRId64 ": %ls\n",user_time,vo->vo_start,vo->vo_stop,(wchar_t*)vo->vo_text);
-        vo = TAILQ_NEXT(vo, vo_link);
-  } while(vo != NULL && vo->vo_start == s && vo->vo_stop > user_time);
+        idx++;
+  } while(idx < es->es_num_entries &&
+          es->es_vec[idx]->vo_start == s &&
+          es->es_vec[idx]->vo_stop > user_time);
 }
 
 
@@ -874,37 +951,34 @@ void
 subtitles_pick(ext_subtitles_t *es, int64_t user_time, int64_t pts,
                media_pipe_t *mp)
 {
-  video_overlay_t *vo = es->es_cur;
+  int idx;
 
   if(es->es_picker)
     return es->es_picker(es, pts);
 
   int64_t user_time_to_pts = pts - user_time;
-  while(vo != NULL) {
-    vo = TAILQ_NEXT(vo, vo_link);
-    if(vo != NULL && vo->vo_start <= user_time && vo->vo_stop > user_time) {
-      vo_deliver(es, vo, mp, user_time, user_time_to_pts);
+
+  if(es->es_cur != -1) {
+    // Anything that became active after what we delivered last
+    idx = es_find_active(es, es->es_cur + 1, user_time);
+    if(idx != -1) {
+      vo_deliver(es, idx, mp, user_time, user_time_to_pts);
       return;
     }
-    if(vo != NULL && vo->vo_start > user_time)
-      break;
-  }
 
-  vo = es->es_cur;
-
-  if(vo != NULL && vo->vo_start <= user_time && vo->vo_stop > user_time) {
-    return; // Already sent
+    const video_overlay_t *vo = es->es_vec[es->es_cur];
+    if(vo->vo_start <= user_time && vo->vo_stop > user_time)
+      return; // Already sent
   }
 
-  TAILQ_FOREACH(vo, &es->es_entries, vo_link) {
-    if(vo->vo_start <= user_time && vo->vo_stop > user_time && vo->vo_start>user_time-1000000) {//don't re-delivery long standing item
-      vo_deliver(es, vo, mp, user_time, user_time_to_pts);
-      return;
-    }
-    if(vo->vo_start>user_time)
-      break;
+  // Don't re-deliver long standing items (ie, after seeking)
+  idx = es_find_active(es, es_count_started(es, user_time - 1000000),
+                       user_time);
+  if(idx != -1) {
+    vo_deliver(es, idx, mp, user_time, user_time_to_pts);
+    return;
   }
-  es->es_cur = NULL;
+  es->es_cur = -1;
 }
 
 
@@ -27,7 +27,14 @@ struct video_decoder;
 
 typedef struct ext_subtitles {
   struct video_overlay_queue es_entries;
-  video_overlay_t *es_cur;
+
+  // Entries sorted on start time, see es_sort()
+  video_overlay_t **es_vec;
+  int64_t *es_maxstop;  // Max stop time per subtree (implicit tree)
+  int es_num_entries;
+  int es_tree_size;     // Number of leaves in es_maxstop, power of two
+
+  int es_cur;           // Index of last delivered entry, -1 if none
 
   void (*es_dtor)(struct ext_subtitles *es);
   void (*es_picker)(struct ext_subtitles *es, int64_t pts);
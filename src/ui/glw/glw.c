@@ -689,6 +689,11 @@ glw_prepare_frame(glw_root_t *gr, int flags)
       double hz = 16000000.0 / d;
       prop_set(gr->gr_prop_ui, "framerate", PROP_SET_FLOAT, hz);
       gr->gr_framerate = hz;
+
+      prop_set(gr->gr_prop_ui, "textureBinds", PROP_SET_INT,
+               gr->gr_stats_texture_binds);
+      prop_set(gr->gr_prop_ui, "drawCalls", PROP_SET_INT,
+               gr->gr_stats_draw_calls);
     }
 
     gr->gr_framerate_avg[gr->gr_frames & 0xf] = gr->gr_frame_start;
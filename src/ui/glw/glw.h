@@ -843,6 +843,10 @@ typedef struct glw_root {
 
   int64_t gr_framerate_avg[16];
 
+  // Filled in by the backend renderer for the last rendered frame
+  int gr_stats_texture_binds;
+  int gr_stats_draw_calls;
+
   uint64_t gr_time_usec;
   double gr_time_sec;
 
@@ -914,6 +918,11 @@ typedef struct glw_root {
     int limit;
   } gr_tex_stash[2];
 
+  // Time from textures being on screen until they are uploaded
+  int64_t gr_tex_latency_sum;
+  int gr_tex_latency_cnt;
+  int gr_tex_latency_max;
+
   struct glw_loadable_texture_list gr_tex_list;
 
   /**
@@ -265,6 +265,12 @@ glw_image_render(glw_t *w, const glw_rctx_t *rc)
   if(gi->gi_externalized)
     return;
 
+  if(gi->gi_pending != NULL)
+    glw_tex_hint(w->glw_root, gi->gi_pending, rc);
+
+  if(gi->gi_current != NULL)
+    glw_tex_hint(w->glw_root, gi->gi_current, rc);
+
   const glw_loadable_texture_t *glt = gi->gi_current;
   float alpha_self;
   float blur = 1 - (rc->rc_sharpness * w->glw_sharpness);
@@ -63,6 +63,7 @@ struct glw_renderer;
 struct glw_backend_texture;
 
 LIST_HEAD(glw_program_list, glw_program);
+LIST_HEAD(glw_atlas_page_list, glw_atlas_page);
 
 /**
  * OpenGL shader program
@@ -132,6 +133,19 @@ typedef struct glw_backend_root {
 
   GLuint gbr_vbo;
 
+  /**
+   * Texture atlas for small images, see glw_texture_opengl.c
+   */
+  struct glw_atlas_page_list gbr_atlas_pages;
+  int gbr_atlas_num_pages;
+  int gbr_atlas_enabled;
+
+  /**
+   * Scratch index buffer used when merging render jobs
+   */
+  uint16_t *gbr_merged_indices;
+  int gbr_merged_indices_capacity;
+
 #if ENABLE_VDPAU
 
   PFNGLVDPAUUNREGISTERSURFACENVPROC     gbr_glVDPAUUnregisterSurfaceNV;
@@ -160,11 +174,26 @@ typedef struct glw_backend_texture {
   uint16_t width;
   uint16_t height;
   uint8_t opaque;
+
+  /**
+   * If non-NULL the texture lives in a cell of a shared atlas page
+   * (textures[0] is then the page's texture). Texture coordinates
+   * are remapped as [s * atlas_st[0] + atlas_st[2], t * atlas_st[1] +
+   * atlas_st[3]] by the renderer
+   */
+  struct glw_atlas_page *atlas;
+  int atlas_cell;
+  float atlas_st[4];
 } glw_backend_texture_t;
 
 #define glw_tex_width(gbt) ((gbt)->width)
 #define glw_tex_height(gbt) ((gbt)->height)
 
+// Render jobs are sorted on this to group jobs using the same texture
+#define glw_tex_sort_key(gbt) ((gbt) ? (uintptr_t)(gbt)->textures[0] : 0)
+
+#define GLW_ATLAS_PAGE_SIZE 1024
+
 #define glw_is_tex_inited(n) ((n)->textures[0] != 0)
 
 int glw_opengl_init_context(struct glw_root *gr);
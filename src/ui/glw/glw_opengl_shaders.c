@@ -33,11 +33,17 @@ const static float projection[16] = {
 };
 #endif
 
+// Texture unit contents are unknown (ie, must rebind)
+#define TEX_UNKNOWN ((GLuint)-1)
+
 typedef struct render_state {
-  const struct glw_backend_texture *t0;
-  const struct glw_backend_texture *t1;
+  GLuint tex0;
+  GLuint tex1;
   int texload_skips;
   int program_switches;
+  int texture_binds;
+  int draw_calls;
+  int merged_jobs;
 } render_state_t;
 
 /**
@@ -73,8 +79,8 @@ load_program(glw_root_t *gr,
 
   if(unlikely(gpa != NULL)) {
 
-    rs->t0 = NULL;
-    rs->t1 = NULL;
+    rs->tex0 = TEX_UNKNOWN;
+    rs->tex1 = TEX_UNKNOWN;
 
     if(unlikely(t1 != NULL)) {
 
@@ -86,6 +92,7 @@ load_program(glw_root_t *gr,
         glBindTexture(GL_TEXTURE_2D, t1->textures[0]);
         glActiveTexture(GL_TEXTURE0);
       }
+      rs->texture_binds++;
     }
 
     if(t0 != NULL) {
@@ -96,6 +103,7 @@ load_program(glw_root_t *gr,
       } else {
         glBindTexture(GL_TEXTURE_2D, t0->textures[0]);
       }
+      rs->texture_binds++;
     }
 
     use_program(gbr, gpa->gpa_prog, rs);
@@ -111,9 +119,10 @@ load_program(glw_root_t *gr,
     if(t1 != NULL) {
       gp = gbr->gbr_renderer_flat_stencil;
 
-      if(rs->t0 != t1) {
+      if(rs->tex0 != t1->textures[0]) {
         glBindTexture(GL_TEXTURE_2D, t1->textures[0]);
-        rs->t0 = t1;
+        rs->tex0 = t1->textures[0];
+        rs->texture_binds++;
       } else {
         rs->texload_skips++;
       }
@@ -131,11 +140,12 @@ load_program(glw_root_t *gr,
       gp = doblur ? gbr->gbr_renderer_tex_stencil_blur :
 	gbr->gbr_renderer_tex_stencil;
 
-      if(rs->t1 != t1) {
+      if(rs->tex1 != t1->textures[0]) {
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, t1->textures[0]);
         glActiveTexture(GL_TEXTURE0);
-        rs->t1 = t1;
+        rs->tex1 = t1->textures[0];
+        rs->texture_binds++;
       } else {
         rs->texload_skips++;
       }
@@ -146,9 +156,10 @@ load_program(glw_root_t *gr,
       gp = gbr->gbr_renderer_tex;
     }
 
-    if(rs->t0 != t0) {
+    if(rs->tex0 != t0->textures[0]) {
       glBindTexture(GL_TEXTURE_2D, t0->textures[0]);
-      rs->t0 = t0;
+      rs->tex0 = t0->textures[0];
+      rs->texture_binds++;
     } else {
       rs->texload_skips++;
     }
@@ -158,6 +169,119 @@ load_program(glw_root_t *gr,
 }
 
 
+/**
+ * Textures living in an atlas page are addressed by the widgets as if
+ * they were standalone textures ([0,1] range). Translate the texture
+ * coordinates into the page before uploading the vertex buffer.
+ *
+ * Texture0 is sampled via [s0, t0] and Texture1 via [s1, t1]
+ */
+static void
+remap_atlas_texcoords(glw_root_t *gr)
+{
+  for(int j = 0; j < gr->gr_num_render_jobs; j++) {
+    const glw_render_job_t *rj = gr->gr_render_jobs + j;
+
+    if(rj->gpa != NULL)
+      continue;
+
+    const float *st0 = rj->t0 != NULL && rj->t0->atlas ? rj->t0->atlas_st : NULL;
+    const float *st1 = rj->t1 != NULL && rj->t1->atlas ? rj->t1->atlas_st : NULL;
+
+    if(st0 == NULL && st1 == NULL)
+      continue;
+
+    float *v = gr->gr_vertex_buffer + rj->vertex_offset * VERTEX_SIZE;
+
+    for(int i = 0; i < rj->num_vertices; i++, v += VERTEX_SIZE) {
+      if(st0 != NULL) {
+        v[8] = v[8] * st0[0] + st0[2];
+        v[9] = v[9] * st0[1] + st0[3];
+      }
+      if(st1 != NULL) {
+        v[10] = v[10] * st1[0] + st1[2];
+        v[11] = v[11] * st1[1] + st1[3];
+      }
+    }
+  }
+}
+
+
+/**
+ * Return 1 if job 'b' can be drawn in the same glDrawElements() call
+ * as job 'a'. Jobs are sorted on zindex and texture so jobs sharing
+ * a texture (or atlas page) and state end up next to each other
+ */
+static int
+can_merge_jobs(const glw_render_order_t *a, const glw_render_order_t *b,
+               int use_stencil)
+{
+  const glw_render_job_t *x = a->job;
+  const glw_render_job_t *y = b->job;
+
+  if(use_stencil && a->zindex != b->zindex)
+    return 0;
+
+  if(x->gpa != NULL || y->gpa != NULL)
+    return 0;
+
+  if(x->primitive_type != GL_TRIANGLES || y->primitive_type != GL_TRIANGLES)
+    return 0;
+
+  if(glw_tex_sort_key(x->t0) != glw_tex_sort_key(y->t0) ||
+     glw_tex_sort_key(x->t1) != glw_tex_sort_key(y->t1))
+    return 0;
+
+  if(x->blur != y->blur || x->flags != y->flags ||
+     x->blendmode != y->blendmode || x->frontface != y->frontface ||
+     x->alpha != y->alpha || x->width != y->width || x->height != y->height)
+    return 0;
+
+  if(!glw_rgb_cmp(&x->rgb_mul, &y->rgb_mul) ||
+     !glw_rgb_cmp(&x->rgb_off, &y->rgb_off))
+    return 0;
+
+  if(x->eyespace != y->eyespace)
+    return 0;
+
+  if(!x->eyespace && memcmp(&x->m, &y->m, sizeof(Mtx)))
+    return 0;
+
+  return 1;
+}
+
+
+/**
+ *
+ */
+static const uint16_t *
+merge_indices(glw_root_t *gr, int first, int last, int *num_indices)
+{
+  glw_backend_root_t *gbr = &gr->gr_be;
+  int total = 0;
+
+  for(int j = first; j <= last; j++)
+    total += gr->gr_render_order[j].job->num_indices;
+
+  if(total > gbr->gbr_merged_indices_capacity) {
+    gbr->gbr_merged_indices_capacity = total * 2;
+    gbr->gbr_merged_indices = realloc(gbr->gbr_merged_indices,
+                                      sizeof(uint16_t) *
+                                      gbr->gbr_merged_indices_capacity);
+  }
+
+  uint16_t *dst = gbr->gbr_merged_indices;
+  for(int j = first; j <= last; j++) {
+    const glw_render_job_t *rj = gr->gr_render_order[j].job;
+    memcpy(dst, gr->gr_index_buffer + rj->index_offset,
+           rj->num_indices * sizeof(uint16_t));
+    dst += rj->num_indices;
+  }
+  *num_indices = total;
+  return gbr->gbr_merged_indices;
+}
+
+
 /**
  *
  */
@@ -165,7 +289,7 @@ static void
 render_unlocked(glw_root_t *gr)
 {
   glw_backend_root_t *gbr = &gr->gr_be;
-  render_state_t rs = {0};
+  render_state_t rs = {TEX_UNKNOWN, TEX_UNKNOWN};
   int64_t ts = arch_get_ts();
   int uni_calls = 0;
   int saved_calls = 0;
@@ -174,6 +298,8 @@ render_unlocked(glw_root_t *gr)
   glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
 		      GL_ONE_MINUS_DST_ALPHA, GL_ONE);
 
+  remap_atlas_texcoords(gr);
+
   const float *vertices = gr->gr_vertex_buffer;
 
   glBindBuffer(GL_ARRAY_BUFFER, gbr->gbr_vbo);
@@ -275,8 +401,13 @@ render_unlocked(glw_root_t *gr)
       }
 
       if(gp->gp_uniform_blur != -1 && t0 != NULL) {
-        glUniform3f(gp->gp_uniform_blur, rj->blur,
-                    1.5 / t0->width, 1.5 / t0->height);
+        if(t0->atlas != NULL) {
+          glUniform3f(gp->gp_uniform_blur, rj->blur,
+                      1.5 / GLW_ATLAS_PAGE_SIZE, 1.5 / GLW_ATLAS_PAGE_SIZE);
+        } else {
+          glUniform3f(gp->gp_uniform_blur, rj->blur,
+                      1.5 / t0->width, 1.5 / t0->height);
+        }
         uni_calls++;
       }
 
@@ -318,12 +449,34 @@ render_unlocked(glw_root_t *gr)
       glFrontFace(current_frontface == GLW_CW ? GL_CW : GL_CCW);
     }
 
-    glDrawElements(rj->primitive_type,
-                   rj->num_indices,
-                   GL_UNSIGNED_SHORT,
-                   gr->gr_index_buffer + rj->index_offset);
+    // Fold following jobs with identical state into this draw call
+
+    int last = j;
+    while(last + 1 < gr->gr_num_render_jobs &&
+          gr->gr_render_order[last + 1].job->num_vertices > 0 &&
+          can_merge_jobs(ro, gr->gr_render_order + last + 1,
+                         gbr->gbr_use_stencil_buffer))
+      last++;
+
+    if(last == j) {
+      glDrawElements(rj->primitive_type,
+                     rj->num_indices,
+                     GL_UNSIGNED_SHORT,
+                     gr->gr_index_buffer + rj->index_offset);
+    } else {
+      int num_indices;
+      const uint16_t *indices = merge_indices(gr, j, last, &num_indices);
+      glDrawElements(rj->primitive_type, num_indices,
+                     GL_UNSIGNED_SHORT, indices);
+      rs.merged_jobs += last - j;
+      j = last;
+    }
+    rs.draw_calls++;
   }
 
+  gr->gr_stats_texture_binds = rs.texture_binds;
+  gr->gr_stats_draw_calls = rs.draw_calls;
+
   if(current_blendmode != GLW_BLEND_NORMAL) {
     glBlendFuncSeparate(GL_SRC_COLOR, GL_ONE,
 			GL_ONE_MINUS_DST_ALPHA, GL_ONE);
@@ -348,13 +501,17 @@ render_unlocked(glw_root_t *gr)
 
   int t = avg/16;
 
-  printf("tt:%-5d  jobs:%-4d vertices:%-4d ps:%-3d uniforms:%-4d (%-4d) tpv:%2.2f\n",
+  printf("tt:%-5d  jobs:%-4d vertices:%-4d ps:%-3d uniforms:%-4d (%-4d) "
+         "binds:%-4d draws:%-4d merged:%-4d tpv:%2.2f\n",
          t,
          gr->gr_num_render_jobs,
          gr->gr_vertex_offset,
          rs.program_switches,
          uni_calls,
          saved_calls,
+         rs.texture_binds,
+         rs.draw_calls,
+         rs.merged_jobs,
          (float)t / gr->gr_vertex_offset);
 #endif
 }
@@ -674,6 +831,10 @@ glw_opengl_shaders_init(glw_root_t *gr)
   glEnableVertexAttribArray(1);
   glEnableVertexAttribArray(2);
 
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  gbr->gbr_atlas_enabled = max_texture_size >= GLW_ATLAS_PAGE_SIZE;
+
   prop_set_string(prop_create(gr->gr_prop_ui, "rendermode"),
 		  "OpenGL VP/FP shaders");
 
@@ -699,6 +860,10 @@ glw_opengl_shaders_fini(glw_root_t *gr)
 
   while((gp = LIST_FIRST(&gbr->gbr_programs)) != NULL)
     glw_destroy_program(gr, gp);
+
+  free(gbr->gbr_merged_indices);
+  gbr->gbr_merged_indices = NULL;
+  gbr->gbr_merged_indices_capacity = 0;
 }
 
 /**
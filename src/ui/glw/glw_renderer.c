@@ -1410,11 +1410,20 @@ render_order_cmp(const void *A, const void *B)
   const glw_render_job_t *aj = a->job;
   const glw_render_job_t *bj = b->job;
 
-  if(aj->t0 < bj->t0)
-    return -1;
+  // Compare on the backend texture object rather than the pointer so
+  // images sharing an atlas page end up next to each other
 
-  if(aj->t0 > bj->t0)
-    return 1;
+  const uintptr_t at0 = glw_tex_sort_key(aj->t0);
+  const uintptr_t bt0 = glw_tex_sort_key(bj->t0);
+
+  if(at0 != bt0)
+    return at0 < bt0 ? -1 : 1;
+
+  const uintptr_t at1 = glw_tex_sort_key(aj->t1);
+  const uintptr_t bt1 = glw_tex_sort_key(bj->t1);
+
+  if(at1 != bt1)
+    return at1 < bt1 ? -1 : 1;
 
   return 0;
 
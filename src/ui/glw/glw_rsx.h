@@ -115,6 +115,8 @@ typedef struct glw_backend_texture {
 #define glw_tex_width(gbt) ((gbt)->tex.width)
 #define glw_tex_height(gbt) ((gbt)->tex.height)
 
+#define glw_tex_sort_key(gbt) ((uintptr_t)(gbt))
+
 
 #define glw_can_tnpo2(gr) 1
 
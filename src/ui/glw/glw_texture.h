@@ -72,6 +72,18 @@ typedef struct glw_loadable_texture {
   int16_t glt_req_xs;
   int16_t glt_req_ys;
 
+  /**
+   * Where the texture was last seen on screen, used to prioritize loads
+   * See glw_tex_hint()
+   */
+  int glt_hint_frame;
+  int16_t glt_hint_x;
+  int16_t glt_hint_y;
+  int16_t glt_hint_dx;
+  int16_t glt_hint_dy;
+
+  int64_t glt_visible_ts;  // When it was first on screen waiting for load
+
   int16_t glt_xs;
   int16_t glt_ys;
 
@@ -117,12 +129,17 @@ void glw_tex_deref(glw_root_t *gr, glw_loadable_texture_t *ht);
 
 void glw_tex_layout(glw_root_t *gr, glw_loadable_texture_t *glt);
 
+void glw_tex_hint(glw_root_t *gr, glw_loadable_texture_t *glt,
+                  const struct glw_rctx *rc);
+
 void glw_tex_purge(glw_root_t *gr);
 
 void glw_tex_autoflush(glw_root_t *gr);
 
 void glw_tex_flush_all(glw_root_t *gr);
 
+void glw_tex_evict(glw_root_t *gr, glw_loadable_texture_t *glt);
+
 
 /**
  * Backend interface
@@ -137,6 +154,8 @@ void glw_tex_backend_free_loader_resources(glw_loadable_texture_t *glt);
 
 void glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt);
 
+void glw_tex_backend_compact(glw_root_t *gr);
+
 void glw_tex_upload(glw_root_t *gr, glw_backend_texture_t *tex,
 		    const pixmap_t *pm, int flags);
 
@@ -69,6 +69,45 @@ glt_cancel(glw_loadable_texture_t *glt)
 }
 
 
+/**
+ *
+ */
+static void
+glw_tex_unstash(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  int stash = glt->glt_stash;
+
+  TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
+  gr->gr_tex_stash[stash].size -= glt->glt_size;
+}
+
+
+/**
+ * Drop a stashed texture. Also used by the backend to drain
+ * sparsely populated atlas pages
+ */
+void
+glw_tex_evict(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  assert(glt->glt_state == GLT_STATE_STASHED);
+
+  glw_tex_unstash(gr, glt);
+
+  glw_tex_backend_free_loader_resources(glt);
+  glw_tex_backend_free_render_resources(gr, glt);
+  glt_set_state(glt, GLT_STATE_INACTIVE);
+  if(glt->glt_refcnt == 0) {
+
+    if(glt->glt_url != NULL) {
+      rstr_release(glt->glt_url);
+      glt->glt_url = NULL;
+      LIST_REMOVE(glt, glt_global_link);
+    }
+    glt_destroy(glt);
+  }
+}
+
+
 /**
  *
  */
@@ -81,22 +120,7 @@ glw_tex_purge_stash(glw_root_t *gr, int stash)
       break;
 
     assert(glt->glt_q == &gr->gr_tex_stash[stash].q);
-
-    TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
-    gr->gr_tex_stash[stash].size -= glt->glt_size;
-
-    glw_tex_backend_free_loader_resources(glt);
-    glw_tex_backend_free_render_resources(gr, glt);
-    glt_set_state(glt, GLT_STATE_INACTIVE);
-    if(glt->glt_refcnt == 0) {
-
-      if(glt->glt_url != NULL) {
-        rstr_release(glt->glt_url);
-        glt->glt_url = NULL;
-        LIST_REMOVE(glt, glt_global_link);
-      }
-      glt_destroy(glt);
-    }
+    glw_tex_evict(gr, glt);
   }
 }
 
@@ -126,17 +150,6 @@ glw_tex_stash(glw_root_t *gr, glw_loadable_texture_t *glt, int unreferenced)
 
 
 
-static void
-glw_tex_unstash(glw_root_t *gr, glw_loadable_texture_t *glt)
-{
-  int stash = glt->glt_stash;
-
-  TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
-  gr->gr_tex_stash[stash].size -= glt->glt_size;
-}
-
-
-
 void
 glw_tex_autoflush(glw_root_t *gr)
 {
@@ -175,6 +188,18 @@ glw_tex_autoflush(glw_root_t *gr)
 
   LIST_MOVE(&gr->gr_tex_flush_list, &gr->gr_tex_active_list, glt_flush_link);
   LIST_INIT(&gr->gr_tex_active_list);
+
+  glw_tex_backend_compact(gr);
+
+  if((gr->gr_frames & 63) == 0 && gr->gr_tex_latency_cnt > 0) {
+    prop_set(gr->gr_prop_ui, "imageLatencyAvg", PROP_SET_INT,
+             (int)(gr->gr_tex_latency_sum / gr->gr_tex_latency_cnt / 1000));
+    prop_set(gr->gr_prop_ui, "imageLatencyMax", PROP_SET_INT,
+             gr->gr_tex_latency_max / 1000);
+    gr->gr_tex_latency_sum = 0;
+    gr->gr_tex_latency_cnt = 0;
+    gr->gr_tex_latency_max = 0;
+  }
 }
 
 
@@ -187,6 +212,56 @@ typedef struct loaderaux {
 } loaderaux_t;
 
 
+#define PRIO_LOOKAHEAD 8 // frames
+
+/**
+ * Lower value is more urgent
+ */
+static int
+glt_priority(const glw_root_t *gr, const glw_loadable_texture_t *glt)
+{
+  if(glt->glt_hint_frame == 0)
+    return 100000; // Laid out but never on screen (preloaded)
+
+  const int age = gr->gr_frames - glt->glt_hint_frame;
+  if(age > 2)
+    return 200000 + MIN(age, 100000); // Was on screen but has moved away
+
+  // Where will it be in a few frames given how it moves
+
+  const int x = glt->glt_hint_x + glt->glt_hint_dx * PRIO_LOOKAHEAD;
+  const int y = glt->glt_hint_y + glt->glt_hint_dy * PRIO_LOOKAHEAD;
+
+  const int ox = x < 0 ? -x : x > gr->gr_width  ? x - gr->gr_width  : 0;
+  const int oy = y < 0 ? -y : y > gr->gr_height ? y - gr->gr_height : 0;
+
+  if(ox == 0 && oy == 0)
+    return (abs(x - gr->gr_width / 2) + abs(y - gr->gr_height / 2)) / 16;
+
+  return 1000 + ox + oy;
+}
+
+
+/**
+ * Pick most urgent texture from a queue, first queued wins on ties
+ */
+static glw_loadable_texture_t *
+glt_pick(const glw_root_t *gr, struct glw_loadable_texture_queue *q)
+{
+  glw_loadable_texture_t *glt, *best = NULL;
+  int best_prio = INT32_MAX;
+
+  TAILQ_FOREACH(glt, q, glt_work_link) {
+    const int prio = glt_priority(gr, glt);
+    if(prio < best_prio) {
+      best = glt;
+      best_prio = prio;
+    }
+  }
+  return best;
+}
+
+
 /**
  *
  */
@@ -202,7 +277,7 @@ loader_get_work(loaderaux_t *la)
     if(gr->gr_tex_threads_running == 0)
       return NULL;
     for(i = 0; i <= last_queue; i++)
-      if((glt = TAILQ_FIRST(&gr->gr_tex_load_queue[i])) != NULL)
+      if((glt = glt_pick(gr, &gr->gr_tex_load_queue[i])) != NULL)
 	return glt;
 
     hts_cond_wait(&gr->gr_tex_load_cond, &gr->gr_mutex);
@@ -573,6 +648,14 @@ glw_tex_deref(glw_root_t *gr, glw_loadable_texture_t *glt)
     // Loading state holds a ref, so this means that we're the only one
     if(glt->glt_refcnt == 1 && glt->glt_state == GLT_STATE_LOADING)
       goto unlink;
+
+    // Same goes for the load queue, no point in waiting for autoflush
+    if(glt->glt_refcnt == 1 && glt->glt_state == GLT_STATE_QUEUED) {
+      LIST_REMOVE(glt, glt_flush_link);
+      TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
+      glt_set_state(glt, GLT_STATE_INACTIVE);
+      glw_tex_deref(gr, glt);
+    }
     return;
   }
 
@@ -679,15 +762,80 @@ gl_tex_req_load(glw_root_t *gr, glw_loadable_texture_t *glt)
 }
 
 
+/**
+ * Invoked by widgets when rendering a texture, must be called with
+ * the rendering context of the frame being rendered.
+ *
+ * Tracks where on screen unloaded textures are and how they move so
+ * the loader threads can pick the most urgent work. Also stamps when
+ * a texture first ended up on screen without being loaded
+ */
+void
+glw_tex_hint(glw_root_t *gr, glw_loadable_texture_t *glt,
+             const glw_rctx_t *rc)
+{
+  if(glt->glt_state == GLT_STATE_VALID || glt->glt_state == GLT_STATE_ERROR)
+    return;
+
+  if(glt->glt_hint_frame == gr->gr_frames)
+    return; // Already seen this frame, texture shared by multiple widgets
+
+  glw_rect_t r;
+  glw_project(&r, rc, gr);
+
+  const int x = GLW_CLAMP((r.x1 + r.x2) / 2, INT16_MIN, INT16_MAX);
+  const int y = GLW_CLAMP((r.y1 + r.y2) / 2, INT16_MIN, INT16_MAX);
+
+  if(glt->glt_hint_frame == gr->gr_frames - 1) {
+    glt->glt_hint_dx = GLW_CLAMP(x - glt->glt_hint_x, INT16_MIN, INT16_MAX);
+    glt->glt_hint_dy = GLW_CLAMP(y - glt->glt_hint_y, INT16_MIN, INT16_MAX);
+  } else {
+    glt->glt_hint_dx = 0;
+    glt->glt_hint_dy = 0;
+  }
+
+  glt->glt_hint_x = x;
+  glt->glt_hint_y = y;
+  glt->glt_hint_frame = gr->gr_frames;
+
+  if(glt->glt_visible_ts == 0 && !glw_is_tex_inited(&glt->glt_texture) &&
+     r.x2 > 0 && r.x1 < gr->gr_width && r.y2 > 0 && r.y1 < gr->gr_height)
+    glt->glt_visible_ts = gr->gr_frame_start;
+}
+
+
+/**
+ *
+ */
+static void
+glt_record_latency(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  const int d = arch_get_ts() - glt->glt_visible_ts;
+  glt->glt_visible_ts = 0;
+
+  gr->gr_tex_latency_sum += d;
+  gr->gr_tex_latency_cnt++;
+  gr->gr_tex_latency_max = MAX(gr->gr_tex_latency_max, d);
+
+  if(gconf.enable_image_debug && glt->glt_url != NULL)
+    TRACE(TRACE_DEBUG, "GLW", "%s visible after %d ms",
+          rstr_get(glt->glt_url), d / 1000);
+}
+
+
 /**
  *
  */
 void
 glw_tex_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 {
-  if(glt->glt_pixmap != NULL)
+  if(glt->glt_pixmap != NULL) {
     glw_tex_backend_layout(gr, glt);
 
+    if(glt->glt_visible_ts != 0 && glw_is_tex_inited(&glt->glt_texture))
+      glt_record_latency(gr, glt);
+  }
+
   switch(glt->glt_state) {
   case GLT_STATE_INACTIVE:
     gl_tex_req_load(gr, glt);
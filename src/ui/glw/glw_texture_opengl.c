@@ -25,6 +25,355 @@
 #include "glw.h"
 #include "glw_texture.h"
 
+/**
+ * Texture atlas
+ *
+ * Small images (icons, badges, small thumbnails) are packed into shared
+ * GLW_ATLAS_PAGE_SIZE^2 pages instead of getting a texture each. This
+ * lets the renderer draw all of them with a single bind and (given that
+ * the rest of the state matches) a single draw call.
+ *
+ * Each page is split into equally sized cells for one size class and
+ * pixel format, so allocating and freeing is trivial and there is no
+ * fragmentation within a page. Each image is surrounded by a border of
+ * replicated edge pixels so linear filtering (and the blur shader) does
+ * not pick up the neighbours.
+ *
+ * Pages are freed as soon as their last cell is released. Textures that
+ * are sitting in the stash are evicted from sparsely populated pages
+ * (see glw_tex_backend_compact()) so such pages can drain.
+ */
+
+#define ATLAS_PADDING     2
+#define ATLAS_MAX_PAGES   8
+
+static const int atlas_classes[] = {32, 64, 128};
+
+#define ATLAS_NUM_CLASSES (sizeof(atlas_classes) / sizeof(atlas_classes[0]))
+
+typedef struct glw_atlas_page {
+  LIST_ENTRY(glw_atlas_page) gap_link;
+  GLuint gap_texture;
+  int gap_format;
+  int gap_internal_format;
+  int gap_class;
+  int gap_cell_size;
+  int gap_cells_per_row;
+  int gap_num_cells;
+  int gap_used;
+  glw_loadable_texture_t **gap_residents;
+} glw_atlas_page_t;
+
+
+/**
+ *
+ */
+static int
+atlas_class(int w, int h)
+{
+  const int m = MAX(w, h);
+  for(int i = 0; i < ATLAS_NUM_CLASSES; i++)
+    if(m <= atlas_classes[i])
+      return i;
+  return -1;
+}
+
+
+/**
+ *
+ */
+static int
+atlas_bpp(int format)
+{
+  switch(format) {
+  case GL_RGBA:
+#ifdef GL_EXT_texture_format_BGRA8888
+  case GL_BGRA_EXT:
+#else
+  case GL_BGRA:
+#endif
+    return 4;
+  case GL_RGB:
+    return 3;
+  case GL_LUMINANCE_ALPHA:
+    return 2;
+  case GL_LUMINANCE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ *
+ */
+static glw_atlas_page_t *
+atlas_page_create(glw_root_t *gr, int format, int internal_format, int class)
+{
+  glw_backend_root_t *gbr = &gr->gr_be;
+  glw_atlas_page_t *gap = calloc(1, sizeof(glw_atlas_page_t));
+
+  gap->gap_format = format;
+  gap->gap_internal_format = internal_format;
+  gap->gap_class = class;
+  gap->gap_cell_size = atlas_classes[class] + ATLAS_PADDING * 2;
+  gap->gap_cells_per_row = GLW_ATLAS_PAGE_SIZE / gap->gap_cell_size;
+  gap->gap_num_cells = gap->gap_cells_per_row * gap->gap_cells_per_row;
+  gap->gap_residents = calloc(gap->gap_num_cells,
+                              sizeof(glw_loadable_texture_t *));
+
+  glGenTextures(1, &gap->gap_texture);
+  glBindTexture(GL_TEXTURE_2D, gap->gap_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
+               GLW_ATLAS_PAGE_SIZE, GLW_ATLAS_PAGE_SIZE,
+               0, format, GL_UNSIGNED_BYTE, NULL);
+
+  LIST_INSERT_HEAD(&gbr->gbr_atlas_pages, gap, gap_link);
+  gbr->gbr_atlas_num_pages++;
+  return gap;
+}
+
+
+/**
+ *
+ */
+static void
+atlas_page_destroy(glw_root_t *gr, glw_atlas_page_t *gap)
+{
+  glw_backend_root_t *gbr = &gr->gr_be;
+  LIST_REMOVE(gap, gap_link);
+  gbr->gbr_atlas_num_pages--;
+  glDeleteTextures(1, &gap->gap_texture);
+  free(gap->gap_residents);
+  free(gap);
+}
+
+
+/**
+ * Find a free cell. Prefer the most populated page so that sparse
+ * pages get a chance to drain
+ */
+static glw_atlas_page_t *
+atlas_alloc(glw_root_t *gr, glw_loadable_texture_t *glt, int class,
+            int *cellp)
+{
+  glw_backend_root_t *gbr = &gr->gr_be;
+  glw_atlas_page_t *gap, *best = NULL;
+
+  LIST_FOREACH(gap, &gbr->gbr_atlas_pages, gap_link) {
+    if(gap->gap_class != class ||
+       gap->gap_format != glt->glt_format ||
+       gap->gap_internal_format != glt->glt_internal_format ||
+       gap->gap_used == gap->gap_num_cells)
+      continue;
+    if(best == NULL || gap->gap_used > best->gap_used)
+      best = gap;
+  }
+
+  if(best == NULL) {
+    if(gbr->gbr_atlas_num_pages >= ATLAS_MAX_PAGES)
+      return NULL;
+    best = atlas_page_create(gr, glt->glt_format, glt->glt_internal_format,
+                             class);
+  }
+
+  for(int i = 0; i < best->gap_num_cells; i++) {
+    if(best->gap_residents[i] == NULL) {
+      best->gap_residents[i] = glt;
+      best->gap_used++;
+      *cellp = i;
+      return best;
+    }
+  }
+  abort(); // gap_used is out of sync with gap_residents
+}
+
+
+/**
+ *
+ */
+static void
+atlas_free(glw_root_t *gr, glw_backend_texture_t *tex)
+{
+  glw_atlas_page_t *gap = tex->atlas;
+
+  assert(gap->gap_residents[tex->atlas_cell] != NULL);
+  gap->gap_residents[tex->atlas_cell] = NULL;
+  gap->gap_used--;
+
+  tex->atlas = NULL;
+  tex->textures[0] = 0;
+
+  if(gap->gap_used == 0)
+    atlas_page_destroy(gr, gap);
+}
+
+
+/**
+ * Copy image into 'dst' surrounded by ATLAS_PADDING pixels of
+ * replicated edges
+ */
+static void
+atlas_pad_copy(uint8_t *dst, const uint8_t *src, int linesize,
+               int w, int h, int bpp)
+{
+  const int dst_linesize = (w + ATLAS_PADDING * 2) * bpp;
+
+  for(int y = 0; y < h + ATLAS_PADDING * 2; y++) {
+    const int sy = GLW_CLAMP(y - ATLAS_PADDING, 0, h - 1);
+    const uint8_t *s = src + sy * linesize;
+    uint8_t *d = dst + y * dst_linesize;
+
+    for(int i = 0; i < ATLAS_PADDING; i++) {
+      memcpy(d, s, bpp);
+      d += bpp;
+    }
+    memcpy(d, s, w * bpp);
+    d += w * bpp;
+    for(int i = 0; i < ATLAS_PADDING; i++) {
+      memcpy(d, s + (w - 1) * bpp, bpp);
+      d += bpp;
+    }
+  }
+}
+
+
+/**
+ * Try to place the texture in an atlas page, returns 0 if the texture
+ * is not eligible or the atlas is full
+ */
+static int
+atlas_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  glw_backend_texture_t *tex = &glt->glt_texture;
+  const pixmap_t *pm = glt->glt_pixmap;
+
+  if(!gr->gr_be.gbr_atlas_enabled ||
+     glt->glt_flags & GLW_TEX_REPEAT ||
+     glt->glt_tex_width || glt->glt_tex_height)
+    return 0;
+
+  const int w = glt->glt_xs;
+  const int h = glt->glt_ys;
+  const int class = atlas_class(w, h);
+  const int bpp = atlas_bpp(glt->glt_format);
+
+  if(class == -1 || bpp == 0 || w < 1 || h < 1)
+    return 0;
+
+  glw_atlas_page_t *gap = tex->atlas;
+  int cell;
+
+  if(gap != NULL &&
+     gap->gap_class == class &&
+     gap->gap_format == glt->glt_format &&
+     gap->gap_internal_format == glt->glt_internal_format) {
+    // Texture was reloaded, reuse the cell
+    cell = tex->atlas_cell;
+  } else {
+
+    if(gap != NULL)
+      atlas_free(gr, tex);
+
+    if(tex->textures[0] != 0) {
+      glDeleteTextures(1, tex->textures);
+      tex->textures[0] = 0;
+    }
+
+    gap = atlas_alloc(gr, glt, class, &cell);
+    if(gap == NULL)
+      return 0;
+  }
+
+  const int x = (cell % gap->gap_cells_per_row) * gap->gap_cell_size;
+  const int y = (cell / gap->gap_cells_per_row) * gap->gap_cell_size;
+  const int pw = w + ATLAS_PADDING * 2;
+  const int ph = h + ATLAS_PADDING * 2;
+
+  uint8_t *buf = malloc(pw * ph * bpp);
+  atlas_pad_copy(buf, pm->pm_data, pm->pm_linesize, w, h, bpp);
+
+  glBindTexture(GL_TEXTURE_2D, gap->gap_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pw, ph,
+                  glt->glt_format, GL_UNSIGNED_BYTE, buf);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  free(buf);
+
+  tex->textures[0] = gap->gap_texture;
+  tex->width  = w;
+  tex->height = h;
+  tex->opaque = glt->glt_opaque;
+  tex->atlas = gap;
+  tex->atlas_cell = cell;
+  tex->atlas_st[0] = (float)w / GLW_ATLAS_PAGE_SIZE;
+  tex->atlas_st[1] = (float)h / GLW_ATLAS_PAGE_SIZE;
+  tex->atlas_st[2] = (float)(x + ATLAS_PADDING) / GLW_ATLAS_PAGE_SIZE;
+  tex->atlas_st[3] = (float)(y + ATLAS_PADDING) / GLW_ATLAS_PAGE_SIZE;
+
+  glt->glt_s = 1;
+  glt->glt_t = 1;
+
+  glw_tex_backend_free_loader_resources(glt);
+  return 1;
+}
+
+
+/**
+ * Invoked once per frame after autoflush.
+ *
+ * If all residents of the least populated page of a class would fit in
+ * the free cells of the other pages, evict whatever residents of it
+ * that are only stashed. The rest will move out as they are flushed and
+ * reloaded, after which the page is released.
+ */
+void
+glw_tex_backend_compact(glw_root_t *gr)
+{
+  glw_backend_root_t *gbr = &gr->gr_be;
+  glw_atlas_page_t *gap, *victim = NULL;
+
+  LIST_FOREACH(gap, &gbr->gbr_atlas_pages, gap_link) {
+    if(gap->gap_used * 4 > gap->gap_num_cells)
+      continue;
+
+    int avail = 0;
+    glw_atlas_page_t *o;
+    LIST_FOREACH(o, &gbr->gbr_atlas_pages, gap_link) {
+      if(o != gap &&
+         o->gap_class == gap->gap_class &&
+         o->gap_format == gap->gap_format &&
+         o->gap_internal_format == gap->gap_internal_format)
+        avail += o->gap_num_cells - o->gap_used;
+    }
+
+    if(avail >= gap->gap_used &&
+       (victim == NULL || gap->gap_used < victim->gap_used))
+      victim = gap;
+  }
+
+  if(victim == NULL)
+    return;
+
+  for(int i = 0; i < victim->gap_num_cells; i++) {
+    glw_loadable_texture_t *glt = victim->gap_residents[i];
+    if(glt == NULL || glt->glt_state != GLT_STATE_STASHED)
+      continue;
+
+    const int last = victim->gap_used == 1;
+    glw_tex_evict(gr, glt);
+    if(last)
+      break; // Page is gone
+  }
+}
+
+
 /**
  * Free texture (always invoked in main rendering thread)
  */
@@ -32,6 +381,11 @@ void
 glw_tex_backend_free_render_resources(glw_root_t *gr, 
 				      glw_loadable_texture_t *glt)
 {
+  if(glt->glt_texture.atlas != NULL) {
+    atlas_free(gr, &glt->glt_texture);
+    return;
+  }
+
   if(glt->glt_texture.textures[0] != 0) {
     glDeleteTextures(1, glt->glt_texture.textures);
     glt->glt_texture.textures[0] = 0;
@@ -63,6 +417,12 @@ glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
   if(glt->glt_pixmap == NULL)
     return;
 
+  if(atlas_layout(gr, glt))
+    return;
+
+  if(glt->glt_texture.atlas != NULL)
+    atlas_free(gr, &glt->glt_texture);
+
   if(glt->glt_texture.textures[0] == 0)
     glGenTextures(1, glt->glt_texture.textures);
 
@@ -57,6 +57,16 @@ glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 }
 
 
+/**
+ * Invoked once per frame after autoflush
+ */
+void
+glw_tex_backend_compact(glw_root_t *gr)
+{
+
+}
+
+
 static void
 init_tex(realityTexture *tex, uint32_t offset,
 	 uint32_t width, uint32_t height, uint32_t stride,
@@ -25,6 +25,7 @@
 #include "event.h"
 #include "playqueue.h"
 #include "misc/str.h"
+#include "misc/minmax.h"
 #include "api/lastfm.h"
 #include "api/soap.h"
 #include "prop/prop_nodefilter.h"
@@ -273,34 +274,69 @@ add_container(htsmsg_t *item, prop_t *root, const char *baseurl,
     prop_destroy(c);
 }
 
+typedef struct nodes_from_didl_aux {
+  prop_t *root;
+  const char *trackid;
+  prop_t **trackptr;
+  const char *baseurl;
+  prop_sub_t *skip;
+} nodes_from_didl_aux_t;
+
+
 /**
  *
  */
 static void
-nodes_from_meta(htsmsg_t *meta, prop_t *root, const char *trackid,
-		prop_t **trackptr, const char *baseurl, prop_sub_t *skip)
+nodes_from_didl_element(void *opaque, htsmsg_field_t *f)
 {
-  htsmsg_t *items;
-  htsmsg_field_t *f;
+  nodes_from_didl_aux_t *nfda = opaque;
+  htsmsg_t *m = htsmsg_get_map_by_field(f);
 
-  items = htsmsg_get_map(meta, "DIDL-Lite");
-  if(items == NULL)
+  if(m == NULL)
     return;
 
-  HTSMSG_FOREACH(f, items) {
-    if(!strcmp(f->hmf_name, "item")) {
-      htsmsg_t *item = htsmsg_get_map_by_field(f);
-      if(item != NULL)
-	add_item(item, root, trackid, trackptr, skip, baseurl);
-    } else if(baseurl != NULL && !strcmp(f->hmf_name, "container")) {
-      htsmsg_t *container = htsmsg_get_map_by_field(f);
-      if(container != NULL)
-	add_container(container, root, baseurl, skip);
-    }
+  if(!strcmp(f->hmf_name, "item")) {
+    add_item(m, nfda->root, nfda->trackid, nfda->trackptr, nfda->skip,
+             nfda->baseurl);
+  } else if(nfda->baseurl != NULL && !strcmp(f->hmf_name, "container")) {
+    add_container(m, nfda->root, nfda->baseurl, nfda->skip);
   }
 }
 
 
+/**
+ * Create nodes from a DIDL-Lite document
+ *
+ * The document is parsed incrementally so each item is added as soon
+ * as it has been parsed and we never hold more than one item's worth
+ * of parsed tree in memory
+ */
+static int
+nodes_from_didl(const char *didl, prop_t *root, const char *trackid,
+                prop_t **trackptr, const char *baseurl, prop_sub_t *skip,
+                char *errbuf, size_t errlen)
+{
+  nodes_from_didl_aux_t nfda = {root, trackid, trackptr, baseurl, skip};
+  size_t len = strlen(didl);
+  int r = 0;
+
+  htsmsg_xml_stream_t *hxs =
+    htsmsg_xml_stream_create(2, nodes_from_didl_element, &nfda);
+
+  while(len > 0 && !r) {
+    const size_t chunk = MIN(len, 16384);
+    r = htsmsg_xml_stream_feed(hxs, didl, chunk, errbuf, errlen);
+    didl += chunk;
+    len -= chunk;
+  }
+
+  if(!r)
+    r = htsmsg_xml_stream_finish(hxs, errbuf, errlen);
+  htsmsg_xml_stream_destroy(hxs);
+  return r;
+}
+
+
 /**
  *
  */
@@ -312,7 +348,6 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
   htsmsg_t *in = htsmsg_create_map(), *out;
   char errbuf[200];
   const char *result;
-  htsmsg_t *meta;
 
   if(trackptr != NULL)
     *trackptr = NULL;
@@ -345,16 +380,14 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
     return -1;
   }
 
-  meta = htsmsg_xml_deserialize_cstr(result, errbuf, sizeof(errbuf));
-  if(meta == NULL) {
+  if(nodes_from_didl(result, nodes, trackid, trackptr, NULL, NULL,
+                     errbuf, sizeof(errbuf))) {
     TRACE(TRACE_ERROR, "UPNP", 
 	  "Browse %s via %s -- XML error %s", uri, id, errbuf);
     htsmsg_release(out);
     return -1;
   }
 
-  nodes_from_meta(meta, nodes, trackid, trackptr, NULL, NULL);
-  htsmsg_release(meta);
   htsmsg_release(out);
   return 0;
 }
@@ -390,7 +423,6 @@ browse_items(upnp_browse_t *ub)
   htsmsg_t *in = htsmsg_create_map(), *out;
   char errbuf[200];
   const char *result, *str;
-  htsmsg_t *meta;
 
   htsmsg_add_str(in, "ObjectID", ub->ub_id);
   htsmsg_add_str(in, "BrowseFlag", "BrowseDirectChildren");
@@ -423,20 +455,21 @@ browse_items(upnp_browse_t *ub)
     ub->ub_run = 0;
   }
 
-  if((result = htsmsg_get_str(out, "Result")) == NULL)
+  if((result = htsmsg_get_str(out, "Result")) == NULL) {
+    htsmsg_release(out);
     return browse_fail(ub, "No SOAP result");
+  }
 
-  meta = htsmsg_xml_deserialize_cstr(result, errbuf, sizeof(errbuf));
-  if(meta == NULL)
+  if(nodes_from_didl(result, ub->ub_items, NULL, NULL,
+                     ub->ub_base_url, ub->ub_itemsub,
+                     errbuf, sizeof(errbuf))) {
+    htsmsg_release(out);
     return browse_fail(ub, "Malformed XML: %s", errbuf);
-
-  nodes_from_meta(meta, ub->ub_items, NULL, NULL, 
-		  ub->ub_base_url, ub->ub_itemsub);
+  }
 
   UPNP_TRACE("Browsed %d of %d items",
 	ub->ub_loaded_entries, ub->ub_total_entries);
 
-  htsmsg_release(meta);
   prop_have_more_childs(ub->ub_items,
                         ub->ub_loaded_entries < ub->ub_total_entries);
   htsmsg_release(out);